@@ -0,0 +1,169 @@
+/**
+ * @file airtime.cpp
+ * @brief LoRa time on air and a rolling one hour airtime budget
+ * @version 0.1
+ * @date 2025-06-02
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "airtime.h"
+#include <LoRaWan-Arduino.h>
+
+/** Airtime per minute in us, bucketUs[bucketMinute % AIRTIME_BUCKETS] is the current minute */
+static uint32_t bucketUs[AIRTIME_BUCKETS];
+static uint32_t bucketMinute = 0;
+
+/**
+ * @brief Time on air of a LoRa packet, after the Semtech formula
+ *    (SX1261/2 datasheet 6.1.4, AN1200.13):
+ *    Tsym = 2^SF / BW
+ *    Tpacket = (Npreamble + 4.25 + 8 + max(ceil((8 PL - 4 SF + 28 + 16 CRC - 20 IH)
+ *              / (4 (SF - 2 DE))) (CR + 4), 0)) Tsym
+ *    DE, the low data rate optimization, is on for symbols of 16 ms and
+ *    longer, like the SX126x driver sets it. Counted in quarter symbols so
+ *    it stays in integers.
+ *
+ * @param mod modulation
+ * @param size PHY payload in bytes
+ * @return uint32_t time on air in us
+ */
+uint32_t airtime_us(const airtime_modulation *mod, uint16_t size)
+{
+	uint32_t symbol = 1UL << mod->sf;
+	int32_t de = (symbol * 1000UL >= 16UL * mod->bw_hz) ? 1 : 0;
+	int32_t bits = 8 * (int32_t)size - 4 * mod->sf + 28 + (mod->crc ? 16 : 0) - (mod->implicit_header ? 20 : 0);
+	int32_t divider = 4 * (mod->sf - 2 * de);
+	uint32_t payload_symbols = 8;
+	if (bits > 0)
+	{
+		payload_symbols += ((bits + divider - 1) / divider) * (mod->cr + 4);
+	}
+	uint32_t quarters = 4 * (uint32_t)mod->preamble + 17 + 4 * payload_symbols;
+	return (uint32_t)(((uint64_t)quarters * symbol * 1000000ULL) / (4ULL * mod->bw_hz));
+}
+
+/**
+ * @brief Uplink modulation of a LoRaWAN data rate
+ *    Explicit header, CRC, 8 symbol preamble and coding rate 4/5. FSK data
+ *    rates are not covered.
+ *
+ * @param region LoRaMacRegion_t
+ * @param datarate DR_0 ..
+ * @param mod filled with the modulation
+ * @return true if the data rate is a LoRa data rate of the region
+ */
+bool airtime_lorawan_modulation(uint8_t region, uint8_t datarate, airtime_modulation *mod)
+{
+	mod->cr = 1;
+	mod->preamble = 8;
+	mod->implicit_header = false;
+	mod->crc = true;
+	mod->bw_hz = 125000;
+
+	switch (region)
+	{
+	case LORAMAC_REGION_US915:
+		// DR0 .. DR3 SF10 .. SF7 / 125 kHz, DR4 SF8 / 500 kHz
+		if (datarate > 4)
+		{
+			return false;
+		}
+		mod->sf = (datarate == 4) ? 8 : 10 - datarate;
+		mod->bw_hz = (datarate == 4) ? 500000 : 125000;
+		return true;
+	case LORAMAC_REGION_AU915:
+		// DR0 .. DR5 SF12 .. SF7 / 125 kHz, DR6 SF8 / 500 kHz
+		if (datarate > 6)
+		{
+			return false;
+		}
+		mod->sf = (datarate == 6) ? 8 : 12 - datarate;
+		mod->bw_hz = (datarate == 6) ? 500000 : 125000;
+		return true;
+	case LORAMAC_REGION_CN470:
+	case LORAMAC_REGION_KR920:
+	case LORAMAC_REGION_IN865:
+		// DR0 .. DR5 SF12 .. SF7 / 125 kHz
+		if (datarate > 5)
+		{
+			return false;
+		}
+		mod->sf = 12 - datarate;
+		return true;
+	default:
+		// EU868 style: DR0 .. DR5 SF12 .. SF7 / 125 kHz, DR6 SF7 / 250 kHz, DR7 is FSK
+		if (datarate > 6)
+		{
+			return false;
+		}
+		mod->sf = (datarate == 6) ? 7 : 12 - datarate;
+		mod->bw_hz = (datarate == 6) ? 250000 : 125000;
+		return true;
+	}
+}
+
+/**
+ * @brief Move the bucket window to the current minute
+ */
+static void airtime_advance(void)
+{
+	uint32_t minute = millis() / AIRTIME_BUCKET_MS;
+	if (minute - bucketMinute >= AIRTIME_BUCKETS)
+	{
+		// Nothing sent for an hour, or millis() wrapped around
+		memset(bucketUs, 0, sizeof(bucketUs));
+	}
+	else
+	{
+		while (bucketMinute != minute)
+		{
+			bucketMinute++;
+			bucketUs[bucketMinute % AIRTIME_BUCKETS] = 0;
+		}
+	}
+	bucketMinute = minute;
+}
+
+/**
+ * @brief Airtime used in the last hour
+ *
+ * @return uint32_t airtime in ms
+ */
+uint32_t airtime_used_ms(void)
+{
+	uint32_t used_us = 0;
+	airtime_advance();
+	for (int bucket = 0; bucket < AIRTIME_BUCKETS; bucket++)
+	{
+		used_us += bucketUs[bucket];
+	}
+	return used_us / 1000;
+}
+
+/**
+ * @brief Check if a packet still fits into the budget of the last hour
+ *
+ * @param airtime_us time on air of the packet
+ * @param budget_ms airtime allowed per hour, 0 = no limit
+ * @return true if the packet may be sent
+ */
+bool airtime_allowed(uint32_t airtime_us, uint32_t budget_ms)
+{
+	if (budget_ms == 0)
+	{
+		return true;
+	}
+	return airtime_used_ms() + (airtime_us + 999) / 1000 <= budget_ms;
+}
+
+/**
+ * @brief Account a packet that was sent
+ *
+ * @param airtime_us time on air of the packet
+ */
+void airtime_add(uint32_t airtime_us)
+{
+	airtime_advance();
+	bucketUs[bucketMinute % AIRTIME_BUCKETS] += airtime_us;
+}
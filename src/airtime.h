@@ -0,0 +1,40 @@
+/**
+ * @file airtime.h
+ * @brief LoRa time on air and a rolling one hour airtime budget
+ * @version 0.1
+ * @date 2025-06-02
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef AIRTIME_H
+#define AIRTIME_H
+#include <Arduino.h>
+
+/** LoRa modulation of a packet */
+struct airtime_modulation
+{
+	uint8_t sf;			  // Spreading factor 7 .. 12
+	uint32_t bw_hz;		  // Bandwidth in Hz
+	uint8_t cr;			  // Coding rate 1: 4/5 .. 4: 4/8
+	uint16_t preamble;	  // Preamble length in symbols
+	bool implicit_header; // No PHY header
+	bool crc;			  // Payload CRC
+};
+
+/** LoRaWAN PHY payload around the application payload: MHDR, FHDR without FOpts, FPort and MIC */
+#define AIRTIME_LORAWAN_OVERHEAD 13
+
+// The budget is kept in one minute buckets, the oldest bucket is dropped
+// when a new minute starts. The window is the current minute and the 59
+// before it.
+#define AIRTIME_BUCKETS 60
+#define AIRTIME_BUCKET_MS 60000UL
+
+uint32_t airtime_us(const airtime_modulation *mod, uint16_t size);
+bool airtime_lorawan_modulation(uint8_t region, uint8_t datarate, airtime_modulation *mod);
+bool airtime_allowed(uint32_t airtime_us, uint32_t budget_ms);
+void airtime_add(uint32_t airtime_us);
+uint32_t airtime_used_ms(void);
+
+#endif
@@ -9,6 +9,11 @@
  *
  */
 #include "main.h"
+#include "sensor.h"
+#include "airtime.h"
+#include "backlog.h"
+#include "perf.h"
+#include "schedule.h"
 
 static char atcmd[ATCMD_SIZE];
 static char cmd_result[ATCMD_SIZE];
@@ -43,17 +48,8 @@ bool g_rx_continuous = true;
 void set_new_config(void)
 {
 	Radio.Sleep();
-	Radio.SetTxConfig(MODEM_LORA, g_lorawan_settings.p2p_tx_power, 0, g_lorawan_settings.p2p_bandwidth,
-					  g_lorawan_settings.p2p_sf, g_lorawan_settings.p2p_cr,
-					  g_lorawan_settings.p2p_preamble_len, false,
-					  true, 0, 0, false, 5000);
-
-	Radio.SetRxConfig(MODEM_LORA, g_lorawan_settings.p2p_bandwidth, g_lorawan_settings.p2p_sf,
-					  g_lorawan_settings.p2p_cr, 0, g_lorawan_settings.p2p_preamble_len,
-					  g_lorawan_settings.p2p_symbol_timeout, false,
-					  0, true, 0, 0, false, g_rx_continuous);
-
-	// Radio.Rx(0);
+	// Only the parameters that changed go to the radio
+	lora_p2p_config(g_rx_continuous);
 }
 
 /**
@@ -179,6 +175,7 @@ void at_settings(void)
 		AT_PRINTF("   Fport %d", g_lorawan_settings.app_port);
 		AT_PRINTF("   %s Message", g_lorawan_settings.confirmed_msg_enabled ? "Confirmed" : "Unconfirmed");
 		AT_PRINTF("   Region %s", region_names[g_lorawan_settings.lora_region]);
+		AT_PRINTF("   Join time %ld ms", g_join_time_ms);
 	}
 	else
 	{
@@ -682,6 +679,7 @@ static int at_exec_p2p_receive(char *str)
 	if (param != NULL)
 	{
 		/* check RX window size */
+		uint32_t switch_us = micros();
 		uint32_t rx_time = strtol(param, NULL, 0);
 		APP_LOG("AT", "Received RX time %ld", rx_time);
 
@@ -692,8 +690,8 @@ static int at_exec_p2p_receive(char *str)
 			g_lora_p2p_rx_time = 0;
 			g_rx_continuous = false;
 			set_new_config();
-			// Put Radio into sleep mode (stops receiving)
-			Radio.Sleep();
+			// Set up the radio for the new mode
+			lora_p2p_start(switch_us);
 			APP_LOG("AT", "Set RX_MODE_NONE");
 		}
 		else if (rx_time == 65534)
@@ -703,8 +701,8 @@ static int at_exec_p2p_receive(char *str)
 			g_lora_p2p_rx_time = 0;
 			g_rx_continuous = true;
 			set_new_config();
-			// Put Radio into continuous RX mode
-			Radio.Rx(0);
+			// Set up the radio for the new mode
+			lora_p2p_start(switch_us);
 			APP_LOG("AT", "Set RX_MODE_RX");
 		}
 		else if (rx_time == 65535)
@@ -714,8 +712,8 @@ static int at_exec_p2p_receive(char *str)
 			g_lora_p2p_rx_time = 0;
 			g_rx_continuous = false;
 			set_new_config();
-			// Put Radio into continuous RX mode
-			Radio.Rx(0);
+			// Set up the radio for the new mode
+			lora_p2p_start(switch_us);
 			APP_LOG("AT", "Set RX_MODE_RX_WAIT");
 		}
 		else if (rx_time < 65534)
@@ -725,8 +723,8 @@ static int at_exec_p2p_receive(char *str)
 			g_lora_p2p_rx_time = rx_time;
 			g_rx_continuous = false;
 			set_new_config();
-			// Put Radio into continuous RX mode
-			Radio.Rx(rx_time);
+			// Set up the radio for the new mode
+			lora_p2p_start(switch_us);
 			APP_LOG("AT", "Set RX_MODE_RX_TIMED");
 		}
 		else
@@ -749,6 +747,88 @@ static int at_query_p2p_receive(void)
 	return AT_SUCCESS;
 }
 
+/**
+ * @brief AT+P2PTRACE=? Print the last P2P radio transitions, oldest first, as
+ * 			ms:event:mode:action:us, then per transition seen since the
+ * 			last reset event:mode:count:last us:max us
+ *
+ * @return int AT_CB_PRINT
+ */
+static int at_query_p2ptrace(void)
+{
+	p2p_trace_entry entry;
+	p2p_transition_stats stats;
+
+	AT_PRINTF("ATC+P2PTRACE=?");
+	for (uint8_t idx = 0; p2p_trace_get(idx, &entry); idx++)
+	{
+		AT_PRINTF("%lu:%s:%d:%s:%lu", entry.time_ms, p2p_event_name(entry.event), entry.mode,
+				  p2p_action_name(entry.action), entry.latency_us);
+	}
+	for (uint8_t event = 0; event < P2P_EVENTS; event++)
+	{
+		for (uint8_t mode = 0; mode < P2P_MODES; mode++)
+		{
+			p2p_stats_get((p2p_event)event, mode, &stats);
+			if (stats.count != 0)
+			{
+				AT_PRINTF("%s:%d:%lu:%lu:%lu", p2p_event_name(event), mode, stats.count, stats.last_us, stats.max_us);
+			}
+		}
+	}
+	snprintf(g_at_query_buf, ATQUERY_SIZE, " ");
+	AT_PRINTF("OK");
+
+	return AT_CB_PRINT;
+}
+
+/**
+ * @brief AT+P2PTRACE Clear the P2P transition trace and timing
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_exec_p2ptrace(void)
+{
+	p2p_trace_reset();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+RADIOCFG=? Print per part of the P2P radio setup how often it
+ * 			was sent and skipped as part:sent:skipped, then the time of the
+ * 			last and the longest setup as time:last us:max us
+ *
+ * @return int AT_CB_PRINT
+ */
+static int at_query_radio_cfg(void)
+{
+	radio_cfg_stats stats;
+	radio_cfg_stats_get(&stats, false);
+
+	AT_PRINTF("ATC+RADIOCFG=?");
+	for (uint8_t part = 0; part < RADIO_CFG_PARTS; part++)
+	{
+		AT_PRINTF("%s:%lu:%lu", radio_cfg_name(part), stats.sent[part], stats.skipped[part]);
+	}
+	AT_PRINTF("time:%lu:%lu", stats.last_us, stats.max_us);
+	snprintf(g_at_query_buf, ATQUERY_SIZE, " ");
+	AT_PRINTF("OK");
+
+	return AT_CB_PRINT;
+}
+
+/**
+ * @brief AT+RADIOCFG Clear the P2P radio setup counts
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_exec_radio_cfg(void)
+{
+	radio_cfg_stats stats;
+	radio_cfg_stats_get(&stats, true);
+	return AT_SUCCESS;
+}
+
 /**
  * @brief AT+BAND=? Get regional frequency band
  *
@@ -786,8 +866,23 @@ static int at_exec_region(char *str)
 		{
 			return AT_ERRNO_PARA_VAL;
 		}
-		g_lorawan_settings.lora_region = api_regions[region];
-		save_settings();
+		if (g_lorawan_settings.lora_region != api_regions[region])
+		{
+			g_lorawan_settings.lora_region = api_regions[region];
+			if (g_lorawan_settings.subband_channels > lorawan_max_subband(g_lorawan_settings.lora_region))
+			{
+				g_lorawan_settings.subband_channels = 1;
+			}
+			save_settings();
+			// Restart the MAC in the new region, a join is needed again
+			if (g_lorawan_initialized)
+			{
+				if (init_lorawan(true) != 0)
+				{
+					return AT_ERRNO_EXEC_FAIL;
+				}
+			}
+		}
 	}
 	else
 	{
@@ -806,7 +901,7 @@ static int at_query_mask(void)
 {
 	if ((g_lorawan_settings.lora_region == LORAMAC_REGION_US915) || (g_lorawan_settings.lora_region == LORAMAC_REGION_AU915) || (g_lorawan_settings.lora_region == LORAMAC_REGION_CN470))
 	{
-		snprintf(g_at_query_buf, ATQUERY_SIZE, "%04X", 1 << (g_lorawan_settings.subband_channels - 1));
+		snprintf(g_at_query_buf, ATQUERY_SIZE, "%04X", g_lorawan_settings.subband_channels == 0 ? 0 : 1 << (g_lorawan_settings.subband_channels - 1));
 
 		return AT_SUCCESS;
 	}
@@ -836,19 +931,20 @@ static int at_exec_mask(char *str)
 		switch (g_lorawan_settings.lora_region)
 		{
 		case LORAMAC_REGION_AU915:
-			maxBand = 9;
-			break;
 		case LORAMAC_REGION_CN470:
-			maxBand = 12;
-			break;
 		case LORAMAC_REGION_US915:
-			maxBand = 9;
+			maxBand = lorawan_max_subband(g_lorawan_settings.lora_region);
 			break;
 		default:
 			return AT_ERRNO_PARA_VAL;
 		}
 		switch (mask)
 		{
+		case 0x0000:
+			// Channel plan of the LoRaWAN stack, takes effect with the next MAC start
+			g_lorawan_settings.subband_channels = 0;
+			save_settings();
+			return AT_SUCCESS;
 		case 0x0001:
 			mask = 1;
 			break;
@@ -895,6 +991,13 @@ static int at_exec_mask(char *str)
 		}
 		g_lorawan_settings.subband_channels = mask;
 		save_settings();
+		if (g_lorawan_initialized)
+		{
+			if (!lmh_setSubBandChannels(mask))
+			{
+				return AT_ERRNO_EXEC_FAIL;
+			}
+		}
 	}
 	else
 	{
@@ -1451,7 +1554,7 @@ static int at_exec_join(char *str)
 					else
 					{
 						// Start Join process
-						lmh_join();
+						lorawan_join();
 					}
 				}
 				else
@@ -1684,6 +1787,90 @@ static int at_exec_txpower(char *str)
 	return AT_SUCCESS;
 }
 
+/**
+ * @brief AT+DCS=? Get duty cycle setting
+ *
+ * @return int AT_SUCCESS;
+ */
+static int at_query_dutycycle(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d", g_lorawan_settings.duty_cycle_enabled ? 1 : 0);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+DCS=X Enable/disable the regional duty cycle of the LoRaWAN MAC
+ *
+ * @param str 0 = disable, 1 = enable duty cycle
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_NOALLOW, AT_ERRNO_PARA_VAL
+ */
+static int at_exec_dutycycle(char *str)
+{
+	if (!g_lorawan_settings.lorawan_enable)
+	{
+		return AT_ERRNO_NOALLOW;
+	}
+	int duty_cycle;
+
+	duty_cycle = strtol(str, NULL, 0);
+	if (duty_cycle != 0 && duty_cycle != 1)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+
+	g_lorawan_settings.duty_cycle_enabled = (duty_cycle == 1 ? true : false);
+
+	save_settings();
+
+	if (g_lorawan_initialized)
+	{
+		LoRaMacTestSetDutyCycleOn(g_lorawan_settings.duty_cycle_enabled);
+	}
+
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+JOINTIME=? Get the time from the last join request to the join accept
+ *
+ * @return int AT_SUCCESS;
+ */
+static int at_query_jointime(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%ld", g_join_time_ms);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+SESSION=? Get the LoRaWAN session state
+ *    <none|restored|active>:<uplink counter>:<ms from boot to first uplink, 0 = none yet>
+ *
+ * @return int AT_SUCCESS;
+ */
+static int at_query_session(void)
+{
+	const char *states[] = {"none", "restored", "active"};
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%s:%ld:%ld", states[lorawan_session_state()],
+			 g_lorawan_initialized ? lorawan_uplink_counter() : 0, g_first_uplink_ms);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+SESSION=0 Delete the stored session, the next start joins again
+ *
+ * @param str 0
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL
+ */
+static int at_exec_session(char *str)
+{
+	if (strtol(str, NULL, 0) != 0)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	clear_session();
+	return AT_SUCCESS;
+}
+
 /**
  * @brief Send data packet over LoRaWAN
  *
@@ -1836,7 +2023,702 @@ static int at_exec_sendint(char *str)
 
 	g_lorawan_settings.send_repeat_time = time * 60000;  // minutes to ms
 	save_settings();
+	apply_sensor_config();
+
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+WINDOW=? Get wind statistics window and gust averaging time,
+ * 			then the samples dropped because a window held more than
+ * 			STATS_MAX_SAMPLES, 0 if every window is complete
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_window(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d:%d:%lu", g_lorawan_settings.wind_window_s, g_lorawan_settings.gust_avg_s,
+			 sensors_truncated());
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+WINDOW=<window>:<gust> Set wind statistics window and gust averaging time
+ *
+ * @param str window in seconds 0 .. 3600 (0 = send interval),
+ * 			gust running mean in seconds 0 .. 10 (0 = gust from the sensor, 3 = WMO)
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL, AT_ERRNO_PARA_NUM
+ */
+static int at_exec_window(char *str)
+{
+	char *param = strtok(str, ":");
+	if (param == NULL)
+	{
+		return AT_ERRNO_PARA_NUM;
+	}
+	long window = strtol(param, NULL, 0);
+
+	param = strtok(NULL, ":");
+	if (param == NULL)
+	{
+		return AT_ERRNO_PARA_NUM;
+	}
+	long gust = strtol(param, NULL, 0);
+
+	if ((window < 0) || (window > 3600) || (gust < 0) || (gust > 10))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+
+	g_lorawan_settings.wind_window_s = window;
+	g_lorawan_settings.gust_avg_s = gust;
+	save_settings();
+	apply_sensor_config();
+
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+LOOP=? Get worst case and last time a reporting pass held the
+ *    sensors, then worst case and last time from a sensor line end to its
+ *    driver, then the worst case of the lines that waited for a flash write
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_loop(void)
+{
+	uint32_t line_last_us;
+	uint32_t line_max_us;
+	uint32_t line_flash_max_us;
+	sensors_latency(&line_last_us, &line_max_us, &line_flash_max_us, false);
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%lu:%lu:%lu:%lu:%lu", g_loop_max_us, g_loop_last_us, line_max_us, line_last_us,
+			 line_flash_max_us);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+LOOP Reset the worst cases
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_exec_loop(void)
+{
+	uint32_t line_last_us;
+	uint32_t line_max_us;
+	uint32_t line_flash_max_us;
+	g_loop_max_us = 0;
+	sensors_latency(&line_last_us, &line_max_us, &line_flash_max_us, true);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+TXSTAT=? Get the report uplink counters
+ *    <sent>:<failed>:<retries>:<last latency ms>:<max latency ms>
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_txstat(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%lu:%lu:%lu:%lu:%lu", g_reports_sent, g_reports_failed,
+			 g_report_retries, g_report_latency_ms, g_report_latency_max_ms);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+TXSTAT Reset the report uplink counters
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_exec_txstat(void)
+{
+	g_reports_sent = 0;
+	g_reports_failed = 0;
+	g_report_retries = 0;
+	g_report_latency_max_ms = 0;
+	return AT_SUCCESS;
+}
+
+#ifdef APP_PERF
+/**
+ * @brief AT+PERF=? Print the timings of the profiled scopes, one line each:
+ *    name:count:p99 us:max us, then log2(cycles):count of the histogram
+ *    buckets that are not empty
+ *
+ * @return int AT_CB_PRINT
+ */
+static int at_query_perf(void)
+{
+	perf_stats stats;
+	uint32_t p99_us;
+	uint32_t max_us;
+
+	AT_PRINTF("ATC+PERF=?");
+	for (int id = 0; id < PERF_SCOPES; id++)
+	{
+		perf_get((perf_id)id, &stats, &p99_us, &max_us);
+		int len = snprintf(g_at_query_buf, ATQUERY_SIZE, "%s:%lu:%lu:%lu", perf_name((perf_id)id),
+						   stats.count, p99_us, max_us);
+		for (int bucket = 0; bucket < PERF_BUCKETS && len < ATQUERY_SIZE; bucket++)
+		{
+			if (stats.buckets[bucket] != 0)
+			{
+				len += snprintf(&g_at_query_buf[len], ATQUERY_SIZE - len, " %d:%lu", bucket, stats.buckets[bucket]);
+			}
+		}
+		AT_PRINTF("%s", g_at_query_buf);
+	}
+	snprintf(g_at_query_buf, ATQUERY_SIZE, " ");
+	AT_PRINTF("OK");
+
+	return AT_CB_PRINT;
+}
+
+/**
+ * @brief AT+PERF Reset the timings
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_exec_perf(void)
+{
+	perf_reset();
+	return AT_SUCCESS;
+}
+#endif
+
+/**
+ * @brief AT+IDLE=? Get the idle mode, the ingest activity since the last reset
+ * 			and the CPU current it costs after the model in sensor.h
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_idle(void)
+{
+	sensor_idle_stats stats;
+	sensors_idle_stats(&stats, false);
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d:%lu:%lu:%lu:%lu:%lu", g_lorawan_settings.sensor_idle ? 1 : 0,
+			 stats.elapsed_ms / 1000, stats.passes, stats.wakes, stats.awake_permille, stats.current_ua);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+IDLE=<mode> Stop polling the sensor UARTs while they are silent
+ *
+ * @param str 0 = poll every 10 ms, 1 = wake on RX
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL
+ */
+static int at_exec_idle(char *str)
+{
+	long mode = strtol(str, NULL, 0);
+	if ((mode < 0) || (mode > 1))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	g_lorawan_settings.sensor_idle = mode == 1;
+	save_settings();
+	apply_sensor_config();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+IDLE Reset the ingest activity counters
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_reset_idle(void)
+{
+	sensor_idle_stats stats;
+	sensors_idle_stats(&stats, true);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+CAPTURE=? Get sensor stream capture mode
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_capture(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d", sensors_get_capture());
+	return AT_SUCCESS;
+}
 
+/**
+ * @brief AT+CAPTURE=<mode> Capture the raw sensor streams over USB
+ *
+ * @param str 0 = off, 1 = raw bytes as +CAP:<name>:<ms>:<hex>,
+ * 			2 = raw bytes and +LINE:<name>:<us>:<line> per handled line
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL
+ */
+static int at_exec_capture(char *str)
+{
+	long mode = strtol(str, NULL, 0);
+	if ((mode < SENSOR_CAPTURE_OFF) || (mode > SENSOR_CAPTURE_TIMING))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	sensors_set_capture(mode);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+WXFEED=<hex> Inject bytes into the stream of the first sensor
+ *
+ * @param str data in ASCII Hex format, 0A for a line end
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL, AT_ERRNO_EXEC_FAIL if the sensor does not keep up
+ */
+static int at_exec_wxfeed(char *str)
+{
+	uint8_t data[ATCMD_SIZE / 2];
+	int len = hex2bin(str, data, sizeof(data));
+	if (len <= 0)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	for (int idx = 0; idx < len; idx++)
+	{
+		if (!sensors_inject(data[idx]))
+		{
+			return AT_ERRNO_EXEC_FAIL;
+		}
+	}
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+WXFEED Send the following USB input to the first sensor,
+ * 			until a Ctrl-D (0x04) is received
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_exec_wxfeed_raw(void)
+{
+	sensors_set_feeding(true);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief Print a sensor payload as +WXREPORT:<ms>:<hex>
+ *
+ * @param payload payload
+ * @param len payload length
+ */
+static void at_print_wxreport(const uint8_t *payload, uint8_t len)
+{
+	for (int idx = 0; idx < len; idx++)
+	{
+		snprintf(&g_at_query_buf[idx * 2], ATQUERY_SIZE - idx * 2, "%02X", payload[idx]);
+	}
+	g_at_query_buf[len * 2] = '\0';
+	AT_PRINTF("+WXREPORT:%lu:%s", millis(), g_at_query_buf);
+}
+
+/**
+ * @brief AT+WXREPORT Print the payload of the running report interval,
+ * 			nothing changes for the next uplink
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_exec_wxreport(void)
+{
+	uint8_t len = sensors_preview(m_lora_app_data_buffer, 255);
+	at_print_wxreport(m_lora_app_data_buffer, len);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+WXREPORT=1 Print the sensor payload and start the next report
+ * 			interval, like a send would do, without sending anything.
+ * 			For the replay of captures on a bench device.
+ *
+ * @param str "1"
+ * @return int AT_SUCCESS or AT_ERRNO_PARA_VAL
+ */
+static int at_exec_wxreport_next(char *str)
+{
+	if (strcmp(str, "1") != 0)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	uint8_t len = sensors_report(m_lora_app_data_buffer, 255);
+	sensors_reset_counters();
+	at_print_wxreport(m_lora_app_data_buffer, len);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+WXHEALTH=? Get the sensor stream health counters
+ * 			Rates are since the previous query
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_wxhealth(void)
+{
+	sensors_health_text(g_at_query_buf, ATQUERY_SIZE);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+WXDIAG=? Get the diagnostic uplink rate
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_wxdiag(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d", g_lorawan_settings.diag_every);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+WXDIAG=<n> Send the sensor health counters every n-th report
+ * 			on fPort LORAWAN_DIAG_PORT
+ *
+ * @param str 0 .. 255, 0 = off
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL
+ */
+static int at_exec_wxdiag(char *str)
+{
+	long every = strtol(str, NULL, 0);
+	if ((every < 0) || (every > 255))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	g_lorawan_settings.diag_every = every;
+	save_settings();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+PAYLOAD=? Get the sensor uplink format
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_payload(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d", g_lorawan_settings.payload_format);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+PAYLOAD=<format> Set the sensor uplink format
+ *
+ * @param str 0 = legacy 16 bit values, 1 = bit packed with version byte
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL
+ */
+static int at_exec_payload(char *str)
+{
+	long format = strtol(str, NULL, 0);
+	if ((format < SENSOR_PAYLOAD_LEGACY) || (format > SENSOR_PAYLOAD_PACKED))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	g_lorawan_settings.payload_format = format;
+	save_settings();
+	apply_sensor_config();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+BATCH=? Get the intervals per batched uplink
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_batch(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d", g_lorawan_settings.batch_intervals);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+BATCH=<n> Split the send interval into n report intervals and
+ * 			send them together, delta encoded
+ *
+ * @param str 1 .. 15, 1 = no batching
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL
+ */
+static int at_exec_batch(char *str)
+{
+	long batch = strtol(str, NULL, 0);
+	if ((batch < 1) || (batch > SENSOR_BATCH_SLOTS))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	g_lorawan_settings.batch_intervals = batch;
+	save_settings();
+	if (batch == 1)
+	{
+		// Intervals of the old batch are not sent anymore
+		sensors_batch_consume(sensors_batch_count());
+	}
+	apply_sensor_config();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+HEARTBEAT=? Get the change-only reporting heartbeat and how often it saved an uplink
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_heartbeat(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d:%lu:%lu", g_lorawan_settings.heartbeat_min, g_reports_suppressed, g_reports_early);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+HEARTBEAT=<minutes> Skip reports with all values inside their
+ * 			deadband, but send one at least every <minutes>
+ *
+ * @param str 0 .. 1440, 0 = report every interval
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL
+ */
+static int at_exec_heartbeat(char *str)
+{
+	long heartbeat = strtol(str, NULL, 0);
+	if ((heartbeat < 0) || (heartbeat > 1440))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	g_lorawan_settings.heartbeat_min = heartbeat;
+	save_settings();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+DEADBAND=? Get the deadbands of change-only reporting
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_deadband(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d:%d:%d:%d", g_lorawan_settings.deadband_wind, g_lorawan_settings.deadband_dir,
+			 g_lorawan_settings.deadband_temp, g_lorawan_settings.deadband_volt);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+DEADBAND=<wind>:<dir>:<temp>:<volt> Set the largest changes
+ * 			against the last report that are not sent
+ *
+ * @param str wind speed, gust and lull in 0.1 m/s 0 .. 500, direction in deg 0 .. 180,
+ * 			temperature in 0.1 °C 0 .. 500, battery and capacitor voltage in 0.01 V 0 .. 500
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL, AT_ERRNO_PARA_NUM
+ */
+static int at_exec_deadband(char *str)
+{
+	long band[4];
+	char *param = strtok(str, ":");
+	for (int idx = 0; idx < 4; idx++)
+	{
+		if (param == NULL)
+		{
+			return AT_ERRNO_PARA_NUM;
+		}
+		band[idx] = strtol(param, NULL, 0);
+		if ((band[idx] < 0) || (band[idx] > ((idx == 1) ? 180 : 500)))
+		{
+			return AT_ERRNO_PARA_VAL;
+		}
+		param = strtok(NULL, ":");
+	}
+
+	g_lorawan_settings.deadband_wind = band[0];
+	g_lorawan_settings.deadband_dir = band[1];
+	g_lorawan_settings.deadband_temp = band[2];
+	g_lorawan_settings.deadband_volt = band[3];
+	save_settings();
+	apply_sensor_config();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+ALERT=? Get the alert rules, the rate limit and the alert uplinks sent
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_alert(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d:%d:%d:%d:%d:%lu:%d", g_lorawan_settings.alert_gust, g_lorawan_settings.alert_dir,
+			 g_lorawan_settings.alert_bat, g_lorawan_settings.alert_cap, g_lorawan_settings.alert_per_hour,
+			 g_alerts_sent, alert_tokens());
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+ALERT=<gust>:<dir>:<bat>:<cap>:<per hour> Set the alert rules
+ * 			and the rate limit, a rule of 0 is off
+ *
+ * @param str gust above in 0.1 m/s 0 .. 1000, mean direction shift in deg 0 .. 180,
+ * 			battery and capacitor voltage below in 0.01 V 0 .. 1000, alert uplinks per hour 0 .. 60
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL, AT_ERRNO_PARA_NUM
+ */
+static int at_exec_alert(char *str)
+{
+	static const long limits[5] = {1000, 180, 1000, 1000, 60};
+	long value[5];
+	char *param = strtok(str, ":");
+	for (int idx = 0; idx < 5; idx++)
+	{
+		if (param == NULL)
+		{
+			return AT_ERRNO_PARA_NUM;
+		}
+		value[idx] = strtol(param, NULL, 0);
+		if ((value[idx] < 0) || (value[idx] > limits[idx]))
+		{
+			return AT_ERRNO_PARA_VAL;
+		}
+		param = strtok(NULL, ":");
+	}
+
+	g_lorawan_settings.alert_gust = value[0];
+	g_lorawan_settings.alert_dir = value[1];
+	g_lorawan_settings.alert_bat = value[2];
+	g_lorawan_settings.alert_cap = value[3];
+	g_lorawan_settings.alert_per_hour = value[4];
+	save_settings();
+	apply_sensor_config();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+SCHED=? Get the report schedule, the next report and the slot of this device
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_sched(void)
+{
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d:%d:%d:%lu:%lu", g_lorawan_settings.schedule_align ? 1 : 0,
+			 g_lorawan_settings.schedule_slot ? 1 : 0, g_lorawan_settings.schedule_jitter_s,
+			 schedule_wait_ms() / 1000, schedule_slot_ms(g_lorawan_settings.send_repeat_time) / 1000);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+SCHED=<align>:<slot>:<jitter> Set the report schedule
+ *
+ * @param str align to the wall clock 0 or 1, DevEUI slot 0 or 1, jitter in s 0 .. 3600
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL, AT_ERRNO_PARA_NUM
+ */
+static int at_exec_sched(char *str)
+{
+	static const long limits[3] = {1, 1, 3600};
+	long value[3];
+	char *param = strtok(str, ":");
+	for (int idx = 0; idx < 3; idx++)
+	{
+		if (param == NULL)
+		{
+			return AT_ERRNO_PARA_NUM;
+		}
+		value[idx] = strtol(param, NULL, 0);
+		if ((value[idx] < 0) || (value[idx] > limits[idx]))
+		{
+			return AT_ERRNO_PARA_VAL;
+		}
+		param = strtok(NULL, ":");
+	}
+
+	g_lorawan_settings.schedule_align = value[0] == 1;
+	g_lorawan_settings.schedule_slot = value[1] == 1;
+	g_lorawan_settings.schedule_jitter_s = value[2];
+	save_settings();
+	schedule_replan();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+TIME=? Get the wall clock
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_time(void)
+{
+	uint32_t unix_s = 0;
+	schedule_get_time(&unix_s);
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%lu", unix_s);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+TIME=<s> Set the wall clock
+ *
+ * @param str Unix time in s, after 2020-01-01
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL
+ */
+static int at_exec_time(char *str)
+{
+	unsigned long unix_s = strtoul(str, NULL, 0);
+	if (unix_s < 1577836800UL)
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	schedule_set_time(unix_s);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+AIRTIME=? Get the airtime of the last hour, the budget, what is left of it
+ * 			and the uplinks refused since boot
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_airtime(void)
+{
+	uint32_t used = airtime_used_ms();
+	uint32_t budget = g_lorawan_settings.airtime_budget_ms;
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%lu:%lu:%lu:%lu", used, budget,
+			 (budget == 0) ? 0 : ((used < budget) ? budget - used : 0), g_airtime_refused);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+AIRTIME=<ms> Set the airtime allowed in any hour
+ *
+ * @param str 0 .. 3600000 ms, 0 = no limit
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL
+ */
+static int at_exec_airtime(char *str)
+{
+	long budget = strtol(str, NULL, 0);
+	if ((budget < 0) || (budget > 3600000))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	g_lorawan_settings.airtime_budget_ms = budget;
+	save_settings();
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+BACKLOG=? Get the store-and-forward backlog
+ *    <depth>:<capacity>:<stored>:<drained>:<dropped>:<drain rate per hour>:<gap s>
+ *
+ * @return int AT_SUCCESS
+ */
+static int at_query_backlog(void)
+{
+	backlog_stats stats;
+	backlog_get_stats(&stats);
+	snprintf(g_at_query_buf, ATQUERY_SIZE, "%d:%d:%lu:%lu:%lu:%lu:%d", backlog_depth(), BACKLOG_RECORDS,
+			 stats.stored, stats.drained, stats.dropped, stats.rate, g_lorawan_settings.backlog_gap_s);
+	return AT_SUCCESS;
+}
+
+/**
+ * @brief AT+BACKLOG=<s> Set the time between two backlog uplinks
+ *
+ * @param str 0 .. 3600 s, 0 = reports that cannot be sent are dropped
+ * @return int AT_SUCCESS if no error, otherwise AT_ERRNO_PARA_VAL
+ */
+static int at_exec_backlog(char *str)
+{
+	long gap = strtol(str, NULL, 0);
+	if ((gap < 0) || (gap > 3600))
+	{
+		return AT_ERRNO_PARA_VAL;
+	}
+	g_lorawan_settings.backlog_gap_s = gap;
+	save_settings();
 	return AT_SUCCESS;
 }
 
@@ -1865,6 +2747,8 @@ static atcmd_t g_at_cmd_list[] = {
 	{"+JOIN", "Join network", at_query_join, at_exec_join, NULL, "RW"},
 	{"+NJS", "Get the join status", at_query_join_status, NULL, NULL, "R"},
 	{"+NJM", "Get or set the network join mode", at_query_joinmode, at_exec_joinmode, NULL, "RW"},
+	{"+JOINTIME", "Get the time from join request to join accept in ms, 0 = not joined", at_query_jointime, NULL, NULL, "R"},
+	{"+SESSION", "Get the stored session state:uplink counter:ms boot to first uplink, AT+SESSION=0 forces a join on next start", at_query_session, at_exec_session, NULL, "RW"},
 	{"+SEND", "Send data", NULL, at_exec_send, NULL, "W"},
 	// LoRa network management
 	{"+ADR", "Get or set the adaptive data rate setting", at_query_adr, at_exec_adr, NULL, "RW"},
@@ -1873,6 +2757,7 @@ static atcmd_t g_at_cmd_list[] = {
 	{"+TXP", "Get or set the transmit power=[0...10]", at_query_txpower, at_exec_txpower, NULL, "RW"},
 	{"+BAND", "Get and Set LoRaWAN region (0 = EU433, 1 = CN470, 2 = RU864, 3 = IN865, 4 = EU868, 5 = US915, 6 = AU915, 7 = KR920, 8 = AS923-1 , 9 = AS923-2 , 10 = AS923-3 , 11 = AS923-4)", at_query_region, at_exec_region, NULL, "RW"},
 	{"+MASK", "Get and Set channels mask", at_query_mask, at_exec_mask, NULL, "RW"},
+	{"+DCS", "Get or set the duty cycle=<0 off, 1 on>", at_query_dutycycle, at_exec_dutycycle, NULL, "RW"},
 	// LoRa P2P management
 	{"+NWM", "Switch LoRa workmode", at_query_mode, at_exec_mode, NULL, "RW"},
 	{"+PFREQ", "Set P2P frequency", at_query_p2p_freq, at_exec_p2p_freq, NULL, "RW"},
@@ -1884,6 +2769,8 @@ static atcmd_t g_at_cmd_list[] = {
 	{"+P2P", "Set P2P configuration", at_query_p2p_config, at_exec_p2p_config, NULL, "RW"},
 	{"+PSEND", "P2P send data", NULL, at_exec_p2p_send, NULL, "W"},
 	{"+PRECV", "P2P receive mode", at_query_p2p_receive, at_exec_p2p_receive, NULL, "RW"},
+	{"+P2PTRACE", "Get the P2P radio transitions ms:event:mode:action:us and event:mode:count:last us:max us, AT+P2PTRACE clears them", at_query_p2ptrace, NULL, at_exec_p2ptrace, "R"},
+	{"+RADIOCFG", "Get the P2P radio setup calls part:sent:skipped and time:last us:max us, AT+RADIOCFG clears them", at_query_radio_cfg, NULL, at_exec_radio_cfg, "R"},
 	// WisToolBox compatibility
 	{"+BOOT", "Force bootloader mode", NULL, NULL, at_exec_boot, "R"},
 	// Custom AT commands
@@ -1891,6 +2778,27 @@ static atcmd_t g_at_cmd_list[] = {
 	{"+STATUS", "Status, Show LoRaWAN status", at_query_status, NULL, at_exec_status, "R"},
 	{"+SENDINT", "Send interval, Get or Set the automatic send interval", at_query_sendint, at_exec_sendint, NULL, "RW"},
 	{"+PORT", "Get or Set the Port=[1..223]", at_query_port, at_exec_port, NULL, "RW"},
+	{"+WINDOW", "Get or Set the wind statistics window=<sec 0..3600>:<gust avg sec 0..10>, get adds :<samples truncated>", at_query_window, at_exec_window, NULL, "RW"},
+	{"+LOOP", "Get reporting pass hold max:last, sensor line latency max:last:max during flash writes in us, AT+LOOP resets max", at_query_loop, NULL, at_exec_loop, "R"},
+#ifdef APP_PERF
+	{"+PERF", "Get name:count:p99 us:max us and log2(cycles):count per profiled scope, AT+PERF resets them", at_query_perf, NULL, at_exec_perf, "R"},
+#endif
+	{"+TXSTAT", "Get report uplinks sent:failed:retries:last latency:max latency in ms, AT+TXSTAT resets them", at_query_txstat, NULL, at_exec_txstat, "R"},
+	{"+IDLE", "Get or Set the sensor idle mode=<0 poll, 1 wake on RX>, query adds s:passes:wakes:awake permille:model uA, AT+IDLE resets", at_query_idle, at_exec_idle, at_reset_idle, "RW"},
+	{"+CAPTURE", "Get or Set the sensor stream capture=<0 off, 1 raw, 2 raw + line timing>", at_query_capture, at_exec_capture, NULL, "RW"},
+	{"+WXFEED", "Inject sensor data=<hex>, AT+WXFEED feeds USB input until Ctrl-D", NULL, at_exec_wxfeed, at_exec_wxfeed_raw, "W"},
+	{"+WXREPORT", "Print the sensor payload, =1 also starts the next report interval", NULL, at_exec_wxreport_next, at_exec_wxreport, "RW"},
+	{"+PAYLOAD", "Get or Set the sensor uplink format=<0 legacy, 1 packed>", at_query_payload, at_exec_payload, NULL, "RW"},
+	{"+BATCH", "Get or Set the report intervals per uplink=<1..15>, 1 = no batching", at_query_batch, at_exec_batch, NULL, "RW"},
+	{"+HEARTBEAT", "Get or Set change-only reporting=<max minutes without report 0..1440, 0 off>, query adds skipped:early reports", at_query_heartbeat, at_exec_heartbeat, NULL, "RW"},
+	{"+DEADBAND", "Get or Set the change-only deadbands=<wind 0.1 m/s>:<dir deg>:<temp 0.1 C>:<volt 0.01 V>", at_query_deadband, at_exec_deadband, NULL, "RW"},
+	{"+SCHED", "Get or Set the report schedule=<align to clock 0/1>:<DevEUI slot 0/1>:<jitter s>, query adds next in s:slot s", at_query_sched, at_exec_sched, NULL, "RW"},
+	{"+TIME", "Get or Set the wall clock in Unix s, 0 = not set", at_query_time, at_exec_time, NULL, "RW"},
+	{"+ALERT", "Get or Set the alert uplinks=<gust 0.1 m/s>:<dir shift deg>:<bat 0.01 V>:<cap 0.01 V>:<per hour>, 0 = off, query adds sent:tokens", at_query_alert, at_exec_alert, NULL, "RW"},
+	{"+BACKLOG", "Get or Set the backlog drain=<s between uplinks, 0 off>, query is depth:capacity:stored:drained:dropped:rate per hour:gap", at_query_backlog, at_exec_backlog, NULL, "RW"},
+	{"+AIRTIME", "Get or Set the airtime budget=<ms per hour, 0 no limit>, query is used:budget:left ms:refused uplinks", at_query_airtime, at_exec_airtime, NULL, "RW"},
+	{"+WXHEALTH", "Get the sensor stream health counters", at_query_wxhealth, NULL, NULL, "R"},
+	{"+WXDIAG", "Get or Set the sensor diagnostic uplink=<every n-th report, 0 off>", at_query_wxdiag, at_exec_wxdiag, NULL, "RW"},
 };
 
 /**
@@ -2329,5 +3237,5 @@ void at_serial_input(uint8_t cmd)
 void tud_cdc_rx_cb(uint8_t itf)
 {
 	(void)itf;
-	g_task_event_type |= AT_CMD;
+	events_set(&g_task_events, AT_CMD);
 }
@@ -0,0 +1,363 @@
+/**
+ * @file backlog.cpp
+ * @brief Store-and-forward backlog of uplinks that could not be sent
+ * @version 0.1
+ * @date 2025-06-09
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "main.h"
+#include "backlog.h"
+#include "schedule.h"
+
+#include <Adafruit_LittleFS.h>
+#include <InternalFileSystem.h>
+using namespace Adafruit_LittleFS_Namespace;
+
+/** Name of the segment files, the segment number is appended */
+static const char backlog_name[] = "BK";
+/** Record ring file of older firmware */
+static const char backlog_ring_name[] = "BKL";
+/** Name for the file with the drain position and boot counter */
+static const char backlog_pos_name[] = "BKP";
+
+/** Drain position and boot counter as stored */
+struct backlog_position
+{
+	uint32_t tail; // Sequence number of the oldest record not sent
+	uint16_t boot; // Boot counter
+};
+
+/** Segment file */
+static File backlog_file(InternalFS);
+/** Drain position and boot counter */
+static backlog_position position = {1, 0};
+/** Sequence number of the next record */
+static uint32_t next_seq = 1;
+/** Counters since boot */
+static backlog_stats stats = {0, 0, 0, 0};
+/** Start of the current drain */
+static unsigned long drain_start = 0;
+/** Records sent in the current drain */
+static uint32_t drain_records = 0;
+
+/**
+ * @brief Get the file name of the segment that holds a record
+ *
+ * @param seq sequence number of the record
+ * @param name filled with the name, at least 4 bytes
+ */
+static void backlog_segment_name(uint32_t seq, char *name)
+{
+	snprintf(name, 4, "%s%d", backlog_name, (int)(((seq - 1) / BACKLOG_SEGMENT_RECORDS) % BACKLOG_SEGMENTS));
+}
+
+/**
+ * @brief Position of a record in its segment file
+ *
+ * @param seq sequence number of the record
+ * @return uint32_t offset in bytes
+ */
+static uint32_t backlog_offset(uint32_t seq)
+{
+	return ((seq - 1) % BACKLOG_SEGMENT_RECORDS) * sizeof(backlog_record);
+}
+
+/**
+ * @brief Write the drain position and boot counter
+ */
+static void backlog_save_position(void)
+{
+	File pos_file(InternalFS);
+	InternalFS.remove(backlog_pos_name);
+	if (pos_file.open(backlog_pos_name, FILE_O_WRITE))
+	{
+		pos_file.write((uint8_t *)&position, sizeof(position));
+		pos_file.flush();
+		pos_file.close();
+	}
+}
+
+/**
+ * @brief Read a record
+ *
+ * @param seq sequence number of the record
+ * @param record filled with the record
+ * @return true if the segment holds this record
+ */
+static bool backlog_read(uint32_t seq, backlog_record *record)
+{
+	char name[4];
+	backlog_segment_name(seq, name);
+	if (!backlog_file.open(name, FILE_O_READ))
+	{
+		return false;
+	}
+	backlog_file.seek(backlog_offset(seq));
+	int read_size = backlog_file.read((uint8_t *)record, sizeof(backlog_record));
+	backlog_file.close();
+	return (read_size == sizeof(backlog_record)) && (record->seq == seq);
+}
+
+/**
+ * @brief Find the oldest and newest record and count this boot
+ *    Call after init_flash()
+ */
+void backlog_init(void)
+{
+	File pos_file(InternalFS);
+	if (pos_file.open(backlog_pos_name, FILE_O_READ))
+	{
+		pos_file.read((uint8_t *)&position, sizeof(position));
+		pos_file.close();
+	}
+	position.boot++;
+
+	if (InternalFS.exists(backlog_ring_name))
+	{
+		// Overwritten in place by older firmware, not kept
+		APP_LOG("BKLG", "Removing the backlog ring of an older firmware");
+		InternalFS.remove(backlog_ring_name);
+	}
+
+	// Sent segments are deleted, the oldest record left was not sent yet or
+	// is in the segment the drain was in
+	backlog_record record;
+	uint32_t newest = 0;
+	uint32_t oldest = 0;
+	for (uint32_t segment = 0; segment < BACKLOG_SEGMENTS; segment++)
+	{
+		char name[4];
+		backlog_segment_name(segment * BACKLOG_SEGMENT_RECORDS + 1, name);
+		if (!backlog_file.open(name, FILE_O_READ))
+		{
+			continue;
+		}
+		while (backlog_file.read((uint8_t *)&record, sizeof(backlog_record)) == sizeof(backlog_record))
+		{
+			if (record.seq > newest)
+			{
+				newest = record.seq;
+			}
+			if ((record.seq != 0) && ((oldest == 0) || (record.seq < oldest)))
+			{
+				oldest = record.seq;
+			}
+		}
+		backlog_file.close();
+	}
+	next_seq = newest + 1;
+	if (next_seq < position.tail)
+	{
+		// All segments were sent and deleted
+		next_seq = position.tail;
+	}
+	if (position.tail < oldest)
+	{
+		position.tail = oldest;
+	}
+	if (next_seq - position.tail > BACKLOG_RECORDS)
+	{
+		// Position lost
+		position.tail = next_seq - BACKLOG_RECORDS;
+	}
+	backlog_save_position();
+	APP_LOG("BKLG", "Boot %d, %d records waiting", position.boot, backlog_depth());
+}
+
+/**
+ * @brief Store an uplink that could not be sent
+ *    The record is appended to its segment. The first record of a segment
+ *    deletes the file first, with the records of the oldest segment.
+ *
+ * @param fport fPort it was meant for
+ * @param data payload
+ * @param size payload size, at most BACKLOG_DATA_SIZE
+ * @return true if it was written
+ */
+bool backlog_push(uint8_t fport, const uint8_t *data, uint8_t size)
+{
+	if (size > BACKLOG_DATA_SIZE)
+	{
+		return false;
+	}
+	backlog_record record;
+	memset(&record, 0, sizeof(backlog_record));
+	record.seq = next_seq;
+	record.boot = position.boot;
+	record.uptime_s = millis() / 1000;
+	schedule_get_time(&record.unix_s); // Stays 0 while the wall clock is not known
+	record.fport = fport;
+	record.size = size;
+	memcpy(record.data, data, size);
+
+	char name[4];
+	uint32_t offset = backlog_offset(record.seq);
+	backlog_segment_name(record.seq, name);
+	if (offset == 0)
+	{
+		InternalFS.remove(name);
+		uint32_t first = (record.seq > BACKLOG_RECORDS - BACKLOG_SEGMENT_RECORDS) ? record.seq - (BACKLOG_RECORDS - BACKLOG_SEGMENT_RECORDS) : 1;
+		if (position.tail < first)
+		{
+			// The oldest segment was not sent
+			stats.dropped += first - position.tail;
+			position.tail = first;
+		}
+	}
+
+	// FILE_O_WRITE appends
+	if (!backlog_file.open(name, FILE_O_WRITE))
+	{
+		APP_LOG("BKLG", "Could not open backlog");
+		return false;
+	}
+	if (backlog_file.size() != offset)
+	{
+		// A record cut by a reset, or a segment that was lost
+		backlog_file.seek(offset);
+	}
+	size_t written = backlog_file.write((uint8_t *)&record, sizeof(backlog_record));
+	backlog_file.flush();
+	backlog_file.close();
+	if (written != sizeof(backlog_record))
+	{
+		return false;
+	}
+
+	next_seq++;
+	stats.stored++;
+	return true;
+}
+
+/**
+ * @brief Records waiting to be sent
+ *
+ * @return uint16_t number of records
+ */
+uint16_t backlog_depth(void)
+{
+	return next_seq - position.tail;
+}
+
+/**
+ * @brief Put the oldest records into a drain uplink
+ *
+ * @param buf uplink buffer
+ * @param size largest uplink
+ * @param count number of records in the uplink
+ * @return uint8_t uplink size, 0 if not even one record fits
+ */
+uint8_t backlog_encode(uint8_t *buf, uint8_t size, uint8_t *count)
+{
+	uint32_t now_s = millis() / 1000;
+	uint8_t used = BACKLOG_FRAME_HEADER;
+	backlog_record record;
+
+	*count = 0;
+	if (size < BACKLOG_FRAME_HEADER)
+	{
+		return 0;
+	}
+	buf[0] = BACKLOG_VERSION;
+	memcpy(&buf[1], &now_s, 4);
+	uint32_t now_unix = 0;
+	bool clock = schedule_get_time(&now_unix);
+	for (uint32_t seq = position.tail; seq < next_seq; seq++)
+	{
+		if (!backlog_read(seq, &record))
+		{
+			if (*count == 0)
+			{
+				// Lost by a reset while it was written, skip it
+				position.tail = seq + 1;
+				stats.dropped++;
+				continue;
+			}
+			break;
+		}
+		if (used + BACKLOG_RECORD_HEADER + record.size > size)
+		{
+			break;
+		}
+		uint16_t boots = position.boot - record.boot;
+		uint32_t time_s = record.uptime_s;
+		if ((record.unix_s == 0) && clock && (boots == 0))
+		{
+			// Stored before the clock was set in this boot
+			record.unix_s = now_unix - (now_s - record.uptime_s);
+		}
+		if (record.unix_s != 0)
+		{
+			boots = BACKLOG_BOOTS_UNIX;
+			time_s = record.unix_s;
+		}
+		else if (boots > BACKLOG_BOOTS_UNIX - 1)
+		{
+			boots = BACKLOG_BOOTS_UNIX - 1;
+		}
+		buf[used++] = record.fport;
+		buf[used++] = record.size;
+		buf[used++] = boots;
+		memcpy(&buf[used], &time_s, 4);
+		used += 4;
+		memcpy(&buf[used], record.data, record.size);
+		used += record.size;
+		(*count)++;
+	}
+	return *count == 0 ? 0 : used;
+}
+
+/**
+ * @brief Remove records that were sent
+ *
+ * @param count number of oldest records to remove
+ */
+void backlog_pop(uint8_t count)
+{
+	if (count > backlog_depth())
+	{
+		count = backlog_depth();
+	}
+	if (drain_records == 0)
+	{
+		drain_start = millis();
+	}
+	// Delete the segments that were sent completely
+	char name[4];
+	for (uint32_t seq = position.tail; seq < position.tail + count; seq++)
+	{
+		if (backlog_offset(seq) == (BACKLOG_SEGMENT_RECORDS - 1) * sizeof(backlog_record))
+		{
+			backlog_segment_name(seq, name);
+			InternalFS.remove(name);
+		}
+	}
+	position.tail += count;
+	stats.drained += count;
+	drain_records += count;
+
+	unsigned long elapsed = millis() - drain_start;
+	if (elapsed >= 1000)
+	{
+		stats.rate = (uint32_t)(((uint64_t)drain_records * 3600000ULL) / elapsed);
+	}
+	if (backlog_depth() == 0)
+	{
+		// Drain finished, the next one measures its own rate. Only now the
+		// position is written, a reset before sends the last records again
+		drain_records = 0;
+		backlog_save_position();
+	}
+}
+
+/**
+ * @brief Get the backlog counters
+ *
+ * @param out filled with the counters
+ */
+void backlog_get_stats(backlog_stats *out)
+{
+	*out = stats;
+}
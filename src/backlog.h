@@ -0,0 +1,65 @@
+/**
+ * @file backlog.h
+ * @brief Store-and-forward backlog of uplinks that could not be sent
+ * @version 0.1
+ * @date 2025-06-09
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef BACKLOG_H
+#define BACKLOG_H
+#include <Arduino.h>
+
+// The backlog is kept in BACKLOG_SEGMENTS LittleFS files of
+// BACKLOG_SEGMENT_RECORDS fixed size records. Records are only appended,
+// a segment file is never rewritten: when the next record starts a new
+// segment, the oldest segment file is deleted, and a segment whose records
+// were all sent is deleted too. Records carry a sequence number, so the
+// newest and oldest are found again after a reset. A small position file
+// keeps the boot counter and the oldest record not yet sent; it is written
+// once per boot and when a drain finished, so a reset in the middle of a
+// drain sends the rest of a segment again.
+#define BACKLOG_SEGMENTS 5
+#define BACKLOG_SEGMENT_RECORDS 16
+#define BACKLOG_RECORDS (BACKLOG_SEGMENTS * BACKLOG_SEGMENT_RECORDS)
+#define BACKLOG_DATA_SIZE 64
+
+/** Uplink that was not sent */
+struct backlog_record
+{
+	uint32_t seq;					 // Sequence number, 0 = empty slot
+	uint16_t boot;					 // Boot counter when it was stored
+	uint32_t uptime_s;				 // Seconds since that boot
+	uint32_t unix_s;				 // Wall clock when it was stored, 0 = not known
+	uint8_t fport;					 // fPort it was meant for
+	uint8_t size;					 // Payload size
+	uint8_t data[BACKLOG_DATA_SIZE]; // Payload
+};
+
+// Drain uplink: version, uptime now in s (4 bytes LE), then per record
+// fPort, size, boots since it was stored, its time in s (4 bytes LE) and
+// the payload. The time is the wall clock (seconds since 1970 UTC) if the
+// boots byte is BACKLOG_BOOTS_UNIX, otherwise the uptime of that boot.
+#define BACKLOG_VERSION 2
+#define BACKLOG_FRAME_HEADER 5
+#define BACKLOG_RECORD_HEADER 7
+#define BACKLOG_BOOTS_UNIX 255
+
+/** Backlog counters, AT+BACKLOG */
+struct backlog_stats
+{
+	uint32_t stored;   // Records stored since boot
+	uint32_t drained;  // Records sent from the backlog since boot
+	uint32_t dropped;  // Records deleted with the oldest segment since boot
+	uint32_t rate;	   // Records per hour of the current or last drain
+};
+
+void backlog_init(void);
+bool backlog_push(uint8_t fport, const uint8_t *data, uint8_t size);
+uint16_t backlog_depth(void);
+uint8_t backlog_encode(uint8_t *buf, uint8_t size, uint8_t *count);
+void backlog_pop(uint8_t count);
+void backlog_get_stats(backlog_stats *stats);
+
+#endif
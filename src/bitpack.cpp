@@ -0,0 +1,65 @@
+/**
+ * @file bitpack.cpp
+ * @brief Packs unsigned fields of any width into a byte buffer, MSB first
+ * @version 0.1
+ * @date 2025-05-26
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "bitpack.h"
+
+/**
+ * @brief Start packing into a buffer, the buffer is cleared
+ *
+ * @param pack packer
+ * @param buffer where to write
+ * @param size size of the buffer in bytes
+ */
+void bitpack_init(bitpack *pack, uint8_t *buffer, uint8_t size)
+{
+	pack->buffer = buffer;
+	pack->size = size;
+	pack->bits = 0;
+	memset(buffer, 0, size);
+}
+
+/**
+ * @brief Append the lowest width bits of value, most significant bit first
+ *
+ * @param pack packer
+ * @param value field value, higher bits are ignored
+ * @param width number of bits 1 .. 32
+ * @return true if written
+ * @return false if the buffer is full, nothing is written
+ */
+bool bitpack_put(bitpack *pack, uint32_t value, uint8_t width)
+{
+	if (pack->bits + width > pack->size * 8)
+	{
+		return false;
+	}
+
+	while (width > 0)
+	{
+		// Fill the rest of the current byte
+		uint8_t free = 8 - (pack->bits & 7);
+		uint8_t take = (width < free) ? width : free;
+		uint8_t chunk = (value >> (width - take)) & ((1U << take) - 1);
+		pack->buffer[pack->bits >> 3] |= chunk << (free - take);
+		pack->bits += take;
+		width -= take;
+	}
+	return true;
+}
+
+/**
+ * @brief Get the number of bytes used, the last byte is padded with 0 bits
+ *
+ * @param pack packer
+ * @return uint8_t bytes used
+ */
+uint8_t bitpack_bytes(const bitpack *pack)
+{
+	return (pack->bits + 7) / 8;
+}
@@ -0,0 +1,25 @@
+/**
+ * @file bitpack.h
+ * @brief Packs unsigned fields of any width into a byte buffer, MSB first
+ * @version 0.1
+ * @date 2025-05-26
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef BITPACK_H
+#define BITPACK_H
+#include <Arduino.h>
+
+struct bitpack
+{
+	uint8_t *buffer;
+	uint8_t size;  // Size of the buffer in bytes
+	uint16_t bits; // Bits written so far
+};
+
+void bitpack_init(bitpack *pack, uint8_t *buffer, uint8_t size);
+bool bitpack_put(bitpack *pack, uint32_t value, uint8_t width);
+uint8_t bitpack_bytes(const bitpack *pack);
+
+#endif
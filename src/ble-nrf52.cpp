@@ -174,7 +174,7 @@ void disconnect_callback(uint16_t conn_handle, uint8_t reason)
 void bleuart_rx_callback(uint16_t conn_handle)
 {
 	(void)conn_handle;
-	g_task_event_type |= BLE_DATA;
+	events_set(&g_task_events, BLE_DATA);
 }
 
 /**
@@ -187,12 +187,12 @@ BLEService init_settings_characteristic(void)
 	lora_service.begin();
 	g_lora_data.setProperties(CHR_PROPS_NOTIFY | CHR_PROPS_READ | CHR_PROPS_WRITE);
 	g_lora_data.setPermission(SECMODE_OPEN, SECMODE_OPEN);
-	g_lora_data.setFixedLen(sizeof(s_lorawan_settings) + 1);
+	g_lora_data.setFixedLen(LORAWAN_SETTINGS_BLE_SIZE + 1);
 	g_lora_data.setWriteCallback(settings_rx_callback);
 
 	g_lora_data.begin();
 
-	g_lora_data.write((void *)&g_lorawan_settings, sizeof(s_lorawan_settings));
+	g_lora_data.write((void *)&g_lorawan_settings, LORAWAN_SETTINGS_BLE_SIZE);
 
 	return lora_service;
 }
@@ -217,7 +217,7 @@ void settings_rx_callback(uint16_t conn_hdl, BLECharacteristic *chr, uint8_t *da
 	// Check the characteristic
 	if (chr->uuid == g_lora_data.uuid)
 	{
-		if (len != sizeof(s_lorawan_settings))
+		if (len != LORAWAN_SETTINGS_BLE_SIZE)
 		{
 			APP_LOG("SETT", "Received settings have wrong size %d", len);
 			return;
@@ -230,17 +230,22 @@ void settings_rx_callback(uint16_t conn_hdl, BLECharacteristic *chr, uint8_t *da
 			return;
 		}
 
-		// Save new LoRa settings
-		memcpy((void *)&g_lorawan_settings, data, sizeof(s_lorawan_settings));
+		// Save new LoRa settings, not while a task works with them. Only the
+		// legacy part, the settings behind it are set over AT commands
+		xSemaphoreTake(g_uplink_mutex, portMAX_DELAY);
+		xSemaphoreTake(g_app_mutex, portMAX_DELAY);
+		memcpy((void *)&g_lorawan_settings, data, LORAWAN_SETTINGS_BLE_SIZE);
 
 		// Save new settings
 		save_settings();
+		xSemaphoreGive(g_app_mutex);
+		xSemaphoreGive(g_uplink_mutex);
 
 		// Update settings
-		g_lora_data.write((void *)&g_lorawan_settings, sizeof(s_lorawan_settings));
+		g_lora_data.write((void *)&g_lorawan_settings, LORAWAN_SETTINGS_BLE_SIZE);
 
 		// Inform connected device about new settings
-		g_lora_data.notify((void *)&g_lorawan_settings, sizeof(s_lorawan_settings));
+		g_lora_data.notify((void *)&g_lorawan_settings, LORAWAN_SETTINGS_BLE_SIZE);
 
 		if (g_lorawan_settings.resetRequest)
 		{
@@ -250,7 +255,7 @@ void settings_rx_callback(uint16_t conn_hdl, BLECharacteristic *chr, uint8_t *da
 		}
 
 		// Notify task about the event
-		g_task_event_type |= BLE_CONFIG;
+		events_set(&g_task_events, BLE_CONFIG);
 		APP_LOG("SETT", "Waking up loop task");
 	}
 }
@@ -0,0 +1,103 @@
+/**
+ * @file events.cpp
+ * @brief Lock-free event bits that wake a waiting task
+ * @version 0.1
+ * @date 2025-06-16
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "events.h"
+
+/**
+ * @brief Set events and wake the waiting task
+ *    Can be called from tasks, callbacks and ISRs
+ *
+ * @param group event group
+ * @param bits events to set
+ */
+void events_set(event_group *group, uint32_t bits)
+{
+	__atomic_fetch_or(&group->bits, bits, __ATOMIC_ACQ_REL);
+
+	TaskHandle_t waiter = group->waiter;
+	if (waiter == NULL)
+	{
+		// Nobody waits yet, the first events_wait() sees the bits
+		return;
+	}
+	if (isInISR())
+	{
+		BaseType_t woken = pdFALSE;
+		vTaskNotifyGiveFromISR(waiter, &woken);
+		portYIELD_FROM_ISR(woken);
+	}
+	else
+	{
+		xTaskNotifyGive(waiter);
+	}
+}
+
+/**
+ * @brief Clear events without waiting
+ *
+ * @param group event group
+ * @param bits events to clear
+ */
+void events_clear(event_group *group, uint32_t bits)
+{
+	__atomic_fetch_and(&group->bits, ~bits, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * @brief Pending events
+ *
+ * @param group event group
+ * @return uint32_t events set and not yet taken
+ */
+uint32_t events_get(event_group *group)
+{
+	return __atomic_load_n(&group->bits, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Take events, block the calling task until they are set
+ *    While the task blocks and no other task runs the MCU sleeps.
+ *    Only the events waited for are taken, others stay pending.
+ *
+ * @param group event group
+ * @param bits events to wait for
+ * @param all true = wait until all are set, false = until any is set
+ * @param timeout_ms longest wait, 0 = only check, EVENTS_WAIT_FOREVER = no limit
+ * @return uint32_t events taken, 0 on timeout
+ */
+uint32_t events_wait(event_group *group, uint32_t bits, bool all, uint32_t timeout_ms)
+{
+	TickType_t start = xTaskGetTickCount();
+	TickType_t timeout = (timeout_ms == EVENTS_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+	group->waiter = xTaskGetCurrentTaskHandle();
+
+	while (true)
+	{
+		uint32_t current = __atomic_load_n(&group->bits, __ATOMIC_ACQUIRE);
+		uint32_t pending = current & bits;
+		while (all ? (pending == bits) : (pending != 0))
+		{
+			// Take them unless another bit changed in between
+			if (__atomic_compare_exchange_n(&group->bits, &current, current & ~pending, true,
+											__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			{
+				return pending;
+			}
+			pending = current & bits;
+		}
+
+		TickType_t waited = xTaskGetTickCount() - start;
+		if ((timeout != portMAX_DELAY) && (waited >= timeout))
+		{
+			return 0;
+		}
+		// A set after the check above leaves a count, so this returns at once
+		ulTaskNotifyTake(pdTRUE, (timeout == portMAX_DELAY) ? portMAX_DELAY : timeout - waited);
+	}
+}
@@ -0,0 +1,36 @@
+/**
+ * @file events.h
+ * @brief Lock-free event bits that wake a waiting task
+ * @version 0.1
+ * @date 2025-06-16
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef EVENTS_H
+#define EVENTS_H
+#include <Arduino.h>
+
+// Event bits are set and taken with atomic read-modify-write operations
+// (LDREX/STREX on the Cortex-M4), so callbacks, ISRs and tasks can set
+// them at the same time without losing one. One task waits on a group,
+// it is woken through its task notification, which counts, so a bit set
+// between the check and the block still ends the wait. The task
+// notification of the waiting task belongs to the group.
+
+/** events_wait() timeout to wait until an event comes */
+#define EVENTS_WAIT_FOREVER 0xFFFFFFFF
+
+/** Event bits and the task waiting on them */
+struct event_group
+{
+	uint32_t bits;				 // Pending events
+	volatile TaskHandle_t waiter; // Task in events_wait(), NULL = none yet
+};
+
+void events_set(event_group *group, uint32_t bits);
+void events_clear(event_group *group, uint32_t bits);
+uint32_t events_get(event_group *group);
+uint32_t events_wait(event_group *group, uint32_t bits, bool all, uint32_t timeout_ms);
+
+#endif
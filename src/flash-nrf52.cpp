@@ -22,10 +22,14 @@ using namespace Adafruit_LittleFS_Namespace;
 
 /** Name for settings file */
 const char settings_name[] = "RAK";
+/** Name for LoRaWAN session file */
+const char session_name[] = "SES";
 
 /** File instance */
 File lora_file(InternalFS);
 
+static void migrate_settings(void);
+
 /**
  * @brief Initialize access to nRF52 internal file system
  *
@@ -55,7 +59,7 @@ void init_flash(void)
 	// Found new structure
 	lora_file.close();
 	lora_file.open(settings_name, FILE_O_READ);
-	lora_file.read((uint8_t *)&g_lorawan_settings, sizeof(s_lorawan_settings));
+	int read_size = lora_file.read((uint8_t *)&g_lorawan_settings, sizeof(s_lorawan_settings));
 	lora_file.close();
 	// Check if it is LPWAN settings
 	if ((g_lorawan_settings.valid_mark_1 != 0xAA) || (g_lorawan_settings.valid_mark_2 != LORAWAN_DATA_MARKER))
@@ -66,9 +70,39 @@ void init_flash(void)
 		delay(1000);
 		sd_nvic_SystemReset();
 	}
+	// Fields behind the end of an older file keep their defaults
+	if (read_size <= (int)offsetof(s_lorawan_settings, settings_version))
+	{
+		g_lorawan_settings.settings_version = 0;
+	}
+	migrate_settings();
 	init_flash_done = true;
 }
 
+/**
+ * @brief Update settings written by an older firmware
+ *
+ */
+static void migrate_settings(void)
+{
+	if (g_lorawan_settings.settings_version >= LORAWAN_SETTINGS_VERSION)
+	{
+		return;
+	}
+	if (g_lorawan_settings.settings_version < 1)
+	{
+		// Region, sub band, data rate and ADR were fixed in init_lorawan() before,
+		// keep what the node really used so its range does not change
+		APP_LOG("FLASH", "Settings version 0, using US915, the default channel plan, DR1 and ADR");
+		g_lorawan_settings.lora_region = LORAMAC_REGION_US915;
+		g_lorawan_settings.subband_channels = 0;
+		g_lorawan_settings.data_rate = DR_1;
+		g_lorawan_settings.adr_enabled = true;
+	}
+	g_lorawan_settings.settings_version = LORAWAN_SETTINGS_VERSION;
+	save_settings();
+}
+
 /**
  * @brief Save changed settings if required
  *
@@ -124,4 +158,57 @@ void flash_reset(void)
 		lora_file.flush();
 		lora_file.close();
 	}
-}
\ No newline at end of file
+}
+/**
+ * @brief Read the stored LoRaWAN session
+ *
+ * @param session filled with the stored session
+ * @return true if a complete session of LORAWAN_SESSION_VERSION was read
+ */
+bool load_session(s_lorawan_session *session)
+{
+	File session_file(InternalFS);
+	if (!session_file.open(session_name, FILE_O_READ))
+	{
+		return false;
+	}
+	int read_size = session_file.read((uint8_t *)session, sizeof(s_lorawan_session));
+	session_file.close();
+	return (read_size == sizeof(s_lorawan_session)) && (session->valid_mark == LORAWAN_SESSION_MARKER) &&
+		   (session->session_version == LORAWAN_SESSION_VERSION);
+}
+
+/**
+ * @brief Write the LoRaWAN session
+ *    LittleFS writes a changed file to a new block, so the writes are spread
+ *    over the file system. The caller keeps the number of writes low.
+ *
+ * @param session session to store
+ * @return true if it was written
+ */
+bool save_session(const s_lorawan_session *session)
+{
+	File session_file(InternalFS);
+	InternalFS.remove(session_name);
+	if (!session_file.open(session_name, FILE_O_WRITE))
+	{
+		APP_LOG("FLASH", "Could not write session");
+		return false;
+	}
+	session_file.write((const uint8_t *)session, sizeof(s_lorawan_session));
+	session_file.flush();
+	session_file.close();
+	return true;
+}
+
+/**
+ * @brief Delete the stored LoRaWAN session, the next start joins again
+ *
+ */
+void clear_session(void)
+{
+	if (InternalFS.exists(session_name))
+	{
+		InternalFS.remove(session_name);
+	}
+}
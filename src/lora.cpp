@@ -9,6 +9,7 @@
  *
  */
 #include "main.h"
+#include "airtime.h"
 
 // LoRa callbacks
 static RadioEvents_t RadioEvents;
@@ -19,9 +20,6 @@ void on_rx_timeout(void);
 void on_rx_crc_error(void);
 void on_cad_done(bool cadResult);
 
-uint8_t g_lora_p2p_rx_mode = RX_MODE_NONE;
-uint32_t g_lora_p2p_rx_time = 0;
-
 /**
  * @brief Initialize LoRa HW and LoRaWan MAC layer
  *
@@ -52,33 +50,11 @@ int8_t init_lora(void)
 	}
 	Radio.Sleep(); // Radio.Standby();
 
-	Radio.SetChannel(g_lorawan_settings.p2p_frequency);
-
-	Radio.SetTxConfig(MODEM_LORA, g_lorawan_settings.p2p_tx_power, 0, g_lorawan_settings.p2p_bandwidth,
-					  g_lorawan_settings.p2p_sf, g_lorawan_settings.p2p_cr,
-					  g_lorawan_settings.p2p_preamble_len, false,
-					  true, 0, 0, false, 5000);
+	// The chip may have been reset or set up by the LoRaWAN MAC, send the whole configuration
+	radio_cfg_invalidate();
+	lora_p2p_config(true);
 
-	Radio.SetRxConfig(MODEM_LORA, g_lorawan_settings.p2p_bandwidth, g_lorawan_settings.p2p_sf,
-					  g_lorawan_settings.p2p_cr, 0, g_lorawan_settings.p2p_preamble_len,
-					  g_lorawan_settings.p2p_symbol_timeout, false,
-					  0, true, 0, 0, false, true);
-
-	switch (g_lora_p2p_rx_mode)
-	{
-	default:
-	case RX_MODE_NONE:
-		// No RX mode, do not start RX
-		Radio.Sleep();
-		break;
-	case RX_MODE_RX:
-	case RX_MODE_RX_WAIT:
-		Radio.Rx(0);
-		break;
-	case RX_MODE_RX_TIMED:
-		Radio.Rx(g_lora_p2p_rx_time);
-		break;
-	}
+	lora_p2p_start(micros());
 
 	digitalWrite(LED_GREEN, LOW);
 
@@ -89,50 +65,83 @@ int8_t init_lora(void)
 	return 0;
 }
 
+/**
+ * @brief Set up the radio after an event, see the table in p2p.cpp
+ *
+ * @param event radio event
+ * @param event_us micros() when the event came in
+ */
+static void lora_p2p_next(p2p_event event, uint32_t event_us)
+{
+	p2p_action action = p2p_handle(event, event_us);
+	if (action == P2P_ACTION_SEND)
+	{
+		// The send wrote its payload length into the packet parameters
+		radio_cfg_invalidate_part(RADIO_CFG_RX);
+	}
+	APP_LOG("LORA", "P2P %s - %s", p2p_event_name(event), p2p_action_name(action));
+}
+
+/**
+ * @brief Set up the modem with the P2P settings, unchanged parts are not sent again
+ *    The radio must be in sleep or standby
+ *
+ * @param rx_continuous RX restarts by itself after a packet
+ */
+void lora_p2p_config(bool rx_continuous)
+{
+	radio_p2p_config config;
+	config.frequency = g_lorawan_settings.p2p_frequency;
+	config.tx_power = g_lorawan_settings.p2p_tx_power;
+	config.bandwidth = g_lorawan_settings.p2p_bandwidth;
+	config.sf = g_lorawan_settings.p2p_sf;
+	config.cr = g_lorawan_settings.p2p_cr;
+	config.preamble_len = g_lorawan_settings.p2p_preamble_len;
+	config.symbol_timeout = g_lorawan_settings.p2p_symbol_timeout;
+	config.rx_continuous = rx_continuous;
+	radio_cfg_apply(&config);
+}
+
+/**
+ * @brief Set up the radio for the current RX mode, AT+PRECV
+ *
+ * @param start_us micros() when the mode change started, the START
+ *    transition in the trace is the time until the radio is ready
+ */
+void lora_p2p_start(uint32_t start_us)
+{
+	lora_p2p_next(P2P_EVENT_START, start_us);
+}
+
 /**
  * @brief Function to be executed on Radio Tx Done event
  */
 void on_tx_done(void)
 {
+	uint32_t event_us = micros();
+	lora_p2p_next(P2P_EVENT_TX_DONE, event_us);
 	digitalWrite(LED_GREEN, LOW);
 	AT_PRINTF("+EVT:TXP2P_DONE")
 	g_rx_fin_result = true;
-
-	// Set RX mode
-	switch (g_lora_p2p_rx_mode)
-	{
-	default:
-	case RX_MODE_NONE:
-		// No RX mode, do not start RX
-		Radio.Sleep();
-		APP_LOG("LORA", "TX finished - Do not start RX");
-		break;
-	case RX_MODE_RX:
-	case RX_MODE_RX_WAIT:
-		Radio.Rx(0);
-		APP_LOG("LORA", "TX finished - Start RX");
-		break;
-	case RX_MODE_RX_TIMED:
-		Radio.Rx(g_lora_p2p_rx_time);
-		APP_LOG("LORA", "TX finished - Start timed RX");
-		break;
-	}
 }
 
 /**@brief Function to be executed on Radio Rx Done event
  */
 void on_rx_done(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
 {
+	uint32_t event_us = micros();
+
+	// Copy the data into loop data buffer, then listen again before anything slow
+	memcpy(g_rx_lora_data, payload, size);
+	g_rx_data_len = size;
+	lora_p2p_next(P2P_EVENT_RX_DONE, event_us);
+
 	digitalWrite(LED_GREEN, LOW);
 
 	g_last_rssi = rssi;
 	g_last_snr = snr;
 	g_rx_fin_result = true;
 
-	// Copy the data into loop data buffer
-	memcpy(g_rx_lora_data, payload, size);
-	g_rx_data_len = size;
-
 	char log_buff[g_rx_data_len * 2] = {0};
 	uint8_t log_idx = 0;
 	for (int idx = 0; idx < g_rx_data_len; idx++)
@@ -141,133 +150,79 @@ void on_rx_done(uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
 		log_idx += 3;
 	}
 	AT_PRINTF("+EVT:RXP2P:%d:%d:%s", g_last_rssi, g_last_snr, log_buff);
-
-		// Set RX mode
-	switch (g_lora_p2p_rx_mode)
-	{
-	default:
-	case RX_MODE_NONE:
-	case RX_MODE_RX_WAIT:
-	case RX_MODE_RX_TIMED:
-		// No RX mode, do not start RX
-		Radio.Sleep();
-		APP_LOG("LORA", "RX finished - Stopping RX");
-		break;
-	case RX_MODE_RX:
-		Radio.Rx(0);
-		APP_LOG("LORA", "RX finished - Restarting RX");
-		break;
-	}
 }
 
 /**@brief Function to be executed on Radio Tx Timeout event
  */
 void on_tx_timeout(void)
 {
+	uint32_t event_us = micros();
+	lora_p2p_next(P2P_EVENT_TX_TIMEOUT, event_us);
 	AT_PRINTF("+EVT:TXP2P_TIMEOUT");
 	digitalWrite(LED_GREEN, LOW);
 	g_rx_fin_result = false;
-
-	// Set RX mode
-	switch (g_lora_p2p_rx_mode)
-	{
-	default:
-	case RX_MODE_NONE:
-	case RX_MODE_RX_WAIT:
-	case RX_MODE_RX_TIMED:
-		// No RX mode, do not start RX
-		Radio.Sleep();
-		APP_LOG("LORA", "TX timeout - Do not start RX");
-		break;
-	case RX_MODE_RX:
-		Radio.Rx(0);
-		APP_LOG("LORA", "TX timeout - Restart RX");
-		break;
-	}
 }
 
 /**@brief Function to be executed on Radio Rx Timeout event
  */
 void on_rx_timeout(void)
 {
+	uint32_t event_us = micros();
+	lora_p2p_next(P2P_EVENT_RX_TIMEOUT, event_us);
 	AT_PRINTF("+EVT:RXP2P_TIMEOUT");
 	digitalWrite(LED_GREEN, LOW);
-
-	// Set RX mode
-	switch (g_lora_p2p_rx_mode)
-	{
-	default:
-	case RX_MODE_NONE:
-	case RX_MODE_RX_WAIT:
-	case RX_MODE_RX_TIMED:
-		// No RX mode, do not start RX
-		Radio.Sleep();
-		APP_LOG("LORA", "RX timeout - Do not start RX");
-		break;
-	case RX_MODE_RX:
-		Radio.Rx(0);
-		APP_LOG("LORA", "RX timeout - Restart RX");
-		break;
-	}
 }
 
 /**@brief Function to be executed on Radio Rx Error event
  */
 void on_rx_crc_error(void)
 {
+	uint32_t event_us = micros();
+	lora_p2p_next(P2P_EVENT_RX_ERROR, event_us);
 	AT_PRINTF("+EVT:TXP2P_CRC_ERROR");
 	digitalWrite(LED_GREEN, LOW);
-
-	// Set RX mode
-	switch (g_lora_p2p_rx_mode)
-	{
-	default:
-	case RX_MODE_NONE:
-	case RX_MODE_RX_WAIT:
-	case RX_MODE_RX_TIMED:
-		// No RX mode, do not start RX
-		Radio.Sleep();
-		APP_LOG("LORA", "RX CRC error - Do not start RX");
-		break;
-	case RX_MODE_RX:
-		Radio.Rx(0);
-		APP_LOG("LORA", "RX CRC error - Restart RX");
-		break;
-	}
 }
 
-/**@brief Function to be executed on Radio Rx Error event
+/**@brief Function to be executed on Radio CAD Done event
  */
 void on_cad_done(bool cadResult)
 {
+	uint32_t event_us = micros();
 	if (cadResult)
 	{
+		// Channel busy, do not send
+		lora_p2p_next(P2P_EVENT_CAD_BUSY, event_us);
 		digitalWrite(LED_GREEN, LOW);
-		// Set RX mode
-		switch (g_lora_p2p_rx_mode)
-		{
-		default:
-		case RX_MODE_NONE:
-		case RX_MODE_RX_WAIT:
-		case RX_MODE_RX_TIMED:
-			// No RX mode, do not start RX
-			Radio.Sleep();
-			APP_LOG("LORA", "CAD failed - Do not start RX");
-			break;
-		case RX_MODE_RX:
-			Radio.Rx(0);
-			APP_LOG("LORA", "CAD failed - Restart RX");
-			break;
-		}
-
 		g_rx_fin_result = false;
 	}
 	else
 	{
-		Radio.Send(g_tx_lora_data, g_tx_data_len);
+		airtime_add(lora_p2p_airtime_us(g_tx_data_len));
+		lora_p2p_next(P2P_EVENT_CAD_FREE, event_us);
 	}
 }
 
+/** P2P bandwidths in Hz, index is g_lorawan_settings.p2p_bandwidth */
+static const uint32_t p2p_bandwidths[10] = {125000, 250000, 500000, 62500, 41670, 31250, 20830, 15630, 10420, 7810};
+
+/**
+ * @brief Time on air of a P2P packet with the current settings
+ *
+ * @param size payload in bytes
+ * @return uint32_t time on air in us
+ */
+uint32_t lora_p2p_airtime_us(uint8_t size)
+{
+	airtime_modulation mod;
+	mod.sf = g_lorawan_settings.p2p_sf;
+	mod.bw_hz = p2p_bandwidths[(g_lorawan_settings.p2p_bandwidth < 10) ? g_lorawan_settings.p2p_bandwidth : 0];
+	mod.cr = g_lorawan_settings.p2p_cr;
+	mod.preamble = g_lorawan_settings.p2p_preamble_len;
+	mod.implicit_header = false;
+	mod.crc = true;
+	return airtime_us(&mod, size);
+}
+
 /**
  * @brief Prepare packet to be sent and start CAD routine
  *
@@ -278,12 +233,22 @@ bool send_p2p_packet(uint8_t *data, uint8_t size)
 	{
 		return false;
 	}
+	if (!airtime_allowed(lora_p2p_airtime_us(size), g_lorawan_settings.airtime_budget_ms))
+	{
+		g_airtime_refused++;
+		APP_LOG("LORA", "Airtime budget of %ld ms per hour used up", g_lorawan_settings.airtime_budget_ms);
+		return false;
+	}
 	g_tx_data_len = size;
 	memcpy(g_tx_lora_data, data, size);
+	p2p_set_packet(g_tx_lora_data, g_tx_data_len);
 
 	// Prepare LoRa CAD
 	Radio.Sleep();
 	Radio.SetCadParams(LORA_CAD_08_SYMBOL, g_lorawan_settings.p2p_sf + 13, 10, LORA_CAD_ONLY, 0);
+	// CAD leaves the chip in another mode, set up TX and RX again afterwards
+	radio_cfg_invalidate_part(RADIO_CFG_TX);
+	radio_cfg_invalidate_part(RADIO_CFG_RX);
 
 	// Switch on Indicator lights
 	digitalWrite(LED_GREEN, HIGH);
@@ -9,6 +9,9 @@
  *
  */
 #include "main.h"
+#include "airtime.h"
+#include "perf.h"
+#include "schedule.h"
 
 /** LoRaWAN setting from flash */
 s_lorawan_settings g_lorawan_settings;
@@ -35,6 +38,39 @@ bool g_lorawan_initialized = false;
 bool g_rx_fin_result;
 /** Result of join request */
 bool g_join_result = false;
+/** Region the MAC was initialized with, for the airtime */
+static uint8_t lorawan_region = LORAMAC_REGION_US915;
+/** Uplinks not sent because the airtime budget was used up */
+uint32_t g_airtime_refused = 0;
+/** Time the last join was started */
+static uint32_t join_start_time = 0;
+/** Time from join request to join accept in ms, 0 = not joined yet */
+uint32_t g_join_time_ms = 0;
+
+// Session persistence: the OTAA session is kept in flash so a reset does
+// not cost a join. The uplink counter is written every SESSION_FCNT_STEP
+// uplinks and skipped ahead as far on restore, no counter is used twice.
+// Uplinks of a restored session are confirmed until the network answers,
+// after SESSION_VERIFY_TRIES unanswered ones the session is dropped and the
+// node joins again.
+#define SESSION_FCNT_STEP 32
+#define SESSION_VERIFY_TRIES 3
+/** Parameters of the MAC, used for the RX1 data rate offset that has no MIB */
+extern LoRaMacParams_t LoRaMacParams;
+/** Session as it is stored in flash */
+static s_lorawan_session lorawan_session;
+/** LORAWAN_SESSION_STATE */
+static uint8_t session_state = SESSION_NONE;
+/** Confirmed uplinks of a restored session without ACK */
+static uint8_t session_misses = 0;
+/** The network did not answer a restored session, join again */
+static volatile bool session_rejected = false;
+/** Time from boot to the first uplink that went out, 0 = none yet */
+uint32_t g_first_uplink_ms = 0;
+/** An uplink finished since lorawan_tx_finished() was last called */
+static volatile bool tx_finished = false;
+/** It went out, or was confirmed with an ACK */
+static volatile bool tx_acked = false;
 
 /**************************************************************/
 /* LoRaWAN properties                                            */
@@ -58,6 +94,14 @@ static void lpwan_unconfirm_tx_finished(void);
 /** LoRaWAN callback after class change request finished */
 static void lpwan_confirm_tx_finished(bool result);
 
+// Session persistence
+static bool session_load(void);
+static void session_restore_counters(void);
+static void session_restore_mac(void);
+static void session_read_mac(void);
+static void session_capture(void);
+static void session_uplink_done(bool confirmed, bool acked);
+
 /**@brief Structure containing LoRaWAN parameters, needed for lmh_init()
  *
  * Set structure members to
@@ -91,11 +135,17 @@ uint32_t otaaDevAddr = 0;
  */
 int8_t init_lorawan(bool region_change)
 {
-	// Initialize LoRa chip.
-	if (lora_rak4630_init() != 0)
+	// The MAC sets up the radio itself, a later P2P setup must send everything
+	radio_cfg_invalidate();
+
+	// Initialize LoRa chip, a region change only restarts the MAC
+	if (!region_change)
 	{
-		APP_LOG("LORA", "Failed to initialize SX1262");
-		return -1;
+		if (lora_rak4630_init() != 0)
+		{
+			APP_LOG("LORA", "Failed to initialize SX1262");
+			return -1;
+		}
 	}
 
 	// Setup the EUIs and Keys
@@ -106,31 +156,35 @@ int8_t init_lorawan(bool region_change)
 	lmh_setAppSKey(g_lorawan_settings.node_apps_key);
 	lmh_setDevAddr(g_lorawan_settings.node_dev_addr);
 
+	// A stored OTAA session is started like an ABP session
+	bool restore = g_lorawan_settings.otaa_enabled && g_lorawan_settings.auto_join && session_load();
+	if (restore)
+	{
+		lmh_setNwkSKey(lorawan_session.nws_key);
+		lmh_setAppSKey(lorawan_session.apps_key);
+		lmh_setDevAddr(lorawan_session.dev_addr);
+	}
+	session_state = SESSION_NONE;
+	session_misses = 0;
+	session_rejected = false;
+
 	// Setup the LoRaWan init structure
-	// lora_param_init.adr_enable = g_lorawan_settings.adr_enabled;
-	// lora_param_init.tx_data_rate = g_lorawan_settings.data_rate;
-	// lora_param_init.enable_public_network = g_lorawan_settings.public_network;
-	// lora_param_init.nb_trials = g_lorawan_settings.join_trials;
-	// lora_param_init.tx_power = g_lorawan_settings.tx_power;
-	// lora_param_init.duty_cycle = g_lorawan_settings.duty_cycle_enabled;
-
-	bool doOTAA = true;
-	#define SCHED_MAX_EVENT_DATA_SIZE APP_TIMER_SCHED_EVENT_DATA_SIZE /**< Maximum size of scheduler events. */
-	#define SCHED_QUEUE_SIZE 60										  /**< Maximum number of events in the scheduler queue. */
-	#define LORAWAN_DATERATE DR_1									  /*LoRaMac datarates definition, from DR_0 to DR_5*/
-	#define LORAWAN_TX_POWER TX_POWER_5								  /*LoRaMac tx power definition, from TX_POWER_0 to TX_POWER_15*/
-	#define JOINREQ_NBTRIALS 3										  /**< Number of trials for the join request. */
-	DeviceClass_t gCurrentClass = CLASS_A;						  /* class definition*/
-	lmh_confirm gCurrentConfirm = LMH_CONFIRMED_MSG;			  /* confirm/unconfirm packet definition*/
-	uint8_t gAppPort = LORAWAN_APP_PORT;						  /* data port*/
-
-	/**@brief Structure containing LoRaWan parameters, needed for lmh_init()
-	 */
-	static lmh_param_t lora_param_init = {LORAWAN_ADR_ON, LORAWAN_DATERATE, LORAWAN_PUBLIC_NETWORK, JOINREQ_NBTRIALS, LORAWAN_TX_POWER, LORAWAN_DUTYCYCLE_OFF};
-
-	APP_LOG("LORA", "Initialize LoRaWAN for region %s", region_names[g_lorawan_settings.lora_region]);
+	lora_param_init.adr_enable = g_lorawan_settings.adr_enabled ? LORAWAN_ADR_ON : LORAWAN_ADR_OFF;
+	lora_param_init.tx_data_rate = g_lorawan_settings.data_rate;
+	lora_param_init.enable_public_network = g_lorawan_settings.public_network ? LORAWAN_PUBLIC_NETWORK : LORAWAN_PRIVATE_NETWORK;
+	lora_param_init.nb_trials = g_lorawan_settings.join_trials;
+	lora_param_init.tx_power = g_lorawan_settings.tx_power;
+	lora_param_init.duty_cycle = g_lorawan_settings.duty_cycle_enabled ? LORAWAN_DUTYCYCLE_ON : LORAWAN_DUTYCYCLE_OFF;
+
+	if (g_lorawan_settings.lora_region > LORAMAC_REGION_RU864)
+	{
+		g_lorawan_settings.lora_region = LORAMAC_REGION_US915;
+	}
+	lorawan_region = g_lorawan_settings.lora_region;
+
+	APP_LOG("LORA", "Initialize LoRaWAN for region %s", region_names[lorawan_region]);
 	// Initialize LoRaWan
-	if (lmh_init(&lora_callbacks, lora_param_init, true, CLASS_A, LORAMAC_REGION_US915) != 0)
+	if (lmh_init(&lora_callbacks, lora_param_init, g_lorawan_settings.otaa_enabled && !restore, CLASS_A, (LoRaMacRegion_t)lorawan_region) != 0)
 	{
 		APP_LOG("LORA", "Failed to initialize LoRaWAN");
 		return -2;
@@ -138,62 +192,325 @@ int8_t init_lorawan(bool region_change)
 
 	// For some regions we might need to define the sub band the gateway is listening to
 	// This must be called AFTER lmh_init()
+	if (g_lorawan_settings.subband_channels > lorawan_max_subband(lorawan_region))
+	{
+		g_lorawan_settings.subband_channels = 1;
+	}
+	if (g_lorawan_settings.subband_channels != 0)
+	{
+		if (!lmh_setSubBandChannels(g_lorawan_settings.subband_channels))
+		{
+			APP_LOG("LORA", "lmh_setSubBandChannels failed. Wrong sub band requested?");
+			return -3;
+		}
+	}
 
-	// Additional check if the subband from the settings is valid
-	// switch ((LoRaMacRegion_t)g_lorawan_settings.lora_region)
-	// {
-	// case LORAMAC_REGION_AS923:
-	// case LORAMAC_REGION_AS923_2:
-	// case LORAMAC_REGION_AS923_3:
-	// case LORAMAC_REGION_AS923_4:
-	// case LORAMAC_REGION_RU864:
-	// 	if (g_lorawan_settings.subband_channels > 1)
-	// 	{
-	// 		g_lorawan_settings.subband_channels = 1;
-	// 	}
-	// 	break;
-	// case LORAMAC_REGION_AU915:
-	// case LORAMAC_REGION_US915:
-	// 	if (g_lorawan_settings.subband_channels > 9)
-	// 	{
-	// 		g_lorawan_settings.subband_channels = 1;
-	// 	}
-	// 	break;
-	// case LORAMAC_REGION_CN470:
-	// 	if (g_lorawan_settings.subband_channels > 12)
-	// 	{
-	// 		g_lorawan_settings.subband_channels = 1;
-	// 	}
-	// 	break;
-	// case LORAMAC_REGION_CN779:
-	// case LORAMAC_REGION_EU433:
-	// case LORAMAC_REGION_IN865:
-	// case LORAMAC_REGION_EU868:
-	// case LORAMAC_REGION_KR920:
-	// 	if (g_lorawan_settings.subband_channels > 2)
-	// 	{
-	// 		g_lorawan_settings.subband_channels = 1;
-	// 	}
-	// 	break;
-	// }
-
-	// if (!lmh_setSubBandChannels(g_lorawan_settings.subband_channels))
-	// {
-	// 	APP_LOG("LORA", "lmh_setSubBandChannels failed. Wrong sub band requested?");
-	// 	return -3;
-	// }
-
-	/// \todo Join should be only started if g_lorawan_settings.auto_join is true.
-	if (g_lorawan_settings.auto_join)
+	g_lpwan_has_joined = false;
+	if (restore)
+	{
+		APP_LOG("LORA", "Restore session %08lX, uplink counter %ld", lorawan_session.dev_addr, lorawan_session.fcnt_up);
+		// Without OTAA lmh_join() only activates the session
+		session_state = SESSION_RESTORED;
+		lmh_join();
+		session_restore_counters();
+		session_restore_mac();
+		g_lpwan_has_joined = true;
+	}
+	else if (g_lorawan_settings.auto_join)
 	{
 		APP_LOG("LORA", "Start Join");
 		// Start Join process
-		lmh_join();
+		lorawan_join();
 	}
 	g_lorawan_initialized = true;
 	return 0;
 }
 
+/**
+ * @brief Highest sub band of a region, like the LoRaWAN stack counts them
+ *
+ * @param region LoRaMacRegion_t
+ * @return uint8_t highest sub band, 1 for regions without sub bands
+ */
+uint8_t lorawan_max_subband(uint8_t region)
+{
+	switch (region)
+	{
+	case LORAMAC_REGION_AU915:
+	case LORAMAC_REGION_US915:
+		return 9;
+	case LORAMAC_REGION_CN470:
+		return 12;
+	case LORAMAC_REGION_CN779:
+	case LORAMAC_REGION_EU433:
+	case LORAMAC_REGION_IN865:
+	case LORAMAC_REGION_EU868:
+	case LORAMAC_REGION_KR920:
+		return 2;
+	default:
+		// AS923-1 .. AS923-4, RU864
+		return 1;
+	}
+}
+
+/**
+ * @brief Start a join and take the time until it is accepted
+ */
+void lorawan_join(void)
+{
+	join_start_time = millis();
+	lmh_join();
+}
+
+/**
+ * @brief Read the stored session and check it belongs to the current settings
+ *
+ * @return true if the session can be restored
+ */
+static bool session_load(void)
+{
+	if (!load_session(&lorawan_session))
+	{
+		return false;
+	}
+	if ((lorawan_session.region != g_lorawan_settings.lora_region) ||
+		(memcmp(lorawan_session.node_device_eui, g_lorawan_settings.node_device_eui, 8) != 0) ||
+		(memcmp(lorawan_session.node_app_eui, g_lorawan_settings.node_app_eui, 8) != 0) ||
+		(memcmp(lorawan_session.node_app_key, g_lorawan_settings.node_app_key, 16) != 0))
+	{
+		APP_LOG("LORA", "Stored session is for other settings, join");
+		clear_session();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Continue the frame counters of a restored session
+ *    The uplink counter skips the uplinks that might have been sent after
+ *    it was written, the new start is written right away.
+ */
+static void session_restore_counters(void)
+{
+	MibRequestConfirm_t mib_req;
+	lorawan_session.fcnt_up += SESSION_FCNT_STEP;
+	mib_req.Type = MIB_UPLINK_COUNTER;
+	mib_req.Param.UpLinkCounter = lorawan_session.fcnt_up;
+	LoRaMacMibSetRequestConfirm(&mib_req);
+	mib_req.Type = MIB_DOWNLINK_COUNTER;
+	mib_req.Param.DownLinkCounter = lorawan_session.fcnt_down;
+	LoRaMacMibSetRequestConfirm(&mib_req);
+	save_session(&lorawan_session);
+}
+
+/**
+ * @brief Put back the MAC state of a restored session
+ *    lmh_init() starts from the region defaults, the network still uses the
+ *    RX windows, channels and data rate it gave the session. Regions with a
+ *    fixed channel plan refuse the channel add, their mask holds the plan.
+ *    The mask goes last, adding a channel enables it.
+ */
+static void session_restore_mac(void)
+{
+	MibRequestConfirm_t mib_req;
+	mib_req.Type = MIB_RECEIVE_DELAY_1;
+	mib_req.Param.ReceiveDelay1 = lorawan_session.rx1_delay_ms;
+	LoRaMacMibSetRequestConfirm(&mib_req);
+	mib_req.Type = MIB_RECEIVE_DELAY_2;
+	mib_req.Param.ReceiveDelay2 = lorawan_session.rx2_delay_ms;
+	LoRaMacMibSetRequestConfirm(&mib_req);
+	mib_req.Type = MIB_RX2_CHANNEL;
+	mib_req.Param.Rx2Channel.Frequency = lorawan_session.rx2_frequency;
+	mib_req.Param.Rx2Channel.Datarate = lorawan_session.rx2_datarate;
+	LoRaMacMibSetRequestConfirm(&mib_req);
+	// The MAC has no MIB for the RX1 data rate offset of DLSettings
+	LoRaMacParams.Rx1DrOffset = lorawan_session.rx1_dr_offset;
+
+	for (uint8_t idx = 0; idx < LORAWAN_SESSION_CHANNELS; idx++)
+	{
+		if (lorawan_session.channel_frequency[idx] == 0)
+		{
+			continue;
+		}
+		ChannelParams_t channel;
+		memset(&channel, 0, sizeof(channel));
+		channel.Frequency = lorawan_session.channel_frequency[idx];
+		channel.Rx1Frequency = lorawan_session.channel_rx1_frequency[idx];
+		channel.DrRange.Value = lorawan_session.channel_dr_range[idx];
+		LoRaMacChannelAdd(idx, channel);
+	}
+	mib_req.Type = MIB_CHANNELS_MASK;
+	mib_req.Param.ChannelsMask = lorawan_session.channels_mask;
+	LoRaMacMibSetRequestConfirm(&mib_req);
+
+	mib_req.Type = MIB_CHANNELS_DATARATE;
+	mib_req.Param.ChannelsDatarate = lorawan_session.datarate;
+	LoRaMacMibSetRequestConfirm(&mib_req);
+}
+
+/**
+ * @brief Copy the MAC state the network set into the session
+ *    The join accept sets the RX windows and the CFList channels, the
+ *    MAC commands after it may change them and the data rate.
+ */
+static void session_read_mac(void)
+{
+	MibRequestConfirm_t mib_req;
+	mib_req.Type = MIB_RECEIVE_DELAY_1;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	lorawan_session.rx1_delay_ms = mib_req.Param.ReceiveDelay1;
+	mib_req.Type = MIB_RECEIVE_DELAY_2;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	lorawan_session.rx2_delay_ms = mib_req.Param.ReceiveDelay2;
+	mib_req.Type = MIB_RX2_CHANNEL;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	lorawan_session.rx2_frequency = mib_req.Param.Rx2Channel.Frequency;
+	lorawan_session.rx2_datarate = mib_req.Param.Rx2Channel.Datarate;
+	lorawan_session.rx1_dr_offset = LoRaMacParams.Rx1DrOffset;
+
+	mib_req.Type = MIB_CHANNELS;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	for (uint8_t idx = 0; idx < LORAWAN_SESSION_CHANNELS; idx++)
+	{
+		lorawan_session.channel_frequency[idx] = mib_req.Param.ChannelList[idx].Frequency;
+		lorawan_session.channel_rx1_frequency[idx] = mib_req.Param.ChannelList[idx].Rx1Frequency;
+		lorawan_session.channel_dr_range[idx] = mib_req.Param.ChannelList[idx].DrRange.Value;
+	}
+	mib_req.Type = MIB_CHANNELS_MASK;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	memcpy(lorawan_session.channels_mask, mib_req.Param.ChannelsMask, sizeof(lorawan_session.channels_mask));
+
+	mib_req.Type = MIB_CHANNELS_DATARATE;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	lorawan_session.datarate = mib_req.Param.ChannelsDatarate;
+}
+
+/**
+ * @brief Take the session of a join accept and write it
+ */
+static void session_capture(void)
+{
+	MibRequestConfirm_t mib_req;
+	lorawan_session.region = lorawan_region;
+	memcpy(lorawan_session.node_device_eui, g_lorawan_settings.node_device_eui, 8);
+	memcpy(lorawan_session.node_app_eui, g_lorawan_settings.node_app_eui, 8);
+	memcpy(lorawan_session.node_app_key, g_lorawan_settings.node_app_key, 16);
+	mib_req.Type = MIB_DEV_ADDR;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	lorawan_session.dev_addr = mib_req.Param.DevAddr;
+	mib_req.Type = MIB_NWK_SKEY;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	memcpy(lorawan_session.nws_key, mib_req.Param.NwkSKey, 16);
+	mib_req.Type = MIB_APP_SKEY;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	memcpy(lorawan_session.apps_key, mib_req.Param.AppSKey, 16);
+	lorawan_session.fcnt_up = 0;
+	lorawan_session.fcnt_down = 0;
+	session_read_mac();
+	save_session(&lorawan_session);
+}
+
+/**
+ * @brief Bookkeeping after an uplink finished
+ *    Writes the frame counters every SESSION_FCNT_STEP uplinks and decides
+ *    if a restored session is accepted by the network.
+ *
+ * @param confirmed uplink was confirmed
+ * @param acked ACK received, or the unconfirmed uplink went out
+ */
+static void session_uplink_done(bool confirmed, bool acked)
+{
+	if (acked && g_first_uplink_ms == 0)
+	{
+		g_first_uplink_ms = millis();
+		APP_LOG("LORA", "First uplink %ld ms after boot", g_first_uplink_ms);
+	}
+
+	if (session_state == SESSION_RESTORED && confirmed)
+	{
+		if (acked)
+		{
+			APP_LOG("LORA", "Restored session accepted");
+			session_state = SESSION_ACTIVE;
+		}
+		else if (++session_misses >= SESSION_VERIFY_TRIES)
+		{
+			APP_LOG("LORA", "No answer to the restored session, join again");
+			clear_session();
+			session_state = SESSION_NONE;
+			session_rejected = true;
+			return;
+		}
+	}
+
+	if (session_state == SESSION_NONE)
+	{
+		return;
+	}
+	uint32_t fcnt_up = lorawan_uplink_counter();
+	if (fcnt_up - lorawan_session.fcnt_up >= SESSION_FCNT_STEP)
+	{
+		MibRequestConfirm_t mib_req;
+		mib_req.Type = MIB_DOWNLINK_COUNTER;
+		LoRaMacMibGetRequestConfirm(&mib_req);
+		lorawan_session.fcnt_up = fcnt_up;
+		lorawan_session.fcnt_down = mib_req.Param.DownLinkCounter;
+		session_read_mac();
+		save_session(&lorawan_session);
+	}
+}
+
+/**
+ * @brief Current uplink frame counter of the MAC
+ *
+ * @return uint32_t FCntUp
+ */
+uint32_t lorawan_uplink_counter(void)
+{
+	MibRequestConfirm_t mib_req;
+	mib_req.Type = MIB_UPLINK_COUNTER;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	return mib_req.Param.UpLinkCounter;
+}
+
+/**
+ * @brief Message type for an uplink
+ *    A restored session sends confirmed uplinks until the network answers.
+ *
+ * @param requested message type the caller wants
+ * @return lmh_confirm message type to send
+ */
+lmh_confirm lorawan_confirm(lmh_confirm requested)
+{
+	return session_state == SESSION_RESTORED ? LMH_CONFIRMED_MSG : requested;
+}
+
+/**
+ * @brief Check if the network did not answer a restored session
+ *    The flag is cleared, the caller starts a new join with init_lorawan(true).
+ *
+ * @return true if a join is needed
+ */
+bool lorawan_session_rejected(void)
+{
+	if (!session_rejected)
+	{
+		return false;
+	}
+	session_rejected = false;
+	return true;
+}
+
+/**
+ * @brief State of the session, AT+SESSION
+ *
+ * @return uint8_t LORAWAN_SESSION_STATE
+ */
+uint8_t lorawan_session_state(void)
+{
+	return session_state;
+}
+
 /**
  * @brief Re-init LoRaWAN stack
  *     Workaround for bug after NAK
@@ -257,6 +574,17 @@ static void lpwan_joined_handler(void)
 
 	AT_PRINTF("+EVT:JOINED");
 
+	if (session_state != SESSION_RESTORED)
+	{
+		g_join_time_ms = millis() - join_start_time;
+		APP_LOG("LORA", "Joined after %ld ms", g_join_time_ms);
+		if (g_lorawan_settings.otaa_enabled)
+		{
+			session_capture();
+			session_state = SESSION_ACTIVE;
+		}
+	}
+
 	g_join_result = true;
 
 	delay(100); // Just to enable the serial port to send the message
@@ -279,20 +607,42 @@ static void lpwan_rx_handler(lmh_app_data_t *app_data)
 	g_last_snr = app_data->snr;
 	g_last_fport = app_data->port;
 
+	// A downlink passed the MIC check, the network knows the session
+	if (session_state == SESSION_RESTORED)
+	{
+		session_state = SESSION_ACTIVE;
+	}
+
 	// Copy the data into loop data buffer
 	memcpy(g_rx_lora_data, app_data->buffer, app_data->buffsize);
 	g_rx_data_len = app_data->buffsize;
 
 	AT_PRINTF("+EVT:RX_1:%d:%d:UNICAST:%d:%s", g_last_rssi, g_last_snr, g_last_fport, app_data->buffer);
 	
-	if (app_data->buffsize > 0 && isdigit(app_data->buffer[0]))
+	if (app_data->port == LORAWAN_TIME_PORT)
+	{
+		// Network time for the report schedule, AT+SCHED
+		if (app_data->buffsize == 4)
+		{
+			uint32_t unix_s;
+			memcpy(&unix_s, app_data->buffer, 4);
+			xSemaphoreTake(g_app_mutex, portMAX_DELAY);
+			schedule_set_time(unix_s);
+			xSemaphoreGive(g_app_mutex);
+		}
+	}
+	else if (app_data->buffsize > 0 && isdigit(app_data->buffer[0]))
 	{
 		int new_interval = atoi((const char *)app_data->buffer); // Convert buffer to integer
 		if (new_interval > 0)
 		{
 			Serial.printf("Setting send interval to %d minutes\n", new_interval);
+			// Settings and flash are shared with the AT and reporting tasks
+			xSemaphoreTake(g_app_mutex, portMAX_DELAY);
 			g_lorawan_settings.send_repeat_time = new_interval * 60000; // Convert minutes to milliseconds
 			save_settings();
+			apply_sensor_config();
+			xSemaphoreGive(g_app_mutex);
 		}
 	}
 	// Check if the buffer contains the "reboot" command
@@ -325,6 +675,10 @@ static void lpwan_unconfirm_tx_finished(void)
 	AT_PRINTF("+EVT:TX_DONE");
 	digitalWrite(LED_GREEN, LOW);
 	g_rx_fin_result = true;
+	tx_acked = true;
+	tx_finished = true;
+	report_task_notify();
+	session_uplink_done(false, true);
 }
 
 /**
@@ -337,6 +691,89 @@ static void lpwan_confirm_tx_finished(bool result)
 	AT_PRINTF("+EVT:%s", result ? "SEND_CONFIRMED_OK" : "SEND_CONFIRMED_FAILED");
 	digitalWrite(LED_GREEN, LOW);
 	g_rx_fin_result = result;
+	tx_acked = result;
+	tx_finished = true;
+	report_task_notify();
+	session_uplink_done(true, result);
+}
+
+/**
+ * @brief Check if the MAC finished an uplink, for the report retries
+ *    The event is cleared.
+ *
+ * @param acked set to true if the uplink went out, or was confirmed with an ACK
+ * @return true if an uplink finished since the last call
+ */
+bool lorawan_tx_finished(bool *acked)
+{
+	if (!tx_finished)
+	{
+		return false;
+	}
+	*acked = tx_acked;
+	tx_finished = false;
+	return true;
+}
+
+/**
+ * @brief Get the largest application payload for the current data rate,
+ *    after the MAC commands waiting to be sent
+ *
+ * @return uint8_t payload size in bytes
+ */
+uint8_t lorawan_max_payload(void)
+{
+	LoRaMacTxInfo_t tx_info;
+	// Fills MaxPossiblePayload even if the MAC commands alone do not fit
+	LoRaMacQueryTxPossible(0, &tx_info);
+	return tx_info.MaxPossiblePayload;
+}
+
+/**
+ * @brief Time on air of an uplink at the current data rate
+ *    MAC commands piggybacked in FOpts are not counted.
+ *
+ * @param size application payload in bytes
+ * @return uint32_t time on air in us, 0 for an FSK data rate
+ */
+uint32_t lorawan_airtime_us(uint8_t size)
+{
+	MibRequestConfirm_t mib_req;
+	airtime_modulation mod;
+	mib_req.Type = MIB_CHANNELS_DATARATE;
+	LoRaMacMibGetRequestConfirm(&mib_req);
+	if (!airtime_lorawan_modulation(lorawan_region, mib_req.Param.ChannelsDatarate, &mod))
+	{
+		return 0;
+	}
+	return airtime_us(&mod, AIRTIME_LORAWAN_OVERHEAD + size);
+}
+
+/**
+ * @brief Check an uplink against the airtime budget, AT+AIRTIME
+ *
+ * @param size application payload in bytes
+ * @return true if it may be sent
+ */
+bool lorawan_airtime_allowed(uint8_t size)
+{
+	if (airtime_allowed(lorawan_airtime_us(size), g_lorawan_settings.airtime_budget_ms))
+	{
+		return true;
+	}
+	g_airtime_refused++;
+	APP_LOG("LORA", "Airtime budget of %ld ms per hour used up", g_lorawan_settings.airtime_budget_ms);
+	return false;
+}
+
+/**
+ * @brief Account an uplink that was handed to the MAC
+ *
+ * @param size application payload in bytes
+ */
+void lorawan_airtime_sent(uint8_t size)
+{
+	airtime_add(lorawan_airtime_us(size));
 }
 
 /**
@@ -346,6 +783,7 @@ static void lpwan_confirm_tx_finished(bool result)
  */
 lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport)
 {
+	PERF_SCOPE(PERF_SEND);
 	if (lmh_join_status_get() != LMH_SET)
 	{
 		// Not joined, try again later
@@ -364,9 +802,19 @@ lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport)
 		m_lora_app_data.port = g_lorawan_settings.app_port;
 	}
 
+	if (!lorawan_airtime_allowed(size))
+	{
+		return LMH_BUSY;
+	}
+
 	m_lora_app_data.buffsize = size;
 
 	memcpy(m_lora_app_data_buffer, data, size);
 
-	return lmh_send(&m_lora_app_data, g_lorawan_settings.confirmed_msg_enabled);
+	lmh_error_status result = lmh_send(&m_lora_app_data, lorawan_confirm(g_lorawan_settings.confirmed_msg_enabled));
+	if (result == LMH_SUCCESS)
+	{
+		lorawan_airtime_sent(size);
+	}
+	return result;
 }
@@ -9,7 +9,10 @@
  *
  */
 #include "main.h"
-#include "ws8x.h"
+#include "sensor.h"
+#include "backlog.h"
+#include "perf.h"
+#include "schedule.h"
 
 #define LORAWAN_APP_DATA_BUFF_SIZE 64
 static uint8_t m_lora_app_data_buffer[LORAWAN_APP_DATA_BUFF_SIZE];
@@ -18,6 +21,115 @@ static lmh_app_data_t m_lora_app_data = {m_lora_app_data_buffer, 0, 0, 0, 0};
 static bool initialSendDone = false;
 static int send_error_count = 0;
 
+// The sensor diagnostic uplink is sent some time after a report, when its RX windows are closed
+#define DIAG_DELAY_MS 10000
+/** Reports sent since the last diagnostic uplink */
+static uint8_t diag_reports = 0;
+/** Diagnostic uplink is due */
+static bool diag_pending = false;
+/** Time of the report the diagnostic uplink follows */
+static unsigned long diag_report_time = 0;
+
+/** Intervals of the current batch already closed, AT+BATCH */
+static uint8_t batch_ticks = 0;
+
+// Change-only reporting, AT+HEARTBEAT and AT+DEADBAND. The values are
+// compared with the last sent report every DEADBAND_CHECK_MS, leaving a
+// deadband sends the report right away, but not sooner than
+// DEADBAND_MIN_GAP_MS after the one before.
+#define DEADBAND_CHECK_MS 10000
+#define DEADBAND_MIN_GAP_MS 60000
+/** Time of the last report that was sent, for the heartbeat */
+static unsigned long last_report_time = 0;
+/** Time of the last deadband check */
+static unsigned long deadband_check_time = 0;
+/** Report intervals not sent because all values stayed inside their deadband */
+uint32_t g_reports_suppressed = 0;
+/** Reports sent before the end of the interval because a value left its deadband */
+uint32_t g_reports_early = 0;
+
+// Alert uplinks, AT+ALERT. An alert goes out before a periodic report that
+// is due, both keep UPLINK_GAP_MS from the uplink before so its RX windows
+// are closed. A token bucket of ALERT_BURST alerts, refilled at
+// alert_per_hour, keeps a flapping rule from using up the duty cycle.
+#define UPLINK_GAP_MS 5000
+#define ALERT_BURST 3
+/** Alert uplinks that may be sent right now */
+static uint8_t alert_bucket = ALERT_BURST;
+/** Time the bucket was last refilled */
+static unsigned long alert_refill_time = 0;
+/** Time of the last alert uplink */
+static unsigned long alert_time = 0;
+/** Alert uplinks sent since boot */
+uint32_t g_alerts_sent = 0;
+
+// Report uplink, AT+TXSTAT. A failed lmh_send() is tried again without
+// blocking loop(), after REPORT_RETRY_MS, doubled with every try up to
+// REPORT_RETRY_MAX_MS, at most REPORT_TRIES times. An uplink the MAC took is
+// done when it calls back that the TX finished, a confirmed one without ACK
+// is tried again. No call back within REPORT_TX_TIMEOUT_MS counts as failed.
+#define REPORT_TRIES 5
+#define REPORT_RETRY_MS 1000
+#define REPORT_RETRY_MAX_MS 16000
+#define REPORT_TX_TIMEOUT_MS 60000
+enum REPORT_TX_STATE
+{
+	REPORT_IDLE = 0,   // No report uplink pending
+	REPORT_RETRY_WAIT, // lmh_send() failed, waiting for the next try
+	REPORT_IN_FLIGHT   // Taken by the MAC, waiting for TX finished
+};
+/** REPORT_TX_STATE */
+static uint8_t report_state = REPORT_IDLE;
+/** lmh_send() calls for the current report */
+static uint8_t report_tries = 0;
+/** Time the report interval was closed, for the latency */
+static unsigned long report_start_time = 0;
+/** Time of the last try */
+static unsigned long report_try_time = 0;
+/** Wait before the next try */
+static unsigned long report_backoff = 0;
+/** Report uplinks that went out since boot */
+uint32_t g_reports_sent = 0;
+/** Reports given up after REPORT_TRIES since boot */
+uint32_t g_reports_failed = 0;
+/** Tries after the first one since boot */
+uint32_t g_report_retries = 0;
+/** Time from closing the interval to TX finished of the last report, in ms */
+uint32_t g_report_latency_ms = 0;
+/** Longest time from closing the interval to TX finished, in ms */
+uint32_t g_report_latency_max_ms = 0;
+
+// Store-and-forward backlog, AT+BACKLOG. A report that cannot be sent goes
+// to the backlog in flash. While reports go out again the backlog is sent
+// in batches, one uplink every backlog_gap_s, not close to a report.
+/** Time of the last backlog uplink */
+static unsigned long backlog_time = 0;
+
+/** Report decided by a reporting pass */
+enum LOOP_REPORT
+{
+	LOOP_REPORT_NONE = 0,
+	LOOP_REPORT_SKIP,  // All values inside their deadband
+	LOOP_REPORT_SEND,  // Send m_lora_app_data
+	LOOP_REPORT_STORE, // Not joined, m_lora_app_data goes to the backlog
+};
+
+/** What a reporting pass decided under g_app_mutex, done after it is given back */
+struct loop_plan
+{
+	uint8_t alert_size;		// Alert uplink in alert, 0 = none
+	uint8_t alert[LORAWAN_APP_DATA_BUFF_SIZE];
+	bool early;				// A value left its deadband
+	uint8_t report;			// LOOP_REPORT
+	bool first_report;		// The normal send interval starts
+	bool batched;			// m_lora_app_data holds a batch, AT+BATCH
+	uint8_t batch_records;	// Intervals in the batch
+	uint8_t batch_waiting;	// Intervals that did not fit
+	bool backlog;			// Send the oldest backlog records
+	uint8_t diag_size;		// Diagnostic uplink in diag, 0 = none
+	uint8_t diag[LORAWAN_APP_DATA_BUFF_SIZE];
+};
+
 // Main Interval
 //   _____ _   _ _______ ______ _______      __     _
 //  |_   _| \ | |__   __|  ____|  __ \ \    / /\   | |
@@ -32,8 +144,38 @@ static int send_error_count = 0;
 unsigned long lastSendTime = 0;
 unsigned long send_interval_ms = SEND_INTERVAL * 60000;
 
-/** Flag for the event type */
-volatile uint16_t g_task_event_type = NO_EVENT;
+/** Longest reporting pass of loop() since the last reset, in us */
+uint32_t g_loop_max_us = 0;
+/** Duration of the last reporting pass of loop(), in us */
+uint32_t g_loop_last_us = 0;
+
+// Tasks: loop() is the reporting task. The sensor task feeds the drivers as
+// soon as the ingest timer has read bytes, the AT task handles USB and BLE
+// input. LoRaMac runs in the LoRa task of the SX126x library. The tasks wake
+// on task notifications and block otherwise, so the MCU sleeps in the idle
+// task. The code they call was written for a single loop, two mutexes keep
+// their passes apart:
+// - g_app_mutex for the sensor drivers, the settings and the schedule. The
+//   sensor task needs it for every line, so it is only held for decisions
+//   and copies, never across an uplink, a flash write or a print.
+// - g_uplink_mutex for LoRaMac, the backlog and the uplink buffer. The
+//   sensor task never takes it.
+// A task that needs both takes g_uplink_mutex first.
+#define REPORT_WAKE_MS 1000
+#define TASK_STACK_WORDS 1024
+// A full inject buffer of AT+WXFEED is retried after one ingest pass
+#define AT_FEED_RETRY_MS 10
+/** Taken around the sensors, settings and schedule */
+SemaphoreHandle_t g_app_mutex = NULL;
+/** Taken around LoRaMac, the backlog and the uplink buffer, before g_app_mutex */
+SemaphoreHandle_t g_uplink_mutex = NULL;
+/** loop() */
+static TaskHandle_t report_task = NULL;
+/** Sensor lines to the drivers */
+static TaskHandle_t sensor_task = NULL;
+
+/** USB and BLE input for the AT task */
+event_group g_task_events = {NO_EVENT, NULL};
 
 /** Set the device name, max length is 10 characters */
 char g_ble_dev_name[10] = "WS8X";
@@ -46,12 +188,134 @@ uint16_t g_sw_ver_3 = 0; // patch version increase on bugfix, no affect on API
 /** Timer for frequent packet sending */
 time_t last_send;
 
+/**
+ * @brief Wake the reporting task, loop()
+ */
+void report_task_notify(void)
+{
+	if (report_task != NULL)
+	{
+		xTaskNotifyGive(report_task);
+	}
+}
+
+/**
+ * @brief Sensor task, hands the received lines to the drivers
+ *
+ * @param arg unused
+ */
+static void sensor_task_run(void *arg)
+{
+	(void)arg;
+	while (true)
+	{
+		// Woken by the ingest timer
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		xSemaphoreTake(g_app_mutex, portMAX_DELAY);
+		{
+			PERF_SCOPE(PERF_SENSORS);
+			sensors_check();
+		}
+		xSemaphoreGive(g_app_mutex);
+		// New samples may raise an alert
+		report_task_notify();
+	}
+}
+
+/**
+ * @brief AT task, handles AT commands from USB and BLE and BLE settings
+ *
+ * @param arg unused
+ */
+static void at_task_run(void *arg)
+{
+	(void)arg;
+	bool feed_retry = false;
+	while (true)
+	{
+		uint32_t events = events_wait(&g_task_events, BLE_CONFIG | BLE_DATA | AT_CMD, false,
+									  feed_retry ? AT_FEED_RETRY_MS : EVENTS_WAIT_FOREVER);
+		if (feed_retry)
+		{
+			feed_retry = false;
+			events |= AT_CMD;
+		}
+
+		// BLE config characteristic received
+		if ((events & BLE_CONFIG) == BLE_CONFIG)
+		{
+			APP_LOG("LOOP", "Config received over BLE");
+			delay(100);
+
+			// Inform connected device about new settings
+			g_lora_data.write((void *)&g_lorawan_settings, LORAWAN_SETTINGS_BLE_SIZE);
+			g_lora_data.notify((void *)&g_lorawan_settings, LORAWAN_SETTINGS_BLE_SIZE);
+		}
+
+		// A command may send or write flash, the AT task holds both
+		xSemaphoreTake(g_uplink_mutex, portMAX_DELAY);
+		xSemaphoreTake(g_app_mutex, portMAX_DELAY);
+		// BLE UART event (AT commands)
+		if ((events & BLE_DATA) == BLE_DATA)
+		{
+			PERF_SCOPE(PERF_BLE_AT);
+			// Send it to AT command parser
+			while (g_ble_uart.available() > 0)
+			{
+				at_serial_input(uint8_t(g_ble_uart.read()));
+			}
+			at_serial_input(uint8_t('\n'));
+		}
+
+		// Serial input event (AT commands)
+		if ((events & AT_CMD) == AT_CMD)
+		{
+			PERF_SCOPE(PERF_SERIAL_AT);
+			while (Serial.available() > 0)
+			{
+				if (sensors_feeding())
+				{
+					// AT+WXFEED, raw sensor data until Ctrl-D
+					uint8_t data = Serial.peek();
+					if (data == 0x04)
+					{
+						sensors_set_feeding(false);
+					}
+					else if (!sensors_inject(data))
+					{
+						// Ingest is behind, retry after its next pass
+						feed_retry = true;
+						break;
+					}
+					Serial.read();
+					continue;
+				}
+				at_serial_input(uint8_t(Serial.read()));
+			}
+		}
+		xSemaphoreGive(g_app_mutex);
+		xSemaphoreGive(g_uplink_mutex);
+
+		// A command may have changed what is due
+		report_task_notify();
+	}
+}
+
 /**
  * @brief Arduino setup, called once
  *
  */
 void setup(void)
 {
+	// Created first, the BLE and LoRa callbacks can come early
+	g_app_mutex = xSemaphoreCreateMutex();
+	g_uplink_mutex = xSemaphoreCreateMutex();
+
+#ifdef APP_PERF
+	// Profiler, AT+PERF
+	perf_init();
+#endif
+
 	// flash_reset();
 	// Initialize the built in LED
 	pinMode(LED_GREEN, OUTPUT);
@@ -83,6 +347,9 @@ void setup(void)
 	// Get LoRa parameter
 	init_flash();
 
+	// Find the uplinks stored before the reset
+	backlog_init();
+
 	// Enable BLE
 	APP_LOG("SETUP", "Init BLE");
 
@@ -144,120 +411,615 @@ void setup(void)
 		APP_LOG("SETUP", "interval set to:  %d sec", g_lorawan_settings.send_repeat_time/1000 );
 		}
 
-		ws8x_init();
+		sensors_init();
+		apply_sensor_config();
+
+	// First report, AT+SCHED
+	schedule_start();
+
+	// Start the tasks, setup() runs in the task of loop()
+	report_task = xTaskGetCurrentTaskHandle();
+	xTaskCreate(sensor_task_run, "WX", TASK_STACK_WORDS, NULL, TASK_PRIO_LOW, &sensor_task);
+	sensors_set_notify(sensor_task);
+	xTaskCreate(at_task_run, "AT", TASK_STACK_WORDS, NULL, TASK_PRIO_LOW, NULL);
 }
 
 /**
- * @brief Arduino loop
- *
+ * @brief Apply the sensor settings, wind statistics window and payload format
+ *    and plan the next report again
+ *    Called again whenever one of them or the send interval changes
  */
-void loop(void)
+void apply_sensor_config(void)
 {
-	// BLE UART event (AT commands)
-	if ((g_task_event_type & BLE_DATA) == BLE_DATA)
+	uint32_t window_ms = g_lorawan_settings.wind_window_s * 1000UL;
+	if (window_ms == 0)
 	{
-		g_task_event_type &= N_BLE_DATA;
-		// Send it to AT command parser
-		while (g_ble_uart.available() > 0)
+		// One report interval, with batching that is a part of the send interval
+		window_ms = g_lorawan_settings.send_repeat_time;
+		if (g_lorawan_settings.batch_intervals > 1)
 		{
-			at_serial_input(uint8_t(g_ble_uart.read()));
-			delay(5);
+			window_ms /= g_lorawan_settings.batch_intervals;
 		}
-		at_serial_input(uint8_t('\n'));
 	}
+	sensor_config config;
+	config.window_ms = window_ms;
+	config.gust_avg_s = g_lorawan_settings.gust_avg_s;
+	config.payload_format = g_lorawan_settings.payload_format;
+	config.deadband.wind = g_lorawan_settings.deadband_wind;
+	config.deadband.dir = g_lorawan_settings.deadband_dir;
+	config.deadband.temperature = g_lorawan_settings.deadband_temp;
+	config.deadband.voltage = g_lorawan_settings.deadband_volt;
+	config.alert.gust = g_lorawan_settings.alert_gust;
+	config.alert.dir_shift = g_lorawan_settings.alert_dir;
+	config.alert.bat_low = g_lorawan_settings.alert_bat;
+	config.alert.cap_low = g_lorawan_settings.alert_cap;
+	config.idle = g_lorawan_settings.sensor_idle;
+	sensors_configure(&config);
+	schedule_replan();
+}
 
-	// BLE config characteristic received
-	if ((g_task_event_type & BLE_CONFIG) == BLE_CONFIG)
+/**
+ * @brief Refill the alert token bucket and get the alerts that may be sent now
+ *
+ * @return uint8_t alert uplinks allowed right now
+ */
+uint8_t alert_tokens(void)
+{
+	if (g_lorawan_settings.alert_per_hour == 0)
 	{
-		g_task_event_type &= N_BLE_CONFIG;
-		APP_LOG("LOOP", "Config received over BLE");
-		delay(100);
+		return 0;
+	}
+	uint32_t refill_ms = 3600000UL / g_lorawan_settings.alert_per_hour;
+	while (alert_bucket < ALERT_BURST && millis() - alert_refill_time >= refill_ms)
+	{
+		alert_bucket++;
+		alert_refill_time += refill_ms;
+	}
+	if (alert_bucket == ALERT_BURST)
+	{
+		// A full bucket does not collect more
+		alert_refill_time = millis();
+	}
+	return alert_bucket;
+}
 
-		// Inform connected device about new settings
-		g_lora_data.write((void *)&g_lorawan_settings, sizeof(s_lorawan_settings));
-		g_lora_data.notify((void *)&g_lorawan_settings, sizeof(s_lorawan_settings));
+/**
+ * @brief Take the alerts raised by the sensors into the plan, if the rate
+ *    limit allows. Called with g_app_mutex, send_alert() sends them.
+ *
+ * @param plan alert is set, alert_size 0 = nothing to send
+ */
+static void plan_alert(loop_plan *plan)
+{
+	plan->alert_size = 0;
+	if (!initialSendDone || report_state != REPORT_IDLE || millis() - lastSendTime < UPLINK_GAP_MS ||
+		millis() - alert_time < UPLINK_GAP_MS || alert_tokens() == 0)
+	{
+		return;
 	}
+	uint8_t max_payload = lorawan_max_payload();
+	if (max_payload > LORAWAN_APP_DATA_BUFF_SIZE)
+	{
+		max_payload = LORAWAN_APP_DATA_BUFF_SIZE;
+	}
+	memset(plan->alert, 0, sizeof(plan->alert));
+	plan->alert_size = sensors_alert_encode(plan->alert, max_payload);
+	if (plan->alert_size != 0)
+	{
+		alert_time = millis();
+	}
+}
 
-	// Serial input event (AT commands)
-	if ((g_task_event_type & AT_CMD) == AT_CMD)
+/**
+ * @brief Send the alert uplink of the plan
+ *
+ * @param plan alert from plan_alert()
+ */
+static void send_alert(loop_plan *plan)
+{
+	Serial.print("Alert payload bytes: ");
+	for (int i = 0; i < plan->alert_size; i++)
+	{
+		Serial.printf("%02X", plan->alert[i]);
+	}
+	Serial.println();
+	lmh_error_status error = send_lora_packet(plan->alert, plan->alert_size, LORAWAN_ALERT_PORT);
+	if (error != LMH_SUCCESS)
+	{
+		// The alerts stay pending, the next try is after UPLINK_GAP_MS
+		Serial.printf("Alert uplink failed with error code: %d\n", error);
+		return;
+	}
+	xSemaphoreTake(g_app_mutex, portMAX_DELAY);
+	sensors_alerts_sent();
+	xSemaphoreGive(g_app_mutex);
+	alert_bucket--;
+	g_alerts_sent++;
+}
+
+/**
+ * @brief Check if change-only reporting is active, AT+HEARTBEAT
+ *    Batched uplinks always send their intervals, so it is off with AT+BATCH > 1
+ *
+ * @return true if reports may be skipped
+ */
+static bool report_policy_active(void)
+{
+	return initialSendDone && g_lorawan_settings.heartbeat_min != 0 && g_lorawan_settings.batch_intervals <= 1;
+}
+
+/**
+ * @brief Check if the report at the end of this interval can be skipped
+ *    The heartbeat is sent at the last interval that keeps the silence
+ *    within AT+HEARTBEAT, so it is never longer than that.
+ *
+ * @return true if all values are inside their deadband and the heartbeat is not due
+ */
+static bool report_suppressed(void)
+{
+	if (!report_policy_active())
+	{
+		return false;
+	}
+	uint32_t heartbeat_ms = g_lorawan_settings.heartbeat_min * 60000UL;
+	if (millis() - last_report_time + g_lorawan_settings.send_repeat_time > heartbeat_ms)
 	{
-		g_task_event_type &= N_AT_CMD;
-		while (Serial.available() > 0)
+		return false;
+	}
+	return !sensors_changed();
+}
+
+/**
+ * @brief Close the report interval and put it into m_lora_app_data
+ *    Called with g_app_mutex, print_report() shows it afterwards.
+ *
+ * @param batch intervals per uplink, AT+BATCH
+ * @param plan batch fields are set
+ */
+static void build_report(uint8_t batch, loop_plan *plan)
+{
+	PERF_SCOPE(PERF_BUILD);
+	plan->batched = batch > 1;
+	plan->batch_records = 0;
+	plan->batch_waiting = 0;
+	if (plan->batched)
+	{
+		// Close the last interval, then send as many intervals as the data rate allows
+		sensors_batch_add();
+		batch_ticks = 0;
+		uint8_t max_payload = lorawan_max_payload();
+		if (max_payload > LORAWAN_APP_DATA_BUFF_SIZE)
 		{
-			at_serial_input(uint8_t(Serial.read()));
-			delay(5);
+			max_payload = LORAWAN_APP_DATA_BUFF_SIZE;
 		}
+		m_lora_app_data.buffsize = sensors_batch_encode(m_lora_app_data.buffer, max_payload, &plan->batch_records);
+		plan->batch_waiting = sensors_batch_count() - plan->batch_records;
+	}
+	else
+	{
+		memset(m_lora_app_data.buffer, 0, LORAWAN_APP_DATA_BUFF_SIZE);
+		m_lora_app_data.buffsize = sensors_report(m_lora_app_data.buffer, LORAWAN_APP_DATA_BUFF_SIZE);
+	}
+	m_lora_app_data.port = LORAWAN_APP_PORT;
+}
+
+/**
+ * @brief Print the report build_report() put into m_lora_app_data
+ *
+ * @param plan batch fields from build_report()
+ */
+static void print_report(const loop_plan *plan)
+{
+	if (plan->batched)
+	{
+		Serial.printf("Batch of %d intervals, %d waiting, payload bytes: ", plan->batch_records, plan->batch_waiting);
+	}
+	else
+	{
+		Serial.print("Payload bytes: ");
+	}
+	for (int i = 0; i < m_lora_app_data.buffsize; i++)
+	{
+		Serial.printf("%02X", m_lora_app_data.buffer[i]);
+	}
+	Serial.println();
+}
+
+/**
+ * @brief Start the next report interval, the closed one is in m_lora_app_data
+ *
+ * @param batch intervals per uplink, AT+BATCH
+ * @param batch_records intervals in a batched uplink
+ */
+static void report_done(uint8_t batch, uint8_t batch_records)
+{
+	if (batch > 1)
+	{
+		sensors_batch_consume(batch_records); // the intervals are reset already
 	}
+	else
+	{
+		sensors_mark_sent();	  // deadbands are around this report
+		sensors_reset_counters(); // reset the averaging counters.
+	}
+}
 
-	ws8x_checkSerial();
-	// if time to send.  if initialsend yet to happen use interim interval of 60 seconds.
-	if (millis() - lastSendTime >= g_lorawan_settings.send_repeat_time || (!initialSendDone && millis() - lastSendTime >= 60000 ))
+/**
+ * @brief Keep a report that could not be sent in the backlog
+ */
+static void report_to_backlog(void)
+{
+	if (g_lorawan_settings.backlog_gap_s == 0)
+	{
+		Serial.println("Backlog is off, report dropped.");
+	}
+	else
 	{
-		if (lmh_join_status_get() == LMH_SET)
+		sensors_flash_write(true);
+		bool stored = backlog_push(m_lora_app_data.port, m_lora_app_data.buffer, m_lora_app_data.buffsize);
+		sensors_flash_write(false);
+		if (stored)
 		{
+			Serial.printf("Report stored, %d in the backlog\n", backlog_depth());
+		}
+		else
+		{
+			Serial.println("Report could not be stored.");
+		}
+	}
+}
 
-			lastSendTime = millis();
+/**
+ * @brief Give up the report after REPORT_TRIES and keep it in the backlog
+ */
+static void report_failed(void)
+{
+	Serial.println("LoRa data send failed after maximum retries.");
+	report_state = REPORT_IDLE;
+	g_reports_failed++;
+	report_to_backlog();
+	send_error_count++; // reset the error_count on success.
+	if (send_error_count > 5)
+	{
+		// reboot.
+		Serial.println("5 Cycles of send error, Rebooting");
+		NVIC_SystemReset(); // Perform a system reset
+	}
+}
 
-			// After first send, switch to normal interval AT+SENDINT=
-			if (!initialSendDone)
-			{
-				initialSendDone = true;
-				Serial.printf("Switching to normal send interval: %lu minutes\n", g_lorawan_settings.send_repeat_time / 60000);
-			}
+/**
+ * @brief Wait with backoff before the next try of the report
+ */
+static void report_retry(void)
+{
+	if (report_tries >= REPORT_TRIES)
+	{
+		report_failed();
+		return;
+	}
+	report_backoff = REPORT_RETRY_MS << (report_tries - 1);
+	if (report_backoff > REPORT_RETRY_MAX_MS)
+	{
+		report_backoff = REPORT_RETRY_MAX_MS;
+	}
+	Serial.printf("LoRa data send failed. Attempt %d of %d, next in %lu ms\n", report_tries, REPORT_TRIES, report_backoff);
+	report_try_time = millis();
+	report_state = REPORT_RETRY_WAIT;
+}
 
-			ws8x_populate_lora_buffer(&m_lora_app_data, LORAWAN_APP_DATA_BUFF_SIZE);
+/**
+ * @brief Hand the report in m_lora_app_data to the MAC
+ */
+static void report_try(void)
+{
+	report_tries++;
+	if (report_tries > 1)
+	{
+		g_report_retries++;
+	}
+	report_try_time = millis();
+	PERF_SCOPE(PERF_SEND);
+	lmh_error_status error = lmh_send(&m_lora_app_data, lorawan_confirm(LMH_UNCONFIRMED_MSG));
+	if (error == LMH_SUCCESS)
+	{
+		lorawan_airtime_sent(m_lora_app_data.buffsize);
+		report_state = REPORT_IN_FLIGHT;
+		return;
+	}
+	Serial.printf("lmh_send failed with error code: %d\n", error);
+	report_retry();
+}
 
-			m_lora_app_data.port = LORAWAN_APP_PORT;
-			lmh_error_status error;
-			int retryCount = 0;
-			const int maxRetries = 5;
-			do
-			{
-				error = lmh_send(&m_lora_app_data, LMH_UNCONFIRMED_MSG);
-				if (error == LMH_SUCCESS)
-				{
-					Serial.println("LoRa data sent successfully.");
-					send_error_count = 0;  // reset the error_count on success.
-					ws8x_reset_counters(); // reset the averaging counters.
-					break;				   // Exit the loop if the send is successful
-				}
-				else
-				{
-					retryCount++;
-					Serial.printf("lmh_send failed with error code: %d\n", error);
-					Serial.printf("LoRa data send failed. Attempt %d of %d\n", retryCount, maxRetries);
-					delay(1000); // Optional: Add a delay between retries
-				}
-			} while (retryCount < maxRetries);
+/**
+ * @brief The MAC finished the report uplink
+ */
+static void report_sent(void)
+{
+	Serial.println("LoRa data sent successfully.");
+	report_state = REPORT_IDLE;
+	send_error_count = 0; // reset the error_count on success.
+	last_report_time = millis();
+	g_reports_sent++;
+	g_report_latency_ms = millis() - report_start_time;
+	if (g_report_latency_ms > g_report_latency_max_ms)
+	{
+		g_report_latency_max_ms = g_report_latency_ms;
+	}
+	if (g_lorawan_settings.diag_every != 0 && ++diag_reports >= g_lorawan_settings.diag_every)
+	{
+		diag_reports = 0;
+		diag_pending = true;
+		diag_report_time = millis();
+	}
+}
+
+/**
+ * @brief Start sending the report in m_lora_app_data
+ */
+static void report_start(void)
+{
+	report_start_time = millis();
+	report_tries = 0;
+	// Over the airtime budget the report goes to the backlog, it drains within the budget
+	if (!lorawan_airtime_allowed(m_lora_app_data.buffsize))
+	{
+		Serial.println("Airtime budget used up, report goes to the backlog.");
+		report_to_backlog();
+		return;
+	}
+	report_try();
+}
 
-			if (retryCount == maxRetries)
+/**
+ * @brief Advance the report uplink, called from every loop()
+ */
+static void report_process(void)
+{
+	bool acked = false;
+	bool finished = lorawan_tx_finished(&acked);
+	switch (report_state)
+	{
+	case REPORT_RETRY_WAIT:
+		if (millis() - report_try_time >= report_backoff)
+		{
+			report_try();
+		}
+		break;
+	case REPORT_IN_FLIGHT:
+		if (finished)
+		{
+			if (acked)
 			{
-				Serial.println("LoRa data send failed after maximum retries.");
-				send_error_count++; // reset the error_count on success.
-				if (send_error_count > 5)
-				{
-					// reboot.
-					Serial.println("5 Cycles of send error, Rebooting");
-					NVIC_SystemReset(); // Perform a system reset
-				}
+				report_sent();
 			}
+			else
+			{
+				Serial.println("No ACK for the report");
+				report_retry();
+			}
+		}
+		else if (millis() - report_try_time >= REPORT_TX_TIMEOUT_MS)
+		{
+			Serial.println("No TX finished for the report");
+			report_retry();
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Send the oldest backlog records in one uplink, AT+BACKLOG
+ */
+static void send_backlog(void)
+{
+	// Record headers make the uplink larger than a report, use what the data rate allows
+	uint8_t records = 0;
+	uint8_t payload[255];
+	uint8_t size = backlog_encode(payload, lorawan_max_payload(), &records);
+	if (size == 0)
+	{
+		// Not even one record fits at this data rate
+		return;
+	}
+	lmh_error_status error = send_lora_packet(payload, size, LORAWAN_BACKLOG_PORT);
+	if (error != LMH_SUCCESS)
+	{
+		Serial.printf("Backlog uplink failed with error code: %d\n", error);
+		return;
+	}
+	sensors_flash_write(true);
+	backlog_pop(records);
+	sensors_flash_write(false);
+	Serial.printf("Sent %d records from the backlog, %d left\n", records, backlog_depth());
+}
+
+/**
+ * @brief Decide what a reporting pass does, called with g_app_mutex
+ *    Only reads and changes the shared state, the uplinks, flash writes and
+ *    prints that follow are done by loop_act() after g_app_mutex is given.
+ *
+ * @param plan filled with what to do
+ */
+static void loop_plan_pass(loop_plan *plan)
+{
+	plan->early = false;
+	plan->report = LOOP_REPORT_NONE;
+	plan->first_report = false;
+	plan->backlog = false;
+	plan->diag_size = 0;
+
+	// Alert uplinks, AT+ALERT: before anything else that is due. An alert
+	// about to be sent holds the report back until its RX windows are closed.
+	plan_alert(plan);
+	bool alert_hold = millis() - alert_time < UPLINK_GAP_MS;
+
+	// Batched uplinks, AT+BATCH: close the intervals between two sends, the
+	// last one ends with the report wherever slot and jitter put it
+	uint8_t batch = g_lorawan_settings.batch_intervals;
+	if (batch > 1 && initialSendDone && batch_ticks < batch - 1 && schedule_part_due(batch, batch_ticks + 1))
+	{
+		sensors_batch_add();
+		batch_ticks++;
+	}
+
+	// Change-only reporting: a value that leaves its deadband is sent right away
+	if (report_policy_active() && !alert_hold && millis() - deadband_check_time >= DEADBAND_CHECK_MS)
+	{
+		deadband_check_time = millis();
+		if (millis() - lastSendTime >= DEADBAND_MIN_GAP_MS && sensors_changed())
+		{
+			g_reports_early++;
+			plan->early = true;
+		}
+	}
+
+	// if time to send, AT+SCHED
+	if (!alert_hold && report_state == REPORT_IDLE && (plan->early || schedule_due()))
+	{
+		lastSendTime = millis();
+		schedule_next();
+		if (!plan->early && report_suppressed())
+		{
+			// Nothing worth an uplink, start the next interval
+			g_reports_suppressed++;
+			sensors_reset_counters();
+			plan->report = LOOP_REPORT_SKIP;
 		}
 		else
 		{
-			Serial.println("Not joined to the network. Cannot send data.");
-			delay(1000);
-			send_error_count++;
-			Serial.printf("send_error_count : %d", send_error_count);
-			if (send_error_count > 5)
+			plan->report = lmh_join_status_get() == LMH_SET ? LOOP_REPORT_SEND : LOOP_REPORT_STORE;
+			if (plan->report == LOOP_REPORT_SEND && !initialSendDone)
 			{
-				// reboot.
-				Serial.println("No Connection, Rebooting");
-				NVIC_SystemReset(); // Perform a system reset
+				// After first send, switch to normal interval AT+SENDINT=
+				initialSendDone = true;
+				plan->first_report = true;
 			}
+			build_report(batch, plan);
+			report_done(batch, plan->batch_records);
 		}
 	}
 
-	yield();
+	// Store-and-forward backlog, AT+BACKLOG: drain while the reports go out, not close to one
+	if (g_lorawan_settings.backlog_gap_s != 0 && backlog_depth() != 0 && send_error_count == 0 && !diag_pending && !alert_hold &&
+		report_state == REPORT_IDLE &&
+		lmh_join_status_get() == LMH_SET && millis() - lastSendTime >= UPLINK_GAP_MS &&
+		schedule_wait_ms() > UPLINK_GAP_MS &&
+		millis() - backlog_time >= g_lorawan_settings.backlog_gap_s * 1000UL)
+	{
+		backlog_time = millis();
+		plan->backlog = true;
+	}
+
+	// Sensor diagnostic uplink, AT+WXDIAG, not in the pass that starts a report
+	if (diag_pending && report_state == REPORT_IDLE && plan->report != LOOP_REPORT_SEND &&
+		(millis() - diag_report_time >= DIAG_DELAY_MS))
+	{
+		diag_pending = false;
+		plan->diag_size = sensors_health_encode(plan->diag, sizeof(plan->diag));
+	}
+}
+
+/**
+ * @brief Do what loop_plan_pass() decided, called with g_uplink_mutex only
+ *
+ * @param plan decisions of the pass
+ */
+static void loop_act(loop_plan *plan)
+{
+	if (plan->alert_size != 0)
+	{
+		send_alert(plan);
+	}
+	if (plan->early)
+	{
+		Serial.println("Value left its deadband, sending report");
+	}
+
+	switch (plan->report)
+	{
+	case LOOP_REPORT_SKIP:
+		Serial.println("All values inside their deadband, report skipped");
+		break;
+	case LOOP_REPORT_SEND:
+		if (plan->first_report)
+		{
+			Serial.printf("Switching to normal send interval: %lu minutes\n", g_lorawan_settings.send_repeat_time / 60000);
+		}
+		Serial.printf("Loop stall max: %lu us\n", g_loop_max_us);
+		print_report(plan);
+		report_start();
+		break;
+	case LOOP_REPORT_STORE:
+		Serial.println("Not joined to the network. Cannot send data.");
+		// Keep the report, the next try is with the next interval
+		print_report(plan);
+		report_to_backlog();
+		send_error_count++;
+		Serial.printf("send_error_count : %d", send_error_count);
+		if (send_error_count > 5)
+		{
+			// reboot.
+			Serial.println("No Connection, Rebooting");
+			NVIC_SystemReset(); // Perform a system reset
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (plan->backlog)
+	{
+		send_backlog();
+	}
+
+	if (plan->diag_size != 0 &&
+		send_lora_packet(plan->diag, plan->diag_size, LORAWAN_DIAG_PORT) != LMH_SUCCESS)
+	{
+		Serial.println("Sensor diagnostic uplink failed");
+	}
+}
+
+/**
+ * @brief Arduino loop
+ *    LoRaMac work comes first, then the decisions of the pass are taken
+ *    under g_app_mutex and carried out after it is given back.
+ */
+void loop(void)
+{
+	// Decisions of the pass, too large for the task stack
+	static loop_plan plan;
+
+	// Sleep until a task or callback has something for the reporting, or the next check is due
+	ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(REPORT_WAKE_MS));
+	xSemaphoreTake(g_uplink_mutex, portMAX_DELAY);
+
+	// The network did not answer a session restored from flash, join again
+	if (lorawan_session_rejected())
+	{
+		init_lorawan(true);
+	}
+
+	// Retries of the report uplink
+	report_process();
+
+	xSemaphoreTake(g_app_mutex, portMAX_DELAY);
+	uint32_t start_us = micros();
+	{
+		PERF_SCOPE(PERF_LOOP);
+		loop_plan_pass(&plan);
+	}
+	// How long this pass kept the sensor task waiting
+	g_loop_last_us = micros() - start_us;
+	if (g_loop_last_us > g_loop_max_us)
+	{
+		g_loop_max_us = g_loop_last_us;
+	}
+	xSemaphoreGive(g_app_mutex);
+
+	loop_act(&plan);
+	xSemaphoreGive(g_uplink_mutex);
 }
 
 uint8_t boardGetBatteryLevel(void)
@@ -38,14 +38,15 @@
 #endif
 
 /** Wake up events, more events can be defined in app.h */
+#include "events.h"
 #define NO_EVENT 0
 #define BLE_CONFIG 0b0000000000000010
-#define N_BLE_CONFIG 0b1111111111111101
 #define BLE_DATA 0b0000000000000100
-#define N_BLE_DATA 0b1111111111111011
 #define AT_CMD 0b0000000000100000
-#define N_AT_CMD 0b1111111111011111
-extern volatile uint16_t g_task_event_type;
+extern event_group g_task_events;
+void report_task_notify(void);
+extern SemaphoreHandle_t g_app_mutex;
+extern SemaphoreHandle_t g_uplink_mutex;
 
 // BLE
 #include <bluefruit.h>
@@ -60,9 +61,32 @@ extern char g_ble_dev_name[];
 int8_t init_lora(void);
 int8_t init_lorawan(bool region_change = false);
 bool send_p2p_packet(uint8_t *data, uint8_t size);
+void lora_p2p_config(bool rx_continuous);
+void lora_p2p_start(uint32_t start_us);
 lmh_error_status send_lora_packet(uint8_t *data, uint8_t size, uint8_t fport = 1);
+uint8_t lorawan_max_payload(void);
+uint32_t lorawan_airtime_us(uint8_t size);
+bool lorawan_airtime_allowed(uint8_t size);
+void lorawan_airtime_sent(uint8_t size);
+uint32_t lora_p2p_airtime_us(uint8_t size);
+uint8_t lorawan_max_subband(uint8_t region);
+void lorawan_join(void);
+lmh_confirm lorawan_confirm(lmh_confirm requested);
+bool lorawan_session_rejected(void);
+bool lorawan_tx_finished(bool *acked);
+uint8_t lorawan_session_state(void);
+uint32_t lorawan_uplink_counter(void);
+extern uint32_t g_airtime_refused;
+extern uint32_t g_join_time_ms;
+extern uint32_t g_first_uplink_ms;
+#define LORAWAN_DIAG_PORT 20 // fPort of the sensor diagnostic uplink
+#define LORAWAN_ALERT_PORT 21 // fPort of the alert uplink
+#define LORAWAN_BACKLOG_PORT 22 // fPort of the store-and-forward backlog uplink
+#define LORAWAN_TIME_PORT 23 // fPort of the time downlink, Unix time in s, 4 bytes LE
 
 #define LORAWAN_DATA_MARKER 0x55
+// 1: LoRaWAN parameters are taken from the settings instead of fixed values in init_lorawan()
+#define LORAWAN_SETTINGS_VERSION 1
 struct s_lorawan_settings
 {
 	uint8_t valid_mark_1 = 0xAA;				// Just a marker for the Flash
@@ -97,7 +121,7 @@ struct s_lorawan_settings
 	uint8_t data_rate = 2;
 	// LoRaWAN class 0: A, 2: C, 1: B is not supported
 	uint8_t lora_class = 0;
-	// Subband channel selection 1 .. 9
+	// Subband channel selection 1 .. 9, 0 = channel plan of the LoRaWAN stack
 	uint8_t subband_channels = 1;
 	// Flag if node joins automatically after reboot
 	bool auto_join = true;
@@ -105,8 +129,8 @@ struct s_lorawan_settings
 	uint8_t app_port = 2;
 	// Flag to enable confirmed messages
 	lmh_confirm confirmed_msg_enabled = LMH_UNCONFIRMED_MSG;
-	// Fixed LoRaWAN lorawan_region (depends on compiler option)
-	uint8_t lora_region = 1;
+	// LoRaWAN region, LoRaMacRegion_t
+	uint8_t lora_region = LORAMAC_REGION_US915;
 	// Flag for LoRaWAN or LoRa P2P
 	bool lorawan_enable = true;
 	// Frequency in Hz
@@ -125,6 +149,102 @@ struct s_lorawan_settings
 	uint16_t p2p_symbol_timeout = 0;
 	// Command from BLE to reset device
 	bool resetRequest = true;
+	// Everything from here on is not part of the BLE settings characteristic,
+	// which keeps the layout WisBlock Toolbox knows. Aligned like the whole
+	// structure, so the first field starts at the legacy size and a legacy
+	// file or BLE write never reaches into it.
+	// Wind statistics window in seconds, 0 = same as the send interval
+	alignas(uint32_t) uint16_t wind_window_s = 0;
+	// Gust running mean time in seconds, 0 = gust reported by the sensor
+	uint8_t gust_avg_s = 0;
+	// Send a sensor diagnostic uplink every n-th report, 0 = never
+	uint8_t diag_every = 0;
+	// Uplink format 0 = legacy 16 bit values, 1 = bit packed with version byte
+	uint8_t payload_format = 0;
+	// Intervals per batched uplink 1 .. 15, 1 = no batching
+	uint8_t batch_intervals = 1;
+	// Change-only reporting: longest time without a report in minutes, 0 = report every interval
+	uint16_t heartbeat_min = 0;
+	// Deadbands of change-only reporting: wind speed, gust and lull in 0.1 m/s
+	uint16_t deadband_wind = 10;
+	// Wind direction in deg
+	uint16_t deadband_dir = 20;
+	// Temperature in 0.1 °C
+	uint16_t deadband_temp = 5;
+	// Battery and capacitor voltage in 0.01 V
+	uint16_t deadband_volt = 10;
+	// Alert uplinks, 0 = rule off: gust above, in 0.1 m/s
+	uint16_t alert_gust = 0;
+	// Mean wind direction shift against the last report in deg
+	uint16_t alert_dir = 0;
+	// Battery voltage below, in 0.01 V
+	uint16_t alert_bat = 0;
+	// Capacitor voltage below, in 0.01 V
+	uint16_t alert_cap = 0;
+	// Most alert uplinks per hour, 0 = no alert uplinks
+	uint8_t alert_per_hour = 6;
+	// Airtime allowed in any hour in ms, 0 = no limit. 36 s is the 1 % duty cycle of EU868
+	uint32_t airtime_budget_ms = 36000;
+	// Layout version of this structure, older files are migrated in init_flash()
+	uint8_t settings_version = LORAWAN_SETTINGS_VERSION;
+	// Seconds between two backlog uplinks, 0 = unsent reports are dropped
+	uint16_t backlog_gap_s = 30;
+	// Report schedule: align the intervals to the wall clock once it is known
+	bool schedule_align = false;
+	// Send in a slot of the interval derived from the DevEUI
+	bool schedule_slot = true;
+	// Random delay added to every report in s, at most a quarter of the interval
+	uint16_t schedule_jitter_s = 10;
+	// Stop polling the sensor UARTs while they are silent, wake on RX
+	bool sensor_idle = true;
+};
+
+/** Part of s_lorawan_settings exchanged over BLE, the legacy layout */
+#define LORAWAN_SETTINGS_BLE_SIZE offsetof(s_lorawan_settings, wind_window_s)
+
+#define LORAWAN_SESSION_MARKER 0x5E
+/** Layout of s_lorawan_session, a stored session of another version is dropped */
+#define LORAWAN_SESSION_VERSION 2
+/** Channels kept with the session, the most a region with a channel list has */
+#define LORAWAN_SESSION_CHANNELS 16
+/** Words of the channel mask, the most a region uses */
+#define LORAWAN_SESSION_MASK_WORDS 6
+/** OTAA session kept in flash, so a reset does not need a join */
+struct s_lorawan_session
+{
+	uint8_t valid_mark = LORAWAN_SESSION_MARKER;
+	uint8_t session_version = LORAWAN_SESSION_VERSION;
+	// Region and credentials the session was joined with
+	uint8_t region = 0;
+	uint8_t node_device_eui[8] = {0};
+	uint8_t node_app_eui[8] = {0};
+	uint8_t node_app_key[16] = {0};
+	// Session from the join accept
+	uint32_t dev_addr = 0;
+	uint8_t nws_key[16] = {0};
+	uint8_t apps_key[16] = {0};
+	// Frame counters when the session was written
+	uint32_t fcnt_up = 0;
+	uint32_t fcnt_down = 0;
+	// MAC state from the join accept and the MAC commands after it
+	uint32_t rx1_delay_ms = 0;
+	uint32_t rx2_delay_ms = 0;
+	uint8_t rx1_dr_offset = 0;
+	uint32_t rx2_frequency = 0;
+	uint8_t rx2_datarate = 0;
+	int8_t datarate = 0;
+	uint16_t channels_mask[LORAWAN_SESSION_MASK_WORDS] = {0};
+	// CFList and NewChannelReq channels, frequency 0 = not used
+	uint32_t channel_frequency[LORAWAN_SESSION_CHANNELS] = {0};
+	uint32_t channel_rx1_frequency[LORAWAN_SESSION_CHANNELS] = {0};
+	int8_t channel_dr_range[LORAWAN_SESSION_CHANNELS] = {0};
+};
+
+enum LORAWAN_SESSION_STATE
+{
+	SESSION_NONE = 0,	  // No session, or joining
+	SESSION_RESTORED = 1, // Restored from flash, no answer from the network yet
+	SESSION_ACTIVE = 2	  // Joined, or restored and answered by the network
 };
 
 extern s_lorawan_settings g_lorawan_settings;
@@ -138,15 +258,8 @@ extern int16_t g_last_rssi;
 extern int8_t g_last_snr;
 extern bool g_rx_fin_result;
 
-enum P2P_RX_MODE
-{
-	RX_MODE_NONE = 0,
-	RX_MODE_RX = 1,
-	RX_MODE_RX_TIMED = 2,
-	RX_MODE_RX_WAIT = 3
-};
-extern uint8_t g_lora_p2p_rx_mode;
-extern uint32_t g_lora_p2p_rx_time;
+#include "p2p.h"
+#include "radio_cfg.h"
 extern bool g_rx_continuous;
 
 
@@ -154,6 +267,9 @@ extern bool g_rx_continuous;
 void init_flash(void);
 bool save_settings(void);
 void flash_reset(void);
+bool load_session(s_lorawan_session *session);
+bool save_session(const s_lorawan_session *session);
+void clear_session(void);
 extern bool init_flash_done;
 
 // Battery
@@ -220,4 +336,20 @@ extern uint16_t g_sw_ver_2; // minor version increase on API change / backward c
 extern uint16_t g_sw_ver_3; // patch version increase on bugfix, no affect on API
 extern uint8_t g_last_fport;
 
+// Sensor
+void apply_sensor_config(void);
+extern uint32_t g_reports_suppressed;
+extern uint32_t g_reports_early;
+extern uint32_t g_alerts_sent;
+extern uint32_t g_reports_sent;
+extern uint32_t g_reports_failed;
+extern uint32_t g_report_retries;
+extern uint32_t g_report_latency_ms;
+extern uint32_t g_report_latency_max_ms;
+uint8_t alert_tokens(void);
+
+// Reporting pass timing
+extern uint32_t g_loop_max_us;
+extern uint32_t g_loop_last_us;
+
 
@@ -0,0 +1,184 @@
+/**
+ * @file p2p.cpp
+ * @brief Table driven LoRa P2P radio state machine with a transition trace
+ * @version 0.1
+ * @date 2025-06-25
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "p2p.h"
+
+uint8_t g_lora_p2p_rx_mode = RX_MODE_NONE;
+uint32_t g_lora_p2p_rx_time = 0;
+
+/**
+ * Radio action per event and RX mode. After a send, RX_WAIT listens for
+ * the answer and RX_TIMED listens for its time again; after anything else
+ * only continuous RX goes on listening. A free channel always sends.
+ */
+static const uint8_t transitions[P2P_EVENTS][P2P_MODES] = {
+	//                      NONE               RX              RX_TIMED             RX_WAIT
+	/* START      */ {P2P_ACTION_SLEEP, P2P_ACTION_RX, P2P_ACTION_RX_TIMED, P2P_ACTION_RX},
+	/* TX_DONE    */ {P2P_ACTION_SLEEP, P2P_ACTION_RX, P2P_ACTION_RX_TIMED, P2P_ACTION_RX},
+	/* RX_DONE    */ {P2P_ACTION_SLEEP, P2P_ACTION_RX, P2P_ACTION_SLEEP, P2P_ACTION_SLEEP},
+	/* TX_TIMEOUT */ {P2P_ACTION_SLEEP, P2P_ACTION_RX, P2P_ACTION_SLEEP, P2P_ACTION_SLEEP},
+	/* RX_TIMEOUT */ {P2P_ACTION_SLEEP, P2P_ACTION_RX, P2P_ACTION_SLEEP, P2P_ACTION_SLEEP},
+	/* RX_ERROR   */ {P2P_ACTION_SLEEP, P2P_ACTION_RX, P2P_ACTION_SLEEP, P2P_ACTION_SLEEP},
+	/* CAD_BUSY   */ {P2P_ACTION_SLEEP, P2P_ACTION_RX, P2P_ACTION_SLEEP, P2P_ACTION_SLEEP},
+	/* CAD_FREE   */ {P2P_ACTION_SEND, P2P_ACTION_SEND, P2P_ACTION_SEND, P2P_ACTION_SEND},
+};
+
+/** Names for AT+P2PTRACE, in enum order */
+static const char *const eventNames[P2P_EVENTS] = {"start", "tx_done", "rx_done", "tx_timeout",
+												   "rx_timeout", "rx_error", "cad_busy", "cad_free"};
+static const char *const actionNames[] = {"sleep", "rx", "rx_timed", "send"};
+
+/** Packet sent on a free channel */
+static uint8_t *txData = NULL;
+static uint8_t txSize = 0;
+
+/** Trace ring, traceHead is the next entry written */
+static p2p_trace_entry trace[P2P_TRACE_SIZE];
+static uint8_t traceHead = 0;
+static uint8_t traceCount = 0;
+/** Timing per transition */
+static p2p_transition_stats stats[P2P_EVENTS][P2P_MODES];
+
+/**
+ * @brief Set up the radio for the next step after an event
+ *
+ * @param event radio event
+ * @param event_us micros() when the event came in
+ * @return p2p_action what the radio does now
+ */
+p2p_action p2p_handle(p2p_event event, uint32_t event_us)
+{
+	uint8_t mode = RX_MODE_NONE;
+	if (g_lora_p2p_rx_mode < P2P_MODES)
+	{
+		mode = g_lora_p2p_rx_mode;
+	}
+	p2p_action action = (p2p_action)transitions[event][mode];
+
+	switch (action)
+	{
+	case P2P_ACTION_SLEEP:
+		Radio.Sleep();
+		break;
+	case P2P_ACTION_RX:
+		Radio.Rx(0);
+		break;
+	case P2P_ACTION_RX_TIMED:
+		Radio.Rx(g_lora_p2p_rx_time);
+		break;
+	case P2P_ACTION_SEND:
+		Radio.Send(txData, txSize);
+		break;
+	}
+	uint32_t latency_us = micros() - event_us;
+
+	p2p_trace_entry *entry = &trace[traceHead];
+	entry->time_ms = millis();
+	entry->event = event;
+	entry->mode = mode;
+	entry->action = action;
+	entry->latency_us = latency_us;
+	traceHead = (traceHead + 1) % P2P_TRACE_SIZE;
+	if (traceCount < P2P_TRACE_SIZE)
+	{
+		traceCount++;
+	}
+
+	p2p_transition_stats *transition = &stats[event][mode];
+	transition->count++;
+	transition->last_us = latency_us;
+	if (latency_us > transition->max_us)
+	{
+		transition->max_us = latency_us;
+	}
+	return action;
+}
+
+/**
+ * @brief Set the packet sent when CAD finds the channel free
+ *
+ * @param data payload, must stay valid until the send
+ * @param size payload size
+ */
+void p2p_set_packet(uint8_t *data, uint8_t size)
+{
+	txData = data;
+	txSize = size;
+}
+
+/**
+ * @brief Transitions in the trace
+ *
+ * @return uint8_t number of entries
+ */
+uint8_t p2p_trace_count(void)
+{
+	return traceCount;
+}
+
+/**
+ * @brief Get a transition from the trace
+ *
+ * @param idx 0 = oldest
+ * @param entry filled with the transition
+ * @return true if there is such an entry
+ */
+bool p2p_trace_get(uint8_t idx, p2p_trace_entry *entry)
+{
+	if (idx >= traceCount)
+	{
+		return false;
+	}
+	*entry = trace[(traceHead + P2P_TRACE_SIZE - traceCount + idx) % P2P_TRACE_SIZE];
+	return true;
+}
+
+/**
+ * @brief Get the timing of one transition
+ *
+ * @param event radio event
+ * @param mode RX mode
+ * @param out filled with the counters since the last reset
+ */
+void p2p_stats_get(p2p_event event, uint8_t mode, p2p_transition_stats *out)
+{
+	*out = stats[event][mode];
+}
+
+/**
+ * @brief Clear the trace and the timing
+ */
+void p2p_trace_reset(void)
+{
+	traceHead = 0;
+	traceCount = 0;
+	memset(stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Name of an event
+ *
+ * @param event p2p_event
+ * @return const char* name
+ */
+const char *p2p_event_name(uint8_t event)
+{
+	return (event < P2P_EVENTS) ? eventNames[event] : "?";
+}
+
+/**
+ * @brief Name of an action
+ *
+ * @param action p2p_action
+ * @return const char* name
+ */
+const char *p2p_action_name(uint8_t action)
+{
+	return (action <= P2P_ACTION_SEND) ? actionNames[action] : "?";
+}
@@ -0,0 +1,85 @@
+/**
+ * @file p2p.h
+ * @brief Table driven LoRa P2P radio state machine with a transition trace
+ * @version 0.1
+ * @date 2025-06-25
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef P2P_H
+#define P2P_H
+#include <Arduino.h>
+#include <LoRaWan-Arduino.h>
+
+// The state is the RX mode of AT+PRECV. Every radio event looks up what
+// the radio does next in one table, keyed by event and state. Only the
+// Radio driver is used here, so the table can be run on a host against a
+// simulated Radio. Each transition is kept in a trace ring with the time
+// from the radio event to the radio being set up again.
+
+/** P2P RX modes, AT+PRECV */
+enum P2P_RX_MODE
+{
+	RX_MODE_NONE = 0,
+	RX_MODE_RX = 1,
+	RX_MODE_RX_TIMED = 2,
+	RX_MODE_RX_WAIT = 3
+};
+#define P2P_MODES 4
+extern uint8_t g_lora_p2p_rx_mode;
+extern uint32_t g_lora_p2p_rx_time;
+
+/** Radio events */
+enum p2p_event
+{
+	P2P_EVENT_START,	  // Radio set up or RX mode changed
+	P2P_EVENT_TX_DONE,	  // Packet sent
+	P2P_EVENT_RX_DONE,	  // Packet received
+	P2P_EVENT_TX_TIMEOUT, // Packet not sent
+	P2P_EVENT_RX_TIMEOUT, // Nothing received
+	P2P_EVENT_RX_ERROR,	  // Packet with CRC error
+	P2P_EVENT_CAD_BUSY,	  // Channel busy before a send
+	P2P_EVENT_CAD_FREE,	  // Channel free before a send
+	P2P_EVENTS
+};
+
+/** What the radio does after an event */
+enum p2p_action
+{
+	P2P_ACTION_SLEEP,	 // Sleep, no RX
+	P2P_ACTION_RX,		 // Continuous RX
+	P2P_ACTION_RX_TIMED, // RX for g_lora_p2p_rx_time ms
+	P2P_ACTION_SEND,	 // Send the packet of p2p_set_packet()
+};
+
+#define P2P_TRACE_SIZE 32
+
+/** One transition in the trace */
+struct p2p_trace_entry
+{
+	uint32_t time_ms;	 // millis() of the event
+	uint8_t event;		 // p2p_event
+	uint8_t mode;		 // P2P_RX_MODE
+	uint8_t action;		 // p2p_action
+	uint32_t latency_us; // From the event to the radio set up again
+};
+
+/** Timing of one transition since the last reset */
+struct p2p_transition_stats
+{
+	uint32_t count;
+	uint32_t last_us;
+	uint32_t max_us;
+};
+
+p2p_action p2p_handle(p2p_event event, uint32_t event_us);
+void p2p_set_packet(uint8_t *data, uint8_t size);
+uint8_t p2p_trace_count(void);
+bool p2p_trace_get(uint8_t idx, p2p_trace_entry *entry);
+void p2p_stats_get(p2p_event event, uint8_t mode, p2p_transition_stats *stats);
+void p2p_trace_reset(void);
+const char *p2p_event_name(uint8_t event);
+const char *p2p_action_name(uint8_t action);
+
+#endif
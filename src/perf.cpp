@@ -0,0 +1,106 @@
+/**
+ * @file perf.cpp
+ * @brief Latency profiler with named scopes on the DWT cycle counter
+ * @version 0.1
+ * @date 2025-06-18
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "perf.h"
+
+#ifdef APP_PERF
+/** Scope names for AT+PERF, in perf_id order */
+static const char *perf_names[PERF_SCOPES] = {"loop", "ingest", "sensors", "ble_at", "serial_at", "build", "send"};
+
+/** Timings per scope */
+static perf_stats stats[PERF_SCOPES];
+
+/**
+ * @brief Start the DWT cycle counter
+ */
+void perf_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	perf_reset();
+}
+
+/**
+ * @brief Account one pass through a scope
+ *    Scopes of different tasks can be left at the same time, a lost
+ *    count is accepted to keep this short.
+ *
+ * @param id scope
+ * @param cycles time in the scope
+ */
+void perf_add(perf_id id, uint32_t cycles)
+{
+	perf_stats *scope = &stats[id];
+	scope->count++;
+	if (cycles > scope->max_cycles)
+	{
+		scope->max_cycles = cycles;
+	}
+	scope->buckets[cycles == 0 ? 0 : 31 - __builtin_clz(cycles)]++;
+}
+
+/**
+ * @brief Clear the timings of all scopes
+ */
+void perf_reset(void)
+{
+	memset(stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Name of a scope
+ *
+ * @param id scope
+ * @return const char* name
+ */
+const char *perf_name(perf_id id)
+{
+	return perf_names[id];
+}
+
+/**
+ * @brief Get the timings of a scope
+ *    The 99th percentile is the upper end of the bucket it falls into,
+ *    so it is at most twice the real one.
+ *
+ * @param id scope
+ * @param out filled with the counters and histogram
+ * @param p99_us 99th percentile in us
+ * @param max_us longest pass in us
+ */
+void perf_get(perf_id id, perf_stats *out, uint32_t *p99_us, uint32_t *max_us)
+{
+	uint32_t cycles_per_us = SystemCoreClock / 1000000;
+	*out = stats[id];
+	*max_us = out->max_cycles / cycles_per_us;
+	*p99_us = 0;
+	if (out->count == 0)
+	{
+		return;
+	}
+
+	uint32_t rank = (uint32_t)(((uint64_t)out->count * 99 + 99) / 100);
+	uint32_t seen = 0;
+	for (int bucket = 0; bucket < PERF_BUCKETS; bucket++)
+	{
+		seen += out->buckets[bucket];
+		if (seen >= rank)
+		{
+			uint64_t upper = (2ULL << bucket) - 1;
+			if (upper > out->max_cycles)
+			{
+				upper = out->max_cycles;
+			}
+			*p99_us = (uint32_t)(upper / cycles_per_us);
+			return;
+		}
+	}
+}
+#endif
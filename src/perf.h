@@ -0,0 +1,93 @@
+/**
+ * @file perf.h
+ * @brief Latency profiler with named scopes on the DWT cycle counter
+ * @version 0.1
+ * @date 2025-06-18
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef PERF_H
+#define PERF_H
+#include <Arduino.h>
+
+// Build with -D APP_PERF to profile, without it PERF_SCOPE() is empty and
+// AT+PERF does not exist. A scope reads the DWT cycle counter when it is
+// entered and when it is left, the cycles go into a histogram with one
+// bucket per power of two. The counter stops while the CPU sleeps and runs
+// on while other tasks run, so a scope must not block. A scope that calls
+// something blocking is opened with PERF_SCOPE_TIMER() and leaves that part
+// out with PERF_PAUSE().
+
+/** Profiled scopes */
+enum perf_id
+{
+	PERF_LOOP,		// Reporting pass of loop(), without uplinks, flash and prints
+	PERF_INGEST,	// Ingest timer, reading the sensor UARTs
+	PERF_SENSORS,	// sensors_check(), lines to the drivers
+	PERF_BLE_AT,	// BLE UART to the AT parser
+	PERF_SERIAL_AT, // USB serial to the AT parser
+	PERF_BUILD,		// Report payload
+	PERF_SEND,		// Handing an uplink to the MAC
+	PERF_SCOPES
+};
+
+/** Histogram buckets, bucket n counts [2^n, 2^(n+1)) cycles */
+#define PERF_BUCKETS 32
+
+/** Timings of one scope */
+struct perf_stats
+{
+	uint32_t count;					 // Times the scope was left
+	uint32_t max_cycles;			 // Longest
+	uint32_t buckets[PERF_BUCKETS]; // log2 histogram
+};
+
+#ifdef APP_PERF
+void perf_init(void);
+void perf_add(perf_id id, uint32_t cycles);
+void perf_reset(void);
+const char *perf_name(perf_id id);
+void perf_get(perf_id id, perf_stats *stats, uint32_t *p99_us, uint32_t *max_us);
+
+/** Times its own lifetime into a scope, without the paused parts */
+class perf_timer
+{
+public:
+	perf_timer(perf_id id) : paused(0), id(id), start(DWT->CYCCNT) {}
+	~perf_timer() { perf_add(id, DWT->CYCCNT - start - paused); }
+
+	uint32_t paused; // Cycles of the perf_pause inside
+
+private:
+	perf_id id;
+	uint32_t start;
+};
+
+/** Leaves its own lifetime out of a perf_timer */
+class perf_pause
+{
+public:
+	perf_pause(perf_timer &timer) : timer(timer), start(DWT->CYCCNT) {}
+	~perf_pause() { timer.paused += DWT->CYCCNT - start; }
+
+private:
+	perf_timer &timer;
+	uint32_t start;
+};
+
+#define PERF_CONCAT2(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT2(a, b)
+/** Time the rest of the enclosing block */
+#define PERF_SCOPE(id) perf_timer PERF_CONCAT(perf_timer_, __LINE__)(id)
+/** Time the rest of the enclosing block as timer, parts can be paused */
+#define PERF_SCOPE_TIMER(timer, id) perf_timer timer(id)
+/** Leave the rest of the enclosing block out of timer */
+#define PERF_PAUSE(timer) perf_pause PERF_CONCAT(perf_pause_, __LINE__)(timer)
+#else
+#define PERF_SCOPE(id)
+#define PERF_SCOPE_TIMER(timer, id)
+#define PERF_PAUSE(timer)
+#endif
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * @file radio_cfg.cpp
+ * @brief Shadow of the LoRa P2P radio configuration, skips unchanged setups
+ * @version 0.1
+ * @date 2025-06-26
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "radio_cfg.h"
+#include <LoRaWan-Arduino.h>
+
+/** Configuration last written to the radio */
+static radio_p2p_config shadow;
+
+/** Parts of the shadow that match the radio */
+static bool shadow_valid[RADIO_CFG_PARTS] = {false};
+
+static radio_cfg_stats cfg_stats;
+
+static const char *const part_names[RADIO_CFG_PARTS] = {"channel", "tx", "rx"};
+
+/**
+ * @brief Count a part and tell whether it must be sent
+ *
+ * @param part configuration part
+ * @param changed its values differ from the shadow
+ * @return true send it to the radio
+ */
+static bool radio_cfg_needed(radio_cfg_part part, bool changed)
+{
+	if (shadow_valid[part] && !changed)
+	{
+		cfg_stats.skipped[part]++;
+		return false;
+	}
+	cfg_stats.sent[part]++;
+	shadow_valid[part] = true;
+	return true;
+}
+
+/**
+ * @brief Set up the radio for LoRa P2P, only the parts that changed are sent
+ *    The radio must be in sleep or standby
+ *
+ * @param config modem parameters
+ */
+void radio_cfg_apply(const radio_p2p_config *config)
+{
+	uint32_t start_us = micros();
+
+	// Modulation and packet parameters are part of both TX and RX setup
+	bool modem = (config->bandwidth != shadow.bandwidth) || (config->sf != shadow.sf) ||
+				 (config->cr != shadow.cr) || (config->preamble_len != shadow.preamble_len);
+	bool channel = radio_cfg_needed(RADIO_CFG_CHANNEL, config->frequency != shadow.frequency);
+	bool tx = radio_cfg_needed(RADIO_CFG_TX, modem || (config->tx_power != shadow.tx_power));
+	bool rx = radio_cfg_needed(RADIO_CFG_RX, tx || (config->symbol_timeout != shadow.symbol_timeout) ||
+												 (config->rx_continuous != shadow.rx_continuous));
+
+	if (channel)
+	{
+		Radio.SetChannel(config->frequency);
+	}
+	if (tx)
+	{
+		Radio.SetTxConfig(MODEM_LORA, config->tx_power, 0, config->bandwidth,
+						  config->sf, config->cr,
+						  config->preamble_len, false,
+						  true, 0, 0, false, 5000);
+	}
+	if (rx)
+	{
+		Radio.SetRxConfig(MODEM_LORA, config->bandwidth, config->sf,
+						  config->cr, 0, config->preamble_len,
+						  config->symbol_timeout, false,
+						  0, true, 0, 0, false, config->rx_continuous);
+	}
+	shadow = *config;
+
+	cfg_stats.last_us = micros() - start_us;
+	if (cfg_stats.last_us > cfg_stats.max_us)
+	{
+		cfg_stats.max_us = cfg_stats.last_us;
+	}
+}
+
+/**
+ * @brief Forget the shadow, the next radio_cfg_apply() sends everything
+ *    Call it after the SX1262 was reset or the LoRaWAN MAC used it
+ */
+void radio_cfg_invalidate(void)
+{
+	for (uint8_t part = 0; part < RADIO_CFG_PARTS; part++)
+	{
+		shadow_valid[part] = false;
+	}
+}
+
+/**
+ * @brief Forget one part, the next radio_cfg_apply() sends it again
+ *    Call it after a radio call that wrote the chip settings of the part
+ *
+ * @param part configuration part
+ */
+void radio_cfg_invalidate_part(radio_cfg_part part)
+{
+	shadow_valid[part] = false;
+}
+
+/**
+ * @brief Get the counts of sent and skipped calls
+ *
+ * @param stats filled with the counts and times
+ * @param reset clear them afterwards
+ */
+void radio_cfg_stats_get(radio_cfg_stats *stats, bool reset)
+{
+	*stats = cfg_stats;
+	if (reset)
+	{
+		memset(&cfg_stats, 0, sizeof(cfg_stats));
+	}
+}
+
+/**
+ * @brief Name of a configuration part
+ *
+ * @param part radio_cfg_part
+ * @return const char* name
+ */
+const char *radio_cfg_name(uint8_t part)
+{
+	return (part < RADIO_CFG_PARTS) ? part_names[part] : "?";
+}
@@ -0,0 +1,63 @@
+/**
+ * @file radio_cfg.h
+ * @brief Shadow of the LoRa P2P radio configuration, skips unchanged setups
+ * @version 0.1
+ * @date 2025-06-26
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef RADIO_CFG_H
+#define RADIO_CFG_H
+#include <Arduino.h>
+
+// Every Radio.SetChannel(), SetTxConfig() and SetRxConfig() is a series
+// of SPI commands to the SX1262. The last values written are kept, a
+// call whose values did not change is not sent again. The SX1262 keeps
+// its configuration in sleep (warm start), so the shadow stays valid
+// until the chip is reset or the LoRaWAN MAC takes over the radio, then
+// it is invalidated. Other calls that write the same chip settings make
+// a part stale: Radio.Send() writes the packet parameters with its
+// payload length, the CAD setup changes the chip mode, so the driver
+// paths that use them invalidate the parts they touch. TX and RX setup
+// share the modulation and packet parameters of the chip, the RX setup
+// is sent again after every TX setup so RX finds its own.
+
+/** Parts of the radio configuration */
+enum radio_cfg_part
+{
+	RADIO_CFG_CHANNEL, // Radio.SetChannel()
+	RADIO_CFG_TX,	   // Radio.SetTxConfig()
+	RADIO_CFG_RX,	   // Radio.SetRxConfig()
+	RADIO_CFG_PARTS
+};
+
+/** LoRa P2P modem parameters, see g_lorawan_settings */
+struct radio_p2p_config
+{
+	uint32_t frequency;
+	uint8_t tx_power;
+	uint8_t bandwidth;
+	uint8_t sf;
+	uint8_t cr;
+	uint8_t preamble_len;
+	uint16_t symbol_timeout;
+	bool rx_continuous;
+};
+
+/** Calls sent to the radio and skipped */
+struct radio_cfg_stats
+{
+	uint32_t sent[RADIO_CFG_PARTS];
+	uint32_t skipped[RADIO_CFG_PARTS];
+	uint32_t last_us; // Time of the last radio_cfg_apply()
+	uint32_t max_us;
+};
+
+void radio_cfg_apply(const radio_p2p_config *config);
+void radio_cfg_invalidate(void);
+void radio_cfg_invalidate_part(radio_cfg_part part);
+void radio_cfg_stats_get(radio_cfg_stats *stats, bool reset);
+const char *radio_cfg_name(uint8_t part);
+
+#endif
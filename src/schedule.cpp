@@ -0,0 +1,221 @@
+/**
+ * @file schedule.cpp
+ * @brief Report schedule with per device slots, jitter and wall clock alignment
+ * @version 0.1
+ * @date 2025-06-20
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "main.h"
+#include "schedule.h"
+
+/** millis() when the next report is due */
+static uint32_t nextMs = 0;
+/** millis() when the current report interval started */
+static uint32_t startMs = 0;
+/** The first report after boot is not sent yet */
+static bool firstPending = true;
+/** Unix time in s at millis() timeBaseMs, valid after AT+TIME or a time downlink */
+static uint32_t timeBaseS = 0;
+static uint32_t timeBaseMs = 0;
+static bool timeValid = false;
+/** xorshift32 state of the jitter, seeded from the DevEUI hash */
+static uint32_t jitterState = 0;
+
+/**
+ * @brief Hash of the DevEUI, FNV-1a with the MurmurHash3 finalizer
+ *    so the low bits used for the slot are mixed as well
+ *
+ * @return uint32_t hash
+ */
+static uint32_t schedule_hash(void)
+{
+	uint32_t hash = 2166136261UL;
+	for (int idx = 0; idx < 8; idx++)
+	{
+		hash ^= g_lorawan_settings.node_device_eui[idx];
+		hash *= 16777619UL;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6BUL;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35UL;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+/**
+ * @brief Slot of this device in a period
+ *
+ * @param period_ms period
+ * @return uint32_t offset from the period boundary in ms, 0 if slots are off
+ */
+uint32_t schedule_slot_ms(uint32_t period_ms)
+{
+	if (!g_lorawan_settings.schedule_slot || period_ms == 0)
+	{
+		return 0;
+	}
+	return schedule_hash() % period_ms;
+}
+
+/**
+ * @brief Random delay of one report
+ *
+ * @param period_ms period
+ * @return uint32_t delay in ms, up to the jitter setting and a quarter of the period
+ */
+static uint32_t schedule_jitter(uint32_t period_ms)
+{
+	uint32_t limit = g_lorawan_settings.schedule_jitter_s * 1000UL;
+	if (limit > period_ms / 4)
+	{
+		limit = period_ms / 4;
+	}
+	if (limit == 0)
+	{
+		return 0;
+	}
+	if (jitterState == 0)
+	{
+		jitterState = schedule_hash() | 1;
+	}
+	jitterState ^= jitterState << 13;
+	jitterState ^= jitterState >> 17;
+	jitterState ^= jitterState << 5;
+	return jitterState % (limit + 1);
+}
+
+/**
+ * @brief Plan the first report after boot
+ */
+void schedule_start(void)
+{
+	firstPending = true;
+	startMs = millis();
+	nextMs = startMs + SCHEDULE_FIRST_MS + schedule_slot_ms(SCHEDULE_FIRST_MS) + schedule_jitter(SCHEDULE_FIRST_MS);
+}
+
+/**
+ * @brief Plan the next report from now
+ */
+static void schedule_plan(void)
+{
+	uint32_t period = g_lorawan_settings.send_repeat_time;
+	if (period == 0)
+	{
+		// No interval, every pass reports
+		nextMs = millis();
+		return;
+	}
+
+	// Time of the clock the boundaries count on
+	uint32_t now_ms = millis();
+	uint64_t clock_ms = now_ms;
+	if (g_lorawan_settings.schedule_align && timeValid)
+	{
+		clock_ms = (uint64_t)timeBaseS * 1000ULL + (now_ms - timeBaseMs);
+	}
+
+	// First boundary plus slot far enough away
+	uint32_t slot = schedule_slot_ms(period);
+	uint64_t earliest = clock_ms + SCHEDULE_MIN_GAP_MS;
+	uint64_t target = slot;
+	if (earliest > slot)
+	{
+		target += ((earliest - slot + period - 1) / period) * period;
+	}
+	nextMs = now_ms + (uint32_t)(target - clock_ms) + schedule_jitter(period);
+}
+
+/**
+ * @brief Plan the next report, call when a report interval was closed
+ */
+void schedule_next(void)
+{
+	firstPending = false;
+	startMs = millis();
+	schedule_plan();
+}
+
+/**
+ * @brief The interval or schedule settings changed, plan the next report again
+ *    The first report after boot keeps its time, the current interval keeps
+ *    its start.
+ */
+void schedule_replan(void)
+{
+	if (!firstPending)
+	{
+		schedule_plan();
+	}
+}
+
+/**
+ * @brief Check if the next report is due
+ *
+ * @return true if it is time for the report
+ */
+bool schedule_due(void)
+{
+	return (int32_t)(millis() - nextMs) >= 0;
+}
+
+/**
+ * @brief Check if a part of the current report interval is over
+ *    The interval from the last report to the next one, with its slot and
+ *    jitter, is split into parts of equal length. The last part ends with
+ *    the next report.
+ *
+ * @param parts parts of the interval
+ * @param part part to check, 1 .. parts
+ * @return true if the part is over
+ */
+bool schedule_part_due(uint8_t parts, uint8_t part)
+{
+	uint32_t span = nextMs - startMs;
+	return millis() - startMs >= (uint32_t)(((uint64_t)span * part) / parts);
+}
+
+/**
+ * @brief Time until the next report
+ *
+ * @return uint32_t ms, 0 if it is due
+ */
+uint32_t schedule_wait_ms(void)
+{
+	int32_t wait = (int32_t)(nextMs - millis());
+	return wait < 0 ? 0 : wait;
+}
+
+/**
+ * @brief Set the wall clock
+ *    Kept on millis(), so it has to be set again within 49 days.
+ *
+ * @param unix_s seconds since 1970-01-01 UTC
+ */
+void schedule_set_time(uint32_t unix_s)
+{
+	timeBaseS = unix_s;
+	timeBaseMs = millis();
+	timeValid = true;
+	APP_LOG("SCHED", "Time set to %lu", unix_s);
+	schedule_replan();
+}
+
+/**
+ * @brief Get the wall clock
+ *
+ * @param unix_s seconds since 1970-01-01 UTC
+ * @return true if the time was set
+ */
+bool schedule_get_time(uint32_t *unix_s)
+{
+	if (!timeValid)
+	{
+		return false;
+	}
+	*unix_s = timeBaseS + (millis() - timeBaseMs) / 1000;
+	return true;
+}
@@ -0,0 +1,37 @@
+/**
+ * @file schedule.h
+ * @brief Report schedule with per device slots, jitter and wall clock alignment
+ * @version 0.1
+ * @date 2025-06-20
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+#include <Arduino.h>
+
+// Reports are due at boundaries of the send interval plus a slot offset.
+// The boundaries count from the boot, or from the Unix epoch when
+// AT+SCHED aligns them and the time was set by AT+TIME or a downlink on
+// LORAWAN_TIME_PORT. The slot offset is a hash of the DevEUI modulo the
+// interval, so nodes powered up together still send apart. A random delay
+// of up to the jitter, at most a quarter of the interval, is added to
+// every report.
+
+/** First report after boot, spread over the same time again by slot and jitter */
+#define SCHEDULE_FIRST_MS 60000
+/** Shortest time from planning to the next report */
+#define SCHEDULE_MIN_GAP_MS 10000
+
+void schedule_start(void);
+void schedule_next(void);
+void schedule_replan(void);
+bool schedule_due(void);
+bool schedule_part_due(uint8_t parts, uint8_t part);
+uint32_t schedule_wait_ms(void);
+uint32_t schedule_slot_ms(uint32_t period_ms);
+void schedule_set_time(uint32_t unix_s);
+bool schedule_get_time(uint32_t *unix_s);
+
+#endif
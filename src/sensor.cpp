@@ -0,0 +1,1122 @@
+/**
+ * @file sensor.cpp
+ * @brief Serial sensor drivers, shared line ingest and compile-time registry
+ * @version 0.1
+ * @date 2025-05-19
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "sensor.h"
+#include "bitpack.h"
+#include "ws8x.h"
+#include "perf.h"
+#include <nrf_soc.h>
+#include <nrf_nvic.h>
+
+// State and port of every registered sensor
+#define SENSOR_DEFINE(name, driver, serial, baud, periph) \
+	static driver##_t name##_state;                       \
+	static sensor_port name##_port;
+SENSOR_LIST(SENSOR_DEFINE)
+#undef SENSOR_DEFINE
+
+// All ports in registry order, the first one takes the injected bytes
+#define SENSOR_PORT(name, driver, serial, baud, periph) &name##_port,
+static sensor_port *const ports[] = {SENSOR_LIST(SENSOR_PORT)};
+#undef SENSOR_PORT
+#define SENSOR_NUM (sizeof(ports) / sizeof(ports[0]))
+
+/** Capture mode, see sensor_capture_mode */
+static volatile uint8_t captureMode = SENSOR_CAPTURE_OFF;
+
+/** Uplink format, see sensor_payload_format */
+static uint8_t payloadFormat = SENSOR_PAYLOAD_LEGACY;
+
+/** One interval of a batched uplink, packed codes of all sensors */
+struct sensor_record
+{
+	uint32_t code[SENSOR_MAX_FIELDS];
+};
+static sensor_record batch[SENSOR_BATCH_SLOTS];
+static uint8_t batchFirst = 0;				   // Oldest interval
+static uint8_t batchCount = 0;				   // Intervals waiting to be sent
+static uint8_t batchFields = 0;				   // Fields per interval
+static uint8_t batchWidth[SENSOR_MAX_FIELDS]; // Width of each field in bits
+
+/** USB input goes to the sensor ingest instead of the AT parser */
+static volatile bool feeding = false;
+
+// The UART RX ring of the core holds 256 bytes, at 115200 baud that is
+// about 22 ms of data, so it has to be drained well before that.
+#define SENSOR_INGEST_PERIOD_MS 10
+static SoftwareTimer ingestTimer;
+/** Task woken when the ingest timer read bytes, see sensors_set_notify() */
+static TaskHandle_t notifyTask = NULL;
+
+/** Idle mode, see SENSOR_IDLE_PASSES */
+static bool idleEnabled = false;
+static volatile bool ingestRunning = false;
+static uint8_t emptyPasses = 0;
+/** Ingest activity for AT+IDLE */
+static uint32_t idleStart = 0;
+static uint32_t idlePasses = 0;
+static uint32_t idleWakes = 0;
+static uint32_t idleBusyUs = 0;
+
+/** Time from the end of a line in the ingest timer to its driver call, last and worst in us */
+static uint32_t lineLatencyLast = 0;
+static uint32_t lineLatencyMax = 0;
+/** Worst of the lines that waited while the reporting task wrote flash */
+static uint32_t lineLatencyFlashMax = 0;
+/** The reporting task writes flash, and when it last stopped */
+static volatile bool flashWriting = false;
+static volatile uint32_t flashEndUs = 0;
+
+/**
+ * @brief Add one byte to the line assembled in the frame queue
+ *
+ * @param port port the byte belongs to
+ * @param c received byte
+ */
+static void sensor_port_putc(sensor_port *port, char c)
+{
+	if (c == '\r')
+	{
+		return;
+	}
+	if (c != '\n')
+	{
+		if (port->line_len < SENSOR_LINE_SIZE - 1)
+		{
+			port->frames[port->head].data[port->line_len++] = c;
+		}
+		else
+		{
+			port->line_overflow = true;
+		}
+		return;
+	}
+
+	// End of line, queue it if it is usable
+	if (!port->line_overflow && port->line_len > 0)
+	{
+		uint8_t next = (port->head + 1) % SENSOR_FRAME_SLOTS;
+		if (next == port->tail)
+		{
+			port->dropped++;
+		}
+		else
+		{
+			port->frames[port->head].data[port->line_len] = '\0';
+			port->frames[port->head].len = port->line_len;
+			port->frames[port->head].time_us = micros();
+			port->head = next;
+		}
+	}
+	port->line_len = 0;
+	port->line_overflow = false;
+}
+
+/**
+ * @brief Add one byte to the capture chunk of this ingest pass
+ *
+ * @param port port the byte belongs to
+ * @param chunk chunk in progress, NULL to start a new one
+ * @param now time stamp of the ingest pass
+ * @param c received byte
+ */
+static void sensor_port_capture(sensor_port *port, sensor_capture **chunk, uint32_t now, uint8_t c)
+{
+	if (*chunk == NULL)
+	{
+		if ((port->capture_head + 1) % SENSOR_CAPTURE_SLOTS == port->capture_tail)
+		{
+			port->capture_lost++;
+			return;
+		}
+		*chunk = &port->capture[port->capture_head];
+		(*chunk)->time = now;
+		(*chunk)->len = 0;
+	}
+	(*chunk)->data[(*chunk)->len++] = c;
+	if ((*chunk)->len == SENSOR_CAPTURE_CHUNK)
+	{
+		port->capture_head = (port->capture_head + 1) % SENSOR_CAPTURE_SLOTS;
+		*chunk = NULL;
+	}
+}
+
+/**
+ * @brief Move received and injected bytes into the frame queue
+ *    Runs in the timer task, never blocks and never waits for a full line
+ *
+ * @param port port to read
+ * @return true if bytes were read
+ */
+static bool sensor_port_ingest(sensor_port *port)
+{
+	uint32_t bytes = port->bytes;
+	sensor_capture *chunk = NULL;
+	uint32_t now = millis();
+	uint8_t c;
+
+	while (true)
+	{
+		if (port->uart->available() > 0)
+		{
+			c = (uint8_t)port->uart->read();
+		}
+		else if (port->inject_tail != port->inject_head)
+		{
+			c = port->inject[port->inject_tail];
+			port->inject_tail = (port->inject_tail + 1) % SENSOR_INJECT_SIZE;
+		}
+		else
+		{
+			break;
+		}
+
+		port->bytes++;
+		if (captureMode != SENSOR_CAPTURE_OFF)
+		{
+			sensor_port_capture(port, &chunk, now, c);
+		}
+		sensor_port_putc(port, (char)c);
+	}
+
+	// Hand the last partial chunk to sensors_check()
+	if (chunk != NULL)
+	{
+		port->capture_head = (port->capture_head + 1) % SENSOR_CAPTURE_SLOTS;
+	}
+	return port->bytes != bytes;
+}
+
+/**
+ * @brief Print the captured raw bytes of a port as +CAP:<name>:<ms>:<hex>
+ *
+ * @param port port to print
+ * @param name instance name from the registry
+ */
+static void sensor_port_print_capture(sensor_port *port, const char *name)
+{
+	while (port->capture_tail != port->capture_head)
+	{
+		sensor_capture *chunk = &port->capture[port->capture_tail];
+		Serial.printf("+CAP:%s:%lu:", name, chunk->time);
+		for (int i = 0; i < chunk->len; i++)
+		{
+			Serial.printf("%02X", chunk->data[i]);
+		}
+		Serial.println();
+		port->capture_tail = (port->capture_tail + 1) % SENSOR_CAPTURE_SLOTS;
+	}
+
+	uint32_t lost = port->capture_lost;
+	if (lost != port->capture_lost_reported)
+	{
+		Serial.printf("+CAP:%s:lost %lu bytes\n", name, lost - port->capture_lost_reported);
+		port->capture_lost_reported = lost;
+	}
+}
+
+/**
+ * @brief Hand the complete lines of a port to its driver
+ *    The driver is a template parameter, so the call is resolved at compile time
+ *
+ * @param port port to drain
+ * @param state driver state
+ * @param name instance name from the registry
+ */
+template <typename T, void (*feed)(T *, char *, uint8_t)>
+static void sensor_port_drain(sensor_port *port, T *state, const char *name)
+{
+	if (captureMode != SENSOR_CAPTURE_OFF)
+	{
+		sensor_port_print_capture(port, name);
+	}
+
+	const int maxIterations = 100; // Maximum number of lines to handle per loop
+	int iterationCount = 0;
+
+	// Only complete lines are in the queue, nothing here waits for the UART
+	while (port->tail != port->head && iterationCount < maxIterations)
+	{
+		iterationCount++;
+		port->lines++;
+		sensor_frame *frame = &port->frames[port->tail];
+		uint32_t now_us = micros();
+		lineLatencyLast = now_us - frame->time_us;
+		// A flash write that ended after the line end overlapped its wait
+		uint32_t *worst = &lineLatencyMax;
+		if (flashWriting || now_us - flashEndUs < lineLatencyLast)
+		{
+			worst = &lineLatencyFlashMax;
+		}
+		if (lineLatencyLast > *worst)
+		{
+			*worst = lineLatencyLast;
+		}
+#ifdef PRINT_WX_SERIAL
+		Serial.println(frame->data);
+#endif
+		if (captureMode == SENSOR_CAPTURE_TIMING)
+		{
+			// The driver may modify the line, keep a copy for the trace
+			char line[SENSOR_LINE_SIZE];
+			memcpy(line, frame->data, frame->len + 1);
+			uint32_t start_us = micros();
+			feed(state, frame->data, frame->len);
+			Serial.printf("+LINE:%s:%lu:%s\n", name, micros() - start_us, line);
+		}
+		else
+		{
+			feed(state, frame->data, frame->len);
+		}
+		port->tail = (port->tail + 1) % SENSOR_FRAME_SLOTS;
+	}
+
+	if (iterationCount >= maxIterations)
+	{
+		port->line_cap++;
+		Serial.println("Maximum serial reading iterations reached");
+	}
+	uint32_t dropped = port->dropped;
+	if (dropped != port->dropped_reported)
+	{
+		Serial.printf("Sensor frame queue overflow, %lu lines dropped\n", dropped - port->dropped_reported);
+		port->dropped_reported = dropped;
+	}
+}
+
+/** Interrupt bits of SENSOR_WAKE_EGU used by the sensors */
+#define SENSOR_WAKE_MASK ((EGU_INTENSET_TRIGGERED0_Msk << SENSOR_NUM) - EGU_INTENSET_TRIGGERED0_Msk)
+
+/**
+ * @brief Start the ingest timer if it was stopped
+ *    Runs in the timer task only, other tasks and the UART wake interrupt
+ *    pend it with xTimerPendFunctionCall(), so it never races the sleep.
+ *
+ * @param unused not used
+ * @param rx_wake 1 if a received byte woke it
+ */
+static void sensors_ingest_wake(void *unused, uint32_t rx_wake)
+{
+	(void)unused;
+	if (ingestRunning)
+	{
+		return;
+	}
+	SENSOR_WAKE_EGU->INTENCLR = SENSOR_WAKE_MASK;
+	ingestRunning = true;
+	if (rx_wake)
+	{
+		idleWakes++;
+	}
+	emptyPasses = 0;
+	ingestTimer.start();
+}
+
+/**
+ * @brief Byte received while the ingest timer is stopped
+ */
+extern "C" void SWI3_EGU3_IRQHandler(void)
+{
+	SENSOR_WAKE_EGU->INTENCLR = SENSOR_WAKE_MASK;
+	for (uint8_t idx = 0; idx < SENSOR_NUM; idx++)
+	{
+		SENSOR_WAKE_EGU->EVENTS_TRIGGERED[idx] = 0;
+	}
+	// Read back, so the cleared event does not enter the handler again
+	(void)SENSOR_WAKE_EGU->EVENTS_TRIGGERED[0];
+
+	BaseType_t woken = pdFALSE;
+	xTimerPendFunctionCallFromISR(sensors_ingest_wake, NULL, 1, &woken);
+	portYIELD_FROM_ISR(woken);
+}
+
+/**
+ * @brief Stop the ingest timer until the next received byte
+ *    Called from the ingest timer callback.
+ */
+static void sensors_ingest_sleep(void)
+{
+	ingestTimer.stop();
+	ingestRunning = false;
+	// Forget the bytes of the passes so far, then arm the wake
+	for (uint8_t idx = 0; idx < SENSOR_NUM; idx++)
+	{
+		SENSOR_WAKE_EGU->EVENTS_TRIGGERED[idx] = 0;
+	}
+	SENSOR_WAKE_EGU->INTENSET = SENSOR_WAKE_MASK;
+
+	// A byte received or injected before the wake was armed does not wake it
+	for (uint8_t idx = 0; idx < SENSOR_NUM; idx++)
+	{
+		if ((ports[idx]->uart->available() > 0) || (ports[idx]->inject_tail != ports[idx]->inject_head))
+		{
+			sensors_ingest_wake(NULL, 0);
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Route the RX event of a UART to the wake interrupt
+ *
+ * @param idx sensor index, selects the PPI channel and the EGU trigger
+ * @param rx_event RXDRDY event of the UART
+ */
+static void sensors_wake_connect(uint8_t idx, volatile uint32_t *rx_event)
+{
+	sd_ppi_channel_assign(SENSOR_WAKE_PPI_CH + idx, rx_event, &SENSOR_WAKE_EGU->TASKS_TRIGGER[idx]);
+	sd_ppi_channel_enable_set(1UL << (SENSOR_WAKE_PPI_CH + idx));
+}
+
+/**
+ * @brief Timer callback, frames the streams of all sensors
+ *    and wakes the task that calls sensors_check()
+ */
+static void sensors_ingest(TimerHandle_t unused)
+{
+	(void)unused;
+	PERF_SCOPE(PERF_INGEST);
+	uint32_t start_us = micros();
+	bool received = false;
+#define SENSOR_INGEST(name, driver, serial, baud, periph) \
+	received |= sensor_port_ingest(&name##_port);
+	SENSOR_LIST(SENSOR_INGEST)
+#undef SENSOR_INGEST
+	if (received && notifyTask != NULL)
+	{
+		xTaskNotifyGive(notifyTask);
+	}
+
+	if (received)
+	{
+		emptyPasses = 0;
+	}
+	else if (idleEnabled && !feeding && ++emptyPasses >= SENSOR_IDLE_PASSES)
+	{
+		sensors_ingest_sleep();
+	}
+	idlePasses++;
+	idleBusyUs += micros() - start_us;
+}
+
+/**
+ * @brief Set the task woken when bytes were received or injected
+ *
+ * @param task task that calls sensors_check(), NULL = none
+ */
+void sensors_set_notify(TaskHandle_t task)
+{
+	notifyTask = task;
+}
+
+/**
+ * @brief Time from the end of a line to its driver call
+ *    The line end is seen by the ingest timer, at most
+ *    SENSOR_INGEST_PERIOD_MS after the byte arrived.
+ *
+ * @param last_us last line
+ * @param max_us worst line since the last reset, without flash writes
+ * @param flash_max_us worst line that waited while the reporting task wrote flash
+ * @param reset start new worst cases
+ */
+void sensors_latency(uint32_t *last_us, uint32_t *max_us, uint32_t *flash_max_us, bool reset)
+{
+	*last_us = lineLatencyLast;
+	*max_us = lineLatencyMax;
+	*flash_max_us = lineLatencyFlashMax;
+	if (reset)
+	{
+		lineLatencyMax = 0;
+		lineLatencyFlashMax = 0;
+	}
+}
+
+/**
+ * @brief Mark the flash writes of the reporting task for sensors_latency()
+ *
+ * @param writing true before the write, false after it
+ */
+void sensors_flash_write(bool writing)
+{
+	if (!writing)
+	{
+		flashEndUs = micros();
+	}
+	flashWriting = writing;
+}
+
+/**
+ * @brief Ingest activity and the modelled CPU current it costs
+ *
+ * @param stats filled with the counters since the last reset
+ * @param reset start counting again
+ */
+void sensors_idle_stats(sensor_idle_stats *stats, bool reset)
+{
+	stats->elapsed_ms = millis() - idleStart;
+	stats->passes = idlePasses;
+	stats->wakes = idleWakes;
+	stats->busy_us = idleBusyUs;
+
+	uint64_t awake_us = (uint64_t)(idlePasses + idleWakes) * SENSOR_MODEL_WAKE_US + idleBusyUs;
+	uint64_t elapsed_us = (uint64_t)stats->elapsed_ms * 1000;
+	if (elapsed_us == 0 || awake_us > elapsed_us)
+	{
+		awake_us = elapsed_us;
+	}
+	stats->awake_permille = elapsed_us == 0 ? 0 : (uint32_t)(awake_us * 1000 / elapsed_us);
+	stats->current_ua = elapsed_us == 0 ? 0 : (uint32_t)(awake_us * SENSOR_MODEL_RUN_UA / elapsed_us);
+
+	if (reset)
+	{
+		idleStart = millis();
+		idlePasses = 0;
+		idleWakes = 0;
+		idleBusyUs = 0;
+	}
+}
+
+/**
+ * @brief Open the UARTs, initialize the drivers and start the ingest timer
+ */
+void sensors_init(void)
+{
+	uint8_t idx = 0;
+#define SENSOR_INIT(name, driver, serial, baud, periph) \
+	name##_port.uart = &serial;                         \
+	serial.begin(baud);                                 \
+	driver##_init(&name##_state);                       \
+	sensors_wake_connect(idx++, &periph->EVENTS_RXDRDY);
+	SENSOR_LIST(SENSOR_INIT)
+#undef SENSOR_INIT
+
+	// Wake interrupt of the idle mode, armed by sensors_ingest_sleep()
+	SENSOR_WAKE_EGU->INTENCLR = SENSOR_WAKE_MASK;
+	sd_nvic_SetPriority(SENSOR_WAKE_IRQn, SENSOR_WAKE_IRQ_PRIO);
+	sd_nvic_ClearPendingIRQ(SENSOR_WAKE_IRQn);
+	sd_nvic_EnableIRQ(SENSOR_WAKE_IRQn);
+
+	// Frame the sensor streams in the background
+	ingestTimer.begin(SENSOR_INGEST_PERIOD_MS, sensors_ingest);
+	idleStart = millis();
+	ingestRunning = true;
+	ingestTimer.start();
+}
+
+/**
+ * @brief Apply settings to all drivers
+ *
+ * @param config settings
+ */
+void sensors_configure(const sensor_config *config)
+{
+	payloadFormat = config->payload_format;
+	idleEnabled = config->idle;
+	if (!idleEnabled)
+	{
+		xTimerPendFunctionCall(sensors_ingest_wake, NULL, 0, portMAX_DELAY);
+	}
+#define SENSOR_CONFIGURE(name, driver, serial, baud, periph) \
+	driver##_configure(&name##_state, config);
+	SENSOR_LIST(SENSOR_CONFIGURE)
+#undef SENSOR_CONFIGURE
+}
+
+/**
+ * @brief Process all lines received since the last call
+ */
+void sensors_check(void)
+{
+#define SENSOR_CHECK(name, driver, serial, baud, periph) \
+	sensor_port_drain<driver##_t, driver##_feed>(&name##_port, &name##_state, #name);
+	SENSOR_LIST(SENSOR_CHECK)
+#undef SENSOR_CHECK
+}
+
+/**
+ * @brief Aggregate all sensors and put their reports into a buffer
+ *    Does not start a new report interval, see sensors_reset_counters()
+ *
+ * @param buffer where to write the payload
+ * @param size size of the buffer
+ * @return uint8_t payload length
+ */
+uint8_t sensors_report(uint8_t *buffer, uint8_t size)
+{
+	uint8_t offset = 0;
+
+	if (payloadFormat == SENSOR_PAYLOAD_PACKED && size > 0)
+	{
+		buffer[offset++] = SENSOR_PAYLOAD_VERSION;
+	}
+
+#define SENSOR_ENCODE(name, driver, serial, baud, periph) \
+	driver##_aggregate(&name##_state);                    \
+	offset += driver##_encode(&name##_state, payloadFormat, &buffer[offset], size - offset);
+	SENSOR_LIST(SENSOR_ENCODE)
+#undef SENSOR_ENCODE
+
+	return offset;
+}
+
+/**
+ * @brief Put the reports of the running interval into a buffer
+ *    Nothing of the report state changes, for AT+WXREPORT
+ *
+ * @param buffer where to write the payload
+ * @param size size of the buffer
+ * @return uint8_t payload length
+ */
+uint8_t sensors_preview(uint8_t *buffer, uint8_t size)
+{
+	uint8_t offset = 0;
+
+	if (payloadFormat == SENSOR_PAYLOAD_PACKED && size > 0)
+	{
+		buffer[offset++] = SENSOR_PAYLOAD_VERSION;
+	}
+
+#define SENSOR_PREVIEW(name, driver, serial, baud, periph) \
+	offset += driver##_preview(&name##_state, payloadFormat, &buffer[offset], size - offset);
+	SENSOR_LIST(SENSOR_PREVIEW)
+#undef SENSOR_PREVIEW
+
+	return offset;
+}
+
+/**
+ * @brief Start the next report interval on all sensors
+ */
+void sensors_reset_counters(void)
+{
+#define SENSOR_RESET(name, driver, serial, baud, periph) \
+	driver##_reset(&name##_state);
+	SENSOR_LIST(SENSOR_RESET)
+#undef SENSOR_RESET
+}
+
+/**
+ * @brief Check if any sensor has values outside the deadbands of its last sent report
+ *
+ * @return true if a report is needed
+ */
+bool sensors_changed(void)
+{
+	bool changed = false;
+#define SENSOR_CHANGED(name, driver, serial, baud, periph) \
+	changed = driver##_changed(&name##_state) || changed;
+	SENSOR_LIST(SENSOR_CHANGED)
+#undef SENSOR_CHANGED
+	return changed;
+}
+
+/**
+ * @brief The last report of all sensors was sent, changes are measured against it
+ */
+void sensors_mark_sent(void)
+{
+#define SENSOR_SENT(name, driver, serial, baud, periph) \
+	driver##_sent(&name##_state);
+	SENSOR_LIST(SENSOR_SENT)
+#undef SENSOR_SENT
+}
+
+/**
+ * @brief Put the alerts of all sensors that wait to be sent into an alert uplink
+ *    Byte 0 is SENSOR_ALERT_VERSION, then SENSOR_ALERT_RECORD_SIZE bytes per
+ *    alert, the upper 4 bits of the first one are the sensor index in the
+ *    registry. Alerts that do not fit stay for the next uplink.
+ *
+ * @param buffer where to write the payload
+ * @param size size of the buffer
+ * @return uint8_t payload length, 0 if no alert is waiting
+ */
+uint8_t sensors_alert_encode(uint8_t *buffer, uint8_t size)
+{
+	uint8_t offset = 1;
+	uint8_t index = 0;
+	if (size < 1 + SENSOR_ALERT_RECORD_SIZE)
+	{
+		return 0;
+	}
+	buffer[0] = SENSOR_ALERT_VERSION;
+
+#define SENSOR_ALERTS(name, driver, serial, baud, periph)                                 \
+	{                                                                                     \
+		uint8_t start = offset;                                                           \
+		offset += driver##_alerts(&name##_state, &buffer[offset], size - offset);         \
+		for (uint8_t record = start; record < offset; record += SENSOR_ALERT_RECORD_SIZE) \
+		{                                                                                 \
+			buffer[record] |= index << 4;                                                 \
+		}                                                                                 \
+		index++;                                                                          \
+	}
+	SENSOR_LIST(SENSOR_ALERTS)
+#undef SENSOR_ALERTS
+
+	return (offset > 1) ? offset : 0;
+}
+
+/**
+ * @brief The alerts put into the last alert uplink were sent, the others keep waiting
+ */
+void sensors_alerts_sent(void)
+{
+#define SENSOR_ALERTS_SENT(name, driver, serial, baud, periph) \
+	driver##_alerts_sent(&name##_state);
+	SENSOR_LIST(SENSOR_ALERTS_SENT)
+#undef SENSOR_ALERTS_SENT
+}
+
+/**
+ * @brief Close an interval of a batched uplink
+ *    Aggregates all sensors, keeps their packed codes and starts the next
+ *    report interval. When the batch is full the oldest interval is dropped.
+ */
+void sensors_batch_add(void)
+{
+	uint8_t fields = 0;
+
+	if (batchCount == SENSOR_BATCH_SLOTS)
+	{
+		batchFirst = (batchFirst + 1) % SENSOR_BATCH_SLOTS;
+		batchCount--;
+		Serial.println("Batch full, oldest interval dropped");
+	}
+	sensor_record *record = &batch[(batchFirst + batchCount) % SENSOR_BATCH_SLOTS];
+
+#define SENSOR_BATCH_FIELDS(name, driver, serial, baud, periph)                                                       \
+	driver##_aggregate(&name##_state);                                                                                \
+	fields += driver##_fields(&name##_state, &record->code[fields], &batchWidth[fields], SENSOR_MAX_FIELDS - fields); \
+	driver##_reset(&name##_state);
+	SENSOR_LIST(SENSOR_BATCH_FIELDS)
+#undef SENSOR_BATCH_FIELDS
+
+	batchFields = fields;
+	batchCount++;
+}
+
+/**
+ * @brief Get the number of intervals waiting to be sent
+ *
+ * @return uint8_t intervals
+ */
+uint8_t sensors_batch_count(void)
+{
+	return batchCount;
+}
+
+/**
+ * @brief Bits needed for a signed delta in two's complement
+ *
+ * @param delta difference between two codes
+ * @return uint8_t width, 0 if the delta is 0
+ */
+static uint8_t sensor_delta_width(int32_t delta)
+{
+	uint8_t width = 0;
+	if (delta == 0)
+	{
+		return 0;
+	}
+	do
+	{
+		width++;
+	} while (delta < -(1L << (width - 1)) || delta > (1L << (width - 1)) - 1);
+	return width;
+}
+
+/**
+ * @brief Put as many waiting intervals as fit into a batched uplink, oldest first
+ *    Byte 0 is SENSOR_BATCH_VERSION, byte 1 has the number of intervals in
+ *    the upper 4 bits and the number still waiting after them (max 15) in
+ *    the lower 4 bits. Then, bit packed MSB first:
+ *    - the first interval with the absolute codes of all fields
+ *    - if there is more than one interval, 4 bits delta width per field,
+ *      then each further interval as signed deltas to the one before
+ *      (two's complement, fields with width 0 are left out)
+ *    If not even one interval fits with the batch header, the oldest one is
+ *    sent as a SENSOR_PAYLOAD_VERSION packed report.
+ *
+ * @param buffer where to write the payload
+ * @param size maximum payload size
+ * @param records number of intervals in the uplink
+ * @return uint8_t payload length, 0 if not even one interval fits
+ */
+uint8_t sensors_batch_encode(uint8_t *buffer, uint8_t size, uint8_t *records)
+{
+	uint8_t deltaWidth[SENSOR_MAX_FIELDS] = {0};
+	uint8_t fitWidth[SENSOR_MAX_FIELDS] = {0};
+	uint16_t absBits = 0;
+	uint16_t deltaBits = 0;
+	uint8_t fit = 0;
+	uint8_t bytes = 0;
+	bitpack pack;
+
+	for (int field = 0; field < batchFields; field++)
+	{
+		absBits += batchWidth[field];
+	}
+
+	// The delta widths only grow with every interval added, stop at the first one that does not fit
+	for (uint8_t count = 1; count <= batchCount; count++)
+	{
+		uint16_t bits = absBits;
+		if (count > 1)
+		{
+			const sensor_record *prev = &batch[(batchFirst + count - 2) % SENSOR_BATCH_SLOTS];
+			const sensor_record *cur = &batch[(batchFirst + count - 1) % SENSOR_BATCH_SLOTS];
+			deltaBits = 0;
+			for (int field = 0; field < batchFields; field++)
+			{
+				uint8_t width = sensor_delta_width((int32_t)(cur->code[field] - prev->code[field]));
+				if (width > deltaWidth[field])
+				{
+					deltaWidth[field] = width;
+				}
+				deltaBits += deltaWidth[field];
+			}
+			bits += batchFields * 4 + (count - 1) * deltaBits;
+		}
+		if (2 + (bits + 7) / 8 > size)
+		{
+			break;
+		}
+		fit = count;
+		bytes = 2 + (bits + 7) / 8;
+		memcpy(fitWidth, deltaWidth, sizeof(fitWidth));
+	}
+
+	*records = fit;
+	if (fit == 0)
+	{
+		// Not even the batch header fits (US915 DR0), send the oldest interval as packed report
+		if (batchCount == 0 || 1 + (absBits + 7) / 8 > size)
+		{
+			return 0;
+		}
+		buffer[0] = SENSOR_PAYLOAD_VERSION;
+		bitpack_init(&pack, &buffer[1], (absBits + 7) / 8);
+		for (int field = 0; field < batchFields; field++)
+		{
+			bitpack_put(&pack, batch[batchFirst].code[field], batchWidth[field]);
+		}
+		*records = 1;
+		return 1 + bitpack_bytes(&pack);
+	}
+
+	uint8_t waiting = batchCount - fit;
+	buffer[0] = SENSOR_BATCH_VERSION;
+	buffer[1] = (fit << 4) | ((waiting > 15) ? 15 : waiting);
+	bitpack_init(&pack, &buffer[2], bytes - 2);
+
+	const sensor_record *prev = &batch[batchFirst];
+	for (int field = 0; field < batchFields; field++)
+	{
+		bitpack_put(&pack, prev->code[field], batchWidth[field]);
+	}
+	if (fit > 1)
+	{
+		for (int field = 0; field < batchFields; field++)
+		{
+			bitpack_put(&pack, fitWidth[field], 4);
+		}
+	}
+	for (uint8_t idx = 1; idx < fit; idx++)
+	{
+		const sensor_record *cur = &batch[(batchFirst + idx) % SENSOR_BATCH_SLOTS];
+		for (int field = 0; field < batchFields; field++)
+		{
+			if (fitWidth[field] != 0)
+			{
+				bitpack_put(&pack, cur->code[field] - prev->code[field], fitWidth[field]);
+			}
+		}
+		prev = cur;
+	}
+
+	return bytes;
+}
+
+/**
+ * @brief Remove sent intervals from the batch
+ *
+ * @param records number of intervals sent, oldest first
+ */
+void sensors_batch_consume(uint8_t records)
+{
+	if (records > batchCount)
+	{
+		records = batchCount;
+	}
+	batchFirst = (batchFirst + records) % SENSOR_BATCH_SLOTS;
+	batchCount -= records;
+}
+
+/**
+ * @brief Select what is captured from the sensor streams
+ *
+ * @param mode see sensor_capture_mode
+ */
+void sensors_set_capture(uint8_t mode)
+{
+	captureMode = mode;
+}
+
+/**
+ * @brief Get the capture mode
+ *
+ * @return uint8_t see sensor_capture_mode
+ */
+uint8_t sensors_get_capture(void)
+{
+	return captureMode;
+}
+
+/**
+ * @brief Route the USB input to the first sensor instead of the AT parser
+ *
+ * @param enable true to feed the sensor
+ */
+void sensors_set_feeding(bool enable)
+{
+	feeding = enable;
+}
+
+/**
+ * @brief Check if USB input goes to the first sensor
+ *
+ * @return true feeding the sensor
+ * @return false USB input goes to the AT parser
+ */
+bool sensors_feeding(void)
+{
+	return feeding;
+}
+
+/**
+ * @brief Inject a byte into the stream of the first sensor, as if it was
+ *    received on its UART
+ *
+ * @param data byte to inject
+ * @return true if queued
+ * @return false if the inject queue is full, try again later
+ */
+bool sensors_inject(uint8_t data)
+{
+	sensor_port *port = ports[0];
+	uint16_t next = (port->inject_head + 1) % SENSOR_INJECT_SIZE;
+	if (next == port->inject_tail)
+	{
+		return false;
+	}
+	port->inject[port->inject_head] = data;
+	port->inject_head = next;
+	// The sleep checks the queue after it cleared the flag, so no byte is left behind
+	if (!ingestRunning)
+	{
+		xTimerPendFunctionCall(sensors_ingest_wake, NULL, 0, portMAX_DELAY);
+	}
+	return true;
+}
+
+/**
+ * @brief Collect the port and driver counters of a sensor
+ *
+ * @param port port of the sensor
+ * @param health counters since boot
+ */
+static void sensor_port_health(sensor_port *port, sensor_health *health)
+{
+	health->lines = port->lines;
+	health->bytes = port->bytes;
+	health->queue_full = port->dropped;
+	health->line_cap = port->line_cap;
+}
+
+/**
+ * @brief Events per time
+ *
+ * @param delta number of events
+ * @param time_ms time span
+ * @param per_ms unit of the rate, 1000 = per second
+ * @return uint32_t rate
+ */
+static uint32_t sensor_rate(uint32_t delta, uint32_t time_ms, uint32_t per_ms)
+{
+	if (time_ms == 0)
+	{
+		return 0;
+	}
+	return (uint32_t)(((uint64_t)delta * per_ms) / time_ms);
+}
+
+/**
+ * @brief Put a counter into a byte, saturated
+ */
+static uint8_t sensor_sat8(uint32_t value)
+{
+	return (value > 0xFF) ? 0xFF : value;
+}
+
+/**
+ * @brief Put a counter into two bytes, saturated
+ */
+static uint16_t sensor_sat16(uint32_t value)
+{
+	return (value > 0xFFFF) ? 0xFFFF : value;
+}
+
+/**
+ * @brief Print the counters of one sensor and take a new snapshot
+ *
+ * @param name instance name from the registry
+ * @param health current counters
+ * @param last snapshot of the previous call, updated
+ * @param now millis()
+ * @param buffer where to print
+ * @param size size of the buffer
+ * @return int length like snprintf()
+ */
+static int sensor_health_print(const char *name, const sensor_health *health, sensor_snapshot *last,
+							   uint32_t now, char *buffer, size_t size)
+{
+	uint32_t lines_10s = sensor_rate(health->lines - last->health.lines, now - last->time, 10000);
+	uint32_t bytes_10s = sensor_rate(health->bytes - last->health.bytes, now - last->time, 10000);
+	long valid_age_ms = (health->last_valid_ms == 0) ? -1L : (long)(now - health->last_valid_ms);
+
+	last->time = now;
+	last->health = *health;
+
+	return snprintf(buffer, size,
+					"%s,lines:%lu,lines/s:%lu.%lu,bytes:%lu,bytes/s:%lu.%lu,queue_full:%lu,line_cap:%lu,"
+					"no_sep:%lu,unknown:%lu,errors:%lu,valid_age_ms:%ld,",
+					name, health->lines, lines_10s / 10, lines_10s % 10, health->bytes, bytes_10s / 10, bytes_10s % 10,
+					health->queue_full, health->line_cap, health->no_separator, health->unknown_keys,
+					health->parse_errors, valid_age_ms);
+}
+
+/**
+ * @brief Put the diagnostic record of one sensor into the uplink and take a new snapshot
+ *
+ * @param health current counters
+ * @param last snapshot of the previous call, updated
+ * @param now millis()
+ * @param buffer where to write, SENSOR_DIAG_RECORD_SIZE bytes
+ */
+static void sensor_health_record(const sensor_health *health, sensor_snapshot *last, uint32_t now, uint8_t *buffer)
+{
+	uint16_t lines_min = sensor_sat16(sensor_rate(health->lines - last->health.lines, now - last->time, 60000));
+	uint16_t bytes_min = sensor_sat16(sensor_rate(health->bytes - last->health.bytes, now - last->time, 60000));
+	uint16_t valid_age_s = (health->last_valid_ms == 0) ? 0xFFFF : sensor_sat16((now - health->last_valid_ms) / 1000);
+	int offset = 0;
+
+	memcpy(&buffer[offset], &lines_min, sizeof(uint16_t));
+	offset += sizeof(uint16_t);
+	memcpy(&buffer[offset], &bytes_min, sizeof(uint16_t));
+	offset += sizeof(uint16_t);
+	buffer[offset++] = sensor_sat8(health->queue_full - last->health.queue_full);
+	buffer[offset++] = sensor_sat8(health->line_cap - last->health.line_cap);
+	buffer[offset++] = sensor_sat8(health->no_separator - last->health.no_separator);
+	buffer[offset++] = sensor_sat8(health->unknown_keys - last->health.unknown_keys);
+	buffer[offset++] = sensor_sat8(health->parse_errors - last->health.parse_errors);
+	memcpy(&buffer[offset], &valid_age_s, sizeof(uint16_t));
+
+	last->time = now;
+	last->health = *health;
+}
+
+/**
+ * @brief Print the health counters of all sensors for AT+WXHEALTH
+ *    Rates are since the previous call, the first call gives the rates since boot
+ *
+ * @param buffer where to print
+ * @param size size of the buffer
+ * @return int length like snprintf()
+ */
+int sensors_health_text(char *buffer, size_t size)
+{
+	int len = 0;
+	uint32_t now = millis();
+	sensor_health health;
+
+#define SENSOR_HEALTH_TEXT(name, driver, serial, baud, periph)                                               \
+	sensor_port_health(&name##_port, &health);                                                               \
+	driver##_health(&name##_state, &health);                                                                 \
+	if ((size_t)len < size && len != 0)                                                                      \
+	{                                                                                                        \
+		buffer[len++] = ';';                                                                                 \
+	}                                                                                                        \
+	if ((size_t)len < size)                                                                                  \
+	{                                                                                                        \
+		len += sensor_health_print(#name, &health, &name##_port.at_snapshot, now, &buffer[len], size - len); \
+	}                                                                                                        \
+	if ((size_t)len < size)                                                                                  \
+	{                                                                                                        \
+		len += driver##_health_keys(&name##_state, &buffer[len], size - len);                                \
+	}
+	SENSOR_LIST(SENSOR_HEALTH_TEXT)
+#undef SENSOR_HEALTH_TEXT
+
+	return len;
+}
+
+/**
+ * @brief Samples the statistics windows of all sensors dropped before
+ *    their time because the window was full, AT+WINDOW
+ *
+ * @return uint32_t samples since boot
+ */
+uint32_t sensors_truncated(void)
+{
+	uint32_t truncated = 0;
+	sensor_health health;
+
+#define SENSOR_TRUNCATED(name, driver, serial, baud, periph) \
+	driver##_health(&name##_state, &health);                \
+	truncated += health.truncated;
+	SENSOR_LIST(SENSOR_TRUNCATED)
+#undef SENSOR_TRUNCATED
+
+	return truncated;
+}
+
+/**
+ * @brief Build the diagnostic uplink, values are since the previous one
+ *    Byte 0 is SENSOR_DIAG_VERSION, then per sensor in registry order,
+ *    little endian, saturated:
+ *      uint16 lines/min, uint16 bytes/min, uint8 queue_full, uint8 line_cap,
+ *      uint8 no_sep, uint8 unknown, uint8 errors, uint16 valid_age_s (0xFFFF = none)
+ *
+ * @param buffer where to write the payload
+ * @param size size of the buffer
+ * @return uint8_t payload length, 0 if it does not fit
+ */
+uint8_t sensors_health_encode(uint8_t *buffer, uint8_t size)
+{
+	uint8_t offset = 0;
+	uint32_t now = millis();
+	sensor_health health;
+
+	if (size < 1 + SENSOR_NUM * SENSOR_DIAG_RECORD_SIZE)
+	{
+		return 0;
+	}
+	buffer[offset++] = SENSOR_DIAG_VERSION;
+
+#define SENSOR_HEALTH_ENCODE(name, driver, serial, baud, periph)                     \
+	sensor_port_health(&name##_port, &health);                                       \
+	driver##_health(&name##_state, &health);                                         \
+	sensor_health_record(&health, &name##_port.diag_snapshot, now, &buffer[offset]); \
+	offset += SENSOR_DIAG_RECORD_SIZE;
+	SENSOR_LIST(SENSOR_HEALTH_ENCODE)
+#undef SENSOR_HEALTH_ENCODE
+
+	return offset;
+}
@@ -0,0 +1,266 @@
+/**
+ * @file sensor.h
+ * @brief Serial sensor drivers, shared line ingest and compile-time registry
+ * @version 0.1
+ * @date 2025-05-19
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef SENSOR_H
+#define SENSOR_H
+#include <Arduino.h>
+#include <LoRaWan-RAK4630.h>
+
+/**
+ * Registry of the sensor instances, one line per instance:
+ *   X(<name>, <driver>, <serial>, <baud>, <uart>)
+ * <uart> is the UARTE peripheral behind <serial>, its RX event wakes the
+ * ingest in idle mode.
+ *
+ * A driver <d> provides the state type <d>_t and the functions
+ *   void <d>_init(<d>_t *)                               reset the state at boot
+ *   void <d>_configure(<d>_t *, const sensor_config *)   apply settings
+ *   void <d>_feed(<d>_t *, char *line, uint8_t len)      handle one received line
+ *   void <d>_aggregate(<d>_t *)                          compute the report values
+ *   uint8_t <d>_encode(<d>_t *, uint8_t format, uint8_t *buf, uint8_t size)
+ *                                                        append the report in a sensor_payload_format,
+ *                                                        returns bytes written
+ *   uint8_t <d>_preview(<d>_t *, uint8_t format, uint8_t *buf, uint8_t size)
+ *                                                        like <d>_aggregate and <d>_encode, but leaves the
+ *                                                        last report and the alerts as they are
+ *   void <d>_reset(<d>_t *)                              start the next report interval
+ *   void <d>_health(<d>_t *, sensor_health *)            fill the driver counters
+ *   int <d>_health_keys(<d>_t *, char *buf, size_t size) print errors per key like snprintf()
+ *   uint8_t <d>_fields(<d>_t *, uint32_t *codes, uint8_t *widths, uint8_t max)
+ *                                                        packed field codes of the report, returns count
+ *   bool <d>_changed(<d>_t *)                            current values outside the deadbands of the
+ *                                                        last sent report, must not print
+ *   void <d>_sent(<d>_t *)                               the last aggregated report was sent
+ *   uint8_t <d>_alerts(<d>_t *, uint8_t *buf, uint8_t size)
+ *                                                        append the alerts waiting to be sent, returns bytes
+ *   void <d>_alerts_sent(<d>_t *)                        the alerts of the last <d>_alerts() were sent
+ * see ws8x.h. sensor.cpp expands this list into direct calls, so there is
+ * no virtual dispatch in the ingest path.
+ *
+ * A second station on the other UART would be added as
+ *   X(ws8x_2, ws8x, Serial2, 115200, NRF_UARTE1)
+ * its payload is appended after the first one.
+ */
+#define SENSOR_LIST(X) \
+	X(ws8x_1, ws8x, Serial1, 115200, NRF_UARTE0)
+
+/** Uplink formats, AT+PAYLOAD */
+enum sensor_payload_format
+{
+	SENSOR_PAYLOAD_LEGACY = 0, // Driver reports appended, no header
+	SENSOR_PAYLOAD_PACKED,	   // SENSOR_PAYLOAD_VERSION, then the bit packed driver reports
+};
+
+/** First byte of a packed uplink, the layout is decoded by tools/ws8x_decoder.js */
+#define SENSOR_PAYLOAD_VERSION 1
+
+/** First byte of a batched uplink, see sensors_batch_encode() */
+#define SENSOR_BATCH_VERSION 2
+/** Intervals kept for a batched uplink (AT+BATCH), the oldest are dropped when full */
+#define SENSOR_BATCH_SLOTS 15
+/** Packed fields of all sensors in one interval */
+#define SENSOR_MAX_FIELDS 24
+
+/** Largest changes against the last sent report that do not need an uplink, AT+DEADBAND */
+struct sensor_deadband
+{
+	uint16_t wind;		  // Speed, gust and lull in 0.1 m/s
+	uint16_t dir;		  // Wind direction in deg
+	uint16_t temperature; // 0.1 °C
+	uint16_t voltage;	  // 0.01 V
+};
+
+/** Alert rules, checked on every sample. Also the rule number in the alert uplink */
+enum sensor_alert_rule
+{
+	SENSOR_ALERT_GUST = 0,	// Gust above the limit
+	SENSOR_ALERT_DIR_SHIFT, // Mean wind direction moved away from the last report
+	SENSOR_ALERT_BAT_LOW,	// Battery voltage below the limit
+	SENSOR_ALERT_CAP_LOW,	// Capacitor voltage below the limit
+	SENSOR_ALERT_NUM
+};
+
+/** Alert limits, AT+ALERT, 0 = rule off */
+struct sensor_alert_config
+{
+	uint16_t gust;		// 0.1 m/s
+	uint16_t dir_shift; // deg
+	uint16_t bat_low;	// 0.01 V
+	uint16_t cap_low;	// 0.01 V
+};
+
+/** Version of the alert uplink, see sensors_alert_encode() */
+#define SENSOR_ALERT_VERSION 1
+/** Bytes per alert in the alert uplink */
+#define SENSOR_ALERT_RECORD_SIZE 3
+
+/** Settings handed to every driver */
+struct sensor_config
+{
+	uint32_t window_ms;		  // Statistics window in ms
+	uint8_t gust_avg_s;		  // Gust running mean time in seconds, 0 = from the sensor
+	uint8_t payload_format;	  // sensor_payload_format
+	sensor_deadband deadband; // Change-only reporting
+	sensor_alert_config alert;
+	bool idle;				  // Stop the ingest timer while the sensors are silent
+};
+
+/** Health counters of one sensor since boot */
+struct sensor_health
+{
+	uint32_t lines;			// Lines handed to the driver
+	uint32_t bytes;			// Bytes received
+	uint32_t queue_full;	// Lines lost because the frame queue was full
+	uint32_t line_cap;		// Drain passes that stopped at the line limit
+	uint32_t no_separator;	// Lines the driver could not split into key and value
+	uint32_t unknown_keys;	// Lines with a key the driver does not handle
+	uint32_t parse_errors;	// Known keys with a malformed value
+	uint32_t last_valid_ms; // millis() of the last valid main reading, 0 = none yet
+	uint32_t truncated;		// Samples dropped from a full statistics window
+};
+
+/** Counters at the previous query, to get rates and deltas */
+struct sensor_snapshot
+{
+	uint32_t time;
+	sensor_health health;
+};
+
+/** Version of the diagnostic uplink, see sensors_health_encode() */
+#define SENSOR_DIAG_VERSION 1
+/** Bytes per sensor in the diagnostic uplink */
+#define SENSOR_DIAG_RECORD_SIZE 11
+
+// Lines of a sensor stream are assembled directly in a fixed queue of
+// frames, so no heap is ever touched. The ingest timer is the single
+// producer and sensors_check(), called from the sensor task it wakes, the
+// single consumer, each index is only written by its owner. The slot at
+// head is never read by the consumer, so it is used to assemble the line
+// that is coming in.
+#define SENSOR_LINE_SIZE 64
+#define SENSOR_FRAME_SLOTS 16
+
+struct sensor_frame
+{
+	uint8_t len;
+	uint32_t time_us; // micros() when the line was complete
+	char data[SENSOR_LINE_SIZE];
+};
+
+// Capture of the raw stream (AT+CAPTURE). The ingest timer packs the bytes
+// of one pass into time stamped chunks, sensors_check() prints them.
+#define SENSOR_CAPTURE_CHUNK 32
+#define SENSOR_CAPTURE_SLOTS 16
+
+struct sensor_capture
+{
+	uint32_t time; // millis() when the bytes were read
+	uint8_t len;
+	uint8_t data[SENSOR_CAPTURE_CHUNK];
+};
+
+/** Capture modes */
+enum sensor_capture_mode
+{
+	SENSOR_CAPTURE_OFF = 0,
+	SENSOR_CAPTURE_RAW,	  // +CAP:<name>:<ms>:<hex> for the raw bytes
+	SENSOR_CAPTURE_TIMING, // additionally +LINE:<name>:<us>:<line> per handled line
+};
+
+// Bytes injected over USB (AT+WXFEED) are read by the ingest timer after
+// the UART bytes, so they take exactly the path of received data.
+#define SENSOR_INJECT_SIZE 256
+
+/** One UART with its frame queue */
+struct sensor_port
+{
+	HardwareSerial *uart;
+	sensor_frame frames[SENSOR_FRAME_SLOTS];
+	volatile uint8_t head;			 // written by ingest only
+	volatile uint8_t tail;			 // written by sensors_check() only
+	uint8_t line_len;				 // Length of the line in frames[head]
+	bool line_overflow;				 // Line longer than the buffer, drop until '\n'
+	volatile uint32_t dropped;		 // Lines dropped because the queue was full
+	uint32_t dropped_reported;		 // Drops already reported
+	sensor_capture capture[SENSOR_CAPTURE_SLOTS];
+	volatile uint8_t capture_head;	 // written by ingest only
+	volatile uint8_t capture_tail;	 // written by sensors_check() only
+	volatile uint32_t capture_lost;	 // Bytes not captured because the queue was full
+	uint32_t capture_lost_reported; // Losses already reported
+	uint8_t inject[SENSOR_INJECT_SIZE];
+	volatile uint16_t inject_head;	 // written by sensors_inject() only
+	volatile uint16_t inject_tail;	 // written by ingest only
+	volatile uint32_t bytes;		 // Bytes read, written by ingest only
+	uint32_t lines;					 // Lines handed to the driver
+	uint32_t line_cap;				 // Drain passes that stopped at the line limit
+	sensor_snapshot at_snapshot;	 // Counters at the last AT+WXHEALTH
+	sensor_snapshot diag_snapshot;	 // Counters at the last diagnostic uplink
+};
+
+// Idle mode, AT+IDLE: the ingest timer stops after SENSOR_IDLE_PASSES
+// passes in a row without a byte. A PPI channel per sensor routes the
+// RXDRDY event of its UART to a trigger of SENSOR_WAKE_EGU, whose
+// interrupt starts the timer again on the next received byte. The UART
+// keeps receiving into the RX ring of the core meanwhile, so no byte is
+// lost, and the CPU sleeps between the lines instead of waking every 10 ms.
+// All starts and stops of the timer run in the timer task.
+#define SENSOR_IDLE_PASSES 5
+#define SENSOR_WAKE_EGU NRF_EGU3 // Handled by SWI3_EGU3_IRQHandler() in sensor.cpp
+#define SENSOR_WAKE_IRQn SWI3_EGU3_IRQn
+#define SENSOR_WAKE_IRQ_PRIO 6
+/** PPI channel of the first sensor, one per sensor from here */
+#define SENSOR_WAKE_PPI_CH 8
+
+// CPU current model of AT+IDLE, typical nRF52840 values with the DC/DC
+// converter. The receiving UART keeps the HF clock running in both modes,
+// so the sleep floor does not depend on the idle mode and is not part of
+// the model, neither is the radio. The result is the current the ingest
+// adds on top of it.
+#define SENSOR_MODEL_RUN_UA 3300 // CPU running from flash at 64 MHz
+#define SENSOR_MODEL_WAKE_US 25	 // Wake up and dispatch of one ingest pass or UART wake
+
+/** Ingest activity since the last reset, AT+IDLE */
+struct sensor_idle_stats
+{
+	uint32_t elapsed_ms;	 // Time since the last reset
+	uint32_t passes;		 // Ingest timer passes
+	uint32_t wakes;			 // Ingest timer starts by a received byte
+	uint32_t busy_us;		 // Time spent in the passes
+	uint32_t awake_permille; // Modelled share of time the CPU runs for the ingest
+	uint32_t current_ua;	 // Modelled average CPU current the ingest adds
+};
+
+void sensors_init(void);
+void sensors_configure(const sensor_config *config);
+void sensors_check(void);
+void sensors_set_notify(TaskHandle_t task);
+void sensors_latency(uint32_t *last_us, uint32_t *max_us, uint32_t *flash_max_us, bool reset);
+void sensors_flash_write(bool writing);
+void sensors_idle_stats(sensor_idle_stats *stats, bool reset);
+void sensors_reset_counters(void);
+bool sensors_changed(void);
+void sensors_mark_sent(void);
+uint8_t sensors_alert_encode(uint8_t *buffer, uint8_t size);
+void sensors_alerts_sent(void);
+void sensors_set_capture(uint8_t mode);
+uint8_t sensors_get_capture(void);
+void sensors_set_feeding(bool enable);
+bool sensors_feeding(void);
+bool sensors_inject(uint8_t data);
+uint8_t sensors_report(uint8_t *buffer, uint8_t size);
+uint8_t sensors_preview(uint8_t *buffer, uint8_t size);
+void sensors_batch_add(void);
+uint8_t sensors_batch_count(void);
+uint8_t sensors_batch_encode(uint8_t *buffer, uint8_t size, uint8_t *records);
+void sensors_batch_consume(uint8_t records);
+int sensors_health_text(char *buffer, size_t size);
+uint32_t sensors_truncated(void);
+uint8_t sensors_health_encode(uint8_t *buffer, uint8_t size);
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * @file stats.cpp
+ * @brief Sliding window statistics over time stamped samples
+ * @version 0.1
+ * @date 2025-05-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include "stats.h"
+
+#define STATS_IDX(seq) ((seq) & (STATS_MAX_SAMPLES - 1))
+
+/**
+ * @brief Initialize a window
+ *
+ * @param stats window to initialize
+ * @param window_ms length of the window in ms, 0 = until stats_reset()
+ */
+void stats_init(stats_window *stats, uint32_t window_ms)
+{
+	stats->window_ms = window_ms;
+	stats->truncated = 0;
+	stats_reset(stats);
+}
+
+/**
+ * @brief Drop all samples, the window length and truncated are kept
+ *
+ * @param stats window to clear
+ */
+void stats_reset(stats_window *stats)
+{
+	stats->first_seq = 0;
+	stats->next_seq = 0;
+	stats->first_ms = 0;
+	stats->last_tick = 0;
+	stats->sum = 0;
+	stats->sum_sq = 0;
+	stats->min_head = stats->min_len = 0;
+	stats->max_head = stats->max_len = 0;
+}
+
+/**
+ * @brief Remove the oldest sample from the window
+ *
+ * @param stats window, must not be empty
+ */
+static void stats_drop_oldest(stats_window *stats)
+{
+	uint16_t seq = stats->first_seq;
+	int32_t value = stats->value[STATS_IDX(seq)];
+
+	stats->sum -= value;
+	stats->sum_sq -= value * value;
+	if (stats->min_len > 0 && stats->min_q[stats->min_head] == seq)
+	{
+		stats->min_head = STATS_IDX(stats->min_head + 1);
+		stats->min_len--;
+	}
+	if (stats->max_len > 0 && stats->max_q[stats->max_head] == seq)
+	{
+		stats->max_head = STATS_IDX(stats->max_head + 1);
+		stats->max_len--;
+	}
+	stats->first_seq++;
+
+	if (stats_count(stats) > 0)
+	{
+		// The next sample becomes the oldest, move the time base to it
+		uint16_t delta = stats->delta[STATS_IDX(stats->first_seq)];
+		stats->first_ms += delta * STATS_TICK_MS;
+		stats->last_tick -= delta;
+	}
+}
+
+/**
+ * @brief Remove samples that are older than the window
+ *
+ * @param stats window
+ * @param now current time in ms
+ */
+void stats_expire(stats_window *stats, uint32_t now)
+{
+	if (stats->window_ms == 0)
+	{
+		return;
+	}
+	while (stats_count(stats) > 0 && (now - stats->first_ms) > stats->window_ms)
+	{
+		stats_drop_oldest(stats);
+	}
+}
+
+/**
+ * @brief Add a sample, expiring old ones first
+ *
+ * @param stats window
+ * @param now time of the sample in ms
+ * @param value sample value
+ */
+void stats_add(stats_window *stats, uint32_t now, int16_t value)
+{
+	stats_expire(stats, now);
+	if (stats_count(stats) == STATS_MAX_SAMPLES)
+	{
+		// Still inside the window, it ends earlier than asked for
+		stats_drop_oldest(stats);
+		stats->truncated++;
+	}
+
+	uint16_t delta = 0;
+	if (stats_count(stats) == 0)
+	{
+		stats->first_ms = now;
+		stats->last_tick = 0;
+	}
+	else
+	{
+		uint32_t tick = (now - stats->first_ms) / STATS_TICK_MS;
+		delta = (tick - stats->last_tick > 0xFFFF) ? 0xFFFF : tick - stats->last_tick;
+		stats->last_tick += delta;
+	}
+
+	uint16_t seq = stats->next_seq++;
+	stats->delta[STATS_IDX(seq)] = delta;
+	stats->value[STATS_IDX(seq)] = value;
+	stats->sum += value;
+	stats->sum_sq += (int32_t)value * value;
+
+	// Samples that can never be the minimum again leave the back of the queue
+	while (stats->min_len > 0 && stats->value[STATS_IDX(stats->min_q[STATS_IDX(stats->min_head + stats->min_len - 1)])] >= value)
+	{
+		stats->min_len--;
+	}
+	stats->min_q[STATS_IDX(stats->min_head + stats->min_len)] = seq;
+	stats->min_len++;
+
+	// Same for the maximum
+	while (stats->max_len > 0 && stats->value[STATS_IDX(stats->max_q[STATS_IDX(stats->max_head + stats->max_len - 1)])] <= value)
+	{
+		stats->max_len--;
+	}
+	stats->max_q[STATS_IDX(stats->max_head + stats->max_len)] = seq;
+	stats->max_len++;
+}
+
+/**
+ * @brief Number of samples in the window
+ */
+uint16_t stats_count(const stats_window *stats)
+{
+	return (uint16_t)(stats->next_seq - stats->first_seq);
+}
+
+/**
+ * @brief Rounded mean of the window, 0 if empty
+ */
+int32_t stats_mean(const stats_window *stats)
+{
+	int32_t count = stats_count(stats);
+	if (count == 0)
+	{
+		return 0;
+	}
+	return (int32_t)((stats->sum >= 0 ? stats->sum + count / 2 : stats->sum - count / 2) / count);
+}
+
+/**
+ * @brief Minimum of the window, 0 if empty
+ */
+int16_t stats_min(const stats_window *stats)
+{
+	return stats->min_len > 0 ? stats->value[STATS_IDX(stats->min_q[stats->min_head])] : 0;
+}
+
+/**
+ * @brief Maximum of the window, 0 if empty
+ */
+int16_t stats_max(const stats_window *stats)
+{
+	return stats->max_len > 0 ? stats->value[STATS_IDX(stats->max_q[stats->max_head])] : 0;
+}
+
+/**
+ * @brief Population variance of the window in squared sample units, 0 if empty
+ */
+uint32_t stats_variance(const stats_window *stats)
+{
+	int64_t count = stats_count(stats);
+	if (count == 0)
+	{
+		return 0;
+	}
+	return (uint32_t)((count * stats->sum_sq - stats->sum * stats->sum) / (count * count));
+}
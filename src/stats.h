@@ -0,0 +1,64 @@
+/**
+ * @file stats.h
+ * @brief Sliding window statistics over time stamped samples
+ * @version 0.1
+ * @date 2025-05-12
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef STATS_H
+#define STATS_H
+#include <Arduino.h>
+
+/** Maximum number of samples kept per window, older samples are dropped first.
+ *  Must be a power of 2 so sequence numbers can wrap around. */
+#define STATS_MAX_SAMPLES 512
+/** Resolution of the sample time stamps in ms */
+#define STATS_TICK_MS 100
+
+/**
+ * Samples older than window_ms are expired from a ring buffer. Mean and
+ * variance come from running sums, min and max from monotonic deques of
+ * sample sequence numbers, so every operation is O(1) amortized and the
+ * RAM use is fixed, about 4 kB per window.
+ *
+ * Sequence numbers are 16 bit, the ring size divides 2^16 so they wrap
+ * with it. A sample keeps its time as STATS_TICK_MS ticks since the sample
+ * before it, only the oldest sample has a full time stamp, so a sample
+ * leaves the window up to one tick early. A gap longer than 65535 ticks
+ * (109 min) is stored as that, longer windows then let the sample after
+ * the gap leave early.
+ *
+ * When more than STATS_MAX_SAMPLES samples fall into the window, the
+ * oldest are dropped before their time and counted in truncated.
+ */
+struct stats_window
+{
+	uint32_t window_ms;					// 0 = keep samples until stats_reset()
+	uint32_t first_ms;					// Time of the oldest sample
+	uint32_t last_tick;					// Time of the newest sample in ticks after first_ms
+	uint16_t first_seq;					// Sequence number of the oldest sample
+	uint16_t next_seq;					// Sequence number of the next sample
+	uint16_t delta[STATS_MAX_SAMPLES];	// Ticks since the sample before
+	int16_t value[STATS_MAX_SAMPLES];	// Sample values
+	int64_t sum;						// Sum of the values in the window
+	int64_t sum_sq;						// Sum of the squared values in the window
+	uint16_t min_q[STATS_MAX_SAMPLES];	// Sequence numbers with increasing values
+	uint16_t max_q[STATS_MAX_SAMPLES];	// Sequence numbers with decreasing values
+	uint16_t min_head, min_len;
+	uint16_t max_head, max_len;
+	uint32_t truncated;					// Samples dropped from a full window since stats_init()
+};
+
+void stats_init(stats_window *stats, uint32_t window_ms);
+void stats_reset(stats_window *stats);
+void stats_add(stats_window *stats, uint32_t now, int16_t value);
+void stats_expire(stats_window *stats, uint32_t now);
+uint16_t stats_count(const stats_window *stats);
+int32_t stats_mean(const stats_window *stats);
+int16_t stats_min(const stats_window *stats);
+int16_t stats_max(const stats_window *stats);
+uint32_t stats_variance(const stats_window *stats);
+
+#endif
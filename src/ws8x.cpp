@@ -1,199 +1,916 @@
 #include "ws8x.h"
+#include "bitpack.h"
 #include <Arduino.h>
 #include <math.h>
 
-// Variables for wind data
-static double dir_sum_sin = 0;
-static double dir_sum_cos = 0;
-static float velSum = 0;
-static float gust = 0;
-static float lull = -1;
-static int velCount = 0;
-static int dirCount = 0;
+// Wind direction is averaged as a unit vector. sin/cos come from a quarter
+// wave table in Q14 at 1 degree steps and are summed as integers, so a
+// sample costs two table reads and two adds instead of double precision
+// soft-float trig (the nRF52840 FPU is single precision only). The sums are
+// only converted with atan2f() once per report.
+//
+// Error against the double precision reference, for a mean vector of
+// length R (1 = steady direction, 0 = directions cancel out):
+// - the WS8x reports whole degrees, other input is rounded to 1 degree
+//   (<= 0.5 deg per sample)
+// - table quantisation is <= 0.5 LSB = 3.1e-5 per component, which moves
+//   the mean direction by at most 0.0025 deg / R
+// - halving the sums on overflow (see ws8x_addDirection) adds < 1 LSB
+//   relative to sums > 2^30, far below the table error
+// - atan2f() is good to about 1e-5 deg
+// The reported direction is rounded to 1 deg, so for whole degree input it
+// only differs from the reference when that sits within 0.0025 deg / R of
+// a rounding boundary.
+static const int16_t sin_q14[91] = {
+    0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563,
+    2845, 3126, 3406, 3686, 3964, 4240, 4516, 4790, 5063, 5334,
+    5604, 5872, 6138, 6402, 6664, 6924, 7182, 7438, 7692, 7943,
+    8192, 8438, 8682, 8923, 9162, 9397, 9630, 9860, 10087, 10311,
+    10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+    12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+    14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+    15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+    16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+    16384};
 
-// Variables for other metrics
-static float batVoltageF = 0;
-static float capVoltageF = 0;
-static float temperatureF = 0;
-static float rain = 0;
-static int rainSum = 0;
+/**
+ * @brief sin() of a whole degree from the quarter wave table
+ *
+ * @param deg angle 0 .. 359
+ * @return int32_t sin in Q14
+ */
+static int32_t ws8x_sinDeg(int deg)
+{
+    if (deg < 90)
+        return sin_q14[deg];
+    if (deg < 180)
+        return sin_q14[180 - deg];
+    if (deg < 270)
+        return -sin_q14[deg - 180];
+    return -sin_q14[360 - deg];
+}
+
+/**
+ * @brief Add a wind direction sample to the vector sums
+ *
+ * @param ws station
+ * @param dir direction in whole degrees
+ */
+void ws8x_addDirection(ws8x_t *ws, int32_t dir)
+{
+    int deg = dir % 360;
+    if (deg < 0)
+        deg += 360;
+    int cosDeg = (deg < 270) ? deg + 90 : deg - 270; // cos(x) = sin(x + 90)
+
+    // Keep headroom for the next sample. Halving both sums keeps the mean
+    // direction, which is all that is derived from them.
+    if (ws->dir_sum_sin > (1L << 30) || ws->dir_sum_sin < -(1L << 30) ||
+        ws->dir_sum_cos > (1L << 30) || ws->dir_sum_cos < -(1L << 30))
+    {
+        ws->dir_sum_sin /= 2;
+        ws->dir_sum_cos /= 2;
+    }
+    ws->dir_sum_sin += ws8x_sinDeg(deg);
+    ws->dir_sum_cos += ws8x_sinDeg(cosDeg);
+    ws->dirCount++;
+}
+
+// Sensor keys are dispatched through a switch on a hash of the key bytes
+// combined with the key length. The case labels are generated at compile
+// time from WS8X_KEYS, so a hash collision between two known keys is a
+// duplicate case label and fails the build. A matching label is confirmed
+// with one memcmp(), unknown keys are rejected without any string compare.
+// To handle another key add it to WS8X_KEYS and to ws8x_feed().
+#define WS8X_KEYS(X)                              \
+    X("WindDir", WS8X_FIELD_WIND_DIR)             \
+    X("WindSpeed", WS8X_FIELD_WIND_SPEED)         \
+    X("WindGust", WS8X_FIELD_WIND_GUST)           \
+    X("BatVoltage", WS8X_FIELD_BAT_VOLTAGE)       \
+    X("CapVoltage", WS8X_FIELD_CAP_VOLTAGE)       \
+    X("GXTS04Temp", WS8X_FIELD_TEMPERATURE)       \
+    X("Temperature", WS8X_FIELD_TEMPERATURE)      \
+    X("Rain", WS8X_FIELD_RAIN)                    \
+    X("RainIntSum", WS8X_FIELD_RAIN_SUM)
+
+/** Name of each field in AT+WXHEALTH, in ws8x_field order */
+static const char *const fieldNames[WS8X_FIELD_NUM] = {
+    "",
+    "WindDir",
+    "WindSpeed",
+    "WindGust",
+    "BatVoltage",
+    "CapVoltage",
+    "Temperature",
+    "Rain",
+    "RainIntSum",
+};
+
+/** Decimal places each field is kept with, in ws8x_field order */
+static const uint8_t fieldDecimals[WS8X_FIELD_NUM] = {
+    0, // WS8X_FIELD_UNKNOWN
+    0, // WS8X_FIELD_WIND_DIR, deg
+    1, // WS8X_FIELD_WIND_SPEED, 0.1 m/s
+    1, // WS8X_FIELD_WIND_GUST, 0.1 m/s
+    2, // WS8X_FIELD_BAT_VOLTAGE, 0.01 V
+    2, // WS8X_FIELD_CAP_VOLTAGE, 0.01 V
+    1, // WS8X_FIELD_TEMPERATURE, 0.1 °C
+    1, // WS8X_FIELD_RAIN, 0.1 mm
+    0, // WS8X_FIELD_RAIN_SUM
+};
+
+/** Unit the WS8x may append to the value of each field, in ws8x_field order */
+static const char *const fieldUnits[WS8X_FIELD_NUM] = {
+    "",  // WS8X_FIELD_UNKNOWN
+    "",  // WS8X_FIELD_WIND_DIR
+    "",  // WS8X_FIELD_WIND_SPEED
+    "",  // WS8X_FIELD_WIND_GUST
+    "V", // WS8X_FIELD_BAT_VOLTAGE, "BatVoltage=3.29V"
+    "V", // WS8X_FIELD_CAP_VOLTAGE
+    "",  // WS8X_FIELD_TEMPERATURE
+    "",  // WS8X_FIELD_RAIN
+    "",  // WS8X_FIELD_RAIN_SUM
+};
+
+/** FNV-1a over len bytes, written as a single expression to stay C++11 constexpr */
+static constexpr uint32_t ws8x_fnv1a(const char *str, size_t len, uint32_t hash = 2166136261UL)
+{
+    return len == 0 ? hash : ws8x_fnv1a(str + 1, len - 1, (hash ^ (uint8_t)*str) * 16777619UL);
+}
 
-void ws8x_init()
+/** Key id used in the dispatch switch, upper 24 bits hash, lower 8 bits length */
+static constexpr uint32_t ws8x_keyId(const char *str, size_t len)
 {
-    // Initialize serial or anything related to ws8x
-    Serial1.begin(115200);
+    return (ws8x_fnv1a(str, len) << 8) | (len & 0xFF);
 }
 
-void ws8x_checkSerial()
+/**
+ * @brief Map a sensor key to its field
+ *
+ * @param key key bytes, does not need to be NUL terminated
+ * @param len length of the key
+ * @return ws8x_field field id or WS8X_FIELD_UNKNOWN
+ */
+ws8x_field ws8x_lookupKey(const char *key, size_t len)
 {
-    const int maxIterations = 100; // Maximum number of lines to read per loop
-    int iterationCount = 0;
+    // Same id as ws8x_keyId(), as a loop. Unoptimised builds turn the
+    // recursive constexpr form into one call per byte.
+    uint32_t hash = 2166136261UL;
+    for (size_t idx = 0; idx < len; idx++)
+    {
+        hash = (hash ^ (uint8_t)key[idx]) * 16777619UL;
+    }
+    switch ((hash << 8) | (len & 0xFF))
+    {
+#define WS8X_KEY_CASE(name, field)    \
+    case ws8x_keyId(name, sizeof(name) - 1): \
+        return memcmp(key, name, len) == 0 ? field : WS8X_FIELD_UNKNOWN;
+        WS8X_KEYS(WS8X_KEY_CASE)
+#undef WS8X_KEY_CASE
+    default:
+        return WS8X_FIELD_UNKNOWN;
+    }
+}
 
-    // Check if data is available on the serial port
-    while (Serial1.available() > 0 && iterationCount < maxIterations)
+/**
+ * @brief Parse a short decimal value like "12.3", "-4", ".5" or "3.29V"
+ *    straight into a scaled integer, without going through float.
+ *    Extra decimals are rounded half away from zero. Only the unit of the
+ *    field may follow the number, exponents and other characters are
+ *    errors.
+ *
+ * @param str NUL terminated, trimmed value
+ * @param decimals number of decimal places of the result
+ * @param unit suffix the value may end with, "" = none
+ * @param out value * 10^decimals
+ * @return ws8x_parse_result WS8X_PARSE_OK, WS8X_PARSE_NO_DATA or WS8X_PARSE_ERROR
+ */
+ws8x_parse_result ws8x_parseFixed(const char *str, uint8_t decimals, const char *unit, int32_t *out)
+{
+    bool negative = false;
+    bool hasDigits = false;
+    bool roundUp = false;
+    uint8_t fracDigits = 0;
+    int32_t value = 0;
+
+    if (str[0] == '-' && str[1] == '-')
     {
-        iterationCount++;
-        String line = Serial1.readStringUntil('\n');
-        line.trim();
-#ifdef PRINT_WX_SERIAL
-        Serial.println(line);
-#else
-        // Serial.print('.');
-#endif
-        if (line.length() > 0)
+        while (*str == '-')
         {
-            // Find the '=' character
-            int index = line.indexOf('=');
-            if (index != -1)
+            str++;
+        }
+        return (*str == '\0') ? WS8X_PARSE_NO_DATA : WS8X_PARSE_ERROR;
+    }
+
+    if (*str == '-' || *str == '+')
+    {
+        negative = (*str == '-');
+        str++;
+    }
+    while (*str >= '0' && *str <= '9')
+    {
+        // Keep room for the decimals, the sensor values are far below this
+        if (value > 999999)
+        {
+            return WS8X_PARSE_ERROR;
+        }
+        value = value * 10 + (*str++ - '0');
+        hasDigits = true;
+    }
+    if (*str == '.')
+    {
+        str++;
+        while (*str >= '0' && *str <= '9')
+        {
+            if (fracDigits < decimals)
+            {
+                value = value * 10 + (*str - '0');
+                fracDigits++;
+            }
+            else if (fracDigits == decimals)
             {
-                // Split into key and value, removing whitespace
-                String key = line.substring(0, index);
-                String value = line.substring(index + 1);
-                key.trim();
-                value.trim();
-
-                // Remove 'V' suffix from voltage readings if present
-                if (value.endsWith("V"))
-                {
-                    value = value.substring(0, value.length() - 1);
-                }
-
-                // Now parse based on the key
-                if (key == "WindDir")
-                {
-                    float windDir = value.toFloat();
-                    double radians = windDir * M_PI / 180.0;
-                    dir_sum_sin += sin(radians);
-                    dir_sum_cos += cos(radians);
-                    dirCount++;
-                }
-                else if (key == "WindSpeed")
-                {
-                    float windSpeed = value.toFloat();
-                    velSum += windSpeed;
-                    velCount++;
-                    if (lull == -1 || windSpeed < lull)
-                        lull = windSpeed;
-                }
-                else if (key == "WindGust")
-                {
-                    float windGust = value.toFloat();
-                    if (windGust > gust)
-                        gust = windGust;
-                }
-                else if (key == "BatVoltage")
-                {
-                    batVoltageF = value.toFloat();
-                }
-                else if (key == "CapVoltage")
-                {
-                    capVoltageF = value.toFloat();
-                }
-                else if (key == "GXTS04Temp" || key == "Temperature") // Handle both sensor types
-                {
-                    if (value != "--") // Check for valid temperature
-                    {
-                        temperatureF = value.toFloat();
-                    }
-                }
-                // ... rest of your parsing code ...
+                // First digit that does not fit decides the rounding
+                roundUp = (*str >= '5');
+                fracDigits++;
             }
+            str++;
+            hasDigits = true;
         }
     }
+    // Unit suffix like "V"
+    if (*unit != '\0' && strcmp(str, unit) == 0)
+    {
+        str += strlen(unit);
+    }
+    if (!hasDigits || *str != '\0')
+    {
+        return WS8X_PARSE_ERROR;
+    }
+
+    for (; fracDigits < decimals; fracDigits++)
+    {
+        value *= 10;
+    }
+    if (roundUp)
+    {
+        value++;
+    }
+    *out = negative ? -value : value;
+    return WS8X_PARSE_OK;
+}
 
-    if (iterationCount >= maxIterations)
+/**
+ * @brief Strip leading and trailing blanks in place
+ *
+ * @param str start of the string
+ * @param end one past the last character, a NUL is written here
+ * @return char* first non blank character
+ */
+static char *ws8x_trim(char *str, char *end)
+{
+    while (str < end && isspace((unsigned char)*str))
     {
-        Serial.println("Maximum serial reading iterations reached");
+        str++;
     }
+    while (end > str && isspace((unsigned char)end[-1]))
+    {
+        end--;
+    }
+    *end = '\0';
+    return str;
 }
-void ws8x_populate_lora_buffer(lmh_app_data_t *m_lora_app_data, int size)
+
+/**
+ * @brief Mean wind direction of the samples since the last ws8x_reset()
+ *
+ * @param ws station
+ * @return float direction 0 .. 360 deg
+ */
+static float ws8x_meanDirection(const ws8x_t *ws)
 {
-    // Calculate averages
-    float velAvg = (velCount > 0) ? velSum / velCount : 0;
-    double avgSin = (dirCount > 0) ? dir_sum_sin / dirCount : 0;
-    double avgCos = (dirCount > 0) ? dir_sum_cos / dirCount : 0;
-    double avgRadians = atan2(avgSin, avgCos);
-    float dirAvg = avgRadians * 180.0 / M_PI; // Convert to degrees
+    // The vector length does not change the angle, no need to divide by dirCount
+    float avgRadians = atan2f((float)ws->dir_sum_sin, (float)ws->dir_sum_cos);
+    float dirAvg = avgRadians * (180.0f / (float)M_PI); // Convert to degrees
     if (dirAvg < 0)
-        dirAvg += 360.0;
+        dirAvg += 360.0f;
+    return dirAvg;
+}
+
+/**
+ * @brief Update one alert rule with a new sample
+ *    An alert is raised once when the rule becomes active and not again
+ *    until the value has gone back past the hysteresis. While it waits to
+ *    be sent the worst value is kept.
+ *
+ * @param ws station
+ * @param rule sensor_alert_rule
+ * @param active sample breaks the rule
+ * @param clear sample is back past the hysteresis
+ * @param value sample, in the units of the report
+ * @param worse true if value is worse than the one waiting to be sent
+ */
+static void ws8x_alertUpdate(ws8x_t *ws, uint8_t rule, bool active, bool clear, int16_t value, bool worse)
+{
+    uint8_t bit = 1 << rule;
+    if (active && !(ws->alertLatched & bit))
+    {
+        ws->alertLatched |= bit;
+        ws->alertPending |= bit;
+        ws->alertValue[rule] = value;
+    }
+    else if (active && (ws->alertPending & bit) && worse)
+    {
+        ws->alertValue[rule] = value;
+    }
+    else if (clear)
+    {
+        ws->alertLatched &= ~bit;
+    }
+}
+
+/**
+ * @brief Check the gust rule, called for every gust sample
+ *
+ * @param ws station
+ * @param gust gust in 0.1 m/s
+ */
+static void ws8x_alertGust(ws8x_t *ws, int16_t gust)
+{
+    uint16_t limit = ws->alert.gust;
+    if (limit != 0)
+    {
+        ws8x_alertUpdate(ws, SENSOR_ALERT_GUST, gust > limit, gust < limit - limit / 10, gust,
+                         gust > ws->alertValue[SENSOR_ALERT_GUST]);
+    }
+}
+
+/**
+ * @brief Check the direction shift rule, called for every direction sample
+ *    The mean direction since the report interval started is compared with
+ *    the last report, once there are enough samples and enough wind for the
+ *    direction to mean something.
+ *
+ * @param ws station
+ */
+static void ws8x_alertDirection(ws8x_t *ws)
+{
+    uint16_t limit = ws->alert.dir_shift;
+    if (limit == 0 || !ws->reportValid || ws->dirCount < WS8X_ALERT_DIR_SAMPLES ||
+        stats_count(&ws->speedStats) == 0 || stats_mean(&ws->speedStats) < WS8X_ALERT_DIR_SPEED)
+    {
+        return;
+    }
+    int16_t dir = (int16_t)lroundf(ws8x_meanDirection(ws)) % 360;
+    int32_t turn = abs(dir - ws->report.dir) % 360;
+    if (turn > 180)
+    {
+        turn = 360 - turn;
+    }
+    ws8x_alertUpdate(ws, SENSOR_ALERT_DIR_SHIFT, turn > limit, turn < limit / 2, dir, true);
+}
+
+/**
+ * @brief Check a low voltage rule, called for every voltage sample
+ *
+ * @param ws station
+ * @param rule SENSOR_ALERT_BAT_LOW or SENSOR_ALERT_CAP_LOW
+ * @param limit alert below this, 0.01 V, 0 = rule off
+ * @param voltage sample in 0.01 V
+ */
+static void ws8x_alertVoltage(ws8x_t *ws, uint8_t rule, uint16_t limit, int32_t voltage)
+{
+    if (limit != 0)
+    {
+        ws8x_alertUpdate(ws, rule, voltage < limit, voltage >= limit + WS8X_ALERT_VOLT_HYST, (int16_t)voltage,
+                         voltage < ws->alertValue[rule]);
+    }
+}
+
+/**
+ * @brief Handle one complete "Key = Value" line from the sensor
+ *
+ * @param ws station
+ * @param line NUL terminated line without the '\n', trimmed in place
+ * @param len length of the line
+ */
+void ws8x_feed(ws8x_t *ws, char *line, uint8_t len)
+{
+    char *eq = (char *)memchr(line, '=', len);
+    if (eq == NULL)
+    {
+        ws->noSeparator++;
+        return;
+    }
+
+    // Split into key and value, removing whitespace
+    char *key = ws8x_trim(line, eq);
+    ws8x_field field = ws8x_lookupKey(key, strlen(key));
+    if (field == WS8X_FIELD_UNKNOWN)
+    {
+        ws->unknownKeys++;
+        return;
+    }
+    char *value = ws8x_trim(eq + 1, line + len);
+
+    // "--" is reported by the sensor when a reading is not available
+    int32_t parsed;
+    ws8x_parse_result result = ws8x_parseFixed(value, fieldDecimals[field], fieldUnits[field], &parsed);
+    if (result != WS8X_PARSE_OK)
+    {
+        if (result == WS8X_PARSE_ERROR)
+        {
+            ws->parseErrors++;
+            ws->keyErrors[field]++;
+#ifdef PRINT_WX_SERIAL
+            Serial.printf("Invalid value for %s: %s\n", key, value);
+#endif
+        }
+        return;
+    }
+
+    ws->seen |= 1 << field;
+    switch (field)
+    {
+    case WS8X_FIELD_WIND_DIR:
+        ws8x_addDirection(ws, parsed);
+        ws8x_alertDirection(ws);
+        break;
+    case WS8X_FIELD_WIND_SPEED:
+        ws->lastSpeedMs = millis();
+        stats_add(&ws->speedStats, millis(), (int16_t)parsed);
+        if (ws->gustAvgSec != 0)
+        {
+            stats_add(&ws->gustMean, millis(), (int16_t)parsed);
+            stats_add(&ws->gustStats, millis(), (int16_t)stats_mean(&ws->gustMean));
+            ws8x_alertGust(ws, (int16_t)stats_mean(&ws->gustMean));
+        }
+        break;
+    case WS8X_FIELD_WIND_GUST:
+        if (ws->gustAvgSec == 0)
+        {
+            stats_add(&ws->gustStats, millis(), (int16_t)parsed);
+            ws8x_alertGust(ws, (int16_t)parsed);
+        }
+        break;
+    case WS8X_FIELD_BAT_VOLTAGE:
+        ws->batVoltage = parsed;
+        ws8x_alertVoltage(ws, SENSOR_ALERT_BAT_LOW, ws->alert.bat_low, parsed);
+        break;
+    case WS8X_FIELD_CAP_VOLTAGE:
+        ws->capVoltage = parsed;
+        ws8x_alertVoltage(ws, SENSOR_ALERT_CAP_LOW, ws->alert.cap_low, parsed);
+        break;
+    case WS8X_FIELD_TEMPERATURE: // Handle both sensor types
+        ws->temperature = parsed;
+        break;
+    case WS8X_FIELD_RAIN:
+        ws->rain = parsed;
+        break;
+    case WS8X_FIELD_RAIN_SUM:
+        ws->rainSum = parsed;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Initialize the station state
+ *
+ * @param ws station
+ */
+void ws8x_init(ws8x_t *ws)
+{
+    memset(ws, 0, sizeof(ws8x_t));
+    stats_init(&ws->speedStats, 0);
+    stats_init(&ws->gustStats, 0);
+    stats_init(&ws->gustMean, 0);
+}
+
+/**
+ * @brief Set the length of the wind statistics window
+ *
+ * @param ws station
+ * @param config window for mean, lull and gust, running mean time for the gust
+ */
+void ws8x_configure(ws8x_t *ws, const sensor_config *config)
+{
+    ws->speedStats.window_ms = config->window_ms;
+    ws->gustStats.window_ms = config->window_ms;
+    if (config->gust_avg_s != ws->gustAvgSec)
+    {
+        // The gust samples change meaning, start over
+        stats_reset(&ws->gustStats);
+        stats_reset(&ws->gustMean);
+        ws->gustAvgSec = config->gust_avg_s;
+    }
+    ws->gustMean.window_ms = config->gust_avg_s * 1000UL;
+    ws->deadband = config->deadband;
+    ws->alert = config->alert;
+}
+
+/**
+ * @brief Compute the report values from the collected samples, without output
+ *
+ * @param ws station
+ * @param report where to put the values
+ */
+static void ws8x_compute(ws8x_t *ws, ws8x_report *report)
+{
+    // Calculate averages, values are already scaled like in the payload
+    uint32_t now = millis();
+    stats_expire(&ws->speedStats, now);
+    stats_expire(&ws->gustStats, now);
+    int32_t velAvg = stats_mean(&ws->speedStats);
+    int32_t gust = stats_max(&ws->gustStats);
+    int32_t lull = -1; // No sample
+    if (ws->gustAvgSec != 0 && stats_count(&ws->gustStats) > 0)
+    {
+        lull = stats_min(&ws->gustStats);
+    }
+    else if (ws->gustAvgSec == 0 && stats_count(&ws->speedStats) > 0)
+    {
+        lull = stats_min(&ws->speedStats);
+    }
+    float dirAvg = ws8x_meanDirection(ws);
+
+    // Convert values to the payload integers
+    report->dir = (int16_t)lroundf(dirAvg);                            // Whole degrees
+    report->speed = (int16_t)velAvg;                                   // 1 decimal place
+    report->gust = (int16_t)gust;                                      // 1 decimal place
+    report->lull = (int16_t)((lull < 0) ? -10 : lull);                 // 1 decimal place, -1.0 if no sample
+    report->batVoltage = (int16_t)(((ws->batVoltage + 5) / 10) * 10); // Rounded to 0.1 V, scaled to 2 decimal places
+    report->capVoltage = (int16_t)(((ws->capVoltage + 5) / 10) * 10); // Rounded to 0.1 V, scaled to 2 decimal places
+    report->temperature = (int16_t)ws->temperature;                    // 1 decimal place
+    report->rain = (uint16_t)ws->rain;                                 // 1 decimal place
+    report->deviceMv = (uint16_t)(analogRead(BATTERY_PIN) * REAL_VBAT_MV_PER_LSB);
+}
+
+/**
+ * @brief Compute the report values from the collected samples
+ *
+ * @param ws station, the result is put into ws->report
+ */
+void ws8x_aggregate(ws8x_t *ws)
+{
+    ws8x_report *report = &ws->report;
+    ws8x_compute(ws, report);
+    // The direction shift is measured against this report from now on
+    ws->reportValid = true;
+    ws->alertLatched &= ~(1 << SENSOR_ALERT_DIR_SHIFT);
 
     // Print data
     Serial.printf("Wind Speed Avg: %.1f m/s, Wind Dir Avg: %d°, Gust: %.1f m/s, Lull: %.1f m/s\n",
-                  velAvg, (int)dirAvg, gust, lull);
+                  report->speed / 10.0f, report->dir, report->gust / 10.0f, report->lull / 10.0f);
+    Serial.printf("Wind Speed StdDev: %.2f m/s over %u samples\n",
+                  sqrtf((float)stats_variance(&ws->speedStats)) / 10.0f, stats_count(&ws->speedStats));
     Serial.printf("Battery Voltage: %.1f V, Capacitor Voltage: %.1f V, Temperature: %.1f °C\n",
-                  batVoltageF, capVoltageF, temperatureF);
-    Serial.printf("Rain: %.1f mm, Rain Sum: %d\n", rain, rainSum);
-
-    // Populate the buffer
-
-    // Clear the buffer
-    memset(m_lora_app_data->buffer, 0, size);
-
-    // Round the values to one decimal place
-    float roundedVelAvg = round(velAvg * 10) / 10.0;
-    float roundedDirAvg = round(dirAvg);
-    float roundedGust = round(gust * 10) / 10.0;
-    float roundedLull = round(lull * 10) / 10.0;
-    float roundedBatVoltageF = round(batVoltageF * 10) / 10.0;
-    float roundedCapVoltageF = round(capVoltageF * 10) / 10.0;
-    float roundedTemperatureF = round(temperatureF * 10) / 10.0;
-    float roundedRain = round(rain * 10) / 10.0;
-
-    // Convert values to integers
-    int16_t intVelAvg = (int16_t)(roundedVelAvg * 10);             // Scale to 1 decimal place
-    int16_t intDirAvg = (int16_t)(roundedDirAvg * 10);             // Scale to 1 decimal place
-    int16_t intGust = (int16_t)(roundedGust * 10);                 // Scale to 1 decimal place
-    int16_t intLull = (int16_t)(roundedLull * 10);                 // Scale to 1 decimal place
-    int16_t intBatVoltageF = (int16_t)(roundedBatVoltageF * 100);  // Scale to 2 decimal places
-    int16_t intCapVoltageF = (int16_t)(roundedCapVoltageF * 100);  // Scale to 2 decimal places
-    int16_t intTemperatureF = (int16_t)(roundedTemperatureF * 10); // Scale to 1 decimal place
-    uint16_t intRain = (uint16_t)(roundedRain * 10);               // Scale to 1 decimal place
-    uint16_t deviceVoltage_mv = (uint16_t)(analogRead(BATTERY_PIN) * REAL_VBAT_MV_PER_LSB);
+                  ws->batVoltage / 100.0f, ws->capVoltage / 100.0f, ws->temperature / 10.0f);
+    Serial.printf("Rain: %.1f mm, Rain Sum: %ld, Parse errors: %lu\n", ws->rain / 10.0f, ws->rainSum, ws->parseErrors);
+}
+
+/**
+ * @brief Check if a value moved further than its deadband
+ *
+ * @param now current value
+ * @param sent value in the last sent report
+ * @param deadband largest change that is not reported
+ * @return true if the change has to be reported
+ */
+static bool ws8x_outside(int32_t now, int32_t sent, uint16_t deadband)
+{
+    return abs(now - sent) > deadband;
+}
+
+/**
+ * @brief Check if the current values left the deadbands around the last sent report
+ *    Only values received since the last ws8x_reset() are compared, the
+ *    others are not known yet.
+ *
+ * @param ws station
+ * @return true if a report is needed, always true before the first one was sent
+ */
+bool ws8x_changed(ws8x_t *ws)
+{
+    if (!ws->sentValid)
+    {
+        return true;
+    }
+    ws8x_report now;
+    const ws8x_report *sent = &ws->sent;
+    const sensor_deadband *band = &ws->deadband;
+    ws8x_compute(ws, &now);
+
+    if (ws->dirCount > 0)
+    {
+        // Shortest turn between the two directions
+        int32_t turn = abs(now.dir - sent->dir) % 360;
+        if (turn > 180)
+        {
+            turn = 360 - turn;
+        }
+        if (ws8x_outside(turn, 0, band->dir))
+        {
+            return true;
+        }
+    }
+    if (stats_count(&ws->speedStats) > 0 &&
+        (ws8x_outside(now.speed, sent->speed, band->wind) ||
+         ws8x_outside(now.gust, sent->gust, band->wind) ||
+         ws8x_outside(now.lull, sent->lull, band->wind)))
+    {
+        return true;
+    }
+    if (((ws->seen & (1 << WS8X_FIELD_BAT_VOLTAGE)) && ws8x_outside(now.batVoltage, sent->batVoltage, band->voltage)) ||
+        ((ws->seen & (1 << WS8X_FIELD_CAP_VOLTAGE)) && ws8x_outside(now.capVoltage, sent->capVoltage, band->voltage)) ||
+        ((ws->seen & (1 << WS8X_FIELD_TEMPERATURE)) && ws8x_outside(now.temperature, sent->temperature, band->temperature)))
+    {
+        return true;
+    }
+    // Any rain is worth a report
+    return (ws->seen & (1 << WS8X_FIELD_RAIN)) && now.rain != sent->rain;
+}
+
+/**
+ * @brief Put the alerts waiting to be sent into the alert uplink
+ *    Each alert is SENSOR_ALERT_RECORD_SIZE bytes: the sensor_alert_rule,
+ *    then the value as int16 little endian in the units of the report
+ *    (gust 0.1 m/s, new mean direction deg, voltages 0.01 V).
+ *
+ * @param ws station
+ * @param buffer where to write the records
+ * @param size size of the buffer
+ * @return uint8_t bytes written, 0 if no alert is waiting
+ */
+uint8_t ws8x_alerts(ws8x_t *ws, uint8_t *buffer, uint8_t size)
+{
+    uint8_t offset = 0;
+    ws->alertSending = 0;
+    for (uint8_t rule = 0; rule < SENSOR_ALERT_NUM; rule++)
+    {
+        if ((ws->alertPending & (1 << rule)) && offset + SENSOR_ALERT_RECORD_SIZE <= size)
+        {
+            ws->alertSending |= 1 << rule;
+            buffer[offset] = rule;
+            memcpy(&buffer[offset + 1], &ws->alertValue[rule], sizeof(int16_t));
+            offset += SENSOR_ALERT_RECORD_SIZE;
+        }
+    }
+    return offset;
+}
+
+/**
+ * @brief The alerts of the last ws8x_alerts() were sent
+ *
+ * @param ws station
+ */
+void ws8x_alerts_sent(ws8x_t *ws)
+{
+    ws->alertPending &= ~ws->alertSending;
+    ws->alertSending = 0;
+}
+
+/**
+ * @brief Remember the last aggregated report as sent, the deadbands are around it
+ *
+ * @param ws station
+ */
+void ws8x_sent(ws8x_t *ws)
+{
+    ws->sent = ws->report;
+    ws->sentValid = true;
+}
+
+// Packed report (SENSOR_PAYLOAD_PACKED). Each field of ws8x_report is sent
+// as (value - offset) / step, rounded, in width bits, MSB first and in this
+// order. Values out of range saturate, the all ones code means "no data"
+// and is sent when the value equals none. 80 bits, so with the version
+// byte the uplink is 11 bytes and still fits US915 DR0.
+// tools/ws8x_decoder.js decodes this, change both together and bump
+// SENSOR_PAYLOAD_VERSION.
+#define WS8X_NONE INT32_MIN // Field always has a value
+#define WS8X_SCHEMA(X)                                          \
+    X(dir, 9, 0, 1, WS8X_NONE)           /* 0 .. 359 deg */     \
+    X(speed, 9, 0, 1, WS8X_NONE)         /* 0 .. 51.0 m/s */    \
+    X(gust, 10, 0, 1, WS8X_NONE)         /* 0 .. 102.2 m/s */   \
+    X(lull, 9, 0, 1, -10)                /* 0 .. 51.0 m/s */    \
+    X(batVoltage, 7, 0, 10, WS8X_NONE)   /* 0 .. 12.6 V */      \
+    X(capVoltage, 7, 0, 10, WS8X_NONE)   /* 0 .. 12.6 V */      \
+    X(temperature, 10, -400, 1, WS8X_NONE) /* -40.0 .. 62.2 C */ \
+    X(rain, 12, 0, 1, WS8X_NONE)         /* 0 .. 409.4 mm */    \
+    X(deviceMv, 7, 2500, 20, WS8X_NONE)  /* 2500 .. 5020 mV */
+
+#define WS8X_SCHEMA_WIDTH(field, width, offset, step, none) +width
+#define WS8X_SCHEMA_ONE(field, width, offset, step, none) +1
+/** Bytes of the packed report */
+#define WS8X_PACKED_SIZE (((0 WS8X_SCHEMA(WS8X_SCHEMA_WIDTH)) + 7) / 8)
+/** Fields of the packed report */
+#define WS8X_PACKED_FIELDS (0 WS8X_SCHEMA(WS8X_SCHEMA_ONE))
+
+/**
+ * @brief Scale a report value to its packed code
+ *
+ * @param value report value
+ * @param width bits of the field
+ * @param offset value of code 0
+ * @param step value per code
+ * @param none value that is sent as "no data"
+ * @return uint32_t code
+ */
+static uint32_t ws8x_packCode(int32_t value, uint8_t width, int32_t offset, int32_t step, int32_t none)
+{
+    uint32_t noData = (1UL << width) - 1;
+    if (value == none)
+    {
+        return noData;
+    }
+    if (value <= offset)
+    {
+        return 0;
+    }
+    uint32_t code = (uint32_t)(value - offset + step / 2) / step;
+    return (code >= noData) ? noData - 1 : code;
+}
+
+/**
+ * @brief Get the packed codes of the last report, in WS8X_SCHEMA order
+ *
+ * @param ws station
+ * @param codes field codes
+ * @param widths field widths in bits
+ * @param max size of codes and widths
+ * @return uint8_t number of fields, 0 if they do not fit
+ */
+uint8_t ws8x_fields(ws8x_t *ws, uint32_t *codes, uint8_t *widths, uint8_t max)
+{
+    const ws8x_report *report = &ws->report;
+    uint8_t count = 0;
+
+    if (max < WS8X_PACKED_FIELDS)
+    {
+        return 0;
+    }
+#define WS8X_SCHEMA_CODE(field, width, offset, step, none)                \
+    codes[count] = ws8x_packCode(report->field, width, offset, step, none); \
+    widths[count++] = width;
+    WS8X_SCHEMA(WS8X_SCHEMA_CODE)
+#undef WS8X_SCHEMA_CODE
+
+    return count;
+}
+
+/**
+ * @brief Put the last report into the uplink buffer, packed
+ *
+ * @param ws station
+ * @param buffer where to write the payload
+ * @param size space left in the buffer
+ * @return uint8_t number of bytes written, 0 if the report does not fit
+ */
+static uint8_t ws8x_encodePacked(ws8x_t *ws, uint8_t *buffer, uint8_t size)
+{
+    uint32_t codes[WS8X_PACKED_FIELDS];
+    uint8_t widths[WS8X_PACKED_FIELDS];
+    bitpack pack;
+
+    if (size < WS8X_PACKED_SIZE)
+    {
+        return 0;
+    }
+    uint8_t count = ws8x_fields(ws, codes, widths, WS8X_PACKED_FIELDS);
+    bitpack_init(&pack, buffer, WS8X_PACKED_SIZE);
+    for (int idx = 0; idx < count; idx++)
+    {
+        bitpack_put(&pack, codes[idx], widths[idx]);
+    }
+
+    return bitpack_bytes(&pack);
+}
+
+/**
+ * @brief Put the last report into the uplink buffer
+ *
+ * @param ws station
+ * @param format SENSOR_PAYLOAD_LEGACY or SENSOR_PAYLOAD_PACKED
+ * @param buffer where to write the payload
+ * @param size space left in the buffer
+ * @return uint8_t number of bytes written, 0 if the report does not fit
+ */
+uint8_t ws8x_encode(ws8x_t *ws, uint8_t format, uint8_t *buffer, uint8_t size)
+{
+    const ws8x_report *report = &ws->report;
+    int16_t intDirAvg = report->dir * 10; // Scaled to 1 decimal place
+
+    if (format == SENSOR_PAYLOAD_PACKED)
+    {
+        return ws8x_encodePacked(ws, buffer, size);
+    }
+
+    // Legacy layout, nine 16 bit little endian values
+    if (size < WS8X_PAYLOAD_SIZE)
+    {
+        return 0;
+    }
+
     // Pack the integers into the buffer in a specific order
     int offset = 0;
-    memcpy(&m_lora_app_data->buffer[offset], &intDirAvg, sizeof(int16_t));
+    memcpy(&buffer[offset], &intDirAvg, sizeof(int16_t));
     offset += sizeof(int16_t);
-    memcpy(&m_lora_app_data->buffer[offset], &intVelAvg, sizeof(int16_t));
+    memcpy(&buffer[offset], &report->speed, sizeof(int16_t));
     offset += sizeof(int16_t);
-    memcpy(&m_lora_app_data->buffer[offset], &intGust, sizeof(int16_t));
+    memcpy(&buffer[offset], &report->gust, sizeof(int16_t));
     offset += sizeof(int16_t);
-    memcpy(&m_lora_app_data->buffer[offset], &intLull, sizeof(int16_t));
+    memcpy(&buffer[offset], &report->lull, sizeof(int16_t));
     offset += sizeof(int16_t);
-    memcpy(&m_lora_app_data->buffer[offset], &intBatVoltageF, sizeof(int16_t));
+    memcpy(&buffer[offset], &report->batVoltage, sizeof(int16_t));
     offset += sizeof(int16_t);
-    memcpy(&m_lora_app_data->buffer[offset], &intCapVoltageF, sizeof(int16_t));
+    memcpy(&buffer[offset], &report->capVoltage, sizeof(int16_t));
     offset += sizeof(int16_t);
-    memcpy(&m_lora_app_data->buffer[offset], &intTemperatureF, sizeof(int16_t));
+    memcpy(&buffer[offset], &report->temperature, sizeof(int16_t));
     offset += sizeof(int16_t);
-    memcpy(&m_lora_app_data->buffer[offset], &intRain, sizeof(uint16_t));
+    memcpy(&buffer[offset], &report->rain, sizeof(uint16_t));
     offset += sizeof(uint16_t);
-    memcpy(&m_lora_app_data->buffer[offset], &deviceVoltage_mv, sizeof(uint16_t));
+    memcpy(&buffer[offset], &report->deviceMv, sizeof(uint16_t));
     offset += sizeof(uint16_t);
 
-    // Print debug information
-    Serial.print("Payload bytes: ");
-    for (int i = 0; i < m_lora_app_data->buffsize; i++)
-    {
-        Serial.printf("%02X", m_lora_app_data->buffer[i]);
-    }
-    Serial.println();
+    return offset;
+}
 
-    // Set the buffer size to the total number of bytes
-    m_lora_app_data->buffsize = offset;
+/**
+ * @brief Put the report of the running interval into a buffer
+ *    Computes the values like ws8x_aggregate() without keeping them, so the
+ *    last report, the alerts and the next uplink do not change.
+ *
+ * @param ws station
+ * @param format SENSOR_PAYLOAD_LEGACY or SENSOR_PAYLOAD_PACKED
+ * @param buffer where to write the payload
+ * @param size space left in the buffer
+ * @return uint8_t number of bytes written, 0 if the report does not fit
+ */
+uint8_t ws8x_preview(ws8x_t *ws, uint8_t format, uint8_t *buffer, uint8_t size)
+{
+    ws8x_report last = ws->report;
+    ws8x_compute(ws, &ws->report);
+    uint8_t len = ws8x_encode(ws, format, buffer, size);
+    ws->report = last;
+    return len;
 }
 
-void ws8x_reset_counters() {
-    // Reset counters
-    dir_sum_sin = dir_sum_cos = 0; // Reset wind direction sums
-    velSum = 0;                    // Reset wind speed sum
-    velCount = dirCount = 0;       // Reset wind direction and speed counts
-    gust = 0;                      // Reset gust
-    lull = -1;                     // Reset lull
+/**
+ * @brief Start the next report interval
+ *
+ * @param ws station
+ */
+void ws8x_reset(ws8x_t *ws)
+{
+    // Reset counters, wind speed, gust and lull are windowed and not reset here
+    ws->dir_sum_sin = ws->dir_sum_cos = 0; // Reset wind direction sums
+    ws->dirCount = 0;                      // Reset wind direction count
 
     // Reset other metrics
-    batVoltageF = 0;  // Reset battery voltage
-    capVoltageF = 0;  // Reset capacitor voltage
-    temperatureF = 0; // Reset temperature
-    rain = 0;         // Reset rain
-    rainSum = 0;      // Reset rain sum
-}
\ No newline at end of file
+    ws->batVoltage = 0;  // Reset battery voltage
+    ws->capVoltage = 0;  // Reset capacitor voltage
+    ws->temperature = 0; // Reset temperature
+    ws->rain = 0;        // Reset rain
+    ws->rainSum = 0;     // Reset rain sum
+    ws->parseErrors = 0; // Reset parse error count
+    ws->seen = 0;
+}
+
+/**
+ * @brief Get the health counters of the station
+ *
+ * @param ws station
+ * @param health the driver part of it is filled
+ */
+void ws8x_health(ws8x_t *ws, sensor_health *health)
+{
+    health->no_separator = ws->noSeparator;
+    health->unknown_keys = ws->unknownKeys;
+    health->parse_errors = 0;
+    for (int field = 0; field < WS8X_FIELD_NUM; field++)
+    {
+        health->parse_errors += ws->keyErrors[field];
+    }
+    health->last_valid_ms = ws->lastSpeedMs;
+    health->truncated = ws->speedStats.truncated + ws->gustStats.truncated + ws->gustMean.truncated;
+}
+
+/**
+ * @brief Print the malformed values per key as <key>:<count>/...
+ *
+ * @param ws station
+ * @param buffer where to print
+ * @param size size of the buffer
+ * @return int length like snprintf()
+ */
+int ws8x_health_keys(ws8x_t *ws, char *buffer, size_t size)
+{
+    int len = 0;
+    for (int field = WS8X_FIELD_UNKNOWN + 1; field < WS8X_FIELD_NUM && (size_t)len < size; field++)
+    {
+        len += snprintf(&buffer[len], size - len, "%s%s:%lu", (len == 0) ? "" : "/",
+                        fieldNames[field], ws->keyErrors[field]);
+    }
+    return len;
+}
@@ -1,10 +1,126 @@
 #ifndef WS8x_H
 #define WS8x_H
 #include <LoRaWan-RAK4630.h>
-void ws8x_init();
-void ws8x_checkSerial();
-void ws8x_populate_lora_buffer(lmh_app_data_t *m_lora_app_data, int size);
-void ws8x_reset_counters();
+#include "sensor.h"
+#include "stats.h"
+
+/** Values the station reports, see WS8X_KEYS in ws8x.cpp */
+enum ws8x_field
+{
+    WS8X_FIELD_UNKNOWN = 0,
+    WS8X_FIELD_WIND_DIR,
+    WS8X_FIELD_WIND_SPEED,
+    WS8X_FIELD_WIND_GUST,
+    WS8X_FIELD_BAT_VOLTAGE,
+    WS8X_FIELD_CAP_VOLTAGE,
+    WS8X_FIELD_TEMPERATURE,
+    WS8X_FIELD_RAIN,
+    WS8X_FIELD_RAIN_SUM,
+    WS8X_FIELD_NUM
+};
+
+/** Size of the report in the legacy uplink */
+#define WS8X_PAYLOAD_SIZE 18
+
+// Direction shift alerts need this many samples since the report interval
+// started and a mean wind speed (0.1 m/s) of at least WS8X_ALERT_DIR_SPEED
+#define WS8X_ALERT_DIR_SAMPLES 10
+#define WS8X_ALERT_DIR_SPEED 10
+/** A low voltage alert is raised again after the voltage was this much (0.01 V) above the limit */
+#define WS8X_ALERT_VOLT_HYST 10
+
+/** Values of one report, scaled like in the uplink */
+struct ws8x_report
+{
+    int16_t dir;         // deg
+    int16_t speed;       // 0.1 m/s
+    int16_t gust;        // 0.1 m/s
+    int16_t lull;        // 0.1 m/s, -10 if there was no sample
+    int16_t batVoltage;  // 0.01 V, rounded to 0.1 V
+    int16_t capVoltage;  // 0.01 V, rounded to 0.1 V
+    int16_t temperature; // 0.1 °C
+    uint16_t rain;       // 0.1 mm
+    uint16_t deviceMv;   // Battery of the node in mV
+};
+
+/** State of one WS80/WS85 station, driver for the sensor registry in sensor.h */
+struct ws8x_t
+{
+    // Wind direction as sum of unit vectors
+    int32_t dir_sum_sin; // Sum of sin(dir) in Q14
+    int32_t dir_sum_cos; // Sum of cos(dir) in Q14
+    int dirCount;
+
+    // Wind speed statistics are kept over a sliding time window instead of
+    // "since the last successful send", so a failed send does not widen them.
+    // gustStats holds either the gusts reported by the sensor or, if a gust
+    // averaging time is set, the running mean of WindSpeed over that time
+    // (WMO style 3 s gust). Then lull is the minimum of that running mean too.
+    // All values in 0.1 m/s.
+    stats_window speedStats;
+    stats_window gustStats;
+    stats_window gustMean;
+    uint8_t gustAvgSec; // 0 = gust from the sensor
+
+    // Other metrics, kept as scaled integers
+    int32_t batVoltage;  // 0.01 V
+    int32_t capVoltage;  // 0.01 V
+    int32_t temperature; // 0.1 °C
+    int32_t rain;        // 0.1 mm
+    int32_t rainSum;
+    uint32_t parseErrors; // Known keys with a malformed value
+
+    // Health counters since boot, see ws8x_health()
+    uint32_t noSeparator;               // Lines without '='
+    uint32_t unknownKeys;               // Lines with a key that is not in WS8X_KEYS
+    uint32_t keyErrors[WS8X_FIELD_NUM]; // Malformed values per field
+    uint32_t lastSpeedMs;               // millis() of the last valid WindSpeed, 0 = none yet
+    uint16_t seen;                      // Bit per ws8x_field received since the last ws8x_reset()
+
+    ws8x_report report; // Result of the last ws8x_aggregate()
+
+    // Change-only reporting, see ws8x_changed()
+    ws8x_report sent;         // Last report that was sent
+    bool sentValid;           // sent holds a report
+    sensor_deadband deadband; // Largest changes that are not reported
+
+    // Alert rules, checked on every sample, see ws8x_alerts()
+    sensor_alert_config alert;
+    bool reportValid;                     // report holds an aggregated report
+    uint8_t alertLatched;                 // Bit per sensor_alert_rule, rule active and already raised
+    uint8_t alertPending;                 // Bit per sensor_alert_rule, raised but not sent yet
+    uint8_t alertSending;                 // Bit per sensor_alert_rule, put into the alert uplink
+    int16_t alertValue[SENSOR_ALERT_NUM]; // Worst value of a pending alert
+};
+
+void ws8x_init(ws8x_t *ws);
+void ws8x_configure(ws8x_t *ws, const sensor_config *config);
+void ws8x_feed(ws8x_t *ws, char *line, uint8_t len);
+void ws8x_aggregate(ws8x_t *ws);
+uint8_t ws8x_encode(ws8x_t *ws, uint8_t format, uint8_t *buffer, uint8_t size);
+uint8_t ws8x_preview(ws8x_t *ws, uint8_t format, uint8_t *buffer, uint8_t size);
+void ws8x_reset(ws8x_t *ws);
+uint8_t ws8x_fields(ws8x_t *ws, uint32_t *codes, uint8_t *widths, uint8_t max);
+void ws8x_health(ws8x_t *ws, sensor_health *health);
+int ws8x_health_keys(ws8x_t *ws, char *buffer, size_t size);
+bool ws8x_changed(ws8x_t *ws);
+void ws8x_sent(ws8x_t *ws);
+uint8_t ws8x_alerts(ws8x_t *ws, uint8_t *buffer, uint8_t size);
+void ws8x_alerts_sent(ws8x_t *ws);
+
+/** Result of ws8x_parseFixed() */
+enum ws8x_parse_result
+{
+    WS8X_PARSE_OK = 0,
+    WS8X_PARSE_NO_DATA, // Sensor reported "--"
+    WS8X_PARSE_ERROR,
+};
+
+// Steps of ws8x_feed(), not static so the host tests can time them
+ws8x_field ws8x_lookupKey(const char *key, size_t len);
+ws8x_parse_result ws8x_parseFixed(const char *str, uint8_t decimals, const char *unit, int32_t *out);
+void ws8x_addDirection(ws8x_t *ws, int32_t dir);
+
 extern unsigned long send_interval_ms; // main uses this
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,154 @@
+/**
+ * @file Arduino.h
+ * @brief Host stand-in for the parts of the Arduino core and FreeRTOS the
+ *    modules built in the native test environment use
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+typedef bool boolean;
+
+// millis() and micros() only move when a test sets them, so the modules
+// see exactly the times a test replays.
+
+inline uint32_t &native_millis(void)
+{
+	static uint32_t ms = 0;
+	return ms;
+}
+
+inline uint32_t &native_micros(void)
+{
+	static uint32_t us = 0;
+	return us;
+}
+
+/** Set both clocks */
+inline void native_set_time_us(uint64_t us)
+{
+	native_micros() = (uint32_t)us;
+	native_millis() = (uint32_t)(us / 1000);
+}
+
+inline unsigned long millis(void) { return native_millis(); }
+inline unsigned long micros(void) { return native_micros(); }
+inline void delay(unsigned long) {}
+
+/** Serial port, the output of the modules is not part of the tests and dropped */
+struct HardwareSerial
+{
+	void begin(unsigned long) {}
+	int available(void) { return 0; }
+	int read(void) { return -1; }
+	int printf(const char *format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		int len = vsnprintf(NULL, 0, format, args);
+		va_end(args);
+		return len;
+	}
+};
+inline HardwareSerial &native_serial(void)
+{
+	static HardwareSerial serial;
+	return serial;
+}
+#define Serial native_serial()
+
+// ADC of the battery, tests set the raw value
+inline int &native_analog(void)
+{
+	static int raw = 0;
+	return raw;
+}
+inline int analogRead(uint8_t) { return native_analog(); }
+#define BATTERY_PIN 5
+#define REAL_VBAT_MV_PER_LSB (1.73 * 0.73242188F)
+
+// FreeRTOS task notifications on host threads. The tick is the real time
+// in ms, so waits with a timeout end like on the device.
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xffffffffUL
+#define pdMS_TO_TICKS(x) ((TickType_t)(x))
+#define portYIELD_FROM_ISR(x) (void)(x)
+
+/** Notification of one thread */
+struct native_task
+{
+	std::mutex lock;
+	std::condition_variable wake;
+	uint32_t count;
+};
+typedef native_task *TaskHandle_t;
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	static thread_local native_task task;
+	return &task;
+}
+
+inline TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+inline void xTaskNotifyGive(TaskHandle_t task)
+{
+	std::lock_guard<std::mutex> guard(task->lock);
+	task->count++;
+	task->wake.notify_one();
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+	xTaskNotifyGive(task);
+	*woken = pdTRUE;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+	native_task *task = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> guard(task->lock);
+	if (ticks == portMAX_DELAY)
+	{
+		task->wake.wait(guard, [task] { return task->count != 0; });
+	}
+	else
+	{
+		task->wake.wait_for(guard, std::chrono::milliseconds(ticks), [task] { return task->count != 0; });
+	}
+	uint32_t count = task->count;
+	if (count != 0)
+	{
+		task->count = clear ? 0 : count - 1;
+	}
+	return count;
+}
+
+/** There are no interrupts on the host */
+inline bool isInISR(void) { return false; }
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * @file LoRaWan-Arduino.h
+ * @brief Host stand-in for the parts of the SX126x-Arduino library the
+ *    modules built in the native test environment use
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef NATIVE_LORAWAN_ARDUINO_H
+#define NATIVE_LORAWAN_ARDUINO_H
+#include <Arduino.h>
+
+typedef enum
+{
+	LORAMAC_REGION_AS923,
+	LORAMAC_REGION_AU915,
+	LORAMAC_REGION_CN470,
+	LORAMAC_REGION_CN779,
+	LORAMAC_REGION_EU433,
+	LORAMAC_REGION_EU868,
+	LORAMAC_REGION_KR920,
+	LORAMAC_REGION_IN865,
+	LORAMAC_REGION_US915,
+	LORAMAC_REGION_AS923_2,
+	LORAMAC_REGION_AS923_3,
+	LORAMAC_REGION_AS923_4,
+	LORAMAC_REGION_RU864,
+} LoRaMacRegion_t;
+
+typedef struct
+{
+	uint8_t *buffer;
+	uint8_t buffsize;
+	uint8_t port;
+	int16_t rssi;
+	int8_t snr;
+} lmh_app_data_t;
+
+typedef enum
+{
+	MODEM_FSK = 0,
+	MODEM_LORA,
+} RadioModems_t;
+
+#define LORA_CAD_08_SYMBOL 3
+#define LORA_CAD_ONLY 0
+
+/** Radio driver, the functions a test does not set are NULL */
+struct Radio_s
+{
+	void (*Sleep)(void);
+	void (*Standby)(void);
+	void (*SetChannel)(uint32_t freq);
+	void (*SetTxConfig)(RadioModems_t modem, int8_t power, uint32_t fdev, uint32_t bandwidth,
+						uint32_t datarate, uint8_t coderate, uint16_t preambleLen, bool fixLen,
+						bool crcOn, bool freqHopOn, uint8_t hopPeriod, bool iqInverted, uint32_t timeout);
+	void (*SetRxConfig)(RadioModems_t modem, uint32_t bandwidth, uint32_t datarate, uint8_t coderate,
+						uint32_t bandwidthAfc, uint16_t preambleLen, uint16_t symbTimeout, bool fixLen,
+						uint8_t payloadLen, bool crcOn, bool freqHopOn, uint8_t hopPeriod, bool iqInverted,
+						bool rxContinuous);
+	void (*Rx)(uint32_t timeout);
+	void (*Send)(uint8_t *buffer, uint8_t size);
+	void (*SetCadParams)(uint8_t cadSymbolNum, uint8_t cadDetPeak, uint8_t cadDetMin, uint8_t cadExitMode,
+						 uint32_t cadTimeout);
+	void (*StartCad)(void);
+};
+
+inline Radio_s &native_radio(void)
+{
+	static Radio_s radio = {};
+	return radio;
+}
+/** A test simulates the radio by setting the functions of Radio */
+#define Radio native_radio()
+
+#endif
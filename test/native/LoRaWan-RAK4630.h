@@ -0,0 +1,14 @@
+/**
+ * @file LoRaWan-RAK4630.h
+ * @brief Host stand-in, the RAK4630 header of the SX126x-Arduino library
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef NATIVE_LORAWAN_RAK4630_H
+#define NATIVE_LORAWAN_RAK4630_H
+#include <LoRaWan-Arduino.h>
+
+#endif
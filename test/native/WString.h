@@ -0,0 +1,208 @@
+/**
+ * @file WString.h
+ * @brief Host stand-in for the Arduino String class, for the benchmarks
+ *    against the parser before user-001. The buffer handling follows
+ *    WString.cpp of the Arduino core: every String owns a heap buffer of
+ *    exactly length + 1 bytes, even when it is empty, and grows it with
+ *    realloc() one append at a time. Stream::readStringUntil() appends
+ *    one character per read. All buffer calls go through native_alloc(),
+ *    so a benchmark can count them.
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#ifndef NATIVE_WSTRING_H
+#define NATIVE_WSTRING_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/** Heap calls of String since the last reset */
+struct native_alloc_stats
+{
+	uint32_t calls;	 // malloc() and realloc() calls
+	uint64_t bytes;	 // Bytes asked for by them
+	uint32_t frees;	 // free() calls
+};
+
+inline native_alloc_stats &native_alloc(void)
+{
+	static native_alloc_stats stats;
+	return stats;
+}
+
+/** realloc() that is counted */
+inline void *native_realloc(void *ptr, size_t size)
+{
+	native_alloc().calls++;
+	native_alloc().bytes += size;
+	return realloc(ptr, size);
+}
+
+/** free() that is counted */
+inline void native_free(void *ptr)
+{
+	if (ptr != NULL)
+	{
+		native_alloc().frees++;
+	}
+	free(ptr);
+}
+
+class String
+{
+public:
+	String(const char *cstr = "") : buffer(NULL), capacity(0), len(0) { copy(cstr, strlen(cstr)); }
+	String(const String &value) : buffer(NULL), capacity(0), len(0) { copy(value.buffer, value.len); }
+	String(String &&rval) : buffer(rval.buffer), capacity(rval.capacity), len(rval.len)
+	{
+		rval.buffer = NULL;
+		rval.capacity = 0;
+		rval.len = 0;
+	}
+	~String() { native_free(buffer); }
+
+	String &operator=(const String &rhs)
+	{
+		if (this != &rhs)
+		{
+			copy(rhs.buffer, rhs.len);
+		}
+		return *this;
+	}
+	String &operator=(String &&rval)
+	{
+		if (this != &rval)
+		{
+			native_free(buffer);
+			buffer = rval.buffer;
+			capacity = rval.capacity;
+			len = rval.len;
+			rval.buffer = NULL;
+			rval.capacity = 0;
+			rval.len = 0;
+		}
+		return *this;
+	}
+	String &operator=(const char *cstr)
+	{
+		copy(cstr, strlen(cstr));
+		return *this;
+	}
+
+	String &operator+=(char c)
+	{
+		char buf[2] = {c, '\0'};
+		concat(buf, 1);
+		return *this;
+	}
+
+	unsigned int length(void) const { return len; }
+	const char *c_str(void) const { return buffer; }
+
+	bool operator==(const char *cstr) const { return strcmp(buffer, cstr) == 0; }
+	bool operator!=(const char *cstr) const { return !(*this == cstr); }
+
+	bool endsWith(const String &suffix) const
+	{
+		return len >= suffix.len && strcmp(&buffer[len - suffix.len], suffix.buffer) == 0;
+	}
+
+	int indexOf(char ch) const
+	{
+		const char *found = strchr(buffer, ch);
+		return found == NULL ? -1 : (int)(found - buffer);
+	}
+
+	String substring(unsigned int left) const { return substring(left, len); }
+	String substring(unsigned int left, unsigned int right) const
+	{
+		String out;
+		if (left > len)
+		{
+			return out;
+		}
+		if (right > len)
+		{
+			right = len;
+		}
+		char temp = buffer[right];
+		buffer[right] = '\0';
+		out = buffer + left;
+		buffer[right] = temp;
+		return out;
+	}
+
+	void trim(void)
+	{
+		if (len == 0)
+		{
+			return;
+		}
+		char *begin = buffer;
+		while (isspace((unsigned char)*begin))
+		{
+			begin++;
+		}
+		char *end = buffer + len - 1;
+		while (isspace((unsigned char)*end) && end >= begin)
+		{
+			end--;
+		}
+		len = end + 1 - begin;
+		if (begin > buffer)
+		{
+			memmove(buffer, begin, len);
+		}
+		buffer[len] = '\0';
+	}
+
+	float toFloat(void) const { return (float)atof(buffer); }
+
+private:
+	char *buffer;
+	unsigned int capacity;
+	unsigned int len;
+
+	/** Grow to hold size characters, the buffer is never larger than needed */
+	bool reserve(unsigned int size)
+	{
+		if (buffer != NULL && capacity >= size)
+		{
+			return true;
+		}
+		char *grown = (char *)native_realloc(buffer, size + 1);
+		if (grown == NULL)
+		{
+			return false;
+		}
+		buffer = grown;
+		capacity = size;
+		return true;
+	}
+
+	void copy(const char *cstr, unsigned int length)
+	{
+		if (reserve(length))
+		{
+			len = length;
+			memcpy(buffer, cstr, length);
+			buffer[len] = '\0';
+		}
+	}
+
+	void concat(const char *cstr, unsigned int length)
+	{
+		if (reserve(len + length))
+		{
+			memcpy(buffer + len, cstr, length);
+			len += length;
+			buffer[len] = '\0';
+		}
+	}
+};
+
+#endif
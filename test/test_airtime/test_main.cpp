@@ -0,0 +1,165 @@
+/**
+ * @file test_main.cpp
+ * @brief Time on air against the Semtech formula, pio test -e native
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include <unity.h>
+#include <LoRaWan-Arduino.h>
+#include "airtime.h"
+
+/** Reference time on air, explicit header, CRC, 8 symbol preamble, CR 4/5 */
+struct airtime_reference
+{
+	uint8_t sf;
+	uint32_t bw_hz;
+	uint16_t size;
+	uint32_t us;
+};
+
+// Values of the SX1261/2 datasheet formula (6.1.4), as the Semtech LoRa
+// calculator gives them. The low data rate optimization is on for SF11 and
+// SF12 at 125 kHz and SF12 at 250 kHz.
+static const airtime_reference references[] = {
+	{7, 125000, 13, 46336},
+	{7, 125000, 51, 102656},
+	{7, 250000, 13, 23168},
+	{7, 500000, 51, 25664},
+	{8, 125000, 13, 82432},
+	{8, 250000, 51, 92416},
+	{8, 500000, 13, 20608},
+	{9, 125000, 51, 328704},
+	{9, 250000, 13, 82432},
+	{9, 500000, 255, 312576},
+	{10, 125000, 13, 288768},
+	{10, 125000, 51, 616448},
+	{10, 500000, 51, 154112},
+	{11, 125000, 13, 577536},
+	{11, 125000, 51, 1314816},
+	{11, 250000, 51, 575488},
+	{11, 500000, 13, 144384},
+	{12, 125000, 1, 827392},
+	{12, 125000, 51, 2465792},
+	{12, 125000, 255, 9019392},
+	{12, 250000, 51, 1232896},
+	{12, 500000, 51, 534528},
+};
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+/**
+ * @brief The formula in floating point, like the datasheet writes it
+ */
+static double semtech_us(const airtime_modulation *mod, uint16_t size)
+{
+	double symbol_s = (double)(1UL << mod->sf) / mod->bw_hz;
+	int de = (symbol_s >= 0.016) ? 1 : 0;
+	double bits = 8.0 * size - 4.0 * mod->sf + 28 + (mod->crc ? 16 : 0) - (mod->implicit_header ? 20 : 0);
+	double payload = ceil(bits / (4.0 * (mod->sf - 2 * de))) * (mod->cr + 4);
+	if (payload < 0)
+	{
+		payload = 0;
+	}
+	return (mod->preamble + 4.25 + 8 + payload) * symbol_s * 1e6;
+}
+
+static void test_reference_values(void)
+{
+	airtime_modulation mod = {7, 125000, 1, 8, false, true};
+	for (size_t idx = 0; idx < sizeof(references) / sizeof(references[0]); idx++)
+	{
+		mod.sf = references[idx].sf;
+		mod.bw_hz = references[idx].bw_hz;
+		char msg[48];
+		snprintf(msg, sizeof(msg), "SF%d %lu Hz %d bytes", mod.sf, (unsigned long)mod.bw_hz, references[idx].size);
+		TEST_ASSERT_EQUAL_UINT32_MESSAGE(references[idx].us, airtime_us(&mod, references[idx].size), msg);
+	}
+}
+
+static void test_low_data_rate_optimization(void)
+{
+	// SF11 / 125 kHz has 16.384 ms symbols, with the optimization a symbol
+	// carries 9 instead of 11 bits, 51 bytes take 60 payload symbols instead of 50
+	airtime_modulation mod = {11, 125000, 1, 8, false, true};
+	uint32_t symbol_us = 16384;
+	TEST_ASSERT_EQUAL_UINT32((4 * 8 + 17 + 4 * (8 + 60)) * symbol_us / 4, airtime_us(&mod, 51));
+	// 8.192 ms symbols at 250 kHz are below the limit
+	mod.bw_hz = 250000;
+	TEST_ASSERT_EQUAL_UINT32((4 * 8 + 17 + 4 * (8 + 50)) * (symbol_us / 2) / 4, airtime_us(&mod, 51));
+}
+
+static void test_against_formula(void)
+{
+	static const uint32_t bandwidths[] = {125000, 250000, 500000};
+	airtime_modulation mod;
+	for (uint8_t sf = 7; sf <= 12; sf++)
+	{
+		for (uint8_t bw = 0; bw < 3; bw++)
+		{
+			for (uint8_t cr = 1; cr <= 4; cr++)
+			{
+				for (uint8_t flags = 0; flags < 4; flags++)
+				{
+					mod.sf = sf;
+					mod.bw_hz = bandwidths[bw];
+					mod.cr = cr;
+					mod.preamble = (flags & 1) ? 12 : 8;
+					mod.implicit_header = (flags & 2) != 0;
+					mod.crc = (flags & 1) == 0;
+					for (uint16_t size = 0; size <= 255; size++)
+					{
+						double expected = semtech_us(&mod, size);
+						// airtime_us() truncates to whole us
+						TEST_ASSERT_INT_WITHIN(1, (int64_t)expected, airtime_us(&mod, size));
+					}
+				}
+			}
+		}
+	}
+}
+
+static void test_lorawan_data_rates(void)
+{
+	airtime_modulation mod;
+	TEST_ASSERT_TRUE(airtime_lorawan_modulation(LORAMAC_REGION_US915, 0, &mod));
+	TEST_ASSERT_EQUAL(10, mod.sf);
+	TEST_ASSERT_EQUAL_UINT32(125000, mod.bw_hz);
+	TEST_ASSERT_TRUE(airtime_lorawan_modulation(LORAMAC_REGION_US915, 4, &mod));
+	TEST_ASSERT_EQUAL(8, mod.sf);
+	TEST_ASSERT_EQUAL_UINT32(500000, mod.bw_hz);
+	TEST_ASSERT_FALSE(airtime_lorawan_modulation(LORAMAC_REGION_US915, 5, &mod));
+
+	TEST_ASSERT_TRUE(airtime_lorawan_modulation(LORAMAC_REGION_EU868, 0, &mod));
+	TEST_ASSERT_EQUAL(12, mod.sf);
+	TEST_ASSERT_TRUE(airtime_lorawan_modulation(LORAMAC_REGION_EU868, 6, &mod));
+	TEST_ASSERT_EQUAL(7, mod.sf);
+	TEST_ASSERT_EQUAL_UINT32(250000, mod.bw_hz);
+	TEST_ASSERT_FALSE(airtime_lorawan_modulation(LORAMAC_REGION_EU868, 7, &mod));
+
+	TEST_ASSERT_TRUE(airtime_lorawan_modulation(LORAMAC_REGION_AU915, 6, &mod));
+	TEST_ASSERT_EQUAL(8, mod.sf);
+	TEST_ASSERT_EQUAL_UINT32(500000, mod.bw_hz);
+
+	// EU868 DR0 with a 11 byte report and the LoRaWAN overhead
+	TEST_ASSERT_TRUE(airtime_lorawan_modulation(LORAMAC_REGION_EU868, 0, &mod));
+	TEST_ASSERT_EQUAL_UINT32(1482752, airtime_us(&mod, 11 + AIRTIME_LORAWAN_OVERHEAD));
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_reference_values);
+	RUN_TEST(test_low_data_rate_optimization);
+	RUN_TEST(test_against_formula);
+	RUN_TEST(test_lorawan_data_rates);
+	return UNITY_END();
+}
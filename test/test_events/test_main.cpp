@@ -0,0 +1,192 @@
+/**
+ * @file test_main.cpp
+ * @brief Event bits under concurrent setters, pio test -e native
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "events.h"
+
+#define SETTERS 4
+#define ROUNDS 5000
+/** A wait that takes this long lost a wake up */
+#define LOST_MS 2000
+
+static event_group group;
+
+void setUp(void)
+{
+	group.bits = 0;
+	group.waiter = NULL;
+}
+
+void tearDown(void)
+{
+}
+
+static void test_get_and_clear(void)
+{
+	events_set(&group, 0x05);
+	TEST_ASSERT_EQUAL_HEX32(0x05, events_get(&group));
+	events_clear(&group, 0x01);
+	TEST_ASSERT_EQUAL_HEX32(0x04, events_get(&group));
+	// Only the bits waited for are taken
+	events_set(&group, 0x03);
+	TEST_ASSERT_EQUAL_HEX32(0x03, events_wait(&group, 0x03, true, 0));
+	TEST_ASSERT_EQUAL_HEX32(0x04, events_get(&group));
+	// A check without the bits set returns at once
+	TEST_ASSERT_EQUAL_HEX32(0, events_wait(&group, 0x01, false, 0));
+}
+
+static void test_timeout(void)
+{
+	TickType_t start = xTaskGetTickCount();
+	TEST_ASSERT_EQUAL_HEX32(0, events_wait(&group, 0x01, false, 50));
+	TEST_ASSERT_GREATER_OR_EQUAL(50, xTaskGetTickCount() - start);
+}
+
+/**
+ * @brief Every set is taken exactly once, no wake up is lost
+ *    Each setter sets its bit and waits until the waiter took it, so
+ *    every set has to end a wait.
+ */
+static void test_no_lost_wakeup(void)
+{
+	std::atomic<uint32_t> taken[SETTERS];
+	std::atomic<bool> stop(false);
+	for (int idx = 0; idx < SETTERS; idx++)
+	{
+		taken[idx] = 0;
+	}
+	// The waiter registers before the setters start
+	events_wait(&group, 0xFF, false, 0);
+
+	std::vector<std::thread> setters;
+	for (int idx = 0; idx < SETTERS; idx++)
+	{
+		setters.push_back(std::thread([idx, &taken, &stop] {
+			for (uint32_t round = 0; round < ROUNDS && !stop; round++)
+			{
+				events_set(&group, 1UL << idx);
+				while (taken[idx] <= round && !stop)
+				{
+					std::this_thread::yield();
+				}
+			}
+		}));
+	}
+
+	uint32_t total = 0;
+	uint32_t lost = 0;
+	while (total < SETTERS * ROUNDS)
+	{
+		uint32_t bits = events_wait(&group, (1UL << SETTERS) - 1, false, LOST_MS);
+		if (bits == 0)
+		{
+			lost++;
+			break;
+		}
+		for (int idx = 0; idx < SETTERS; idx++)
+		{
+			if (bits & (1UL << idx))
+			{
+				taken[idx]++;
+				total++;
+			}
+		}
+	}
+	stop = true;
+	for (size_t idx = 0; idx < setters.size(); idx++)
+	{
+		setters[idx].join();
+	}
+	TEST_ASSERT_EQUAL_UINT32(0, lost);
+	for (int idx = 0; idx < SETTERS; idx++)
+	{
+		TEST_ASSERT_EQUAL_UINT32(ROUNDS, taken[idx].load());
+	}
+	TEST_ASSERT_EQUAL_HEX32(0, events_get(&group));
+}
+
+/**
+ * @brief Waiting for all bits returns only when every one is set, while
+ *    other bits change at the same time and stay pending
+ */
+static void test_wait_all(void)
+{
+	std::atomic<uint32_t> taken(0);
+	std::atomic<bool> stop(false);
+	std::atomic<uint32_t> noise(0);
+	events_wait(&group, 0x03, true, 0);
+
+	std::thread first([&taken, &stop] {
+		for (uint32_t round = 0; round < ROUNDS && !stop; round++)
+		{
+			events_set(&group, 0x01);
+			while (taken <= round && !stop)
+			{
+				std::this_thread::yield();
+			}
+		}
+	});
+	std::thread second([&taken, &stop] {
+		for (uint32_t round = 0; round < ROUNDS && !stop; round++)
+		{
+			events_set(&group, 0x02);
+			while (taken <= round && !stop)
+			{
+				std::this_thread::yield();
+			}
+		}
+	});
+	std::thread other([&stop, &noise] {
+		while (!stop)
+		{
+			events_set(&group, 0x100);
+			events_clear(&group, 0x100);
+			noise++;
+		}
+	});
+
+	uint32_t wrong = 0;
+	uint32_t lost = 0;
+	while (taken < ROUNDS)
+	{
+		uint32_t bits = events_wait(&group, 0x03, true, LOST_MS);
+		if (bits == 0)
+		{
+			lost++;
+			break;
+		}
+		if (bits != 0x03)
+		{
+			wrong++;
+		}
+		taken++;
+	}
+	stop = true;
+	first.join();
+	second.join();
+	other.join();
+	TEST_ASSERT_EQUAL_UINT32(0, lost);
+	TEST_ASSERT_EQUAL_UINT32(0, wrong);
+	TEST_ASSERT_EQUAL_UINT32(ROUNDS, taken.load());
+	TEST_ASSERT_EQUAL_HEX32(0, events_get(&group) & 0x03);
+	TEST_ASSERT_GREATER_THAN(0, noise.load());
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_get_and_clear);
+	RUN_TEST(test_timeout);
+	RUN_TEST(test_no_lost_wakeup);
+	RUN_TEST(test_wait_all);
+	return UNITY_END();
+}
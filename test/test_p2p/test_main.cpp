@@ -0,0 +1,216 @@
+/**
+ * @file test_main.cpp
+ * @brief P2P transition table against a simulated Radio, pio test -e native
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include <unity.h>
+#include "p2p.h"
+
+/** What the simulated radio was told to do */
+enum sim_call
+{
+	SIM_NONE,
+	SIM_SLEEP,
+	SIM_RX,
+	SIM_SEND,
+};
+
+static sim_call lastCall;
+static uint32_t lastRxTimeout;
+static uint8_t *lastData;
+static uint8_t lastSize;
+static uint32_t calls;
+/** Time the simulated radio takes for a call */
+static uint32_t callUs;
+
+static void sim_sleep(void)
+{
+	lastCall = SIM_SLEEP;
+	calls++;
+	native_micros() += callUs;
+}
+
+static void sim_rx(uint32_t timeout)
+{
+	lastCall = SIM_RX;
+	lastRxTimeout = timeout;
+	calls++;
+	native_micros() += callUs;
+}
+
+static void sim_send(uint8_t *buffer, uint8_t size)
+{
+	lastCall = SIM_SEND;
+	lastData = buffer;
+	lastSize = size;
+	calls++;
+	native_micros() += callUs;
+}
+
+static uint8_t packet[] = {0x01, 0x02, 0x03};
+
+void setUp(void)
+{
+	Radio.Sleep = sim_sleep;
+	Radio.Rx = sim_rx;
+	Radio.Send = sim_send;
+	lastCall = SIM_NONE;
+	calls = 0;
+	callUs = 0;
+	g_lora_p2p_rx_time = 3000;
+	p2p_set_packet(packet, sizeof(packet));
+	p2p_trace_reset();
+}
+
+void tearDown(void)
+{
+}
+
+/**
+ * What the radio did for each event and RX mode before the table, from
+ * the callbacks in lora.cpp. SIM_TIMED marks Rx(g_lora_p2p_rx_time).
+ */
+#define SIM_TIMED 0x10
+static const uint8_t expected[P2P_EVENTS][P2P_MODES] = {
+	//               NONE        RX       RX_TIMED            RX_WAIT
+	/* START      */ {SIM_SLEEP, SIM_RX, SIM_RX | SIM_TIMED, SIM_RX},
+	/* TX_DONE    */ {SIM_SLEEP, SIM_RX, SIM_RX | SIM_TIMED, SIM_RX},
+	/* RX_DONE    */ {SIM_SLEEP, SIM_RX, SIM_SLEEP, SIM_SLEEP},
+	/* TX_TIMEOUT */ {SIM_SLEEP, SIM_RX, SIM_SLEEP, SIM_SLEEP},
+	/* RX_TIMEOUT */ {SIM_SLEEP, SIM_RX, SIM_SLEEP, SIM_SLEEP},
+	/* RX_ERROR   */ {SIM_SLEEP, SIM_RX, SIM_SLEEP, SIM_SLEEP},
+	/* CAD_BUSY   */ {SIM_SLEEP, SIM_RX, SIM_SLEEP, SIM_SLEEP},
+	/* CAD_FREE   */ {SIM_SEND, SIM_SEND, SIM_SEND, SIM_SEND},
+};
+
+static void test_every_transition(void)
+{
+	char msg[40];
+	for (uint8_t event = 0; event < P2P_EVENTS; event++)
+	{
+		for (uint8_t mode = 0; mode < P2P_MODES; mode++)
+		{
+			snprintf(msg, sizeof(msg), "%s in mode %d", p2p_event_name(event), mode);
+			g_lora_p2p_rx_mode = mode;
+			lastCall = SIM_NONE;
+			uint32_t before = calls;
+			p2p_action action = p2p_handle((p2p_event)event, micros());
+
+			uint8_t call = expected[event][mode] & ~SIM_TIMED;
+			bool timed = (expected[event][mode] & SIM_TIMED) != 0;
+			TEST_ASSERT_EQUAL_UINT32_MESSAGE(before + 1, calls, msg);
+			TEST_ASSERT_EQUAL_MESSAGE(call, lastCall, msg);
+			if (call == SIM_RX)
+			{
+				TEST_ASSERT_EQUAL_UINT32_MESSAGE(timed ? 3000 : 0, lastRxTimeout, msg);
+				TEST_ASSERT_EQUAL_MESSAGE(timed ? P2P_ACTION_RX_TIMED : P2P_ACTION_RX, action, msg);
+			}
+			else if (call == SIM_SEND)
+			{
+				TEST_ASSERT_TRUE_MESSAGE(lastData == packet, msg);
+				TEST_ASSERT_EQUAL_MESSAGE(sizeof(packet), lastSize, msg);
+				TEST_ASSERT_EQUAL_MESSAGE(P2P_ACTION_SEND, action, msg);
+			}
+			else
+			{
+				TEST_ASSERT_EQUAL_MESSAGE(P2P_ACTION_SLEEP, action, msg);
+			}
+		}
+	}
+}
+
+static void test_unknown_mode_sleeps(void)
+{
+	g_lora_p2p_rx_mode = 7;
+	TEST_ASSERT_EQUAL(P2P_ACTION_SLEEP, p2p_handle(P2P_EVENT_RX_DONE, micros()));
+	TEST_ASSERT_EQUAL(SIM_SLEEP, lastCall);
+	p2p_trace_entry entry;
+	TEST_ASSERT_TRUE(p2p_trace_get(0, &entry));
+	TEST_ASSERT_EQUAL(RX_MODE_NONE, entry.mode);
+}
+
+/**
+ * @brief A send in RX_WAIT mode, the simulated radio answers each call
+ *    with the event it would raise
+ */
+static void test_send_and_wait_for_answer(void)
+{
+	g_lora_p2p_rx_mode = RX_MODE_RX_WAIT;
+	p2p_event event = P2P_EVENT_START;
+	static const p2p_event answers[] = {P2P_EVENT_CAD_FREE, P2P_EVENT_TX_DONE, P2P_EVENT_RX_DONE};
+	static const p2p_action actions[] = {P2P_ACTION_RX, P2P_ACTION_SEND, P2P_ACTION_RX, P2P_ACTION_SLEEP};
+	for (uint8_t step = 0; step < 4; step++)
+	{
+		TEST_ASSERT_EQUAL(actions[step], p2p_handle(event, micros()));
+		if (step < 3)
+		{
+			event = answers[step];
+		}
+	}
+	TEST_ASSERT_EQUAL(SIM_SLEEP, lastCall);
+	TEST_ASSERT_EQUAL(4, p2p_trace_count());
+}
+
+static void test_trace_and_timing(void)
+{
+	g_lora_p2p_rx_mode = RX_MODE_RX;
+	native_millis() = 1000;
+	for (uint32_t idx = 0; idx < P2P_TRACE_SIZE + 5; idx++)
+	{
+		native_millis()++;
+		callUs = 100 + idx;
+		// The event came in 20 us before the callback handled it
+		uint32_t event_us = micros();
+		native_micros() += 20;
+		p2p_handle((idx % 2) ? P2P_EVENT_RX_DONE : P2P_EVENT_RX_ERROR, event_us);
+	}
+	TEST_ASSERT_EQUAL(P2P_TRACE_SIZE, p2p_trace_count());
+
+	// Oldest first, the first 5 were overwritten
+	p2p_trace_entry entry;
+	TEST_ASSERT_TRUE(p2p_trace_get(0, &entry));
+	TEST_ASSERT_EQUAL_UINT32(1006, entry.time_ms);
+	TEST_ASSERT_EQUAL(P2P_EVENT_RX_DONE, entry.event);
+	TEST_ASSERT_EQUAL_UINT32(20 + 105, entry.latency_us);
+	TEST_ASSERT_TRUE(p2p_trace_get(P2P_TRACE_SIZE - 1, &entry));
+	TEST_ASSERT_EQUAL_UINT32(1000 + P2P_TRACE_SIZE + 5, entry.time_ms);
+	TEST_ASSERT_FALSE(p2p_trace_get(P2P_TRACE_SIZE, &entry));
+
+	p2p_transition_stats stats;
+	p2p_stats_get(P2P_EVENT_RX_DONE, RX_MODE_RX, &stats);
+	TEST_ASSERT_EQUAL_UINT32((P2P_TRACE_SIZE + 5) / 2, stats.count);
+	// The last RX_DONE was the one before the last pass
+	TEST_ASSERT_EQUAL_UINT32(20 + 100 + P2P_TRACE_SIZE + 3, stats.max_us);
+	TEST_ASSERT_EQUAL_UINT32(stats.max_us, stats.last_us);
+	p2p_stats_get(P2P_EVENT_RX_ERROR, RX_MODE_RX, &stats);
+	TEST_ASSERT_EQUAL_UINT32((P2P_TRACE_SIZE + 5 + 1) / 2, stats.count);
+
+	p2p_trace_reset();
+	TEST_ASSERT_EQUAL(0, p2p_trace_count());
+	p2p_stats_get(P2P_EVENT_RX_DONE, RX_MODE_RX, &stats);
+	TEST_ASSERT_EQUAL_UINT32(0, stats.count);
+}
+
+static void test_names(void)
+{
+	TEST_ASSERT_EQUAL_STRING("start", p2p_event_name(P2P_EVENT_START));
+	TEST_ASSERT_EQUAL_STRING("cad_free", p2p_event_name(P2P_EVENT_CAD_FREE));
+	TEST_ASSERT_EQUAL_STRING("?", p2p_event_name(P2P_EVENTS));
+	TEST_ASSERT_EQUAL_STRING("rx_timed", p2p_action_name(P2P_ACTION_RX_TIMED));
+	TEST_ASSERT_EQUAL_STRING("?", p2p_action_name(P2P_ACTION_SEND + 1));
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_every_transition);
+	RUN_TEST(test_unknown_mode_sleeps);
+	RUN_TEST(test_send_and_wait_for_answer);
+	RUN_TEST(test_trace_and_timing);
+	RUN_TEST(test_names);
+	return UNITY_END();
+}
@@ -0,0 +1,193 @@
+/**
+ * @file test_main.cpp
+ * @brief P2P radio setup shadow against a simulated Radio, pio test -e native
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include <unity.h>
+#include <LoRaWan-Arduino.h>
+#include "radio_cfg.h"
+
+/** Calls the simulated radio got, the stubs keep only the parameters they check */
+static uint32_t channelCalls;
+static uint32_t txCalls;
+static uint32_t rxCalls;
+static uint32_t lastFrequency;
+static int8_t lastPower;
+static bool lastRxContinuous;
+
+static void sim_set_channel(uint32_t freq)
+{
+	channelCalls++;
+	lastFrequency = freq;
+}
+
+static void sim_set_tx_config(RadioModems_t, int8_t power, uint32_t, uint32_t, uint32_t, uint8_t, uint16_t, bool,
+							  bool, bool, uint8_t, bool, uint32_t)
+{
+	txCalls++;
+	lastPower = power;
+}
+
+static void sim_set_rx_config(RadioModems_t, uint32_t, uint32_t, uint8_t, uint32_t, uint16_t, uint16_t, bool,
+							  uint8_t, bool, bool, uint8_t, bool, bool rxContinuous)
+{
+	rxCalls++;
+	lastRxContinuous = rxContinuous;
+}
+
+static uint32_t setup_calls(void)
+{
+	return channelCalls + txCalls + rxCalls;
+}
+
+static radio_p2p_config config;
+
+void setUp(void)
+{
+	Radio.SetChannel = sim_set_channel;
+	Radio.SetTxConfig = sim_set_tx_config;
+	Radio.SetRxConfig = sim_set_rx_config;
+	radio_cfg_stats stats;
+	radio_cfg_stats_get(&stats, true);
+	channelCalls = txCalls = rxCalls = 0;
+
+	config.frequency = 916000000;
+	config.tx_power = 22;
+	config.bandwidth = 0;
+	config.sf = 7;
+	config.cr = 1;
+	config.preamble_len = 8;
+	config.symbol_timeout = 0;
+	config.rx_continuous = true;
+	radio_cfg_invalidate();
+}
+
+void tearDown(void)
+{
+}
+
+static void test_first_setup_sends_all(void)
+{
+	radio_cfg_apply(&config);
+	TEST_ASSERT_EQUAL_UINT32(1, channelCalls);
+	TEST_ASSERT_EQUAL_UINT32(1, txCalls);
+	TEST_ASSERT_EQUAL_UINT32(1, rxCalls);
+	TEST_ASSERT_EQUAL_UINT32(916000000, lastFrequency);
+
+	radio_cfg_apply(&config);
+	TEST_ASSERT_EQUAL_UINT32(3, setup_calls());
+	radio_cfg_stats stats;
+	radio_cfg_stats_get(&stats, false);
+	for (uint8_t part = 0; part < RADIO_CFG_PARTS; part++)
+	{
+		TEST_ASSERT_EQUAL_UINT32(1, stats.sent[part]);
+		TEST_ASSERT_EQUAL_UINT32(1, stats.skipped[part]);
+	}
+}
+
+static void test_rx_mode_switch_sends_rx_only(void)
+{
+	radio_cfg_apply(&config);
+	config.rx_continuous = false;
+	radio_cfg_apply(&config);
+	TEST_ASSERT_EQUAL_UINT32(1, channelCalls);
+	TEST_ASSERT_EQUAL_UINT32(1, txCalls);
+	TEST_ASSERT_EQUAL_UINT32(2, rxCalls);
+	TEST_ASSERT_FALSE(lastRxContinuous);
+}
+
+static void test_tx_setup_is_followed_by_rx(void)
+{
+	radio_cfg_apply(&config);
+	config.tx_power = 14;
+	radio_cfg_apply(&config);
+	TEST_ASSERT_EQUAL_UINT32(2, txCalls);
+	TEST_ASSERT_EQUAL_UINT32(2, rxCalls);
+	TEST_ASSERT_EQUAL(14, lastPower);
+
+	config.sf = 9;
+	radio_cfg_apply(&config);
+	TEST_ASSERT_EQUAL_UINT32(1, channelCalls);
+	TEST_ASSERT_EQUAL_UINT32(3, txCalls);
+	TEST_ASSERT_EQUAL_UINT32(3, rxCalls);
+}
+
+static void test_send_and_cad_invalidate(void)
+{
+	radio_cfg_apply(&config);
+
+	// lora.cpp after Radio.Send()
+	radio_cfg_invalidate_part(RADIO_CFG_RX);
+	radio_cfg_apply(&config);
+	TEST_ASSERT_EQUAL_UINT32(1, txCalls);
+	TEST_ASSERT_EQUAL_UINT32(2, rxCalls);
+
+	// lora.cpp after Radio.SetCadParams()
+	radio_cfg_invalidate_part(RADIO_CFG_TX);
+	radio_cfg_invalidate_part(RADIO_CFG_RX);
+	radio_cfg_apply(&config);
+	TEST_ASSERT_EQUAL_UINT32(1, channelCalls);
+	TEST_ASSERT_EQUAL_UINT32(2, txCalls);
+	TEST_ASSERT_EQUAL_UINT32(3, rxCalls);
+}
+
+/**
+ * @brief Boot, the P2P AT setters, AT+PRECV switches, a send and a re-init
+ *    The old code sent SetTxConfig() and SetRxConfig() for every step and
+ *    no SetChannel().
+ */
+static void test_session_call_counts(void)
+{
+	uint32_t old_calls = 0;
+
+	radio_cfg_apply(&config); // init_lora()
+	old_calls += 2;
+	config.tx_power = 22; // AT+PTP, unchanged
+	radio_cfg_apply(&config);
+	old_calls += 2;
+	config.sf = 9; // AT+PSF
+	radio_cfg_apply(&config);
+	old_calls += 2;
+	config.rx_continuous = false; // AT+PRECV timed
+	radio_cfg_apply(&config);
+	old_calls += 2;
+	config.rx_continuous = true; // AT+PRECV continuous
+	radio_cfg_apply(&config);
+	old_calls += 2;
+	radio_cfg_apply(&config); // AT+PRECV wait, same flag
+	old_calls += 2;
+
+	// AT+PSEND, CAD and send
+	radio_cfg_invalidate_part(RADIO_CFG_TX);
+	radio_cfg_invalidate_part(RADIO_CFG_RX);
+	radio_cfg_invalidate_part(RADIO_CFG_RX);
+	radio_cfg_apply(&config); // AT+PRECV after the send
+	old_calls += 2;
+
+	radio_cfg_invalidate(); // init_lora() again
+	radio_cfg_apply(&config);
+	old_calls += 2;
+
+	char msg[64];
+	snprintf(msg, sizeof(msg), "setup calls %lu, old code %lu", (unsigned long)setup_calls(), (unsigned long)old_calls);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_EQUAL_UINT32(16, old_calls);
+	TEST_ASSERT_EQUAL_UINT32(2, channelCalls);
+	TEST_ASSERT_EQUAL_UINT32(4, txCalls);
+	TEST_ASSERT_EQUAL_UINT32(6, rxCalls);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_first_setup_sends_all);
+	RUN_TEST(test_rx_mode_switch_sends_rx_only);
+	RUN_TEST(test_tx_setup_is_followed_by_rx);
+	RUN_TEST(test_send_and_cad_invalidate);
+	RUN_TEST(test_session_call_counts);
+	return UNITY_END();
+}
@@ -0,0 +1,193 @@
+/**
+ * @file test_main.cpp
+ * @brief Sliding window statistics against a brute force window, pio test -e native
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include <unity.h>
+#include <deque>
+#include "stats.h"
+
+/** Sample of the brute force window */
+struct sample
+{
+	uint32_t time;	 // Time it was added
+	uint32_t stored; // Time the window keeps for it, on the tick grid of the first sample
+	int16_t value;
+};
+
+/** Brute force window with the time resolution of stats.h */
+struct reference
+{
+	uint32_t window_ms;
+	uint32_t base; // Time of the sample that started the window
+	std::deque<sample> samples;
+	uint32_t truncated;
+
+	void expire(uint32_t now)
+	{
+		while (window_ms != 0 && !samples.empty() && now - samples.front().stored > window_ms)
+		{
+			samples.pop_front();
+		}
+	}
+
+	void add(uint32_t now, int16_t value)
+	{
+		expire(now);
+		if (samples.size() == STATS_MAX_SAMPLES)
+		{
+			samples.pop_front();
+			truncated++;
+		}
+		if (samples.empty())
+		{
+			base = now;
+		}
+		sample entry = {now, base + (now - base) / STATS_TICK_MS * STATS_TICK_MS, value};
+		samples.push_back(entry);
+	}
+};
+
+static stats_window window;
+static reference ref;
+
+void setUp(void)
+{
+	ref.samples.clear();
+	ref.truncated = 0;
+}
+
+void tearDown(void)
+{
+}
+
+/**
+ * @brief Compare all results of the window with the brute force values
+ */
+static void check(uint32_t now)
+{
+	TEST_ASSERT_EQUAL_UINT16(ref.samples.size(), stats_count(&window));
+	TEST_ASSERT_EQUAL_UINT32(ref.truncated, window.truncated);
+	if (ref.samples.empty())
+	{
+		TEST_ASSERT_EQUAL_INT32(0, stats_mean(&window));
+		return;
+	}
+	int64_t sum = 0;
+	int64_t sum_sq = 0;
+	int16_t min = INT16_MAX;
+	int16_t max = INT16_MIN;
+	for (size_t idx = 0; idx < ref.samples.size(); idx++)
+	{
+		const sample &entry = ref.samples[idx];
+		sum += entry.value;
+		sum_sq += (int64_t)entry.value * entry.value;
+		min = (entry.value < min) ? entry.value : min;
+		max = (entry.value > max) ? entry.value : max;
+		// No sample is older than the window
+		if (ref.window_ms != 0)
+		{
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(ref.window_ms, now - entry.time);
+		}
+	}
+	int64_t count = ref.samples.size();
+	double mean = (double)sum / count;
+	TEST_ASSERT_EQUAL_INT32((int32_t)(mean < 0 ? ceil(mean - 0.5) : floor(mean + 0.5)), stats_mean(&window));
+	TEST_ASSERT_EQUAL_INT16(min, stats_min(&window));
+	TEST_ASSERT_EQUAL_INT16(max, stats_max(&window));
+	TEST_ASSERT_EQUAL_UINT32((uint32_t)((count * sum_sq - sum * sum) / (count * count)), stats_variance(&window));
+}
+
+/**
+ * @brief Random samples with random gaps against the brute force window
+ */
+static void run_random(uint32_t window_ms, uint32_t max_gap_ms, uint32_t seed, uint32_t rounds)
+{
+	stats_init(&window, window_ms);
+	ref.window_ms = window_ms;
+	srand(seed);
+	uint32_t now = 0xFFFF0000UL; // millis() wraps during the run
+	for (uint32_t round = 0; round < rounds; round++)
+	{
+		now += rand() % (max_gap_ms + 1);
+		int16_t value = (int16_t)(rand() % 2001 - 1000);
+		if (rand() % 8 == 0)
+		{
+			// Only expire, like ws8x_aggregate()
+			stats_expire(&window, now);
+			ref.expire(now);
+		}
+		else
+		{
+			stats_add(&window, now, value);
+			ref.add(now, value);
+		}
+		check(now);
+	}
+}
+
+static void test_short_window(void)
+{
+	run_random(3000, 700, 1, 50000);
+}
+
+static void test_report_window(void)
+{
+	run_random(600000, 2500, 2, 50000);
+}
+
+static void test_full_window_truncates(void)
+{
+	// 1 s samples into a 20 min window do not fit into 512 samples
+	run_random(1200000, 1000, 3, 5000);
+	TEST_ASSERT_GREATER_THAN(0, window.truncated);
+}
+
+static void test_samples_leave_at_most_a_tick_early(void)
+{
+	stats_init(&window, 1000);
+	stats_add(&window, 50, 1);
+	stats_add(&window, 249, 2); // Kept as 100 ms after the first one, 99 ms early
+	stats_add(&window, 1049, 3);
+	stats_expire(&window, 1050);
+	TEST_ASSERT_EQUAL_UINT16(3, stats_count(&window));
+	stats_expire(&window, 1051);
+	TEST_ASSERT_EQUAL_UINT16(2, stats_count(&window));
+	stats_expire(&window, 1150);
+	TEST_ASSERT_EQUAL_UINT16(2, stats_count(&window));
+	stats_expire(&window, 1151);
+	TEST_ASSERT_EQUAL_UINT16(1, stats_count(&window));
+	TEST_ASSERT_EQUAL_INT16(3, stats_min(&window));
+}
+
+static void test_reset_keeps_truncated(void)
+{
+	stats_init(&window, 0);
+	for (int idx = 0; idx < STATS_MAX_SAMPLES + 10; idx++)
+	{
+		stats_add(&window, idx * 10, (int16_t)idx);
+	}
+	TEST_ASSERT_EQUAL_UINT16(STATS_MAX_SAMPLES, stats_count(&window));
+	TEST_ASSERT_EQUAL_UINT32(10, window.truncated);
+	TEST_ASSERT_EQUAL_INT16(10, stats_min(&window));
+	stats_reset(&window);
+	TEST_ASSERT_EQUAL_UINT16(0, stats_count(&window));
+	TEST_ASSERT_EQUAL_UINT32(10, window.truncated);
+	stats_init(&window, 0);
+	TEST_ASSERT_EQUAL_UINT32(0, window.truncated);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_short_window);
+	RUN_TEST(test_report_window);
+	RUN_TEST(test_full_window_truncates);
+	RUN_TEST(test_samples_leave_at_most_a_tick_early);
+	RUN_TEST(test_reset_keeps_truncated);
+	return UNITY_END();
+}
@@ -0,0 +1,317 @@
+/**
+ * @file test_main.cpp
+ * @brief Line parser against the String parser it replaced, pio test -e native
+ *    The recorded stream of test_ws8x_replay is read BENCH_PASSES times by
+ *    a copy of the old ws8x_checkSerial() and by the sensor_port framing
+ *    with ws8x_feed(). Prints lines/s and heap bytes per line for both.
+ *    Host timing, the nRF52 numbers are lower but the ratio holds.
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include <unity.h>
+#include <chrono>
+#include <new>
+#include <string>
+#include "WString.h"
+#include "ws8x.h"
+#include "../test_ws8x_replay/capture.h"
+
+/** Times the whole capture is read by each parser */
+#define BENCH_PASSES 200
+
+// Count heap use of C++ code too, so a heap call of the new path shows up
+void *operator new(size_t size)
+{
+	void *ptr = native_realloc(NULL, size);
+	if (ptr == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	native_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+	native_free(ptr);
+}
+
+/** Result of one parser over all passes */
+struct bench_result
+{
+	uint32_t lines;
+	double seconds;
+	native_alloc_stats heap;
+};
+
+/** The capture as the raw bytes the UART delivered */
+static std::string stream;
+static uint32_t stream_lines;
+
+/**
+ * @brief Stream stand-in with the reads the old parser used, readStringUntil()
+ *    grows the String by one character per read like Stream.cpp does
+ */
+struct legacy_stream
+{
+	size_t pos;
+
+	int available(void) { return (int)(stream.size() - pos); }
+	int read(void) { return pos < stream.size() ? (unsigned char)stream[pos++] : -1; }
+	String readStringUntil(char terminator)
+	{
+		String ret;
+		int c = read();
+		while (c >= 0 && c != terminator)
+		{
+			ret += (char)c;
+			c = read();
+		}
+		return ret;
+	}
+};
+
+static legacy_stream Serial1;
+
+// State of the old parser
+static double dir_sum_sin = 0;
+static double dir_sum_cos = 0;
+static float velSum = 0;
+static float gust = 0;
+static float lull = -1;
+static int velCount = 0;
+static int dirCount = 0;
+static float batVoltageF = 0;
+static float capVoltageF = 0;
+static float temperatureF = 0;
+
+/**
+ * @brief ws8x_checkSerial() before the line parser, without the debug print
+ */
+static void legacy_checkSerial(void)
+{
+	const int maxIterations = 100; // Maximum number of lines to read per loop
+	int iterationCount = 0;
+
+	while (Serial1.available() > 0 && iterationCount < maxIterations)
+	{
+		iterationCount++;
+		String line = Serial1.readStringUntil('\n');
+		line.trim();
+		if (line.length() > 0)
+		{
+			int index = line.indexOf('=');
+			if (index != -1)
+			{
+				String key = line.substring(0, index);
+				String value = line.substring(index + 1);
+				key.trim();
+				value.trim();
+
+				if (value.endsWith("V"))
+				{
+					value = value.substring(0, value.length() - 1);
+				}
+
+				if (key == "WindDir")
+				{
+					float windDir = value.toFloat();
+					double radians = windDir * M_PI / 180.0;
+					dir_sum_sin += sin(radians);
+					dir_sum_cos += cos(radians);
+					dirCount++;
+				}
+				else if (key == "WindSpeed")
+				{
+					float windSpeed = value.toFloat();
+					velSum += windSpeed;
+					velCount++;
+					if (lull == -1 || windSpeed < lull)
+						lull = windSpeed;
+				}
+				else if (key == "WindGust")
+				{
+					float windGust = value.toFloat();
+					if (windGust > gust)
+						gust = windGust;
+				}
+				else if (key == "BatVoltage")
+				{
+					batVoltageF = value.toFloat();
+				}
+				else if (key == "CapVoltage")
+				{
+					capVoltageF = value.toFloat();
+				}
+				else if (key == "GXTS04Temp" || key == "Temperature")
+				{
+					if (value != "--")
+					{
+						temperatureF = value.toFloat();
+					}
+				}
+			}
+		}
+	}
+}
+
+static void legacy_reset(void)
+{
+	dir_sum_sin = dir_sum_cos = 0;
+	velSum = 0;
+	velCount = dirCount = 0;
+	gust = 0;
+	lull = -1;
+	batVoltageF = 0;
+	capVoltageF = 0;
+	temperatureF = 0;
+}
+
+static ws8x_t ws;
+static sensor_config config;
+
+/** Line framing state, like sensor_port in sensor.cpp */
+static char line[SENSOR_LINE_SIZE];
+static uint8_t line_len;
+static bool line_overflow;
+
+/**
+ * @brief Frame one byte like sensor_port_putc(), feed complete lines
+ */
+static void putc_line(char c)
+{
+	if (c == '\r')
+	{
+		return;
+	}
+	if (c != '\n')
+	{
+		if (line_len < SENSOR_LINE_SIZE - 1)
+		{
+			line[line_len++] = c;
+		}
+		else
+		{
+			line_overflow = true;
+		}
+		return;
+	}
+	if (!line_overflow && line_len > 0)
+	{
+		line[line_len] = '\0';
+		ws8x_feed(&ws, line, line_len);
+	}
+	line_len = 0;
+	line_overflow = false;
+}
+
+void setUp(void)
+{
+	stream.clear();
+	stream_lines = 0;
+	size_t chunks = sizeof(capture_chunks) / sizeof(capture_chunks[0]);
+	for (size_t idx = 0; idx < chunks; idx++)
+	{
+		const char *hex = capture_chunks[idx].hex;
+		for (size_t pos = 0; hex[pos] != '\0' && hex[pos + 1] != '\0'; pos += 2)
+		{
+			char byte[3] = {hex[pos], hex[pos + 1], '\0'};
+			char c = (char)strtoul(byte, NULL, 16);
+			stream += c;
+			if (c == '\n')
+			{
+				stream_lines++;
+			}
+		}
+	}
+
+	ws8x_init(&ws);
+	memset(&config, 0, sizeof(config));
+	config.window_ms = CAPTURE_INTERVAL_S * 1000UL;
+	ws8x_configure(&ws, &config);
+	line_len = 0;
+	line_overflow = false;
+	legacy_reset();
+}
+
+void tearDown(void)
+{
+}
+
+static bench_result bench_legacy(void)
+{
+	bench_result result;
+	memset(&native_alloc(), 0, sizeof(native_alloc_stats));
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < BENCH_PASSES; pass++)
+	{
+		Serial1.pos = 0;
+		while (Serial1.available() > 0)
+		{
+			legacy_checkSerial();
+		}
+		legacy_reset();
+	}
+	std::chrono::duration<double> spent = std::chrono::steady_clock::now() - start;
+	result.lines = stream_lines * BENCH_PASSES;
+	result.seconds = spent.count();
+	result.heap = native_alloc();
+	return result;
+}
+
+static bench_result bench_feed(void)
+{
+	bench_result result;
+	memset(&native_alloc(), 0, sizeof(native_alloc_stats));
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < BENCH_PASSES; pass++)
+	{
+		for (size_t pos = 0; pos < stream.size(); pos++)
+		{
+			putc_line(stream[pos]);
+		}
+		ws8x_reset(&ws);
+	}
+	std::chrono::duration<double> spent = std::chrono::steady_clock::now() - start;
+	result.lines = stream_lines * BENCH_PASSES;
+	result.seconds = spent.count();
+	result.heap = native_alloc();
+	return result;
+}
+
+static void print_result(const char *name, const bench_result &result)
+{
+	char msg[128];
+	snprintf(msg, sizeof(msg), "%s: %.0f lines/s, %.1f heap bytes/line, %.1f heap calls/line",
+			 name, result.lines / result.seconds,
+			 (double)result.heap.bytes / result.lines, (double)result.heap.calls / result.lines);
+	TEST_MESSAGE(msg);
+}
+
+static void test_bench(void)
+{
+	TEST_ASSERT_GREATER_THAN(0, stream_lines);
+	bench_result legacy = bench_legacy();
+	bench_result feed = bench_feed();
+	print_result("String parser", legacy);
+	print_result("ws8x_feed", feed);
+
+	// The line parser never touches the heap
+	TEST_ASSERT_GREATER_THAN(0, legacy.heap.bytes);
+	TEST_ASSERT_EQUAL(0, feed.heap.calls);
+	TEST_ASSERT_TRUE(feed.seconds < legacy.seconds);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_bench);
+	return UNITY_END();
+}
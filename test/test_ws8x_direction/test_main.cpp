@@ -0,0 +1,208 @@
+/**
+ * @file test_main.cpp
+ * @brief WS8x mean wind direction from the Q14 table against atan2(), pio test -e native
+ *    test_direction_timing times ws8x_addDirection() against the double
+ *    sin()/cos() sums it replaced and against sinf()/cosf(). The host has
+ *    a double FPU, on the nRF52 double trig runs in software and the gap
+ *    is larger.
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include "ws8x.h"
+
+/** Direction samples in each timed loop */
+#define BENCH_SAMPLES 1000000
+
+static ws8x_t ws;
+
+void setUp(void)
+{
+	ws8x_init(&ws);
+}
+
+void tearDown(void)
+{
+}
+
+static void feed_dir(int dir)
+{
+	char line[SENSOR_LINE_SIZE];
+	int len = snprintf(line, sizeof(line), "WindDir=%d", dir);
+	ws8x_feed(&ws, line, (uint8_t)len);
+}
+
+/** Reported direction, 0 .. 359 */
+static int report_dir(void)
+{
+	ws8x_aggregate(&ws);
+	return ws.report.dir % 360;
+}
+
+/** Signed difference a - b on the circle, -180 .. 180 */
+static double circle_diff(double a, double b)
+{
+	double diff = fmod(a - b + 540.0, 360.0) - 180.0;
+	return diff;
+}
+
+static void test_single_samples(void)
+{
+	for (int dir = 0; dir < 360; dir++)
+	{
+		ws8x_init(&ws);
+		feed_dir(dir);
+		TEST_ASSERT_EQUAL_INT(dir, report_dir());
+	}
+}
+
+static void test_input_outside_a_turn(void)
+{
+	feed_dir(-90);
+	TEST_ASSERT_EQUAL_INT(270, report_dir());
+	ws8x_init(&ws);
+	feed_dir(450);
+	TEST_ASSERT_EQUAL_INT(90, report_dir());
+}
+
+static void test_wrap_around_north(void)
+{
+	feed_dir(350);
+	feed_dir(10);
+	feed_dir(355);
+	feed_dir(5);
+	TEST_ASSERT_EQUAL_INT(0, report_dir());
+}
+
+/**
+ * @brief Random sample sets against the double precision mean
+ *    ws8x.cpp bounds the error by 0.0025 deg / R for a mean vector of
+ *    length R, so the reported direction is the rounded reference unless
+ *    that sits within the bound of a rounding boundary, then it may be
+ *    the neighbour.
+ */
+static void test_against_atan2(void)
+{
+	srand(4);
+	uint32_t boundary = 0;
+	for (int round = 0; round < 5000; round++)
+	{
+		ws8x_init(&ws);
+		int count = 1 + rand() % 300;
+		int base = rand() % 360;
+		int spread = 1 + rand() % 360;
+		double sum_sin = 0;
+		double sum_cos = 0;
+		for (int idx = 0; idx < count; idx++)
+		{
+			int dir = (base + rand() % spread) % 360;
+			feed_dir(dir);
+			sum_sin += sin(dir * M_PI / 180.0);
+			sum_cos += cos(dir * M_PI / 180.0);
+		}
+		double length = sqrt(sum_sin * sum_sin + sum_cos * sum_cos) / count;
+		if (length < 0.01)
+		{
+			// The directions cancel out, there is no mean to compare with
+			continue;
+		}
+		double expected = atan2(sum_sin, sum_cos) * 180.0 / M_PI;
+		expected = (expected < 0) ? expected + 360.0 : expected;
+		double tolerance = 0.0025 / length + 1e-4;
+		double to_boundary = fabs(expected - floor(expected) - 0.5);
+		int reported = report_dir();
+		if (to_boundary <= tolerance)
+		{
+			boundary++;
+			TEST_ASSERT_DOUBLE_WITHIN(0.5 + tolerance, 0.0, circle_diff(reported, expected));
+		}
+		else
+		{
+			TEST_ASSERT_EQUAL_INT(((int)floor(expected + 0.5)) % 360, reported);
+		}
+	}
+	char msg[48];
+	snprintf(msg, sizeof(msg), "%lu sets next to a rounding boundary", (unsigned long)boundary);
+	TEST_MESSAGE(msg);
+}
+
+static void test_long_run_halves_sums(void)
+{
+	// 2^30 / 16384 samples of one direction fill the sums, they are halved
+	for (int idx = 0; idx < 200000; idx++)
+	{
+		feed_dir((idx % 2) ? 100 : 120);
+	}
+	TEST_ASSERT_TRUE(ws.dir_sum_sin <= (1L << 30) + 16384);
+	TEST_ASSERT_EQUAL_INT(110, report_dir());
+}
+
+static void test_direction_timing(void)
+{
+	std::vector<int> dirs(BENCH_SAMPLES);
+	srand(5);
+	for (size_t idx = 0; idx < dirs.size(); idx++)
+	{
+		dirs[idx] = rand() % 360;
+	}
+
+	// ws8x_checkSerial() before the table: float degrees, double trig
+	volatile double sink = 0;
+	double dir_sum_sin = 0;
+	double dir_sum_cos = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t idx = 0; idx < dirs.size(); idx++)
+	{
+		float windDir = (float)dirs[idx];
+		double radians = windDir * M_PI / 180.0;
+		dir_sum_sin += sin(radians);
+		dir_sum_cos += cos(radians);
+	}
+	std::chrono::duration<double, std::nano> legacy = std::chrono::steady_clock::now() - start;
+	sink = dir_sum_sin + dir_sum_cos;
+
+	float sum_sinf = 0;
+	float sum_cosf = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t idx = 0; idx < dirs.size(); idx++)
+	{
+		float radians = (float)dirs[idx] * ((float)M_PI / 180.0f);
+		sum_sinf += sinf(radians);
+		sum_cosf += cosf(radians);
+	}
+	std::chrono::duration<double, std::nano> single = std::chrono::steady_clock::now() - start;
+	sink = sink + sum_sinf + sum_cosf;
+
+	start = std::chrono::steady_clock::now();
+	for (size_t idx = 0; idx < dirs.size(); idx++)
+	{
+		ws8x_addDirection(&ws, dirs[idx]);
+	}
+	std::chrono::duration<double, std::nano> table = std::chrono::steady_clock::now() - start;
+	sink = sink + ws.dir_sum_sin + ws.dir_sum_cos;
+	(void)sink;
+
+	char msg[128];
+	snprintf(msg, sizeof(msg), "double sin/cos %.2f ns, sinf/cosf %.2f ns, Q14 table %.2f ns per sample",
+			 legacy.count() / BENCH_SAMPLES, single.count() / BENCH_SAMPLES, table.count() / BENCH_SAMPLES);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_EQUAL_UINT32(BENCH_SAMPLES, ws.dirCount);
+	TEST_ASSERT_TRUE(table.count() < legacy.count());
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_single_samples);
+	RUN_TEST(test_input_outside_a_turn);
+	RUN_TEST(test_wrap_around_north);
+	RUN_TEST(test_against_atan2);
+	RUN_TEST(test_long_run_halves_sums);
+	RUN_TEST(test_direction_timing);
+	return UNITY_END();
+}
@@ -0,0 +1,291 @@
+/**
+ * @file test_main.cpp
+ * @brief WS8x key dispatch, pio test -e native
+ *    test_lookup_timing times ws8x_lookupKey() against the String == chain
+ *    it replaced over the keys of the test_ws8x_replay capture.
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "WString.h"
+#include "ws8x.h"
+#include "../test_ws8x_replay/capture.h"
+
+/** Times the keys of the capture are looked up by each dispatch */
+#define BENCH_PASSES 2000
+
+/** The keys of WS8X_KEYS in ws8x.cpp and their fields */
+struct key_field
+{
+	const char *key;
+	ws8x_field field;
+};
+
+static const key_field known[] = {
+	{"WindDir", WS8X_FIELD_WIND_DIR},
+	{"WindSpeed", WS8X_FIELD_WIND_SPEED},
+	{"WindGust", WS8X_FIELD_WIND_GUST},
+	{"BatVoltage", WS8X_FIELD_BAT_VOLTAGE},
+	{"CapVoltage", WS8X_FIELD_CAP_VOLTAGE},
+	{"GXTS04Temp", WS8X_FIELD_TEMPERATURE},
+	{"Temperature", WS8X_FIELD_TEMPERATURE},
+	{"Rain", WS8X_FIELD_RAIN},
+	{"RainIntSum", WS8X_FIELD_RAIN_SUM},
+};
+#define KNOWN_NUM (sizeof(known) / sizeof(known[0]))
+
+static ws8x_t ws;
+
+void setUp(void)
+{
+	ws8x_init(&ws);
+}
+
+void tearDown(void)
+{
+}
+
+/**
+ * @brief Feed "<key>=1"
+ *
+ * @return ws8x_field field the key was dispatched to, WS8X_FIELD_UNKNOWN if rejected
+ */
+static ws8x_field dispatch(const char *key)
+{
+	char line[SENSOR_LINE_SIZE];
+	int len = snprintf(line, sizeof(line), "%s=1", key);
+	uint32_t unknown = ws.unknownKeys;
+	ws.seen = 0;
+	ws8x_feed(&ws, line, (uint8_t)len);
+	if (ws.unknownKeys != unknown)
+	{
+		return WS8X_FIELD_UNKNOWN;
+	}
+	for (uint8_t field = 1; field < WS8X_FIELD_NUM; field++)
+	{
+		if (ws.seen & (1 << field))
+		{
+			return (ws8x_field)field;
+		}
+	}
+	TEST_FAIL_MESSAGE(key);
+	return WS8X_FIELD_UNKNOWN;
+}
+
+/** Key matches one of the known keys */
+static bool is_known(const char *key)
+{
+	for (size_t idx = 0; idx < KNOWN_NUM; idx++)
+	{
+		if (strcmp(key, known[idx].key) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void test_known_keys(void)
+{
+	for (size_t idx = 0; idx < KNOWN_NUM; idx++)
+	{
+		TEST_ASSERT_EQUAL_MESSAGE(known[idx].field, dispatch(known[idx].key), known[idx].key);
+	}
+	TEST_ASSERT_EQUAL_UINT32(0, ws.unknownKeys);
+}
+
+static void test_whitespace_around_key(void)
+{
+	char line[] = "  WindSpeed \t= 3.4 ";
+	ws8x_feed(&ws, line, (uint8_t)strlen(line));
+	TEST_ASSERT_TRUE(ws.seen & (1 << WS8X_FIELD_WIND_SPEED));
+	TEST_ASSERT_EQUAL_UINT32(0, ws.unknownKeys);
+}
+
+static void test_near_misses(void)
+{
+	char key[SENSOR_LINE_SIZE];
+	uint32_t tried = 0;
+	for (size_t idx = 0; idx < KNOWN_NUM; idx++)
+	{
+		size_t len = strlen(known[idx].key);
+		// Every prefix
+		for (size_t cut = 1; cut < len; cut++)
+		{
+			snprintf(key, sizeof(key), "%.*s", (int)cut, known[idx].key);
+			if (!is_known(key))
+			{
+				TEST_ASSERT_EQUAL_MESSAGE(WS8X_FIELD_UNKNOWN, dispatch(key), key);
+				tried++;
+			}
+		}
+		// Appended characters
+		snprintf(key, sizeof(key), "%sX", known[idx].key);
+		TEST_ASSERT_EQUAL_MESSAGE(WS8X_FIELD_UNKNOWN, dispatch(key), key);
+		snprintf(key, sizeof(key), "%s1", known[idx].key);
+		TEST_ASSERT_EQUAL_MESSAGE(WS8X_FIELD_UNKNOWN, dispatch(key), key);
+		// Every single character changed, including the case
+		for (size_t pos = 0; pos < len; pos++)
+		{
+			for (int c = '0'; c <= 'z'; c++)
+			{
+				strcpy(key, known[idx].key);
+				if (key[pos] == c)
+				{
+					continue;
+				}
+				key[pos] = (char)c;
+				if (c == '=' || is_known(key))
+				{
+					continue;
+				}
+				TEST_ASSERT_EQUAL_MESSAGE(WS8X_FIELD_UNKNOWN, dispatch(key), key);
+				tried++;
+			}
+		}
+	}
+	TEST_ASSERT_EQUAL_UINT32(tried, ws.unknownKeys - 2 * KNOWN_NUM);
+}
+
+static void test_random_keys(void)
+{
+	static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_";
+	char key[16];
+	srand(1);
+	for (int round = 0; round < 200000; round++)
+	{
+		int len = 1 + rand() % (sizeof(key) - 1);
+		for (int pos = 0; pos < len; pos++)
+		{
+			key[pos] = chars[rand() % (sizeof(chars) - 1)];
+		}
+		key[len] = '\0';
+		if (!is_known(key))
+		{
+			TEST_ASSERT_EQUAL_MESSAGE(WS8X_FIELD_UNKNOWN, dispatch(key), key);
+		}
+	}
+}
+
+/**
+ * @brief Key dispatch of ws8x_checkSerial() before the hashed lookup
+ */
+static ws8x_field legacy_lookup(const String &key)
+{
+	if (key == "WindDir")
+		return WS8X_FIELD_WIND_DIR;
+	else if (key == "WindSpeed")
+		return WS8X_FIELD_WIND_SPEED;
+	else if (key == "WindGust")
+		return WS8X_FIELD_WIND_GUST;
+	else if (key == "BatVoltage")
+		return WS8X_FIELD_BAT_VOLTAGE;
+	else if (key == "CapVoltage")
+		return WS8X_FIELD_CAP_VOLTAGE;
+	else if (key == "GXTS04Temp" || key == "Temperature")
+		return WS8X_FIELD_TEMPERATURE;
+	return WS8X_FIELD_UNKNOWN;
+}
+
+/** Trimmed keys of the lines in the capture of test_ws8x_replay */
+static std::vector<std::string> capture_keys(void)
+{
+	std::vector<std::string> keys;
+	std::string line;
+	size_t chunks = sizeof(capture_chunks) / sizeof(capture_chunks[0]);
+	for (size_t idx = 0; idx < chunks; idx++)
+	{
+		const char *hex = capture_chunks[idx].hex;
+		for (size_t pos = 0; hex[pos] != '\0' && hex[pos + 1] != '\0'; pos += 2)
+		{
+			char byte[3] = {hex[pos], hex[pos + 1], '\0'};
+			char c = (char)strtoul(byte, NULL, 16);
+			if (c != '\n')
+			{
+				line += c;
+				continue;
+			}
+			size_t sep = line.find('=');
+			if (sep != std::string::npos)
+			{
+				size_t end = line.find_last_not_of(" \t", sep - 1);
+				size_t begin = line.find_first_not_of(" \t");
+				keys.push_back(end == std::string::npos ? "" : line.substr(begin, end + 1 - begin));
+			}
+			line.clear();
+		}
+	}
+	return keys;
+}
+
+static void test_lookup_timing(void)
+{
+	std::vector<std::string> keys = capture_keys();
+	TEST_ASSERT_GREATER_THAN(0, keys.size());
+	// The old code built a String of every key, that is not part of the timing
+	std::vector<String> legacy_keys;
+	for (size_t idx = 0; idx < keys.size(); idx++)
+	{
+		legacy_keys.push_back(String(keys[idx].c_str()));
+		ws8x_field field = legacy_lookup(legacy_keys[idx]);
+		if (field != WS8X_FIELD_UNKNOWN)
+		{
+			TEST_ASSERT_EQUAL_MESSAGE(field, ws8x_lookupKey(keys[idx].data(), keys[idx].size()), keys[idx].c_str());
+		}
+	}
+
+	volatile uint32_t sink = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < BENCH_PASSES; pass++)
+	{
+		for (size_t idx = 0; idx < legacy_keys.size(); idx++)
+		{
+			sink = sink + legacy_lookup(legacy_keys[idx]);
+		}
+	}
+	std::chrono::duration<double, std::nano> legacy = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < BENCH_PASSES; pass++)
+	{
+		for (size_t idx = 0; idx < keys.size(); idx++)
+		{
+			sink = sink + ws8x_lookupKey(keys[idx].data(), keys[idx].size());
+		}
+	}
+	std::chrono::duration<double, std::nano> hashed = std::chrono::steady_clock::now() - start;
+
+	double lookups = (double)keys.size() * BENCH_PASSES;
+	char msg[128];
+	snprintf(msg, sizeof(msg), "%u keys, String == chain %.1f ns/key, ws8x_lookupKey %.1f ns/key",
+			 (unsigned)keys.size(), legacy.count() / lookups, hashed.count() / lookups);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_TRUE(hashed.count() < legacy.count());
+}
+
+static void test_line_without_separator(void)
+{
+	char line[] = "WindDir 180";
+	ws8x_feed(&ws, line, (uint8_t)strlen(line));
+	TEST_ASSERT_EQUAL_UINT32(1, ws.noSeparator);
+	TEST_ASSERT_EQUAL_UINT32(0, ws.unknownKeys);
+	TEST_ASSERT_EQUAL_UINT16(0, ws.seen);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_known_keys);
+	RUN_TEST(test_whitespace_around_key);
+	RUN_TEST(test_near_misses);
+	RUN_TEST(test_random_keys);
+	RUN_TEST(test_line_without_separator);
+	RUN_TEST(test_lookup_timing);
+	return UNITY_END();
+}
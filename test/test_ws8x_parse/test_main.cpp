@@ -0,0 +1,276 @@
+/**
+ * @file test_main.cpp
+ * @brief WS8x value parser against atof(), pio test -e native
+ *    test_parse_timing times ws8x_parseFixed() against String::toFloat()
+ *    over a generated corpus of sensor values, and measures the error of
+ *    both against the value the digits denote.
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "WString.h"
+#include "ws8x.h"
+
+/** Values in the timing corpus */
+#define BENCH_VALUES 100000
+
+static ws8x_t ws;
+
+void setUp(void)
+{
+	ws8x_init(&ws);
+}
+
+void tearDown(void)
+{
+}
+
+/**
+ * @brief Feed one "key=value" line
+ *
+ * @return true if the value was taken, false if it was a parse error
+ */
+static bool feed(const char *key, const char *value)
+{
+	char line[SENSOR_LINE_SIZE];
+	int len = snprintf(line, sizeof(line), "%s=%s", key, value);
+	uint32_t errors = ws.parseErrors;
+	ws8x_feed(&ws, line, (uint8_t)len);
+	return ws.parseErrors == errors;
+}
+
+/**
+ * @brief Reference with atof(), rounded half away from zero
+ *    The small offset keeps decimal halves like 1.15 from rounding down
+ *    through their binary representation.
+ */
+static int32_t reference(const char *value, uint8_t decimals)
+{
+	double scaled = atof(value) * pow(10, decimals);
+	double rounded = floor(fabs(scaled) + 0.5 + 1e-7);
+	return (int32_t)((scaled < 0) ? -rounded : rounded);
+}
+
+static void test_examples(void)
+{
+	TEST_ASSERT_TRUE(feed("Temperature", "21.35"));
+	TEST_ASSERT_EQUAL_INT32(214, ws.temperature);
+	TEST_ASSERT_TRUE(feed("Temperature", "-4"));
+	TEST_ASSERT_EQUAL_INT32(-40, ws.temperature);
+	TEST_ASSERT_TRUE(feed("Temperature", "-0.05"));
+	TEST_ASSERT_EQUAL_INT32(-1, ws.temperature);
+	TEST_ASSERT_TRUE(feed("Rain", ".5"));
+	TEST_ASSERT_EQUAL_INT32(5, ws.rain);
+	TEST_ASSERT_TRUE(feed("Rain", "+7."));
+	TEST_ASSERT_EQUAL_INT32(70, ws.rain);
+	TEST_ASSERT_TRUE(feed("BatVoltage", "3.29V"));
+	TEST_ASSERT_EQUAL_INT32(329, ws.batVoltage);
+	TEST_ASSERT_TRUE(feed("CapVoltage", " 5.1 "));
+	TEST_ASSERT_EQUAL_INT32(510, ws.capVoltage);
+	TEST_ASSERT_TRUE(feed("RainIntSum", "12"));
+	TEST_ASSERT_EQUAL_INT32(12, ws.rainSum);
+}
+
+static void test_against_atof(void)
+{
+	static const char *const keys[] = {"Temperature", "BatVoltage", "RainIntSum"};
+	static const uint8_t decimals[] = {1, 2, 0};
+	char value[24];
+	srand(5);
+	for (int round = 0; round < 20000; round++)
+	{
+		uint8_t key = round % 3;
+		int32_t whole = rand() % 100000;
+		int frac_digits = rand() % 5;
+		int32_t frac = rand() % 10000;
+		const char *sign = (rand() % 3 == 0) ? "-" : "";
+		if (frac_digits == 0)
+		{
+			snprintf(value, sizeof(value), "%s%ld", sign, (long)whole);
+		}
+		else
+		{
+			snprintf(value, sizeof(value), "%s%ld.%0*ld", sign, (long)whole, frac_digits,
+					 (long)(frac % (int32_t)pow(10, frac_digits)));
+		}
+		TEST_ASSERT_TRUE_MESSAGE(feed(keys[key], value), value);
+		int32_t parsed = (key == 0) ? ws.temperature : (key == 1) ? ws.batVoltage : ws.rainSum;
+		TEST_ASSERT_EQUAL_INT_MESSAGE(reference(value, decimals[key]), parsed, value);
+	}
+}
+
+static void test_rejects_malformed(void)
+{
+	static const char *const bad[] = {"1e5", "1E5", "2.5e-1", "1.2.3", "12x", "0x10", "1,5", "-", ".",
+									  "+", "", "3.2 V", "1-2", "inf", "nan", "--5"};
+	ws.temperature = 99;
+	for (size_t idx = 0; idx < sizeof(bad) / sizeof(bad[0]); idx++)
+	{
+		TEST_ASSERT_FALSE_MESSAGE(feed("Temperature", bad[idx]), bad[idx]);
+	}
+	TEST_ASSERT_EQUAL_INT32(99, ws.temperature);
+	TEST_ASSERT_EQUAL_UINT32(sizeof(bad) / sizeof(bad[0]), ws.keyErrors[WS8X_FIELD_TEMPERATURE]);
+}
+
+static void test_unit_suffix(void)
+{
+	// Only the voltages come with a unit, and only "V"
+	TEST_ASSERT_TRUE(feed("CapVoltage", "4.98V"));
+	TEST_ASSERT_EQUAL_INT32(498, ws.capVoltage);
+	TEST_ASSERT_FALSE(feed("CapVoltage", "4.98mV"));
+	TEST_ASSERT_FALSE(feed("CapVoltage", "4.98VV"));
+	TEST_ASSERT_FALSE(feed("CapVoltage", "4.98v"));
+	TEST_ASSERT_FALSE(feed("BatVoltage", "V"));
+	TEST_ASSERT_FALSE(feed("Temperature", "21.5V"));
+	TEST_ASSERT_FALSE(feed("Temperature", "21.5C"));
+	TEST_ASSERT_EQUAL_INT32(498, ws.capVoltage);
+}
+
+static void test_no_data(void)
+{
+	ws.temperature = 123;
+	TEST_ASSERT_TRUE(feed("Temperature", "--"));
+	TEST_ASSERT_TRUE(feed("Temperature", "---"));
+	TEST_ASSERT_EQUAL_INT32(123, ws.temperature);
+	TEST_ASSERT_EQUAL_UINT32(0, ws.keyErrors[WS8X_FIELD_TEMPERATURE]);
+}
+
+static void test_range(void)
+{
+	TEST_ASSERT_TRUE(feed("RainIntSum", "9999999"));
+	TEST_ASSERT_EQUAL_INT32(9999999, ws.rainSum);
+	TEST_ASSERT_FALSE(feed("RainIntSum", "99999999"));
+}
+
+/** Value of the timing corpus */
+struct corpus_value
+{
+	std::string text;
+	uint8_t decimals;
+	const char *unit;
+	int32_t exact; // Value of the digits * 10^decimals, rounded half away from zero
+};
+
+/**
+ * @brief Values like the WS8x sends: temperature, wind speed and voltage
+ *    with a unit, with zero to three decimals each
+ */
+static std::vector<corpus_value> make_corpus(void)
+{
+	static const int32_t pow10[] = {1, 10, 100, 1000};
+	std::vector<corpus_value> corpus(BENCH_VALUES);
+	char text[24];
+	srand(6);
+	for (size_t idx = 0; idx < corpus.size(); idx++)
+	{
+		corpus_value &value = corpus[idx];
+		int kind = idx % 3;
+		int frac_digits = rand() % 4;
+		int32_t whole = (kind == 0) ? rand() % 50 : (kind == 1) ? rand() % 60 : rand() % 6;
+		int32_t frac = rand() % pow10[frac_digits];
+		bool negative = (kind == 0) && (rand() % 4 == 0);
+		value.decimals = (kind == 2) ? 2 : 1;
+		value.unit = (kind == 2) ? "V" : "";
+		if (frac_digits == 0)
+		{
+			snprintf(text, sizeof(text), "%s%d%s", negative ? "-" : "", (int)whole, value.unit);
+		}
+		else
+		{
+			snprintf(text, sizeof(text), "%s%d.%0*d%s", negative ? "-" : "", (int)whole, frac_digits, (int)frac, value.unit);
+		}
+		value.text = text;
+
+		int32_t digits = whole * pow10[frac_digits] + frac;
+		if (frac_digits <= value.decimals)
+		{
+			value.exact = digits * pow10[value.decimals - frac_digits];
+		}
+		else
+		{
+			int32_t cut = pow10[frac_digits - value.decimals];
+			value.exact = digits / cut + ((digits % cut) * 2 >= cut ? 1 : 0);
+		}
+		value.exact = negative ? -value.exact : value.exact;
+	}
+	return corpus;
+}
+
+static void test_parse_timing(void)
+{
+	std::vector<corpus_value> corpus = make_corpus();
+	std::vector<String> strings;
+	for (size_t idx = 0; idx < corpus.size(); idx++)
+	{
+		strings.push_back(String(corpus[idx].text.c_str()));
+	}
+
+	std::vector<float> floats(corpus.size());
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t idx = 0; idx < corpus.size(); idx++)
+	{
+		floats[idx] = strings[idx].toFloat();
+	}
+	std::chrono::duration<double, std::nano> legacy = std::chrono::steady_clock::now() - start;
+
+	std::vector<int32_t> fixed(corpus.size());
+	uint32_t failed = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t idx = 0; idx < corpus.size(); idx++)
+	{
+		const corpus_value &value = corpus[idx];
+		if (ws8x_parseFixed(value.text.c_str(), value.decimals, value.unit, &fixed[idx]) != WS8X_PARSE_OK)
+		{
+			failed++;
+		}
+	}
+	std::chrono::duration<double, std::nano> parsed = std::chrono::steady_clock::now() - start;
+
+	// toFloat() is scaled the best way it can be, rounding the float
+	uint32_t float_wrong = 0;
+	int32_t float_max = 0;
+	uint32_t fixed_wrong = 0;
+	int32_t fixed_max = 0;
+	for (size_t idx = 0; idx < corpus.size(); idx++)
+	{
+		const corpus_value &value = corpus[idx];
+		float scale = value.decimals == 2 ? 100.0f : 10.0f;
+		int32_t from_float = (int32_t)lroundf(floats[idx] * scale);
+		int32_t float_error = abs(from_float - value.exact);
+		int32_t fixed_error = abs(fixed[idx] - value.exact);
+		float_wrong += (float_error != 0);
+		float_max = (float_error > float_max) ? float_error : float_max;
+		fixed_wrong += (fixed_error != 0);
+		fixed_max = (fixed_error > fixed_max) ? fixed_error : fixed_max;
+	}
+
+	char msg[160];
+	snprintf(msg, sizeof(msg), "toFloat %.1f ns/value, %u of %u off by up to %d LSB",
+			 legacy.count() / corpus.size(), (unsigned)float_wrong, (unsigned)corpus.size(), (int)float_max);
+	TEST_MESSAGE(msg);
+	snprintf(msg, sizeof(msg), "ws8x_parseFixed %.1f ns/value, %u of %u off by up to %d LSB",
+			 parsed.count() / corpus.size(), (unsigned)fixed_wrong, (unsigned)corpus.size(), (int)fixed_max);
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_EQUAL_UINT32(0, failed);
+	TEST_ASSERT_EQUAL_UINT32(0, fixed_wrong);
+	TEST_ASSERT_TRUE(parsed.count() < legacy.count());
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_examples);
+	RUN_TEST(test_against_atof);
+	RUN_TEST(test_rejects_malformed);
+	RUN_TEST(test_unit_suffix);
+	RUN_TEST(test_no_data);
+	RUN_TEST(test_range);
+	RUN_TEST(test_parse_timing);
+	return UNITY_END();
+}
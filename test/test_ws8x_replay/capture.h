@@ -0,0 +1,274 @@
+// Generated by tools/ws8x_replay.py header from test/test_ws8x_replay/ws85_capture.txt, do not edit
+#define CAPTURE_INTERVAL_S 60
+
+// Time of the ingest pass in ms and the bytes it read
+static const struct
+{
+	uint32_t ms;
+	const char *hex;
+} capture_chunks[] = {
+	{12040, "57696E644469722020202020203D203235320D0A57696E645370656564202020"},
+	{12040, "203D"},
+	{12050, "20342E350D0A57696E644775737420202020203D20372E300D0A475854533034"},
+	{12050, "54656D702020203D2031392E390D0A5261696E2020202020202020203D20302E"},
+	{12050, "300D0A5261696E496E7453756D2020203D20300D0A426174566F6C7461676520"},
+	{12050, "20203D20332E3235560D0A436170566F6C7461"},
+	{12060, "67652020203D20352E3138560D0A"},
+	{17050, "57696E644469722020202020203D203237370D0A57696E645370656564202020"},
+	{17050, "203D20322E310D0A57696E644775737420202020203D20332E340D0A47585453"},
+	{17050, "303454656D702020203D2032302E320D0A5261696E2020202020202020203D20"},
+	{17050, "302E300D0A5261"},
+	{17060, "696E496E7453756D2020203D20300D0A426174566F6C746167652020203D2033"},
+	{17060, "2E3333560D0A436170566F6C746167652020203D20352E3036560D0A"},
+	{22080, "57696E644469722020202020203D203237380D0A57696E645370656564202020"},
+	{22080, "203D20332E390D0A57696E644775"},
+	{22090, "737420202020203D20352E380D0A47585453303454656D702020203D2031392E"},
+	{22090, "390D0A5261696E2020202020202020203D20302E300D0A5261696E496E745375"},
+	{22090, "6D2020203D20300D0A426174566F6C746167652020203D20332E3232560D0A43"},
+	{22090, "6170566F6C746167652020203D20352E313056"},
+	{22100, "0D0A"},
+	{27100, "2D2D2D2057533835202D2D2D0D0A57696E644469722020202020203D20323739"},
+	{27100, "0D0A57696E645370656564202020"},
+	{27110, "203D20342E340D0A57696E644775737420202020203D20362E380D0A47585453"},
+	{27110, "303454656D702020203D2032302E330D0A5261696E2020202020202020203D20"},
+	{27110, "302E300D0A5261696E496E7453756D2020203D20300D0A426174566F6C746167"},
+	{27110, "652020203D20332E3237560D0A436170566F6C"},
+	{27120, "746167652020203D20342E3937560D0A48756D696469747920202020203D2035"},
+	{27120, "350D0A"},
+	{32080, "57696E644469722020202020203D203236360D0A57696E645370656564202020"},
+	{32080, "203D20342E340D0A57696E644775737420202020203D20352E300D0A47585453"},
+	{32080, "303454656D702020203D2032302E320D0A5261696E20202020202020"},
+	{32090, "20203D20302E300D0A5261696E496E7453756D2020203D20300D0A426174566F"},
+	{32090, "6C746167652020203D20332E3334560D0A436170566F6C746167652020203D20"},
+	{32090, "342E3930560D0A"},
+	{37100, "57696E644469722020202020203D203238330D0A57696E645370656564202020"},
+	{37100, "203D20332E370D0A57696E644775"},
+	{37110, "737420202020203D20342E310D0A47585453303454656D702020203D2032302E"},
+	{37110, "340D0A5261696E2020202020202020203D20302E300D0A5261696E496E745375"},
+	{37110, "6D2020203D20300D0A426174566F6C746167652020203D20332E3333560D0A43"},
+	{37110, "6170566F6C746167652020203D20352E313156"},
+	{37120, "0D0A"},
+	{42080, "57696E644469722020202020203D203234330D0A57696E645370656564202020"},
+	{42080, "203D20322E330D0A57696E644775"},
+	{42090, "737420202020203D20332E370D0A47585453303454656D702020203D2032302E"},
+	{42090, "330D0A5261696E2020202020202020203D20302E300D0A5261696E496E745375"},
+	{42090, "6D2020203D20300D0A426174566F6C746167652020203D20332E3333560D0A43"},
+	{42090, "6170566F6C746167652020203D20352E303156"},
+	{42100, "0D0A"},
+	{47060, "57696E644469722020202020203D203235350D0A57696E645370656564202020"},
+	{47060, "203D"},
+	{47070, "20322E320D0A57696E644775737420202020203D20342E330D0A475854533034"},
+	{47070, "54656D702020203D202D2D0D0A5261696E2020202020202020203D20302E300D"},
+	{47070, "0A5261696E496E7453756D2020203D20300D0A426174566F6C74616765202020"},
+	{47070, "3D20332E3334560D0A436170566F6C74616765"},
+	{47080, "2020203D20342E3935560D0A"},
+	{52080, "57696E644469722020202020203D203236380D0A57696E645370656564202020"},
+	{52080, "203D"},
+	{52090, "20312E350D0A57696E644775737420202020203D20322E300D0A475854533034"},
+	{52090, "54656D702020203D2032302E330D0A5261696E2020202020202020203D20302E"},
+	{52090, "300D0A5261696E496E7453756D2020203D20300D0A426174566F6C7461676520"},
+	{52090, "20203D20332E3234560D0A436170566F6C7461"},
+	{52100, "67652020203D20342E3936560D0A"},
+	{57040, "57696E6444697220202020"},
+	{57050, "20203D203236320D0A57696E645370656564202020203D20322E390D0A57696E"},
+	{57050, "644775737420202020203D20342E370D0A47585453303454656D702020203D20"},
+	{57050, "32302E330D0A5261696E2020202020202020203D20302E300D0A5261696E496E"},
+	{57050, "7453756D2020203D20300D0A426174566F6C74"},
+	{57060, "6167652020203D20332E3238560D0A436170566F6C746167652020203D20342E"},
+	{57060, "3935560D0A"},
+	{62080, "57696E644469722020202020203D203335330D0A57696E645370656564202020"},
+	{62080, "203D20322E330D0A57696E644775"},
+	{62090, "737420202020203D20342E300D0A47585453303454656D702020203D2032302E"},
+	{62090, "360D0A5261696E2020202020202020203D20302E310D0A5261696E496E745375"},
+	{62090, "6D2020203D20310D0A426174566F6C746167652020203D20332E3231560D0A43"},
+	{62090, "6170566F6C746167652020203D20352E313256"},
+	{62100, "0D0A"},
+	{67050, "57696E644469722020202020203D203335380D0A57696E645370656564202020"},
+	{67050, "203D20312E380D0A57696E644775737420202020203D20332E"},
+	{67060, "350D0A47585453303454656D702020203D2032302E360D0A5261696E20202020"},
+	{67060, "20202020203D20302E310D0A5261696E496E7453756D2020203D20310D0A4261"},
+	{67060, "74566F6C746167652020203D20332E3238560D0A436170566F6C746167652020"},
+	{67060, "203D20352E3139560D0A"},
+	{72040, "57696E6444697220202020"},
+	{72050, "20203D203235340D0A57696E645370656564202020203D20332E390D0A57696E"},
+	{72050, "644775737420202020203D20362E300D0A47585453303454656D702020203D20"},
+	{72050, "32302E360D0A5261696E2020202020202020203D20302E310D0A5261696E496E"},
+	{72050, "7453756D2020203D20310D0A426174566F6C74"},
+	{72060, "6167652020203D20332E3331560D0A436170566F6C746167652020203D20352E"},
+	{72060, "3138560D0A"},
+	{77040, "57696E644469722020202020203D203235340D0A57696E645370656564202020"},
+	{77040, "203D20352E310D0A57696E644775737420202020203D20362E350D0A47585453"},
+	{77040, "303454656D702020203D2032302E360D0A5261696E2020202020202020203D20"},
+	{77040, "302E310D0A5261696E496E7453756D2020203D"},
+	{77050, "20310D0A426174566F6C746167652020203D20332E3330560D0A436170566F6C"},
+	{77050, "746167652020203D20342E3939560D0A"},
+	{82040, "57696E644469722020202020203D203237320D0A57696E645370656564202020"},
+	{82040, "203D20332E350D0A57696E644775737420202020203D20352E310D0A47585453"},
+	{82040, "303454656D"},
+	{82050, "702020203D2032302E360D0A5261696E2020202020202020203D20302E310D0A"},
+	{82050, "5261696E496E7453756D2020203D20310D0A426174566F6C746167652020203D"},
+	{82050, "20332E3234560D0A436170566F6C746167652020203D20342E3936560D0A"},
+	{87040, "57696E644469722020202020203D203235320D0A57696E645370656564202020"},
+	{87040, "203D20322E370D0A57696E644775737420202020203D20352E"},
+	{87050, "330D0A47585453303454656D702020203D2032302E360D0A5261696E20202020"},
+	{87050, "20202020203D20302E310D0A5261696E496E7453756D2020203D20310D0A4261"},
+	{87050, "74566F6C746167652020203D20332E3239560D0A436170566F6C746167652020"},
+	{87050, "203D20352E3038560D0A"},
+	{92080, "57696E644469722020202020203D203234310D0A57696E645370656564202020"},
+	{92080, "203D20342E340D0A57696E644775737420202020203D20362E380D0A47585453"},
+	{92080, "303454656D702020203D2032302E360D0A5261696E20202020202020"},
+	{92090, "20203D20302E310D0A5261696E496E7453756D2020203D20310D0A426174566F"},
+	{92090, "6C746167652020203D20332E3236560D0A436170566F6C746167652020203D20"},
+	{92090, "342E3933560D0A"},
+	{97090, "57696E644469722020202020203D203235360D0A57696E645370656564202020"},
+	{97090, "203D20352E370D0A57696E644775737420202020203D20372E330D0A47585453"},
+	{97090, "303454656D702020203D2032302E370D0A5261696E20202020202020"},
+	{97100, "20203D20302E310D0A5261696E496E7453756D2020203D20310D0A426174566F"},
+	{97100, "6C746167652020203D20332E3331560D0A436170566F6C746167652020203D20"},
+	{97100, "352E3134560D0A"},
+	{102060, "57696E644469722020202020203D203235370D0A57696E645370656564202020"},
+	{102060, "203D20312E370D0A57696E644775737420202020203D20322E310D0A47585453"},
+	{102060, "303454656D702020203D2032302E380D0A5261696E20202020202020"},
+	{102070, "20203D20302E310D0A5261696E496E7453756D2020203D20310D0A426174566F"},
+	{102070, "6C746167652020203D20332E3233560D0A436170566F6C746167652020203D20"},
+	{102070, "352E3031560D0A"},
+	{107040, "57696E644469722020202020203D203235390D0A57696E645370656564202020"},
+	{107040, "203D20312E350D0A57696E644775737420202020203D20332E370D0A47585453"},
+	{107040, "303454656D702020203D2032302E380D0A5261696E2020202020202020203D20"},
+	{107040, "302E310D0A5261696E496E7453756D2020203D"},
+	{107050, "20310D0A426174566F6C746167652020203D20332E3231560D0A436170566F6C"},
+	{107050, "746167652020203D20352E3133560D0A"},
+	{112010, "57696E644469722020202020203D203238360D0A57696E645370656564202020"},
+	{112010, "203D20352E330D0A57696E644775737420202020203D20362E310D0A47585453"},
+	{112010, "303454656D702020203D2032312E300D0A5261696E2020202020202020203D20"},
+	{112010, "302E320D0A5261"},
+	{112020, "696E496E7453756D2020203D20320D0A426174566F6C746167652020203D2033"},
+	{112020, "2E3238560D0A436170566F6C746167652020203D20342E3931560D0A"},
+	{116980, "57696E644469722020202020203D203238380D0A57696E645370656564202020"},
+	{116980, "203D20342E380D0A57696E644775737420202020203D20372E360D0A47585453"},
+	{116980, "303454656D"},
+	{116990, "702020203D2032312E320D0A5261696E2020202020202020203D20302E320D0A"},
+	{116990, "5261696E496E7453756D2020203D20320D0A426174566F6C746167652020203D"},
+	{116990, "20332E3233560D0A436170566F6C746167652020203D20352E3134560D0A"},
+	{122000, "57696E644469722020202020203D203238310D0A57696E645370656564202020"},
+	{122000, "203D20312E390D0A57696E644775737420202020203D20322E340D0A47585453"},
+	{122000, "303454656D"},
+	{122010, "702020203D2032302E390D0A5261696E2020202020202020203D20302E320D0A"},
+	{122010, "5261696E496E7453756D2020203D20320D0A426174566F6C746167652020203D"},
+	{122010, "20332E3237560D0A436170566F6C746167652020203D20342E3936560D0A"},
+	{126970, "57696E644469722020202020203D203237380D0A57696E645370656564202020"},
+	{126970, "203D20332E390D0A57696E644775737420202020203D20352E350D0A47585453"},
+	{126970, "303454656D702020203D2032312E310D"},
+	{126980, "0A5261696E2020202020202020203D20302E320D0A5261696E496E7453756D20"},
+	{126980, "20203D20320D0A426174566F6C746167652020203D20332E3236560D0A436170"},
+	{126980, "566F6C746167652020203D20352E3130560D0A"},
+	{131990, "57696E644469722020202020203D203237320D0A57696E645370656564202020"},
+	{131990, "203D20352E360D0A57696E644775"},
+	{132000, "737420202020203D20372E330D0A47585453303454656D702020203D2032312E"},
+	{132000, "320D0A5261696E2020202020202020203D20302E320D0A5261696E496E745375"},
+	{132000, "6D2020203D20320D0A426174566F6C746167652020203D20332E3330560D0A43"},
+	{132000, "6170566F6C746167652020203D20352E313056"},
+	{132010, "0D0A"},
+	{136990, "57696E6444697220202020"},
+	{137000, "20203D203235350D0A57696E645370656564202020203D20322E370D0A57696E"},
+	{137000, "644775737420202020203D20332E370D0A47585453303454656D702020203D20"},
+	{137000, "32312E320D0A5261696E2020202020202020203D20302E320D0A5261696E496E"},
+	{137000, "7453756D2020203D20320D0A426174566F6C74"},
+	{137010, "6167652020203D20332E3235560D0A436170566F6C746167652020203D20352E"},
+	{137010, "3135560D0A"},
+	{141990, "57696E644469722020202020203D203237390D0A57696E645370656564202020"},
+	{141990, "203D20342E310D0A57696E644775737420202020203D20352E350D0A47585453"},
+	{141990, "303454656D702020203D2032312E330D0A5261696E2020202020202020203D20"},
+	{141990, "302E320D0A5261"},
+	{142000, "696E496E7453756D2020203D20320D0A426174566F6C746167652020203D2033"},
+	{142000, "2E3335560D0A436170566F6C746167652020203D20342E3935560D0A"},
+	{146970, "57696E644469722020202020203D203237370D0A57696E"},
+	{146980, "645370656564202020203D20352E380D0A57696E644775737420202020203D20"},
+	{146980, "382E310D0A47585453303454656D702020203D2032312E320D0A5261696E2020"},
+	{146980, "202020202020203D20302E320D0A5261696E496E7453756D2020203D20320D0A"},
+	{146980, "426174566F6C746167652020203D20332E3238"},
+	{146990, "560D0A436170566F6C746167652020203D20352E3030560D0A"},
+	{152010, "57696E644469722020202020203D203238340D0A57696E645370656564202020"},
+	{152010, "203D20352E370D0A57696E644775737420202020203D20362E350D0A47585453"},
+	{152010, "303454656D"},
+	{152020, "702020203D2032312E350D0A5261696E2020202020202020203D20302E320D0A"},
+	{152020, "5261696E496E7453756D2020203D20320D0A426174566F6C746167652020203D"},
+	{152020, "20332E3231560D0A436170566F6C746167652020203D20342E3932560D0A"},
+	{157050, "57696E644469722020202020203D203235320D0A57696E645370656564202020"},
+	{157050, "203D20322E310D0A57696E644775737420202020203D20322E380D0A47585453"},
+	{157050, "303454656D702020203D2032312E360D0A5261696E2020202020202020203D20"},
+	{157050, "302E320D0A5261"},
+	{157060, "696E496E7453756D2020203D20320D0A426174566F6C746167652020203D2033"},
+	{157060, "2E3234560D0A436170566F6C746167652020203D20352E3134560D0A"},
+	{162010, "57696E644469722020202020203D203235360D0A57696E645370656564202020"},
+	{162010, "203D20332E360D0A57696E644775"},
+	{162020, "737420202020203D20342E370D0A47585453303454656D702020203D2032312E"},
+	{162020, "330D0A5261696E2020202020202020203D20302E330D0A5261696E496E745375"},
+	{162020, "6D2020203D20330D0A426174566F6C746167652020203D20332E3335560D0A43"},
+	{162020, "6170566F6C746167652020203D20352E303956"},
+	{162030, "0D0A"},
+	{167010, "57696E644469722020202020203D203234310D0A57696E645370656564202020"},
+	{167010, "203D20342E380D0A57696E644775737420202020203D20362E390D0A47585453"},
+	{167010, "303454656D702020203D2032312E340D0A5261696E2020202020202020203D20"},
+	{167010, "302E330D0A5261"},
+	{167020, "696E496E7453756D2020203D20330D0A426174566F6C746167652020203D2033"},
+	{167020, "2E3333560D0A436170566F6C746167652020203D20352E3132560D0A"},
+	{172020, "57696E644469722020202020203D203235340D0A57696E645370656564202020"},
+	{172020, "203D20342E390D0A57696E644775737420202020203D20362E330D0A47585453"},
+	{172020, "303454656D702020203D2032312E360D0A5261696E20202020202020"},
+	{172030, "20203D20302E330D0A5261696E496E7453756D2020203D20330D0A426174566F"},
+	{172030, "6C746167652020203D20332E3235560D0A436170566F6C746167652020203D20"},
+	{172030, "352E3035560D0A"},
+	{176990, "57696E6444697220202020"},
+	{177000, "20203D203238360D0A57696E645370656564202020203D20312E330D0A57696E"},
+	{177000, "644775737420202020203D20332E310D0A47585453303454656D702020203D20"},
+	{177000, "32312E370D0A5261696E2020202020202020203D20302E330D0A5261696E496E"},
+	{177000, "7453756D2020203D20330D0A426174566F6C74"},
+	{177010, "6167652020203D20332E3333560D0A436170566F6C746167652020203D20342E"},
+	{177010, "3935560D0A"},
+	{182000, "57696E644469722020202020203D203234310D0A57696E645370656564202020"},
+	{182000, "203D20342E340D0A57696E644775737420202020203D20352E330D0A47585453"},
+	{182000, "303454656D702020203D2032312E360D0A5261696E20202020202020"},
+	{182010, "20203D20302E330D0A5261696E496E7453756D2020203D20330D0A426174566F"},
+	{182010, "6C746167652020203D20332E3238560D0A436170566F6C746167652020203D20"},
+	{182010, "352E3031560D0A"},
+	{186970, "57696E644469722020202020203D203236310D0A57696E645370656564202020"},
+	{186970, "203D20322E310D0A57696E644775"},
+	{186980, "737420202020203D20322E350D0A47585453303454656D702020203D2032312E"},
+	{186980, "380D0A5261696E2020202020202020203D20302E330D0A5261696E496E745375"},
+	{186980, "6D2020203D20330D0A426174566F6C746167652020203D20332E3238560D0A43"},
+	{186980, "6170566F6C746167652020203D20352E313556"},
+	{186990, "0D0A"},
+	{191980, "57696E644469722020202020203D203236360D0A57696E645370656564202020"},
+	{191980, "203D20342E360D0A57696E644775737420202020203D20352E330D0A47585453"},
+	{191980, "303454656D"},
+	{191990, "702020203D2032312E390D0A5261696E2020202020202020203D20302E330D0A"},
+	{191990, "5261696E496E7453756D2020203D20330D0A426174566F6C746167652020203D"},
+	{191990, "20332E3230560D0A436170566F6C746167652020203D20352E3033560D0A"},
+	{196960, "57696E644469722020202020203D203235350D0A57696E645370656564202020"},
+	{196960, "203D20332E330D0A57696E644775737420202020203D20332E390D0A47585453"},
+	{196960, "303454656D702020203D2032312E390D0A5261696E20202020202020"},
+	{196970, "20203D20302E330D0A5261696E496E7453756D2020203D20330D0A426174566F"},
+	{196970, "6C746167652020203D20332E3232560D0A436170566F6C746167652020203D20"},
+	{196970, "342E3937560D0A"},
+	{201940, "57696E644469722020202020203D203235380D0A57696E645370656564202020"},
+	{201940, "203D20342E390D0A57696E644775737420202020203D20372E300D0A47585453"},
+	{201940, "303454656D702020203D2032312E380D0A5261696E20202020202020"},
+	{201950, "20203D20302E330D0A5261696E496E7453756D2020203D20330D0A426174566F"},
+	{201950, "6C746167652020203D20332E3331560D0A436170566F6C746167652020203D20"},
+	{201950, "342E3938560D0A"},
+	{206930, "57696E644469722020202020203D203237390D0A57696E645370656564202020"},
+	{206930, "203D20312E380D0A57696E644775737420202020203D20342E350D0A47585453"},
+	{206930, "303454656D702020203D2032312E390D0A5261696E20202020202020"},
+	{206940, "20203D20302E330D0A5261696E496E7453756D2020203D20330D0A426174566F"},
+	{206940, "6C746167652020203D20332E3232560D0A436170566F6C746167652020203D20"},
+	{206940, "352E3138560D0A"},
+};
+
+// Expected payloads, one per report interval
+static const char *const capture_payloads[] = {
+	"DC0A1E0046000F004A010802CE0001000000",
+	"5A0A26004C000F004A01FE01D40002000000",
+	"460A260051000D004001F401DB0003000000",
+	"500A260051000D0040010802DB0003000000",
+};
@@ -0,0 +1,200 @@
+/**
+ * @file test_main.cpp
+ * @brief WS8x driver against a recorded sensor stream, pio test -e native
+ *    capture.h is made from ws85_capture.txt and ws85_expect.json with
+ *    tools/ws8x_replay.py header. The chunks are framed like the ingest
+ *    in sensor.cpp and fed at their capture time, a report is taken every
+ *    CAPTURE_INTERVAL_S like ws8x_replay.py replay does on the device.
+ * @version 0.1
+ * @date 2025-07-14
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#include <unity.h>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "ws8x.h"
+#include "capture.h"
+
+/** Bytes of the payload that come from the sensor, the last value is the node battery */
+#define SENSOR_BYTES 16
+/** Limit for the parse time of one line on the PC, far above the usual few us */
+#define LINE_US_LIMIT 100
+
+static ws8x_t ws;
+static sensor_config config;
+
+/** Line framing state, like sensor_port in sensor.cpp */
+static char line[SENSOR_LINE_SIZE];
+static uint8_t line_len;
+static bool line_overflow;
+
+/** Print the running report after every chunk like AT+WXREPORT */
+static bool preview;
+
+static std::vector<double> line_us;
+static std::vector<std::string> payloads;
+
+void setUp(void)
+{
+	ws8x_init(&ws);
+	memset(&config, 0, sizeof(config));
+	config.window_ms = CAPTURE_INTERVAL_S * 1000UL;
+	ws8x_configure(&ws, &config);
+	line_len = 0;
+	line_overflow = false;
+	preview = false;
+	line_us.clear();
+	payloads.clear();
+}
+
+void tearDown(void)
+{
+}
+
+/**
+ * @brief Frame one byte like sensor_port_putc(), feed complete lines
+ */
+static void putc_line(char c)
+{
+	if (c == '\r')
+	{
+		return;
+	}
+	if (c != '\n')
+	{
+		if (line_len < SENSOR_LINE_SIZE - 1)
+		{
+			line[line_len++] = c;
+		}
+		else
+		{
+			line_overflow = true;
+		}
+		return;
+	}
+	if (!line_overflow && line_len > 0)
+	{
+		line[line_len] = '\0';
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		ws8x_feed(&ws, line, line_len);
+		std::chrono::duration<double, std::micro> spent = std::chrono::steady_clock::now() - start;
+		line_us.push_back(spent.count());
+	}
+	line_len = 0;
+	line_overflow = false;
+}
+
+/**
+ * @brief Take the report like AT+WXREPORT=1, keep the payload as hex
+ */
+static void take_report(void)
+{
+	uint8_t buffer[WS8X_PAYLOAD_SIZE];
+	char hex[2 * WS8X_PAYLOAD_SIZE + 1];
+	ws8x_aggregate(&ws);
+	uint8_t size = ws8x_encode(&ws, SENSOR_PAYLOAD_LEGACY, buffer, sizeof(buffer));
+	TEST_ASSERT_EQUAL(WS8X_PAYLOAD_SIZE, size);
+	for (uint8_t idx = 0; idx < size; idx++)
+	{
+		snprintf(&hex[2 * idx], 3, "%02X", buffer[idx]);
+	}
+	payloads.push_back(hex);
+	ws8x_reset(&ws);
+}
+
+/**
+ * @brief Replay all chunks at their capture time
+ */
+static void replay(void)
+{
+	size_t chunks = sizeof(capture_chunks) / sizeof(capture_chunks[0]);
+	uint32_t next_report_ms = capture_chunks[0].ms + CAPTURE_INTERVAL_S * 1000UL;
+	for (size_t idx = 0; idx < chunks; idx++)
+	{
+		uint32_t ms = capture_chunks[idx].ms;
+		while (ms >= next_report_ms)
+		{
+			native_set_time_us((uint64_t)next_report_ms * 1000);
+			take_report();
+			next_report_ms += CAPTURE_INTERVAL_S * 1000UL;
+		}
+		native_set_time_us((uint64_t)ms * 1000);
+		const char *hex = capture_chunks[idx].hex;
+		for (size_t pos = 0; hex[pos] != '\0' && hex[pos + 1] != '\0'; pos += 2)
+		{
+			char byte[3] = {hex[pos], hex[pos + 1], '\0'};
+			putc_line((char)strtoul(byte, NULL, 16));
+		}
+		if (preview)
+		{
+			uint8_t buffer[WS8X_PAYLOAD_SIZE];
+			TEST_ASSERT_EQUAL(WS8X_PAYLOAD_SIZE, ws8x_preview(&ws, SENSOR_PAYLOAD_LEGACY, buffer, sizeof(buffer)));
+		}
+	}
+	take_report();
+}
+
+static void test_payloads(void)
+{
+	size_t expected = sizeof(capture_payloads) / sizeof(capture_payloads[0]);
+	replay();
+	TEST_ASSERT_EQUAL(expected, payloads.size());
+	for (size_t idx = 0; idx < expected; idx++)
+	{
+		char msg[32];
+		snprintf(msg, sizeof(msg), "report %u", (unsigned)idx);
+		TEST_ASSERT_EQUAL_STRING_LEN_MESSAGE(capture_payloads[idx], payloads[idx].c_str(), 2 * SENSOR_BYTES, msg);
+	}
+}
+
+static void test_preview_keeps_report(void)
+{
+	// AT+WXREPORT between the reports must not change what they send
+	preview = true;
+	test_payloads();
+}
+
+static void test_line_errors(void)
+{
+	replay();
+	sensor_health health;
+	memset(&health, 0, sizeof(health));
+	ws8x_health(&ws, &health);
+	// The capture has one banner line, one unknown key and one "--" value
+	TEST_ASSERT_EQUAL(1, health.no_separator);
+	TEST_ASSERT_EQUAL(1, health.unknown_keys);
+	for (int field = 0; field < WS8X_FIELD_NUM; field++)
+	{
+		TEST_ASSERT_EQUAL(0, ws.keyErrors[field]);
+	}
+	TEST_ASSERT_EQUAL(0, ws.speedStats.truncated);
+}
+
+static void test_line_timing(void)
+{
+	replay();
+	TEST_ASSERT_GREATER_THAN(0, line_us.size());
+	std::vector<double> ordered(line_us);
+	std::sort(ordered.begin(), ordered.end());
+	double p50 = ordered[ordered.size() / 2];
+	double p99 = ordered[std::min(ordered.size() - 1, ordered.size() * 99 / 100)];
+	char msg[96];
+	snprintf(msg, sizeof(msg), "%u lines, p50 %.2f us, p99 %.2f us, max %.2f us",
+			 (unsigned)ordered.size(), p50, p99, ordered.back());
+	TEST_MESSAGE(msg);
+	TEST_ASSERT_LESS_THAN(LINE_US_LIMIT, p99);
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_payloads);
+	RUN_TEST(test_preview_keeps_report);
+	RUN_TEST(test_line_errors);
+	RUN_TEST(test_line_timing);
+	return UNITY_END();
+}
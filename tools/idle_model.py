@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Model the CPU current of the sensor ingest for a WS8x stream, AT+IDLE.
+
+A WS8x sends a burst of text lines every --period seconds at 115200 baud.
+The ingest timer of the firmware polls the UART every 10 ms. In idle mode
+it stops after SENSOR_IDLE_PASSES passes without a byte and the RX event
+of the next byte starts it again. This replays the stream through both
+modes and applies the current model of sensor.h (SENSOR_MODEL_*): the run
+current while the CPU wakes up for a pass and reads the bytes. The sleep
+floor, with the HF clock kept by the receiving UART, is the same in both
+modes and not part of the result.
+
+The constants are read from src/sensor.h and src/sensor.cpp, so the model
+follows the firmware. The numbers are a benchmark to compare changes with,
+not a measurement; AT+IDLE=? reports the same model from the device
+counters. --json prints the result for tracking.
+"""
+import argparse
+import json
+import os
+import re
+
+SRC = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src")
+
+
+def read_defines():
+    """SENSOR_* integer defines of the firmware."""
+    defines = {}
+    for name in ("sensor.h", "sensor.cpp"):
+        with open(os.path.join(SRC, name)) as source:
+            for match in re.finditer(r"^#define (SENSOR_\w+) (\d+)", source.read(), re.MULTILINE):
+                defines[match.group(1)] = int(match.group(2))
+    return defines
+
+
+def stream(args):
+    """Arrival times in us of the bytes of one period."""
+    byte_us = 10e6 / args.baud
+    times = []
+    now = 0.0
+    for _ in range(args.lines):
+        for _ in range(args.line_bytes):
+            now += byte_us
+            times.append(now)
+        now += args.line_gap_ms * 1000
+    return times
+
+
+def simulate(args, defines, idle):
+    """Return passes, wakes and busy us of the ingest over --seconds."""
+    period_us = defines["SENSOR_INGEST_PERIOD_MS"] * 1000
+    burst = stream(args)
+    arrivals = []
+    start = 0.0
+    while start < args.seconds * 1e6:
+        arrivals.extend(start + offset for offset in burst)
+        start += args.period * 1e6
+
+    passes = wakes = 0
+    busy_us = 0.0
+    empty = 0
+    running = True
+    now = 0.0
+    idx = 0
+    end = args.seconds * 1e6
+    while now < end:
+        if not running:
+            if idx >= len(arrivals):
+                break
+            # The first received byte wakes the timer, its first pass one period later
+            now = arrivals[idx] + period_us
+            wakes += 1
+            running = True
+            empty = 0
+            continue
+        read = 0
+        while idx < len(arrivals) and arrivals[idx] <= now:
+            idx += 1
+            read += 1
+        passes += 1
+        busy_us += args.pass_us + read * args.byte_cpu_us
+        if read:
+            empty = 0
+        else:
+            empty += 1
+            if idle and empty >= defines["SENSOR_IDLE_PASSES"]:
+                running = False
+        now += period_us
+    return passes, wakes, busy_us
+
+
+def model(defines, seconds, passes, wakes, busy_us):
+    """Awake share in permille and the CPU current in uA the ingest adds, as sensors_idle_stats()."""
+    elapsed_us = seconds * 1e6
+    awake_us = min((passes + wakes) * defines["SENSOR_MODEL_WAKE_US"] + busy_us, elapsed_us)
+    return 1000 * awake_us / elapsed_us, awake_us * defines["SENSOR_MODEL_RUN_UA"] / elapsed_us
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--period", type=float, default=5.0, help="s between two bursts of the station")
+    parser.add_argument("--lines", type=int, default=9, help="lines per burst")
+    parser.add_argument("--line-bytes", type=int, default=24, help="bytes per line")
+    parser.add_argument("--line-gap-ms", type=float, default=1.0, help="gap between two lines of a burst")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--pass-us", type=float, default=6.0, help="CPU time of a pass without bytes")
+    parser.add_argument("--byte-cpu-us", type=float, default=1.5, help="CPU time per byte read and framed")
+    parser.add_argument("--seconds", type=float, default=3600, help="modelled time")
+    parser.add_argument("--json", action="store_true", help="print the result as JSON")
+    args = parser.parse_args()
+
+    defines = read_defines()
+    result = {}
+    for mode, idle in (("poll", False), ("idle", True)):
+        passes, wakes, busy_us = simulate(args, defines, idle)
+        awake, current = model(defines, args.seconds, passes, wakes, busy_us)
+        result[mode] = {
+            "passes_per_s": round(passes / args.seconds, 2),
+            "wakes": wakes,
+            "awake_permille": round(awake, 3),
+            "current_ua": round(current, 2),
+        }
+    result["saving_ua"] = round(result["poll"]["current_ua"] - result["idle"]["current_ua"], 2)
+
+    if args.json:
+        print(json.dumps(result, indent=2))
+        return
+    print("mode  passes/s  wakes  awake permille  CPU current uA")
+    for mode in ("poll", "idle"):
+        row = result[mode]
+        print("%-4s  %8.2f  %5d  %14.3f  %14.2f" % (mode, row["passes_per_s"], row["wakes"],
+                                                      row["awake_permille"], row["current_ua"]))
+    print("idle mode saves %.2f uA" % result["saving_ua"])
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Simulate uplink collisions of N nodes for the report schedules of AT+SCHED.
+
+Every node sends one uplink of --airtime ms per interval on one of
+--channels channels, picked at random like the LoRaWAN MAC does. Two
+uplinks that overlap on the same channel collide (pure ALOHA, no capture
+effect). The nodes are powered up within --boot-spread seconds of each
+other, their clocks run off by up to --ppm.
+
+Schedules, as the firmware plans them (src/schedule.cpp):
+  legacy   every interval after the last report, first report 60 s after
+           boot (the schedule before AT+SCHED)
+  slot     DevEUI hash slot in the interval, counted from boot
+  jitter   slot plus a random delay of up to --jitter s
+  aligned  slot plus jitter on wall clock boundaries, --clock-error s off
+
+The result is the share of uplinks that collided, next to the pure ALOHA
+value for uplinks at independent random times.
+"""
+import argparse
+import math
+import random
+
+FIRST_MS = 60000
+MIN_GAP_MS = 10000
+MASK32 = 0xFFFFFFFF
+
+
+def device_hash(eui):
+    """FNV-1a of the DevEUI with the MurmurHash3 finalizer, as schedule_hash()."""
+    value = 2166136261
+    for byte in eui:
+        value = ((value ^ byte) * 16777619) & MASK32
+    value ^= value >> 16
+    value = (value * 0x85EBCA6B) & MASK32
+    value ^= value >> 13
+    value = (value * 0xC2B2AE35) & MASK32
+    value ^= value >> 16
+    return value
+
+
+class Node:
+    """Uplink times of one node in ms of the simulation clock."""
+
+    def __init__(self, args, mode, rng):
+        eui = bytes([0xAC, 0x1F, 0x09, 0xFF, 0xFE]) + bytes(rng.randrange(256) for _ in range(3))
+        self.hash = device_hash(eui)
+        self.jitter_state = self.hash | 1
+        self.mode = mode
+        self.period = args.interval * 1000
+        self.jitter_ms = min(args.jitter * 1000, self.period // 4) if mode in ("jitter", "aligned") else 0
+        self.boot = rng.uniform(0, args.boot_spread * 1000)
+        self.drift = 1 + rng.uniform(-args.ppm, args.ppm) * 1e-6
+        self.clock_offset = rng.uniform(-args.clock_error, args.clock_error) * 1000
+
+    def jitter(self):
+        """xorshift32 delay like schedule_jitter()."""
+        if self.jitter_ms == 0:
+            return 0
+        state = self.jitter_state
+        state ^= (state << 13) & MASK32
+        state ^= state >> 17
+        state ^= (state << 5) & MASK32
+        self.jitter_state = state
+        return state % (self.jitter_ms + 1)
+
+    def slot(self, period):
+        return 0 if self.mode == "legacy" else self.hash % period
+
+    def uplinks(self, end_ms, rng):
+        """Yield the uplink start times until end_ms, planned like schedule_next()."""
+        local = FIRST_MS + self.slot(FIRST_MS) + self.jitter()
+        while True:
+            # The node clock counts from boot at the drifting rate
+            start = self.boot + local * self.drift
+            if start > end_ms:
+                return
+            yield start
+            if self.mode == "legacy":
+                # Next interval after the last report, loop() checks once per second
+                local += self.period + 1000 * rng.random()
+                continue
+            clock = start + self.clock_offset if self.mode == "aligned" else local
+            slot = self.slot(self.period)
+            earliest = clock + MIN_GAP_MS
+            target = slot + max(0, math.ceil((earliest - slot) / self.period)) * self.period
+            local += target - clock + self.jitter()
+
+
+def simulate(args, mode, seed):
+    """Return (uplinks, collided) of one run."""
+    rng = random.Random(seed)
+    end_ms = args.hours * 3600 * 1000
+    events = []
+    for _ in range(args.nodes):
+        node = Node(args, mode, rng)
+        for start in node.uplinks(end_ms, rng):
+            events.append((rng.randrange(args.channels), start))
+    events.sort()
+    collided = set()
+    for idx in range(1, len(events)):
+        # Sorted by channel, then start: overlap with the uplink before on the same channel
+        for back in range(idx - 1, -1, -1):
+            channel, start = events[back]
+            if channel != events[idx][0] or events[idx][1] - start >= args.airtime:
+                break
+            collided.add(idx)
+            collided.add(back)
+    return len(events), len(collided)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--nodes", type=int, nargs="+", default=[10, 50, 200], help="fleet sizes")
+    parser.add_argument("--interval", type=int, default=600, help="send interval in s")
+    parser.add_argument("--airtime", type=float, default=400, help="time on air of one uplink in ms")
+    parser.add_argument("--channels", type=int, default=8, help="uplink channels")
+    parser.add_argument("--jitter", type=int, default=10, help="jitter in s, AT+SCHED")
+    parser.add_argument("--boot-spread", type=float, default=1.0, help="power up of the fleet within s")
+    parser.add_argument("--ppm", type=float, default=20, help="clock error of the nodes in ppm")
+    parser.add_argument("--clock-error", type=float, default=0.5, help="wall clock error of the nodes in s")
+    parser.add_argument("--hours", type=float, default=24, help="simulated time")
+    parser.add_argument("--runs", type=int, default=5, help="runs per case with different seeds")
+    args = parser.parse_args()
+
+    modes = ("legacy", "slot", "jitter", "aligned")
+    print("nodes  " + "  ".join("%8s" % mode for mode in modes) + "     aloha")
+    for nodes in args.nodes:
+        args.nodes = nodes
+        shares = []
+        for mode in modes:
+            sent = collided = 0
+            for run in range(args.runs):
+                run_sent, run_collided = simulate(args, mode, run)
+                sent += run_sent
+                collided += run_collided
+            shares.append(collided / sent if sent else 0.0)
+        load = nodes * args.airtime / (args.interval * 1000.0 * args.channels)
+        aloha = 1 - math.exp(-2 * load)
+        print("%5d  " % nodes + "  ".join("%7.2f%%" % (100 * share) for share in shares) + "  %7.2f%%" % (100 * aloha))
+
+
+if __name__ == "__main__":
+    main()
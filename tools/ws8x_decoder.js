@@ -0,0 +1,268 @@
+// Uplink decoder for the WS8x weather station node.
+// Works as TTN v3 / ChirpStack v4 payload formatter (decodeUplink) and
+// under node.js: node ws8x_decoder.js <fPort> <hex payload>
+//
+// fPort LORAWAN_APP_PORT (2) carries the report, one record per sensor in
+// registry order (sensor.h):
+//   legacy (AT+PAYLOAD=0): 18 bytes per sensor, nine 16 bit little endian values
+//   packed (AT+PAYLOAD=1): byte 0 is the format version, then 10 bytes per
+//                          sensor, bit packed like WS8X_SCHEMA in ws8x.cpp
+//   batch (AT+BATCH>1):    byte 0 is 2, byte 1 intervals << 4 | intervals still
+//                          waiting, then the first interval absolute and the
+//                          others delta encoded, see sensors_batch_encode()
+//                          in sensor.cpp. Intervals are oldest first, each is
+//                          send interval / AT+BATCH long.
+// fPort LORAWAN_DIAG_PORT (20) carries the sensor health, see
+// sensors_health_encode() in sensor.cpp.
+// fPort LORAWAN_ALERT_PORT (21) carries the alerts of AT+ALERT, see
+// sensors_alert_encode() in sensor.cpp.
+// fPort LORAWAN_BACKLOG_PORT (22) carries reports from the store-and-forward
+// backlog of AT+BACKLOG, see backlog_encode() in backlog.cpp. Each record is
+// decoded like an uplink on its own fPort.
+
+var WS8X_LEGACY_SIZE = 18;
+var DIAG_RECORD_SIZE = 11;
+var ALERT_RECORD_SIZE = 3;
+// sensor_alert_rule in sensor.h: name, scale of the value
+var ALERT_RULES = [
+  ["gust", 0.1],
+  ["dirShift", 1],
+  ["batLow", 0.01],
+  ["capLow", 0.01],
+];
+// backlog.h: version and uptime, then fPort, size, boots ago and time per record.
+// Boots ago BACKLOG_BOOTS_UNIX means the time is the wall clock, not the uptime.
+var BACKLOG_FRAME_HEADER = 5;
+var BACKLOG_RECORD_HEADER = 7;
+var BACKLOG_BOOTS_UNIX = 255;
+// Sensors in SENSOR_LIST (sensor.h), batches carry no per sensor size
+var SENSOR_COUNT = 1;
+
+// Keep in sync with WS8X_SCHEMA in ws8x.cpp: name, width, offset, step, has "no data" code
+var WS8X_SCHEMA_V1 = [
+  ["dir", 9, 0, 1, false],
+  ["speed", 9, 0, 1, false],
+  ["gust", 10, 0, 1, false],
+  ["lull", 9, 0, 1, true],
+  ["batVoltage", 7, 0, 10, false],
+  ["capVoltage", 7, 0, 10, false],
+  ["temperature", 10, -400, 1, false],
+  ["rain", 12, 0, 1, false],
+  ["deviceMv", 7, 2500, 20, false],
+];
+
+function int16(bytes, i) {
+  var v = bytes[i] | (bytes[i + 1] << 8);
+  return v & 0x8000 ? v - 0x10000 : v;
+}
+
+function uint16(bytes, i) {
+  return bytes[i] | (bytes[i + 1] << 8);
+}
+
+// Raw report values in the units of ws8x_report to engineering units
+function ws8xValues(r) {
+  return {
+    windDir: r.dir,
+    windSpeed: r.speed / 10,
+    windGust: r.gust / 10,
+    windLull: r.lull === null ? null : r.lull / 10,
+    batVoltage: r.batVoltage / 100,
+    capVoltage: r.capVoltage / 100,
+    temperature: r.temperature / 10,
+    rain: r.rain / 10,
+    deviceVoltage: r.deviceMv / 1000,
+  };
+}
+
+function decodeLegacy(bytes) {
+  var sensors = [];
+  for (var i = 0; i + WS8X_LEGACY_SIZE <= bytes.length; i += WS8X_LEGACY_SIZE) {
+    var lull = int16(bytes, i + 6);
+    sensors.push(ws8xValues({
+      dir: int16(bytes, i) / 10,
+      speed: int16(bytes, i + 2),
+      gust: int16(bytes, i + 4),
+      lull: lull < 0 ? null : lull,
+      batVoltage: int16(bytes, i + 8),
+      capVoltage: int16(bytes, i + 10),
+      temperature: int16(bytes, i + 12),
+      rain: uint16(bytes, i + 14),
+      deviceMv: uint16(bytes, i + 16),
+    }));
+  }
+  return sensors;
+}
+
+// Reads fields MSB first, like bitpack.cpp
+function BitReader(bytes, start) {
+  this.bytes = bytes;
+  this.bit = start * 8;
+}
+
+BitReader.prototype.get = function (width) {
+  var value = 0;
+  for (var n = 0; n < width; n++, this.bit++) {
+    value = value * 2 + ((this.bytes[this.bit >> 3] >> (7 - (this.bit & 7))) & 1);
+  }
+  return value;
+};
+
+BitReader.prototype.getSigned = function (width) {
+  var value = this.get(width);
+  return width > 0 && value >= Math.pow(2, width - 1) ? value - Math.pow(2, width) : value;
+};
+
+function schemaBits(schema) {
+  var width = 0;
+  schema.forEach(function (f) { width += f[1]; });
+  return width;
+}
+
+// Packed codes of all sensors in one interval to values
+function codesToSensors(codes, schema) {
+  var sensors = [];
+  for (var s = 0; s + schema.length <= codes.length; s += schema.length) {
+    var r = {};
+    schema.forEach(function (f, i) {
+      var noData = Math.pow(2, f[1]) - 1;
+      r[f[0]] = f[4] && codes[s + i] === noData ? null : f[2] + codes[s + i] * f[3];
+    });
+    sensors.push(ws8xValues(r));
+  }
+  return sensors;
+}
+
+function decodePacked(bytes, schema) {
+  var recordSize = Math.ceil(schemaBits(schema) / 8);
+  var codes = [];
+  for (var start = 1; start + recordSize <= bytes.length; start += recordSize) {
+    var reader = new BitReader(bytes, start);
+    schema.forEach(function (f) { codes.push(reader.get(f[1])); });
+  }
+  return codesToSensors(codes, schema);
+}
+
+function decodeBatch(bytes, schema) {
+  var count = bytes[1] >> 4;
+  var reader = new BitReader(bytes, 2);
+  var widths = [];
+  for (var s = 0; s < SENSOR_COUNT; s++) {
+    schema.forEach(function (f) { widths.push(f[1]); });
+  }
+  var codes = widths.map(function (w) { return reader.get(w); });
+  var intervals = [codesToSensors(codes, schema)];
+  if (count > 1) {
+    var deltaWidths = widths.map(function () { return reader.get(4); });
+    for (var i = 1; i < count; i++) {
+      codes = codes.map(function (code, f) { return code + reader.getSigned(deltaWidths[f]); });
+      intervals.push(codesToSensors(codes, schema));
+    }
+  }
+  return { intervals: intervals, waiting: bytes[1] & 0x0f };
+}
+
+function decodeDiag(bytes) {
+  var sensors = [];
+  for (var i = 1; i + DIAG_RECORD_SIZE <= bytes.length; i += DIAG_RECORD_SIZE) {
+    var age = uint16(bytes, i + 9);
+    sensors.push({
+      linesPerMin: uint16(bytes, i),
+      bytesPerMin: uint16(bytes, i + 2),
+      queueFull: bytes[i + 4],
+      lineCap: bytes[i + 5],
+      noSeparator: bytes[i + 6],
+      unknownKeys: bytes[i + 7],
+      parseErrors: bytes[i + 8],
+      validAgeS: age === 0xffff ? null : age,
+    });
+  }
+  return sensors;
+}
+
+function decodeAlerts(bytes) {
+  var alerts = [];
+  for (var i = 1; i + ALERT_RECORD_SIZE <= bytes.length; i += ALERT_RECORD_SIZE) {
+    var rule = ALERT_RULES[bytes[i] & 0x0f];
+    alerts.push({
+      sensor: bytes[i] >> 4,
+      rule: rule ? rule[0] : "rule" + (bytes[i] & 0x0f),
+      value: int16(bytes, i + 1) * (rule ? rule[1] : 1),
+    });
+  }
+  return alerts;
+}
+
+function uint32(bytes, i) {
+  return (bytes[i] | (bytes[i + 1] << 8) | (bytes[i + 2] << 16)) + bytes[i + 3] * 0x1000000;
+}
+
+function decodeBacklog(bytes) {
+  var version = bytes[0];
+  var now = uint32(bytes, 1);
+  var records = [];
+  var i = BACKLOG_FRAME_HEADER;
+  while (i + BACKLOG_RECORD_HEADER <= bytes.length) {
+    var fPort = bytes[i];
+    var size = bytes[i + 1];
+    var boots = bytes[i + 2];
+    var time = uint32(bytes, i + 3);
+    var payload = bytes.slice(i + BACKLOG_RECORD_HEADER, i + BACKLOG_RECORD_HEADER + size);
+    var record = { fPort: fPort };
+    if (version >= 2 && boots === BACKLOG_BOOTS_UNIX) {
+      record.time = new Date(time * 1000).toISOString();
+    } else {
+      record.bootsAgo = boots;
+      record.uptimeS = time;
+      // Age is only known for records of the current boot
+      record.ageS = boots === 0 ? now - time : null;
+    }
+    record.report = decodeUplink({ fPort: fPort, bytes: payload });
+    records.push(record);
+    i += BACKLOG_RECORD_HEADER + size;
+  }
+  return { uptimeS: now, records: records };
+}
+
+function decodeUplink(input) {
+  var bytes = input.bytes;
+  if (input.fPort === 22) {
+    if (bytes[0] !== 1 && bytes[0] !== 2) {
+      return { errors: ["unknown backlog version " + bytes[0]] };
+    }
+    return { data: decodeBacklog(bytes) };
+  }
+  if (input.fPort === 21) {
+    if (bytes[0] !== 1) {
+      return { errors: ["unknown alert version " + bytes[0]] };
+    }
+    return { data: { version: bytes[0], alerts: decodeAlerts(bytes) } };
+  }
+  if (input.fPort === 20) {
+    if (bytes[0] !== 1) {
+      return { errors: ["unknown diagnostic version " + bytes[0]] };
+    }
+    return { data: { version: bytes[0], sensors: decodeDiag(bytes) } };
+  }
+  // Legacy uplinks have no header and are a multiple of 18 bytes
+  if (bytes.length > 0 && bytes.length % WS8X_LEGACY_SIZE === 0) {
+    return { data: { format: "legacy", sensors: decodeLegacy(bytes) } };
+  }
+  if (bytes[0] === 2) {
+    var batch = decodeBatch(bytes, WS8X_SCHEMA_V1);
+    return { data: { format: "batch", version: 2, waiting: batch.waiting, intervals: batch.intervals } };
+  }
+  if (bytes[0] === 1) {
+    return { data: { format: "packed", version: 1, sensors: decodePacked(bytes, WS8X_SCHEMA_V1) } };
+  }
+  return { errors: ["unknown payload format, " + bytes.length + " bytes"] };
+}
+
+if (typeof module !== "undefined" && require.main === module) {
+  var hex = process.argv[3] || "";
+  var bytes = [];
+  for (var i = 0; i + 1 < hex.length; i += 2) {
+    bytes.push(parseInt(hex.substr(i, 2), 16));
+  }
+  console.log(JSON.stringify(decodeUplink({ fPort: parseInt(process.argv[2], 10), bytes: bytes }), null, 2));
+}
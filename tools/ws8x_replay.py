@@ -0,0 +1,275 @@
+#!/usr/bin/env python3
+"""Record and replay WS8x serial streams through the firmware.
+
+record: enables AT+CAPTURE=1 and writes the raw sensor bytes reported by
+        the device (+CAP:<name>:<ms>:<hex>) to a capture file.
+
+replay: streams a capture file into the parser of the device with AT+WXFEED,
+        keeping the original timing (or faster with --speed). Every
+        --interval seconds of capture time the report is taken with
+        AT+WXREPORT=1, which starts the next interval. The payloads and
+        the per line parse times (+LINE from AT+CAPTURE=2) are written as
+        JSON. With --expect the payloads are
+        compared against an earlier run, the exit code is 1 on a mismatch.
+
+header: writes a capture and the payloads of a result JSON as a C header.
+        test/test_ws8x_replay feeds it through the driver on the PC
+        (pio test -e native) and checks the payloads and the parse time
+        of every line without a device.
+
+Wind speed, gust and lull are kept over a sliding window on the device
+clock, so only replays at --speed 1 give the same values as the field.
+Faster replays are still deterministic and fine for regression checks
+against a run with the same speed.
+
+record and replay need pyserial.
+"""
+import argparse
+import json
+import sys
+import threading
+import time
+
+try:
+    import serial
+except ImportError:
+    serial = None  # Only header works without it
+
+CTRL_D = b"\x04"
+
+
+def read_capture(path):
+    """Return [(ms, bytes)] of the +CAP lines of the first sensor in a log."""
+    chunks = []
+    name = None
+    with open(path) as capture:
+        for line in capture:
+            line = line.strip()
+            if not line.startswith("+CAP:"):
+                continue
+            parts = line.split(":")
+            if len(parts) != 4 or not parts[2].isdigit():
+                continue  # Loss report
+            if name is None:
+                name = parts[1]
+            if parts[1] != name:
+                continue
+            chunks.append((int(parts[2]), bytes.fromhex(parts[3])))
+    return chunks
+
+
+class Device:
+    """USB connection, collects the lines printed by the firmware."""
+
+    def __init__(self, port, baud):
+        self.serial = serial.Serial(port, baud, timeout=0.1)
+        self.lines = []
+        self.lock = threading.Lock()
+        self.running = True
+        self.reader = threading.Thread(target=self._read, daemon=True)
+        self.reader.start()
+
+    def _read(self):
+        pending = b""
+        while self.running:
+            pending += self.serial.read(256)
+            while b"\n" in pending:
+                line, pending = pending.split(b"\n", 1)
+                with self.lock:
+                    self.lines.append(line.decode(errors="replace").strip())
+
+    def take(self, prefix):
+        """Remove and return the collected lines starting with prefix."""
+        with self.lock:
+            found = [line for line in self.lines if line.startswith(prefix)]
+            self.lines = [line for line in self.lines if not line.startswith(prefix)]
+        return found
+
+    def command(self, cmd, wait=0.3):
+        self.serial.write(cmd.encode() + b"\r\n")
+        time.sleep(wait)
+
+    def close(self):
+        self.running = False
+        self.reader.join()
+        self.serial.close()
+
+
+def wait_for(device, prefix, timeout=2.0):
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        found = device.take(prefix)
+        if found:
+            return found
+        time.sleep(0.05)
+    return []
+
+
+def record(args):
+    device = Device(args.port, args.baud)
+    device.command("AT+CAPTURE=1")
+    print("Recording to %s, Ctrl-C to stop" % args.output)
+    try:
+        with open(args.output, "w") as output:
+            while True:
+                for line in device.take("+CAP:"):
+                    output.write(line + "\n")
+                output.flush()
+                time.sleep(0.2)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        device.command("AT+CAPTURE=0")
+        device.close()
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+
+def replay(args):
+    chunks = read_capture(args.capture)
+    if not chunks:
+        sys.exit("No +CAP lines in %s" % args.capture)
+
+    device = Device(args.port, args.baud)
+    device.command("AT+CAPTURE=%d" % (2 if args.timing else 0))
+    # Start with an empty report interval
+    device.command("AT+WXREPORT=1")
+    device.take("")
+
+    reports = []
+    line_us = []
+
+    def take_report():
+        device.serial.write(CTRL_D)
+        time.sleep(0.1)  # Let the device parse the last lines
+        device.command("AT+WXREPORT=1", wait=0)
+        for line in wait_for(device, "+WXREPORT:"):
+            reports.append(line.split(":")[2])
+        for line in device.take("+LINE:"):
+            line_us.append(int(line.split(":")[2]))
+        device.serial.write(b"AT+WXFEED\r\n")
+        time.sleep(0.1)
+
+    start_ms = chunks[0][0]
+    next_report_ms = start_ms + args.interval * 1000
+    device.serial.write(b"AT+WXFEED\r\n")
+    time.sleep(0.1)
+    wall_start = time.monotonic()
+    for ms, data in chunks:
+        while ms >= next_report_ms:
+            take_report()
+            next_report_ms += args.interval * 1000
+        due = wall_start + (ms - start_ms) / 1000.0 / args.speed
+        delay = due - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+        device.serial.write(data)
+    take_report()
+    device.serial.write(CTRL_D)
+    device.command("AT+CAPTURE=0")
+    device.close()
+
+    result = {
+        "capture": args.capture,
+        "speed": args.speed,
+        "interval_s": args.interval,
+        "payloads": reports,
+    }
+    if args.timing:
+        result["line_us"] = {
+            "lines": len(line_us),
+            "mean": sum(line_us) / len(line_us) if line_us else 0,
+            "p50": percentile(line_us, 50),
+            "p99": percentile(line_us, 99),
+            "max": max(line_us) if line_us else 0,
+        }
+    text = json.dumps(result, indent=2)
+    if args.output:
+        with open(args.output, "w") as output:
+            output.write(text + "\n")
+    print(text)
+
+    if args.expect:
+        with open(args.expect) as expect:
+            expected = json.load(expect)["payloads"]
+        if expected != reports:
+            for idx, (want, got) in enumerate(zip(expected, reports)):
+                if want != got:
+                    print("report %d: expected %s got %s" % (idx, want, got))
+            if len(expected) != len(reports):
+                print("expected %d reports, got %d" % (len(expected), len(reports)))
+            sys.exit(1)
+        print("Payloads match %s" % args.expect)
+
+
+def header(args):
+    chunks = read_capture(args.capture)
+    if not chunks:
+        sys.exit("No +CAP lines in %s" % args.capture)
+    payloads = []
+    if args.expect:
+        with open(args.expect) as expect:
+            payloads = json.load(expect)["payloads"]
+
+    out = ["// Generated by tools/ws8x_replay.py header from %s, do not edit" % args.capture,
+           "#define CAPTURE_INTERVAL_S %d" % args.interval,
+           "",
+           "// Time of the ingest pass in ms and the bytes it read",
+           "static const struct",
+           "{",
+           "\tuint32_t ms;",
+           "\tconst char *hex;",
+           "} capture_chunks[] = {"]
+    for ms, data in chunks:
+        out.append('\t{%d, "%s"},' % (ms, data.hex().upper()))
+    out += ["};", "", "// Expected payloads, one per report interval", "static const char *const capture_payloads[] = {"]
+    for payload in payloads:
+        out.append('\t"%s",' % payload)
+    out += ["};", ""]
+    with open(args.output, "w") as output:
+        output.write("\n".join(out))
+    print("%d chunks, %d payloads written to %s" % (len(chunks), len(payloads), args.output))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", help="USB serial port of the RAK4631, needed by record and replay")
+    parser.add_argument("--baud", type=int, default=115200)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    rec = commands.add_parser("record", help="capture the raw sensor stream")
+    rec.add_argument("output", help="capture file to write")
+    rec.set_defaults(func=record)
+
+    rep = commands.add_parser("replay", help="replay a capture and collect the payloads")
+    rep.add_argument("capture", help="capture file, any log with +CAP lines works")
+    rep.add_argument("--speed", type=float, default=1.0, help="replay speed, 10 = 10x faster")
+    rep.add_argument("--interval", type=int, default=60, help="report interval in seconds of capture time")
+    rep.add_argument("--timing", action="store_true", help="collect the parse time of every line")
+    rep.add_argument("--output", help="write the result JSON here")
+    rep.add_argument("--expect", help="result JSON of an earlier run to compare the payloads with")
+    rep.set_defaults(func=replay)
+
+    hdr = commands.add_parser("header", help="write a capture as C header for the native tests")
+    hdr.add_argument("capture", help="capture file, any log with +CAP lines works")
+    hdr.add_argument("output", help="header file to write")
+    hdr.add_argument("--interval", type=int, default=60, help="report interval in seconds of capture time")
+    hdr.add_argument("--expect", help="result JSON with the payloads the test expects")
+    hdr.set_defaults(func=header)
+
+    args = parser.parse_args()
+    if args.func != header:
+        if serial is None:
+            sys.exit("record and replay need pyserial")
+        if not args.port:
+            parser.error("--port is required for %s" % args.command)
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()